@@ -0,0 +1,1273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/analysis.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+
+// Worst-case execution time analysis (--wcet) over the image of the final pass.
+//
+// Render functions record every instruction with the assembler's timing, so code
+// generated by directives is analysed too. A routine starts at an entry point or a
+// CALL/RST target, its control flow graph follows jumps and branches (tail jumps just
+// extend it) and ends at returns, callees are analysed separately and charged at call
+// sites. Loops are back edges of depth-first search and must be bounded: either by
+// LOOPBOUND annotation in front of the closing instruction, or DJNZ and block
+// instructions with the counter loaded by LD B,n / LD BC,nn on the only path in front
+// of the loop. Loops are collapsed from the innermost ones: header is charged with
+// extra iterations of the longest path around the loop, then the longest path from
+// entry to return is the WCET of routine. Unbounded loops, recursion, indirect jumps
+// and HALT are reported, such routines are estimated without repeating unbounded loops.
+//
+// Interrupt latency (--latency) uses the same graphs for windows with interrupts
+// disabled: from DI or interrupt handler entry (interrupt acceptance disables them as
+// well) to EI and the instruction following it. Handlers are found by interrupt modes
+// set by the source: every restart vector for IM 0, IM 1 entry (also without any IM
+// instruction), targets of the table addressed by LD A,n / LD I,A for IM 2, and labels
+// given by user. Paths leaving window through return can't be bounded since interrupts
+// stay disabled in the caller. JP PO over EI restores the state saved by LD A,I and is
+// taken as EI, windows assume interrupts were enabled.
+
+// how far to look behind a loop for its counter load
+#define COUNTER_MAX_LOOKBEHIND 16
+
+// addresses of IM 1 interrupt handler and NMI handler, restart and interrupt vectors are below
+#define IM1_ENTRY 0x0038
+#define NMI_ENTRY 0x0066
+#define VECTORS_END (NMI_ENTRY + 2)
+#define RST_STEP 8
+
+// IM 2 table of handler addresses: interrupting device puts low byte of entry on data bus
+#define IM2_TABLE_ENTRIES 128
+
+typedef enum {
+  FLOW_NEXT,
+  FLOW_JUMP,
+  FLOW_BRANCH,      // conditional jump or DJNZ
+  FLOW_CALL,        // CALL, conditional CALL or RST
+  FLOW_RET,
+  FLOW_CONDRET,
+  FLOW_REPEAT,      // block instruction repeated until counter is zero
+  FLOW_INDIRECT,    // JP (HL), JP (IX), JP (IY)
+  FLOW_HALT,
+} flow_kind;
+
+typedef struct {
+  flow_kind kind;
+  uint32_t target;
+  bool counter_bc;  // FLOW_REPEAT: counter is BC (LDIR, CPIR, ...) rather than B (INIR, OTIR, ...)
+} flow_t;
+
+enum {
+  COUNTER_KEEP,
+  COUNTER_LOAD,
+  COUNTER_CLOBBER,
+};
+
+enum {
+  ROUTINE_IN_PROGRESS,
+  ROUTINE_DONE,
+};
+
+typedef struct {
+  uint32_t entry;
+  int state;
+  long cycles;          // the longest path to return, -1 if routine never returns
+  dynarray *reasons;    // what makes routine unbounded, NULL if it's bounded
+  dynarray *callees;    // entry addresses of called routines
+} routine_t;
+
+enum {
+  NODE_WHITE = 0,
+  NODE_GREY,
+  NODE_BLACK,
+};
+
+typedef struct {
+  int header;
+  int *body;
+  int nbody;
+} loop_t;
+
+// control flow graph of routine, arrays are indexed by instruction index in code map
+typedef struct {
+  analysis_t *a;
+  routine_t *routine;
+  int entry;
+  bool window;          // graph of interrupts disabled window ending at EI rather than routine
+
+  int *nodes;           // instructions of routine in DFS order
+  int nnodes;
+  uint8_t *color;
+  int (*succ)[2];       // fall through and jump target, -1 if none
+  bool (*back)[2];      // edge closes a loop
+  int *npreds;
+  int *pred_start;
+  int *preds;
+  long *weight;         // cycles of instruction including callees and repeats
+  long *extra;          // extra iterations of loops headed by instruction
+
+  // scratch for the longest path search
+  bool *in_body;
+  bool *is_target;
+  long *memo;
+} cfg_t;
+
+void analysis_start(compile_ctx_t *ctx)
+{
+  analysis_t *a = ctx->analysis;
+
+  if (a == NULL)
+    return;
+
+  a->pending_bound = -1;
+}
+
+void analysis_add(analysis_t *a, section_ctx_t *section, uint32_t pos, int size, int cycles)
+{
+  if (a == NULL)
+    return;
+
+  code_instr_t *ci = (code_instr_t *)xmalloc(sizeof(code_instr_t));
+  ci->addr = section->start + pos;
+  ci->section = section;
+  ci->pos = pos;
+  ci->size = size;
+  ci->cycles = cycles;
+  ci->bound = a->pending_bound;
+  ci->in_window = false;
+
+  a->pending_bound = -1;
+  a->instrs = dynarray_append_ptr(a->instrs, ci);
+}
+
+void analysis_code(compile_ctx_t *ctx, int size, int cycles)
+{
+  if (ctx->analysis == NULL)
+    return;
+
+  section_ctx_t *section = get_current_section(ctx);
+  analysis_add(ctx->analysis, section, section->content->len - size, size, cycles);
+}
+
+void analysis_label(compile_ctx_t *ctx, const char *name, uint32_t addr)
+{
+  analysis_t *a = ctx->analysis;
+
+  if (a == NULL)
+    return;
+
+  code_label_t *label = (code_label_t *)xmalloc(sizeof(code_label_t));
+  label->name = xstrdup(name);
+  label->addr = addr;
+  label->order = dynarray_length(a->labels);
+
+  a->labels = dynarray_append_ptr(a->labels, label);
+}
+
+void analysis_bound(compile_ctx_t *ctx, int bound)
+{
+  if (ctx->analysis == NULL)
+    return;
+
+  if (ctx->analysis->pending_bound != -1)
+    report_warning(ctx, "previous LOOPBOUND isn't followed by any instruction");
+
+  ctx->analysis->pending_bound = bound;
+}
+
+static int code_instr_cmp(const void *a, const void *b)
+{
+  const code_instr_t *c1 = *(const code_instr_t **)a;
+  const code_instr_t *c2 = *(const code_instr_t **)b;
+
+  return (c1->addr > c2->addr) - (c1->addr < c2->addr);
+}
+
+static int code_label_cmp(const void *a, const void *b)
+{
+  const code_label_t *l1 = *(const code_label_t **)a;
+  const code_label_t *l2 = *(const code_label_t **)b;
+
+  if (l1->addr != l2->addr)
+    return (l1->addr > l2->addr) - (l1->addr < l2->addr);
+
+  // prefer global labels for names of addresses, then the last defined one: code usually follows
+  // labels of preceding data ends
+  bool local1 = strchr(l1->name, '.') != NULL;
+  bool local2 = strchr(l2->name, '.') != NULL;
+
+  if (local1 != local2)
+    return local1 - local2;
+
+  return l2->order - l1->order;
+}
+
+static int code_find(analysis_t *a, uint32_t addr)
+{
+  int lo = 0;
+  int hi = a->ncode - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if (a->code[mid]->addr == addr)
+      return mid;
+    else if (a->code[mid]->addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return -1;
+}
+
+static code_label_t *label_find(analysis_t *a, uint32_t addr)
+{
+  int found = -1;
+  int lo = 0;
+  int hi = a->nlabels - 1;
+
+  // the last label placed at or in front of address
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if (a->sorted_labels[mid]->addr <= addr) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  if (found == -1)
+    return NULL;
+
+  // the first one of labels sharing its address
+  while (found > 0 && a->sorted_labels[found - 1]->addr == a->sorted_labels[found]->addr)
+    found--;
+
+  return a->sorted_labels[found];
+}
+
+static char *addr_name(analysis_t *a, uint32_t addr)
+{
+  static _Thread_local char names[4][128];
+  static _Thread_local int next = 0;
+  char *name = names[next];
+  code_label_t *label = label_find(a, addr);
+
+  next = (next + 1) % 4;
+
+  if (label == NULL)
+    snprintf(name, sizeof(names[0]), "0x%04x", addr);
+  else if (label->addr == addr)
+    snprintf(name, sizeof(names[0]), "%s", label->name);
+  else
+    snprintf(name, sizeof(names[0]), "%s+%u", label->name, addr - label->addr);
+
+  return name;
+}
+
+static inline uint8_t *instr_bytes(code_instr_t *ci)
+{
+  return (uint8_t *)&ci->section->content->data[ci->pos];
+}
+
+static flow_t decode_flow(code_instr_t *ci)
+{
+  uint8_t *op = instr_bytes(ci);
+  flow_t flow = {FLOW_NEXT, 0, false};
+
+  if (op[0] == 0xC3 || op[0] == 0x18 || op[0] == 0x10 || (op[0] & 0xE7) == 0x20 || (op[0] & 0xC7) == 0xC2) {
+    // jp nn, jr e, djnz e, jr cc,e, jp cc,nn
+    flow.kind = (op[0] == 0xC3 || op[0] == 0x18) ? FLOW_JUMP : FLOW_BRANCH;
+
+    if (ci->size == 2)
+      flow.target = (ci->addr + 2 + (int8_t)op[1]) & 0xffff;
+    else
+      flow.target = op[1] | (op[2] << 8);
+  } else if (op[0] == 0xCD || (op[0] & 0xC7) == 0xC4) {
+    // call nn, call cc,nn
+    flow.kind = FLOW_CALL;
+    flow.target = op[1] | (op[2] << 8);
+  } else if ((op[0] & 0xC7) == 0xC7) {
+    // rst n
+    flow.kind = FLOW_CALL;
+    flow.target = op[0] & 0x38;
+  } else if (op[0] == 0xC9) {
+    flow.kind = FLOW_RET;
+  } else if ((op[0] & 0xC7) == 0xC0) {
+    flow.kind = FLOW_CONDRET;
+  } else if (op[0] == 0xE9 || ((op[0] == 0xDD || op[0] == 0xFD) && ci->size == 2 && op[1] == 0xE9)) {
+    flow.kind = FLOW_INDIRECT;
+  } else if (op[0] == 0x76) {
+    flow.kind = FLOW_HALT;
+  } else if (op[0] == 0xED && (op[1] == 0x45 || op[1] == 0x4D)) {
+    // retn, reti
+    flow.kind = FLOW_RET;
+  } else if (op[0] == 0xED && (op[1] & 0xF4) == 0xB0) {
+    // ldir, cpir, inir, otir, lddr, cpdr, indr, otdr
+    flow.kind = FLOW_REPEAT;
+    flow.counter_bc = (op[1] & 0x02) == 0;
+  }
+
+  return flow;
+}
+
+// how instruction affects B (or BC) register used as loop counter
+static int counter_effect(code_instr_t *ci, bool bc, int *value)
+{
+  uint8_t *op = instr_bytes(ci);
+
+  if (op[0] == 0xED) {
+    if (op[1] == 0x40 || op[1] == 0x4B)                // in b,(c); ld bc,(nn)
+      return COUNTER_CLOBBER;
+    if (op[1] == 0x48)                                 // in c,(c)
+      return bc ? COUNTER_CLOBBER : COUNTER_KEEP;
+    if ((op[1] & 0xE4) == 0xA0)                        // block instructions
+      return COUNTER_CLOBBER;
+
+    return COUNTER_KEEP;
+  }
+
+  if (op[0] == 0xCB) {
+    int reg = op[1] & 0x07;
+
+    if ((op[1] & 0xC0) == 0x40 || reg > 1)             // bit n,r or another register
+      return COUNTER_KEEP;
+
+    return (reg == 0 || bc) ? COUNTER_CLOBBER : COUNTER_KEEP;
+  }
+
+  // index prefixes don't change destination of LD B,(IX+d) and alike
+  bool prefixed = (op[0] == 0xDD || op[0] == 0xFD);
+  uint8_t opc = prefixed ? op[1] : op[0];
+
+  if (prefixed && opc == 0xCB)
+    return COUNTER_KEEP;
+
+  switch (opc) {
+    case 0x06:                                         // ld b,n
+      *value = op[1];
+      return (bc || prefixed) ? COUNTER_CLOBBER : COUNTER_LOAD;
+    case 0x01:                                         // ld bc,nn
+      *value = bc ? (op[1] | (op[2] << 8)) : op[2];
+      return prefixed ? COUNTER_CLOBBER : COUNTER_LOAD;
+    case 0x0C: case 0x0D: case 0x0E:                   // inc c, dec c, ld c,n
+      return bc ? COUNTER_CLOBBER : COUNTER_KEEP;
+    case 0x03: case 0x04: case 0x05: case 0x0B:        // inc bc, inc b, dec b, dec bc
+    case 0x10: case 0xC1: case 0xD9:                   // djnz, pop bc, exx
+    case 0xCD:                                         // call: callee could change it
+      return COUNTER_CLOBBER;
+    default:
+      break;
+  }
+
+  if ((opc & 0xC7) == 0xC4 || (opc & 0xC7) == 0xC7)     // call cc, rst
+    return COUNTER_CLOBBER;
+  if (opc >= 0x40 && opc <= 0x47)                      // ld b,r
+    return COUNTER_CLOBBER;
+  if (opc >= 0x48 && opc <= 0x4F)                      // ld c,r
+    return bc ? COUNTER_CLOBBER : COUNTER_KEEP;
+
+  return COUNTER_KEEP;
+}
+
+static void add_reason(routine_t *routine, char *reason)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, routine->reasons) {
+    if (strcmp((char *)dfirst(dc), reason) == 0)
+      return;
+  }
+
+  routine->reasons = dynarray_append_ptr(routine->reasons, xstrdup(reason));
+}
+
+static routine_t *routine_analyze(analysis_t *a, uint32_t entry);
+
+static int cfg_follow(cfg_t *g, code_instr_t *from, uint32_t addr)
+{
+  int idx = code_find(g->a, addr & 0xffff);
+
+  if (idx == -1) {
+    char *reason = bsprintf("control goes from %s to 0x%04x which isn't code",
+      addr_name(g->a, from->addr), addr & 0xffff);
+    add_reason(g->routine, reason);
+    xfree(reason);
+  }
+
+  return idx;
+}
+
+// JP PO skipping the following EI: state of interrupts saved by LD A,I is restored
+static bool restores_interrupts(analysis_t *a, code_instr_t *ci)
+{
+  uint8_t *op = instr_bytes(ci);
+
+  if (op[0] != 0xE2 || ci->size != 3 || (uint32_t)(op[1] | (op[2] << 8)) != ci->addr + 4)
+    return false;
+
+  int next = code_find(a, ci->addr + 3);
+
+  return next != -1 && instr_bytes(a->code[next])[0] == 0xFB;
+}
+
+static void cfg_visit(cfg_t *g, int i)
+{
+  code_instr_t *ci = g->a->code[i];
+  flow_t flow = decode_flow(ci);
+  char *reason = NULL;
+
+  g->color[i] = NODE_GREY;
+  g->nodes[g->nnodes++] = i;
+
+  switch (flow.kind) {
+    case FLOW_NEXT:
+    case FLOW_CALL:
+    case FLOW_CONDRET:
+    case FLOW_REPEAT:
+      g->succ[i][0] = cfg_follow(g, ci, ci->addr + ci->size);
+      break;
+    case FLOW_JUMP:
+      g->succ[i][1] = cfg_follow(g, ci, flow.target);
+      break;
+    case FLOW_BRANCH:
+      g->succ[i][0] = cfg_follow(g, ci, ci->addr + ci->size);
+      g->succ[i][1] = cfg_follow(g, ci, flow.target);
+      break;
+    case FLOW_INDIRECT:
+      reason = bsprintf("indirect jump at %s", addr_name(g->a, ci->addr));
+      break;
+    case FLOW_HALT:
+      reason = bsprintf("HALT at %s waits for interrupt", addr_name(g->a, ci->addr));
+      break;
+    case FLOW_RET:
+      break;
+  }
+
+  if (g->window) {
+    if (restores_interrupts(g->a, ci)) {
+      // window assumes interrupts were enabled in front of it, so the saved state re-enables them
+      g->succ[i][1] = -1;
+    }
+
+    if (instr_bytes(ci)[0] == 0xFB) {
+      // ei: interrupts are accepted after the next instruction
+      g->succ[i][0] = g->succ[i][1] = -1;
+    } else if (flow.kind == FLOW_RET || flow.kind == FLOW_CONDRET) {
+      reason = bsprintf("returns with interrupts disabled at %s", addr_name(g->a, ci->addr));
+    }
+  }
+
+  if (reason) {
+    add_reason(g->routine, reason);
+    xfree(reason);
+  }
+
+  for (int k = 0; k < 2; k++) {
+    int s = g->succ[i][k];
+
+    if (s == -1)
+      continue;
+
+    if (g->color[s] == NODE_GREY)
+      g->back[i][k] = true;
+    else if (g->color[s] == NODE_WHITE)
+      cfg_visit(g, s);
+  }
+
+  g->color[i] = NODE_BLACK;
+}
+
+static void cfg_build_preds(cfg_t *g)
+{
+  int pos = 0;
+
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+
+    for (int k = 0; k < 2; k++) {
+      if (g->succ[i][k] != -1)
+        g->npreds[g->succ[i][k]]++;
+    }
+  }
+
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+
+    g->pred_start[i] = pos;
+    pos += g->npreds[i];
+    g->npreds[i] = 0;
+  }
+
+  g->preds = (int *)xmalloc(sizeof(int) * (pos + 1));
+
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+
+    for (int k = 0; k < 2; k++) {
+      int s = g->succ[i][k];
+
+      if (s != -1)
+        g->preds[g->pred_start[s] + g->npreds[s]++] = i;
+    }
+  }
+}
+
+// walks back the only path leading to instruction looking for the counter load
+static bool cfg_find_counter(cfg_t *g, int i, bool bc, int *value)
+{
+  for (int steps = 0; steps < COUNTER_MAX_LOOKBEHIND; steps++) {
+    int effect = counter_effect(g->a->code[i], bc, value);
+
+    if (effect == COUNTER_LOAD)
+      return true;
+    if (effect == COUNTER_CLOBBER || i == g->entry || g->npreds[i] != 1)
+      return false;
+
+    i = g->preds[g->pred_start[i]];
+  }
+
+  return false;
+}
+
+static long repeat_bound(cfg_t *g, int i, bool bc)
+{
+  code_instr_t *ci = g->a->code[i];
+  int value = 0;
+
+  if (ci->bound > 0)
+    return ci->bound;
+
+  if (i == g->entry || g->npreds[i] != 1 || !cfg_find_counter(g, g->preds[g->pred_start[i]], bc, &value))
+    return -1;
+
+  // zero counter means full range
+  if (value == 0)
+    return bc ? 65536 : 256;
+
+  return value;
+}
+
+static void cfg_weigh(cfg_t *g)
+{
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+    code_instr_t *ci = g->a->code[i];
+    flow_t flow = decode_flow(ci);
+
+    g->weight[i] = ci->cycles;
+
+    if (g->window && instr_bytes(ci)[0] == 0xFB) {
+      int next = code_find(g->a, ci->addr + ci->size);
+
+      if (next != -1)
+        g->weight[i] += g->a->code[next]->cycles;
+    } else if (flow.kind == FLOW_CALL) {
+      routine_t *callee = routine_analyze(g->a, flow.target);
+      dynarray_cell *dc = NULL;
+      bool known = false;
+
+      foreach (dc, g->routine->callees)
+        known |= ((uint32_t)dfirst_int(dc) == callee->entry);
+
+      if (!known)
+        g->routine->callees = dynarray_append_int(g->routine->callees, callee->entry);
+
+      if (callee->state == ROUTINE_IN_PROGRESS) {
+        char *reason = bsprintf("recursive call of %s at %s",
+          addr_name(g->a, callee->entry), addr_name(g->a, ci->addr));
+        add_reason(g->routine, reason);
+        xfree(reason);
+        continue;
+      }
+
+      if (callee->cycles > 0)
+        g->weight[i] += callee->cycles;
+
+      foreach (dc, callee->reasons)
+        add_reason(g->routine, (char *)dfirst(dc));
+    } else if (flow.kind == FLOW_REPEAT) {
+      long bound = repeat_bound(g, i, flow.counter_bc);
+
+      if (bound == -1) {
+        char *reason = bsprintf("block instruction at %s has no bound (use LOOPBOUND)", addr_name(g->a, ci->addr));
+        add_reason(g->routine, reason);
+        xfree(reason);
+        continue;
+      }
+
+      g->weight[i] = ci->cycles * bound - BLOCK_LAST_ITER_SAVING;
+    }
+  }
+}
+
+// the longest path from instruction to any target one within loop body, -1 if there is no such path
+static long cfg_longest(cfg_t *g, int i)
+{
+  if (g->memo[i] != -2)
+    return g->memo[i];
+
+  long best = g->is_target[i] ? 0 : -1;
+
+  // mark as visited: only back edges could lead here again and they are skipped
+  g->memo[i] = -1;
+
+  for (int k = 0; k < 2; k++) {
+    int s = g->succ[i][k];
+
+    if (s == -1 || g->back[i][k] || !g->in_body[s])
+      continue;
+
+    long len = cfg_longest(g, s);
+    if (len > best)
+      best = len;
+  }
+
+  if (best != -1)
+    best += g->weight[i] + g->extra[i];
+
+  g->memo[i] = best;
+  return best;
+}
+
+static long cfg_longest_from(cfg_t *g, int from)
+{
+  for (int n = 0; n < g->nnodes; n++)
+    g->memo[g->nodes[n]] = -2;
+
+  return cfg_longest(g, from);
+}
+
+static int loop_cmp(const void *a, const void *b)
+{
+  return ((const loop_t *)a)->nbody - ((const loop_t *)b)->nbody;
+}
+
+// natural loop: header and all instructions reaching loop's back edges without passing the header
+static void cfg_loop_body(cfg_t *g, loop_t *loop)
+{
+  int *stack = (int *)xmalloc(sizeof(int) * (g->nnodes + 1));
+  int sp = 0;
+
+  loop->body = (int *)xmalloc(sizeof(int) * g->nnodes);
+  loop->nbody = 0;
+
+  g->in_body[loop->header] = true;
+  loop->body[loop->nbody++] = loop->header;
+
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+
+    for (int k = 0; k < 2; k++) {
+      if (g->back[i][k] && g->succ[i][k] == loop->header && !g->in_body[i]) {
+        g->in_body[i] = true;
+        loop->body[loop->nbody++] = i;
+        stack[sp++] = i;
+      }
+    }
+  }
+
+  while (sp > 0) {
+    int i = stack[--sp];
+
+    for (int p = g->pred_start[i]; p < g->pred_start[i] + g->npreds[i]; p++) {
+      int pred = g->preds[p];
+
+      if (!g->in_body[pred]) {
+        g->in_body[pred] = true;
+        loop->body[loop->nbody++] = pred;
+        stack[sp++] = pred;
+      }
+    }
+  }
+
+  for (int n = 0; n < loop->nbody; n++)
+    g->in_body[loop->body[n]] = false;
+
+  xfree(stack);
+}
+
+// the most times loop is repeated through back edge from the latch instruction
+static long latch_bound(cfg_t *g, loop_t *loop, int latch)
+{
+  code_instr_t *ci = g->a->code[latch];
+  int entering = -1;
+  int value = 0;
+
+  if (ci->bound > 0)
+    return ci->bound;
+
+  if (instr_bytes(ci)[0] != 0x10)
+    return -1;
+
+  // DJNZ must be the only instruction changing B in loop
+  for (int n = 0; n < loop->nbody; n++) {
+    if (loop->body[n] != latch && counter_effect(g->a->code[loop->body[n]], false, &value) != COUNTER_KEEP)
+      return -1;
+  }
+
+  if (loop->header == g->entry)
+    return -1;
+
+  for (int p = g->pred_start[loop->header]; p < g->pred_start[loop->header] + g->npreds[loop->header]; p++) {
+    int pred = g->preds[p];
+    bool is_back = false;
+
+    for (int k = 0; k < 2; k++)
+      is_back |= (g->back[pred][k] && g->succ[pred][k] == loop->header);
+
+    if (is_back)
+      continue;
+
+    if (entering != -1)
+      return -1;
+
+    entering = pred;
+  }
+
+  if (entering == -1 || !cfg_find_counter(g, entering, false, &value))
+    return -1;
+
+  // the last DJNZ falls through
+  return value == 0 ? 255 : value - 1;
+}
+
+static void cfg_collapse_loops(cfg_t *g)
+{
+  loop_t *loops = (loop_t *)xmalloc(sizeof(loop_t) * (g->nnodes + 1));
+  int nloops = 0;
+
+  for (int n = 0; n < g->nnodes; n++) {
+    int i = g->nodes[n];
+
+    for (int k = 0; k < 2; k++) {
+      if (!g->back[i][k])
+        continue;
+
+      bool known = false;
+      for (int l = 0; l < nloops; l++)
+        known |= (loops[l].header == g->succ[i][k]);
+
+      if (!known) {
+        loops[nloops].header = g->succ[i][k];
+        cfg_loop_body(g, &loops[nloops]);
+        nloops++;
+      }
+    }
+  }
+
+  // inner loops are smaller than outer ones
+  qsort(loops, nloops, sizeof(loop_t), loop_cmp);
+
+  for (int l = 0; l < nloops; l++) {
+    loop_t *loop = &loops[l];
+    long extra_iters = 0;
+
+    for (int n = 0; n < loop->nbody; n++)
+      g->in_body[loop->body[n]] = true;
+
+    for (int n = 0; n < loop->nbody; n++) {
+      int i = loop->body[n];
+
+      for (int k = 0; k < 2; k++) {
+        if (!g->back[i][k] || g->succ[i][k] != loop->header)
+          continue;
+
+        long bound = latch_bound(g, loop, i);
+
+        if (bound == -1) {
+          char *reason = bsprintf("loop at %s closed at %s has no bound (use LOOPBOUND)",
+            addr_name(g->a, g->a->code[loop->header]->addr), addr_name(g->a, g->a->code[i]->addr));
+          add_reason(g->routine, reason);
+          xfree(reason);
+          bound = 0;
+        }
+
+        g->is_target[i] = true;
+        extra_iters += bound;
+      }
+    }
+
+    long iteration = cfg_longest_from(g, loop->header);
+    if (iteration > 0)
+      g->extra[loop->header] += extra_iters * iteration;
+
+    for (int n = 0; n < loop->nbody; n++) {
+      g->in_body[loop->body[n]] = false;
+      g->is_target[loop->body[n]] = false;
+    }
+
+    xfree(loop->body);
+  }
+
+  xfree(loops);
+}
+
+static routine_t *routine_new(uint32_t entry)
+{
+  routine_t *routine = (routine_t *)xmalloc(sizeof(routine_t));
+
+  routine->entry = entry;
+  routine->state = ROUTINE_IN_PROGRESS;
+  routine->cycles = -1;
+  routine->reasons = NULL;
+  routine->callees = NULL;
+
+  return routine;
+}
+
+// finds the longest path from start instruction to return (or EI for interrupts disabled window)
+static void cfg_analyze(analysis_t *a, routine_t *routine, int start, bool window)
+{
+  int n = a->ncode;
+  cfg_t g = {0};
+
+  g.a = a;
+  g.routine = routine;
+  g.entry = start;
+  g.window = window;
+  g.nodes = (int *)xmalloc(sizeof(int) * n);
+  g.color = (uint8_t *)xmalloc(sizeof(uint8_t) * n);
+  g.succ = xmalloc(sizeof(int[2]) * n);
+  g.back = xmalloc(sizeof(bool[2]) * n);
+  g.npreds = (int *)xmalloc(sizeof(int) * n);
+  g.pred_start = (int *)xmalloc(sizeof(int) * n);
+  g.weight = (long *)xmalloc(sizeof(long) * n);
+  g.extra = (long *)xmalloc(sizeof(long) * n);
+  g.in_body = (bool *)xmalloc(sizeof(bool) * n);
+  g.is_target = (bool *)xmalloc(sizeof(bool) * n);
+  g.memo = (long *)xmalloc(sizeof(long) * n);
+
+  for (int i = 0; i < n; i++) {
+    g.color[i] = NODE_WHITE;
+    g.succ[i][0] = g.succ[i][1] = -1;
+    g.back[i][0] = g.back[i][1] = false;
+    g.npreds[i] = 0;
+    g.extra[i] = 0;
+    g.in_body[i] = false;
+    g.is_target[i] = false;
+  }
+
+  cfg_visit(&g, start);
+  cfg_build_preds(&g);
+  cfg_weigh(&g);
+  cfg_collapse_loops(&g);
+
+  // paths end at returns, at EI of window and at dead ends already reported as unbounded
+  for (int k = 0; k < g.nnodes; k++) {
+    int i = g.nodes[k];
+    flow_kind kind = decode_flow(a->code[i]).kind;
+
+    g.in_body[i] = true;
+    g.is_target[i] = (kind == FLOW_RET || kind == FLOW_CONDRET || (g.succ[i][0] == -1 && g.succ[i][1] == -1));
+
+    if (window)
+      a->code[i]->in_window = true;
+  }
+
+  routine->cycles = cfg_longest_from(&g, start);
+  routine->state = ROUTINE_DONE;
+
+  xfree(g.nodes);
+  xfree(g.color);
+  xfree(g.succ);
+  xfree(g.back);
+  xfree(g.npreds);
+  xfree(g.pred_start);
+  xfree(g.preds);
+  xfree(g.weight);
+  xfree(g.extra);
+  xfree(g.in_body);
+  xfree(g.is_target);
+  xfree(g.memo);
+}
+
+static routine_t *routine_analyze(analysis_t *a, uint32_t entry)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, a->routines) {
+    routine_t *routine = (routine_t *)dfirst(dc);
+
+    if (routine->entry == entry)
+      return routine;
+  }
+
+  routine_t *routine = routine_new(entry);
+  a->routines = dynarray_append_ptr(a->routines, routine);
+
+  int entry_idx = code_find(a, entry);
+  if (entry_idx == -1) {
+    char *reason = bsprintf("%s isn't code", addr_name(a, entry));
+    add_reason(routine, reason);
+    xfree(reason);
+
+    routine->state = ROUTINE_DONE;
+    return routine;
+  }
+
+  cfg_analyze(a, routine, entry_idx, false);
+  return routine;
+}
+
+static dynarray *append_entry(dynarray *entries, uint32_t addr)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, entries) {
+    if ((uint32_t)dfirst_int(dc) == addr)
+      return entries;
+  }
+
+  return dynarray_append_int(entries, addr);
+}
+
+// interrupt handlers placed at vectors, targets of jumps from vectors and all called routines
+static dynarray *default_entries(analysis_t *a)
+{
+  dynarray *entries = NULL;
+  uint32_t handlers[] = {IM1_ENTRY, NMI_ENTRY};
+
+  for (int h = 0; h < 2; h++) {
+    int i = code_find(a, handlers[h]);
+
+    if (i != -1 && decode_flow(a->code[i]).kind != FLOW_JUMP)
+      entries = append_entry(entries, handlers[h]);
+  }
+
+  for (int i = 0; i < a->ncode; i++) {
+    flow_t flow = decode_flow(a->code[i]);
+
+    if (flow.kind == FLOW_CALL ||
+      (flow.kind == FLOW_JUMP && a->code[i]->addr < VECTORS_END && flow.target >= VECTORS_END))
+    {
+      entries = append_entry(entries, flow.target);
+    }
+  }
+
+  return entries;
+}
+
+static code_label_t *label_by_name(analysis_t *a, const char *name)
+{
+  for (int i = 0; i < a->nlabels; i++) {
+    if (strcmp(a->sorted_labels[i]->name, name) == 0)
+      return a->sorted_labels[i];
+  }
+
+  return NULL;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+// "N cycles" for bounded routine or window followed by its callees
+static char *routine_summary(analysis_t *a, routine_t *routine, const char *never_ends)
+{
+  dynarray_cell *dc = NULL;
+  buffer *buf = buffer_init();
+
+  if (routine->reasons == NULL)
+    buffer_append(buf, "%ld cycles", routine->cycles);
+  else if (routine->cycles < 0)
+    buffer_append(buf, "unbounded, %s", never_ends);
+  else
+    buffer_append(buf, "unbounded, %ld cycles without repeating unbounded loops", routine->cycles);
+
+  foreach (dc, routine->callees)
+    buffer_append(buf, "%s%s", foreach_current_index(dc) == 0 ? ", calls " : ", ", addr_name(a, dfirst_int(dc)));
+
+  char *summary = xstrdup(buf->data);
+  buffer_free(buf);
+
+  return summary;
+}
+
+static void report_reasons(routine_t *routine, const char *indent)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, routine->reasons)
+    report_info("%s%s", indent, (char *)dfirst(dc));
+}
+
+static void wcet_report(analysis_t *a)
+{
+  dynarray_cell *dc = NULL;
+  dynarray *entries = NULL;
+
+  if (a->entries) {
+    foreach (dc, a->entries) {
+      char *name = (char *)dfirst(dc);
+      code_label_t *label = label_by_name(a, name);
+
+      if (label == NULL)
+        report_error_noloc("unknown WCET entry point %s", name);
+
+      entries = append_entry(entries, label->addr);
+    }
+  } else {
+    entries = default_entries(a);
+  }
+
+  int nentries = dynarray_length(entries);
+  int *sorted = (int *)xmalloc(sizeof(int) * (nentries + 1));
+  foreach (dc, entries)
+    sorted[foreach_current_index(dc)] = dfirst_int(dc);
+  qsort(sorted, nentries, sizeof(int), entry_cmp);
+
+  for (int e = 0; e < nentries; e++) {
+    routine_t *routine = routine_analyze(a, sorted[e]);
+    char *summary = routine_summary(a, routine, "never returns");
+
+    report_info("\x1b[96mWCET\x1b[97m %s: %s", addr_name(a, routine->entry), summary);
+    report_reasons(routine, "    ");
+
+    xfree(summary);
+  }
+
+  xfree(sorted);
+  dynarray_free(entries);
+}
+
+// unbounded windows are the worst ones, then the longest
+static int window_cmp(const void *a, const void *b)
+{
+  const routine_t *w1 = *(const routine_t **)a;
+  const routine_t *w2 = *(const routine_t **)b;
+  bool unbounded1 = w1->reasons != NULL;
+  bool unbounded2 = w2->reasons != NULL;
+
+  if (unbounded1 != unbounded2)
+    return unbounded2 - unbounded1;
+
+  if (w1->cycles != w2->cycles)
+    return (w2->cycles > w1->cycles) - (w2->cycles < w1->cycles);
+
+  return (w1->entry > w2->entry) - (w1->entry < w2->entry);
+}
+
+// little endian word of the image, false if no section has bytes there
+static bool image_word(dynarray *sections, uint32_t addr, uint32_t *value)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+
+    if (section->start <= addr && addr + 2 <= section->start + section->content->len) {
+      uint8_t *p = (uint8_t *)&section->content->data[addr - section->start];
+
+      *value = p[0] | (p[1] << 8);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// entry points of interrupt handlers for interrupt modes which are set by the source
+static dynarray *handler_entries(analysis_t *a, dynarray *sections)
+{
+  dynarray *entries = NULL;
+  dynarray *im2_targets = NULL;
+  dynarray_cell *dc = NULL;
+  bool im0 = false, im1 = false, im2 = false;
+
+  for (int i = 0; i < a->ncode; i++) {
+    code_instr_t *ci = a->code[i];
+    uint8_t *op = instr_bytes(ci);
+
+    if (ci->size != 2 || op[0] != 0xED)
+      continue;
+
+    im0 |= (op[1] == 0x46);
+    im1 |= (op[1] == 0x56);
+    im2 |= (op[1] == 0x5E);
+
+    // ld a,n / ld i,a: table of IM 2 handlers is at page n
+    if (op[1] == 0x47 && i > 0 && a->code[i - 1]->size == 2 && instr_bytes(a->code[i - 1])[0] == 0x3E &&
+      a->code[i - 1]->addr + 2 == ci->addr)
+    {
+      uint32_t table = instr_bytes(a->code[i - 1])[1] << 8;
+      uint32_t target;
+
+      for (int e = 0; e < IM2_TABLE_ENTRIES; e++) {
+        if (image_word(sections, table + 2 * e, &target) && code_find(a, target) != -1)
+          im2_targets = append_entry(im2_targets, target);
+      }
+    }
+  }
+
+  // IM 0 after reset with 0FFh on data bus (RST 38h) is handled as IM 1
+  if (im1 || (!im0 && !im2))
+    entries = append_entry(entries, IM1_ENTRY);
+
+  if (im0) {
+    for (uint32_t addr = 0; addr <= IM1_ENTRY; addr += RST_STEP)
+      entries = append_entry(entries, addr);
+  }
+
+  if (im2) {
+    foreach (dc, im2_targets)
+      entries = append_entry(entries, dfirst_int(dc));
+  }
+
+  dynarray_free(im2_targets);
+
+  foreach (dc, a->isr_entries) {
+    char *name = (char *)dfirst(dc);
+    code_label_t *label = label_by_name(a, name);
+
+    if (label == NULL)
+      report_error_noloc("unknown interrupt handler %s", name);
+
+    entries = append_entry(entries, label->addr);
+  }
+
+  return entries;
+}
+
+static void latency_report(analysis_t *a, dynarray *sections)
+{
+  dynarray_cell *dc = NULL;
+  dynarray *entries = NULL;
+
+  // windows are started by DI and by acceptance of interrupt (it disables interrupts too)
+  for (int i = 0; i < a->ncode; i++) {
+    if (instr_bytes(a->code[i])[0] == 0xF3)
+      entries = append_entry(entries, a->code[i]->addr);
+  }
+
+  dynarray *handlers = handler_entries(a, sections);
+  foreach (dc, handlers)
+    entries = append_entry(entries, dfirst_int(dc));
+  dynarray_free(handlers);
+
+  foreach (dc, entries) {
+    int i = code_find(a, dfirst_int(dc));
+
+    if (i == -1)
+      continue;
+
+    routine_t *window = routine_new(a->code[i]->addr);
+    a->windows = dynarray_append_ptr(a->windows, window);
+
+    cfg_analyze(a, window, i, true);
+  }
+
+  dynarray_free(entries);
+
+  foreach (dc, sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+    routine_t **ranked = (routine_t **)xmalloc(sizeof(routine_t *) * (dynarray_length(a->windows) + 1));
+    dynarray_cell *wc = NULL;
+    code_instr_t *longest = NULL;
+    int nranked = 0;
+
+    foreach (wc, a->windows) {
+      routine_t *window = (routine_t *)dfirst(wc);
+
+      if (a->code[code_find(a, window->entry)]->section == section)
+        ranked[nranked++] = window;
+    }
+
+    // block instructions accept interrupts between iterations, so with interrupts enabled
+    // latency is up to the longest instruction (or iteration)
+    for (int i = 0; i < a->ncode; i++) {
+      code_instr_t *ci = a->code[i];
+
+      if (ci->section == section && !ci->in_window && (longest == NULL || ci->cycles > longest->cycles))
+        longest = ci;
+    }
+
+    if (nranked == 0 && longest == NULL) {
+      xfree(ranked);
+      continue;
+    }
+
+    qsort(ranked, nranked, sizeof(routine_t *), window_cmp);
+
+    report_info("\x1b[96mInterrupt latency\x1b[97m in section %s: %d interrupts disabled windows", section->name, nranked);
+
+    for (int w = 0; w < nranked; w++) {
+      routine_t *window = ranked[w];
+      char *summary = routine_summary(a, window, "never enables interrupts");
+
+      report_info("  %d. %s at %s: %s", w + 1,
+        instr_bytes(a->code[code_find(a, window->entry)])[0] == 0xF3 ? "DI" : "interrupt handler",
+        addr_name(a, window->entry), summary);
+      report_reasons(window, "       ");
+
+      xfree(summary);
+    }
+
+    if (longest)
+      report_info("  longest instruction with interrupts enabled: %d cycles at %s", longest->cycles, addr_name(a, longest->addr));
+
+    xfree(ranked);
+  }
+}
+
+void analysis_report(compile_ctx_t *ctx)
+{
+  analysis_t *a = ctx->analysis;
+  dynarray_cell *dc = NULL;
+
+  a->ncode = dynarray_length(a->instrs);
+  a->code = (code_instr_t **)xmalloc(sizeof(code_instr_t *) * (a->ncode + 1));
+  foreach (dc, a->instrs)
+    a->code[foreach_current_index(dc)] = (code_instr_t *)dfirst(dc);
+  qsort(a->code, a->ncode, sizeof(code_instr_t *), code_instr_cmp);
+
+  a->nlabels = dynarray_length(a->labels);
+  a->sorted_labels = (code_label_t **)xmalloc(sizeof(code_label_t *) * (a->nlabels + 1));
+  foreach (dc, a->labels)
+    a->sorted_labels[foreach_current_index(dc)] = (code_label_t *)dfirst(dc);
+  qsort(a->sorted_labels, a->nlabels, sizeof(code_label_t *), code_label_cmp);
+
+  if (ctx->opts.wcet)
+    wcet_report(a);
+
+  if (ctx->opts.latency)
+    latency_report(a, ctx->sections);
+}
+
+static void routines_free(dynarray *routines)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, routines) {
+    routine_t *routine = (routine_t *)dfirst(dc);
+
+    dynarray_free_deep(routine->reasons);
+    dynarray_free(routine->callees);
+  }
+
+  dynarray_free_deep(routines);
+}
+
+void analysis_free(analysis_t *a)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, a->labels)
+    xfree(((code_label_t *)dfirst(dc))->name);
+
+  routines_free(a->routines);
+  routines_free(a->windows);
+
+  dynarray_free_deep(a->instrs);
+  dynarray_free_deep(a->labels);
+
+  xfree(a->code);
+  xfree(a->sorted_labels);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// the last iteration of block instructions (LDIR, OTIR, ...) doesn't repeat: 16 cycles instead of 21
+#define BLOCK_LAST_ITER_SAVING 5
+
+// instruction rendered by the final pass
+typedef struct {
+  uint32_t addr;
+  section_ctx_t *section;
+  uint32_t pos;           // offset of opcode in section content
+  int size;
+  int cycles;             // assembler's timing (taken branch, repeated block instruction)
+  int bound;              // LOOPBOUND annotation or -1
+  bool in_window;         // instruction is executed with interrupts disabled
+} code_instr_t;
+
+typedef struct {
+  char *name;
+  uint32_t addr;
+  int order;              // definition order in source
+} code_label_t;
+
+typedef struct analysis_t {
+  dynarray *instrs;       // code_instr_t rendered by the final pass
+  dynarray *labels;       // code_label_t of all labels
+  int pending_bound;      // LOOPBOUND value waiting for the next instruction or -1
+  dynarray *entries;      // entry point names for WCET report (NULL for default ones)
+  dynarray *isr_entries;  // names of interrupt handlers starting latency windows besides found ones
+
+  // built by analysis_report() for lookups by address
+  code_instr_t **code;
+  int ncode;
+  code_label_t **sorted_labels;
+  int nlabels;
+  dynarray *routines;
+  dynarray *windows;
+} analysis_t;
+
+extern void analysis_start(compile_ctx_t *ctx);
+extern void analysis_code(compile_ctx_t *ctx, int size, int cycles);
+extern void analysis_add(analysis_t *a, section_ctx_t *section, uint32_t pos, int size, int cycles);
+extern void analysis_label(compile_ctx_t *ctx, const char *name, uint32_t addr);
+extern void analysis_bound(compile_ctx_t *ctx, int bound);
+extern void analysis_report(compile_ctx_t *ctx);
+extern void analysis_free(analysis_t *a);
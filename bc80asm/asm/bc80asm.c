@@ -1,11 +1,17 @@
 #include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "asm/bc80asm.h"
+#include "asm/cache.h"
 #include "asm/compile.h"
+#include "asm/deps.h"
 #include "asm/parse.h"
 #include "asm/snafmt.h"
+#include "asm/watch.h"
 #include "bits/dynarray.h"
 #include "bits/error.h"
 #include "bits/filesystem.h"
@@ -15,29 +21,106 @@
 static void print_usage(char *cmd)
 {
   printf("Assembler for Z80 CPU\n\n"
-         "usage: %s [options] <input file>\n\n"
+         "usage: %s [options] <input file>...\n\n"
          "options:\n"
          "  -h              this help\n"
-         "  -o filename     name of target file (will use input file name if omitted)\n"
+         "  -o filename     name of target file (will use input file name if omitted, single input only)\n"
+         "  --out kind=file write output of given kind (target type or map) to file, repeatable. All\n"
+         "                  outputs are rendered from one assembly of single input file (can't be used with\n"
+         "                  -o and -t)\n"
+         "  -j jobs         assemble input files by given number of parallel jobs (default: 1), messages\n"
+         "                  of every file are printed together when all of them are assembled\n"
          "  -Ipath          add directory to include path list (for preprocessor #include directive search)\n"
          "  -Dkey[=value]   define symbol for preprocessor\n"
+         "  -MD             write make rule of dependencies of output file: input file and INCLUDE and\n"
+         "                  INCBIN files which are read, to file named as output with suffix .d\n"
+         "  -MF file        write the rule to given file (implies -MD, single input only)\n"
+         "  -MP             add empty rules for dependencies, so make doesn't fail when any of them is removed\n"
          "  --profile[=all] enable profiling for blocks between global labels (or all labels if 'all' specified)\n"
          "  --profile-data  if profiling enabled, show information for data blocks (e.g. DB with labels)\n"
+         "  --rst-opt       call the most frequently called routines with RST at free restart vectors\n"
+         "                  (covered by ORG padding only). Routine ending with RET or JP which isn't\n"
+         "                  fallen into is moved to the vector if it fits ORG padding there: call takes\n"
+         "                  11 cycles instead of 17. Others are reached through JP trampoline at vector,\n"
+         "                  which makes call 4 cycles slower, so their calls inside loops are kept\n"
+         "  --wcet[=label,...]  report worst-case execution time of routines including their callees.\n"
+         "                  Default entry points are IM 1 and NMI handlers, targets of jumps from\n"
+         "                  restart vectors and all called routines. Loops are bounded by DJNZ or block\n"
+         "                  instruction counters loaded in front of them, or by LOOPBOUND n directive\n"
+         "                  placed before the instruction closing the loop: it jumps back at most n\n"
+         "                  times (block instruction repeats at most n times).\n"
+         "  --latency[=label,...]  report worst-case interrupt latency: windows from DI or interrupt\n"
+         "                  handler entry to EI ranked by length per section, loops are bounded as for\n"
+         "                  --wcet. Handlers are restart vectors for IM 0, IM 1 entry, targets of IM 2\n"
+         "                  table addressed by LD A,n / LD I,A and given labels\n"
+         "  --perf-lint     report slow instruction idioms with suggested replacements and their byte and\n"
+         "                  cycle deltas; findings inside PROFILE blocks are ranked first as hot code\n"
+         "  --merge-strings don't render labeled DB/DM strings identical to, or suffixes of, other strings\n"
+         "                  of the same section: their labels point into those strings. Strings must end\n"
+         "                  with zero or a byte with bit 7 set and must be accessed through labels only\n"
+         "  --map file      write memory map: sections, global labels with sizes of their blocks, gaps and\n"
+         "                  overlaps between sections, the largest free regions and code/data totals\n"
+         "  --gc-sections   remove blocks between global labels which aren't reachable from entry points:\n"
+         "                  reset, restart and NMI vectors, the lowest section address, --sna-pc and\n"
+         "                  labels listed by KEEP directive. Blocks are reached through label references\n"
+         "                  and by falling through from the preceding block\n"
+         "  --watch         stay running and assemble input files again whenever any of source, INCLUDE or\n"
+         "                  INCBIN files changes. Only changed files and files including them are parsed\n"
+         "                  again, others are kept parsed between runs\n"
+         "  --cache-dir dir keep outputs, map and messages of assemblies in directory and reuse them when\n"
+         "                  input file, its INCLUDE and INCBIN files, defines and options are the same\n"
+         "  --cache-size MiB  limit of cache size, the least recently used outputs are removed above it\n"
+         "                  (default: 64)\n"
          "  -t target       set output file target type. Can be one of:\n"
          "     raw (default)       raw binary rendered from absolute offset specified by ORG directive.\n"
          "                         Source file can contain only single section.\n"
          "     object              ELF object file. Source file can define multiple sections.\n"
          "     sna                 RAM snapshot file (SNA, 48k uncompressed)\n"
+         "     hex                 Intel HEX of bytes written by sections. Filler of ORG and ALIGN isn't\n"
+         "                         written unless gap is short enough (see --gap-threshold).\n"
+         "     ranges              list of written byte ranges like hex, each one is 16-bit little endian\n"
+         "                         address and size followed by data. The list ends with zero size, its\n"
+         "                         address is the lowest address of image.\n"
          "\nFollowing options are valid only for sna target:\n"
          "  --sna-generic      don't initialize RAM in the shapshot (default: initialize for ZX Spectrum device)\n"
          "  --sna-pc value     initial value of PC (default: lowest section address)\n"
-         "  --sna-ramtop addr  address for RAM top (zxspectrum; default 5D5Bh) or initial stack (generic; default 4000h)\n",
+         "  --sna-ramtop addr  address for RAM top (zxspectrum; default 5D5Bh) or initial stack (generic; default 4000h)\n"
+         "\nFollowing options are valid only for hex and ranges targets:\n"
+         "  --gap-threshold bytes  fill gaps up to given size instead of starting new record (default: 6 for\n"
+         "                     hex, 4 for ranges, where filler costs as much as the new record)\n",
          cmd
   );
 }
 
-static jmp_buf error_env;
-dynarray *g_includeopts;
+// output file of one target type
+typedef struct {
+  int target;
+  char *file;
+} output_file_t;
+
+// every input file is assembled by its own job, jobs of -j N run by worker threads
+typedef struct {
+  char *infile;
+  output_file_t *outputs;             // rendered from the same assembly
+  int noutputs;
+  char *depfile;                      // make rule of outfile dependencies (NULL if not requested)
+  bool depfile_phony;                 // add empty rules for dependencies
+  compile_opts *opts;                 // shared by all jobs, read only
+  hashmap *defineopts;                // shared by all jobs, read only
+  jmp_buf error_env;
+  char *log;                          // messages of job run by worker thread (NULL for stderr)
+  size_t log_size;
+  FILE *log_stream;                   // stream writing log while job runs (NULL for stderr)
+  int cached;                         // 1 if outputs are taken from cache, -1 if they aren't found there
+  int ret;
+} asm_job_t;
+
+typedef struct {
+  asm_job_t *jobs;
+  int njobs;
+  int next;                           // the first job which isn't taken by worker yet
+  pthread_mutex_t lock;
+} job_queue_t;
 
 enum {
   LONGOPT_SNA_GENERIC = 1,
@@ -45,22 +128,332 @@ enum {
   LONGOPT_SNA_RAMTOP,
   LONGOPT_PROFILE,
   LONGOPT_PROFILE_DATA,
+  LONGOPT_RST_OPT,
+  LONGOPT_WCET,
+  LONGOPT_LATENCY,
+  LONGOPT_PERF_LINT,
+  LONGOPT_MERGE_STRINGS,
+  LONGOPT_MAP,
+  LONGOPT_GC_SECTIONS,
+  LONGOPT_WATCH,
+  LONGOPT_CACHE_DIR,
+  LONGOPT_CACHE_SIZE,
+  LONGOPT_OUT,
+  LONGOPT_GAP_THRESHOLD,
 };
 
-int main(int argc, char **argv)
+// ASM_TARGET_* of target name (-1 if not known)
+static int parse_target(const char *name)
+{
+  if (strcasecmp(name, "raw") == 0)
+    return ASM_TARGET_RAW;
+  else if (strcasecmp(name, "object") == 0)
+    return ASM_TARGET_ELF;
+  else if (strcasecmp(name, "sna") == 0)
+    return ASM_TARGET_SNA;
+  else if (strcasecmp(name, "hex") == 0)
+    return ASM_TARGET_HEX;
+  else if (strcasecmp(name, "ranges") == 0)
+    return ASM_TARGET_RANGES;
+
+  return -1;
+}
+
+static void write_output(char *outfile, char *data, uint32_t size)
+{
+  FILE *fout = fopen(outfile, "w");
+  if (!fout)
+    report_error_noloc("%s: can't open for writing", outfile);
+
+  size_t sret = (size > 0) ? fwrite(data, size, 1, fout) : 1;
+  fclose(fout);
+
+  if (sret != 1)
+    report_error_noloc("%s: can't write", outfile);
+
+  if (size > 0)
+    report_info("%u bytes written to %s", size, outfile);
+}
+
+// outputs of the same input are written again with messages which assembly printed
+static void use_cached(asm_job_t *job, cache_entry_t *entry)
+{
+  if (entry->log_size > 0)
+    fwrite(entry->log, entry->log_size, 1, job->log_stream);
+
+  if (job->opts->map_file != NULL)
+    write_file(entry->map, entry->map_size, job->opts->map_file);
+
+  for (int i = 0; i < entry->noutputs && i < job->noutputs; i++)
+    write_output(job->outputs[i].file, entry->outputs[i].data, entry->outputs[i].size);
+}
+
+// outputs are stored with messages printed since log_start
+static void store_cached(asm_job_t *job, digest_t *key, deps_t *deps, compile_output_t *outputs,
+  size_t log_start)
+{
+  cache_entry_t entry = {.outputs = outputs, .noutputs = job->noutputs};
+
+  fflush(job->log_stream);
+  entry.log = job->log + log_start;
+  entry.log_size = job->log_size - log_start;
+
+  if (job->opts->map_file != NULL) {
+    entry.map = read_file(job->opts->map_file);
+    entry.map_size = fs_file_size(job->opts->map_file);
+  }
+
+  cache_store(job->opts->cache, key, deps, &entry);
+
+  xfree(entry.map);
+}
+
+static void assemble_file(asm_job_t *job)
 {
-  int optflag;
-  char *outfile = NULL;
   size_t filesize, sret;
   FILE *fin = NULL;
-  FILE *fout = NULL;
-  char *infile = NULL;
   char *source = NULL;
-  char *dest_buf = NULL;
+  compile_output_t *outputs;
+  char **targets = NULL;
+  dynarray *statements = NULL;
+  compile_opts opts = *job->opts;
+  deps_t *deps = NULL;
+  cache_entry_t *entry = NULL;
+  digest_t key;
+  size_t log_start = 0;
+
+  if (!fs_file_exists(job->infile))
+    report_error_noloc("%s: file not found", job->infile);
+
+  outputs = (compile_output_t *)xmalloc(sizeof(compile_output_t) * job->noutputs);
+  memset(outputs, 0, sizeof(compile_output_t) * job->noutputs);
+
+  for (int i = 0; i < job->noutputs; i++)
+    outputs[i].target = job->outputs[i].target;
+
+  // parsed files are kept between runs of --watch
+  if (opts.watch != NULL) {
+    watch_parse(opts.watch, job->infile, NULL, &opts, &statements);
+  } else {
+    filesize = fs_file_size(job->infile);
+    fin = fopen(job->infile, "r");
+    if (!fin)
+      report_error_noloc("%s: can't open for reading", job->infile);
+
+    source = (char *)xmalloc(filesize + 1);
+
+    // files are closed before reporting errors: job could be followed by other ones
+    sret = fread(source, filesize, 1, fin);
+    fclose(fin);
+
+    if (sret != 1)
+      report_error_noloc("%s: can't read", job->infile);
+
+    source[filesize] = '\0';
+
+    // files read by assembly are listed by cache entry and depfile
+    if (opts.cache != NULL || job->depfile != NULL) {
+      deps = deps_create();
+      opts.deps = deps;
+    }
+
+    if (opts.cache != NULL) {
+      key = cache_key(opts.cache, job->infile, source, filesize, &opts, job->defineopts, outputs,
+        job->noutputs);
+      entry = cache_lookup(opts.cache, &key, &opts);
+      job->cached = (entry != NULL) ? 1 : -1;
+
+      fflush(job->log_stream);
+      log_start = job->log_size;
+    }
+
+    if (entry == NULL && parse_source(job->infile, source, &opts, &statements) != 0)
+      report_error_noloc("parse %s error", job->infile);
+  }
+
+  if (entry != NULL) {
+    use_cached(job, entry);
+    cache_entry_free(entry);
+  } else {
+    compile_outputs(opts, job->defineopts, statements, outputs, job->noutputs);
+
+    if (opts.cache != NULL)
+      store_cached(job, &key, deps, outputs, log_start);
+
+    for (int i = 0; i < job->noutputs; i++)
+      write_output(job->outputs[i].file, outputs[i].data, outputs[i].size);
+  }
+
+  // map is written by assembly too, so it's a target of the rule as well
+  if (job->depfile != NULL) {
+    int ntargets = 0;
+
+    targets = (char **)xmalloc(sizeof(char *) * (job->noutputs + 1));
+
+    for (int i = 0; i < job->noutputs; i++)
+      targets[ntargets++] = job->outputs[i].file;
+
+    if (opts.map_file != NULL)
+      targets[ntargets++] = opts.map_file;
+
+    deps_write(deps, job->depfile, targets, ntargets, job->infile, job->depfile_phony);
+  }
+
+  if (deps != NULL)
+    deps_free(deps);
+
+  for (int i = 0; i < job->noutputs; i++)
+    xfree(outputs[i].data);
+
+  xfree(outputs);
+  xfree(targets);
+  xfree(source);
+}
+
+// error of assembly returns here, locals of caller aren't in setjmp frame
+static void run_assembly(asm_job_t *job)
+{
+  if (setjmp(job->error_env) == 0)
+    assemble_file(job);
+  else
+    job->ret = 1;
+}
+
+static void run_job(asm_job_t *job, bool buffered)
+{
+  FILE *log = NULL;
+  mmgr_pool *pool = NULL;
+  mmgr_pool *prev = NULL;
+
+  // allocations of job are tracked by its own pool (watch has run pool for it), so leftovers
+  // of job interrupted by error are released before the next one starts
+  if (job->opts->watch == NULL) {
+    pool = mmgr_pool_create();
+    prev = mmgr_switch(pool);
+  }
+
+  if (buffered) {
+    log = open_memstream(&job->log, &job->log_size);
+    set_error_output(log);
+  }
+
+  job->log_stream = log;
+
+  set_error_context(&job->error_env);
+
+  job->ret = 0;
+
+  if (job->opts->watch != NULL)
+    watch_begin(job->opts->watch);
+
+  run_assembly(job);
+
+  // error could interrupt quiet pass
+  set_error_quiet(false);
+
+  if (job->opts->watch != NULL)
+    watch_end(job->opts->watch);
+
+  if (pool != NULL) {
+    mmgr_switch(prev);
+    mmgr_pool_free(pool);
+  }
+
+  if (log) {
+    set_error_output(NULL);
+    fclose(log);
+    job->log_stream = NULL;
+  }
+}
+
+static void print_job_log(asm_job_t *job)
+{
+  if (job->log_size > 0)
+    fwrite(job->log, job->log_size, 1, stderr);
+
+  free(job->log);
+  job->log = NULL;
+  job->log_size = 0;
+}
+
+static void *job_worker(void *arg)
+{
+  job_queue_t *queue = (job_queue_t *)arg;
+
+  // memory is tracked per thread, jobs release their own pools
+  mmgr_init();
+
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    int next = queue->next++;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (next >= queue->njobs)
+      break;
+
+    run_job(&queue->jobs[next], true);
+  }
+
+  mmgr_finish(false);
+
+  return NULL;
+}
+
+static void run_jobs_parallel(asm_job_t *jobs, int njobs, int nthreads)
+{
+  job_queue_t queue = {.jobs = jobs, .njobs = njobs, .next = 0};
+  pthread_t *threads;
+  int nstarted = 0;
+
+  if (nthreads > njobs)
+    nthreads = njobs;
+
+  pthread_mutex_init(&queue.lock, NULL);
+  threads = (pthread_t *)xmalloc(sizeof(pthread_t) * nthreads);
+
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, job_worker, &queue) != 0)
+      break;
+    nstarted++;
+  }
+
+  // jobs are taken by started workers anyway, so fewer threads only slow them down
+  if (nstarted == 0)
+    report_error_noloc("can't start worker threads");
+
+  for (int i = 0; i < nstarted; i++)
+    pthread_join(threads[i], NULL);
+
+  xfree(threads);
+  pthread_mutex_destroy(&queue.lock);
+
+  // messages are printed by files in command line order
+  for (int i = 0; i < njobs; i++)
+    print_job_log(&jobs[i]);
+}
+
+int main(int argc, char **argv)
+{
+  int optflag;
+  char *outfile = NULL;
+  dynarray *outopts = NULL;
+  bool target_set = false;
   hashmap *defineopts;
+  asm_job_t *jobs = NULL;
+  int njobs = 0;
+  int nthreads = 1;
+  bool watch = false;
+  char *cache_dir = NULL;
+  bool depfile = false;
+  bool depfile_phony = false;
+  char *depfile_name = NULL;
+  int cache_size = CACHE_DEFAULT_SIZE_MB;
+  jmp_buf error_env;
 
   compile_opts opts = {0};
-  g_includeopts = NULL;
+  opts.sna_pc_addr = -1;
+  opts.sna_ramtop = -1;
+  opts.gap_threshold = -1;
 
   int ret = setjmp(error_env);
   if (ret != 0)
@@ -81,10 +474,22 @@ int main(int argc, char **argv)
     {"sna-ramtop",   required_argument, 0,            LONGOPT_SNA_RAMTOP},
     {"profile",      optional_argument, 0,            LONGOPT_PROFILE},
     {"profile-data", no_argument,       0,            LONGOPT_PROFILE_DATA},
+    {"rst-opt",      no_argument,       0,            LONGOPT_RST_OPT},
+    {"wcet",         optional_argument, 0,            LONGOPT_WCET},
+    {"latency",      optional_argument, 0,            LONGOPT_LATENCY},
+    {"perf-lint",    no_argument,       0,            LONGOPT_PERF_LINT},
+    {"merge-strings", no_argument,      0,            LONGOPT_MERGE_STRINGS},
+    {"map",          required_argument, 0,            LONGOPT_MAP},
+    {"gc-sections",  no_argument,       0,            LONGOPT_GC_SECTIONS},
+    {"watch",        no_argument,       0,            LONGOPT_WATCH},
+    {"cache-dir",    required_argument, 0,            LONGOPT_CACHE_DIR},
+    {"cache-size",   required_argument, 0,            LONGOPT_CACHE_SIZE},
+    {"out",          required_argument, 0,            LONGOPT_OUT},
+    {"gap-threshold", required_argument, 0,           LONGOPT_GAP_THRESHOLD},
     {0, 0, 0, 0}
   };
 
-  while ((optflag = getopt_long(argc, argv, "hD:I:o:t:", long_options, NULL)) != -1) {
+  while ((optflag = getopt_long(argc, argv, "hD:I:j:M:o:t:", long_options, NULL)) != -1) {
     switch (optflag) {
       case 0:
         // no_argument option processed
@@ -104,6 +509,11 @@ int main(int argc, char **argv)
           report_error_noloc("can't parse value for ramtop address: %s", optarg);
         break;
 
+      case LONGOPT_GAP_THRESHOLD:
+        if (!parse_any_integer(optarg, &opts.gap_threshold) || opts.gap_threshold < 0)
+          report_error_noloc("gap threshold must be non-negative number of bytes: %s", optarg);
+        break;
+
       case LONGOPT_PROFILE:
         if (optarg == NULL)
           opts.profile_mode = PROFILE_GLOBALS;
@@ -117,6 +527,62 @@ int main(int argc, char **argv)
         opts.profile_data = true;
         break;
 
+      case LONGOPT_RST_OPT:
+        opts.rst_opt = true;
+        break;
+
+      case LONGOPT_WCET:
+        opts.wcet = true;
+        if (optarg)
+          opts.wcet_entries = split_string_sep(optarg, ',', false);
+        break;
+
+      case LONGOPT_LATENCY:
+        opts.latency = true;
+        if (optarg)
+          opts.latency_entries = split_string_sep(optarg, ',', false);
+        break;
+
+      case LONGOPT_PERF_LINT:
+        opts.perf_lint = true;
+        break;
+
+      case LONGOPT_MERGE_STRINGS:
+        opts.merge_strings = true;
+        break;
+
+      case LONGOPT_MAP:
+        opts.map_file = optarg;
+        break;
+
+      case LONGOPT_GC_SECTIONS:
+        opts.gc_sections = true;
+        break;
+
+      case LONGOPT_WATCH:
+        watch = true;
+        break;
+
+      case LONGOPT_CACHE_DIR:
+        cache_dir = optarg;
+        break;
+
+      case LONGOPT_CACHE_SIZE:
+        if (!parse_any_integer(optarg, &cache_size) || cache_size < 1)
+          report_error_noloc("cache size must be positive number of MiB: %s", optarg);
+        break;
+
+      // outputs are collected as kind=file strings until the input file is known
+      case LONGOPT_OUT: {
+        char *eq = strchr(optarg, '=');
+
+        if (eq == NULL || eq[1] == '\0')
+          report_error_noloc("output must be given as kind=file: %s", optarg);
+
+        outopts = dynarray_append_ptr(outopts, optarg);
+        break;
+      }
+
       case 'D': {
         dynarray *kvparts = split_string_sep(optarg, '=', true);
         hashmap_set(defineopts, dinitial(kvparts),
@@ -125,22 +591,41 @@ int main(int argc, char **argv)
       }
 
       case 'I':
-        g_includeopts = dynarray_append_ptr(g_includeopts, xstrdup(optarg));
+        opts.includeopts = dynarray_append_ptr(opts.includeopts, xstrdup(optarg));
+        break;
+
+      // -MD, -MF file and -MP like ones of C compilers
+      case 'M':
+        if (strcmp(optarg, "D") == 0) {
+          depfile = true;
+        } else if (strcmp(optarg, "P") == 0) {
+          depfile_phony = true;
+        } else if (optarg[0] == 'F') {
+          if (optarg[1] == '\0' && optind >= argc)
+            report_error_noloc("missing file name for -MF");
+
+          depfile = true;
+          depfile_name = (optarg[1] != '\0') ? optarg + 1 : argv[optind++];
+        } else {
+          report_error_noloc("unknown option: -M%s", optarg);
+        }
+        break;
+
+      case 'j':
+        if (!parse_any_integer(optarg, &nthreads) || nthreads < 1)
+          report_error_noloc("number of jobs must be positive: %s", optarg);
         break;
 
       case 'o':
+        xfree(outfile);
         outfile = xstrdup(optarg);
         break;
 
       case 't':
-        if (strcasecmp(optarg, "raw") == 0)
-          opts.target = ASM_TARGET_RAW;
-        else if (strcasecmp(optarg, "object") == 0)
-          opts.target = ASM_TARGET_ELF;
-        else if (strcasecmp(optarg, "sna") == 0)
-          opts.target = ASM_TARGET_SNA;
-        else
-          report_error_noloc("target must be one of 'raw', 'object', 'sna'");
+        opts.target = parse_target(optarg);
+        if (opts.target == -1)
+          report_error_noloc("target must be one of 'raw', 'object', 'sna', 'hex', 'ranges'");
+        target_set = true;
         break;
 
       case ':':
@@ -159,74 +644,180 @@ int main(int argc, char **argv)
   if (opts.sna_ramtop == -1)
     opts.sna_ramtop = opts.sna_generic ? SNA_DEFAULT_RAMTOP : ZX_DEFAULT_RAMTOP;
 
-  if (argc - optind >= 1)
-    infile = xstrdup(argv[optind]);
+  njobs = argc - optind;
 
-  if (infile == NULL)
+  if (njobs == 0)
     report_error_noloc("error: no input file specified\n");
 
-  if (outfile == NULL) {
-    // evaluate output filename from input one
-    outfile = fs_replace_suffix(infile,
-      (opts.target == ASM_TARGET_ELF) ? "obj" :
-      (opts.target == ASM_TARGET_SNA) ? "sna" :
-      "bin");
+  if (njobs > 1 && outfile != NULL)
+    report_error_noloc("-o can't be used with multiple input files");
+
+  if (njobs > 1 && depfile_name != NULL)
+    report_error_noloc("-MF can't be used with multiple input files");
+
+  if (njobs > 1 && opts.map_file != NULL)
+    report_error_noloc("--map can't be used with multiple input files");
+
+  if (outopts != NULL && njobs > 1)
+    report_error_noloc("--out can't be used with multiple input files");
+
+  if (outopts != NULL && (outfile != NULL || target_set))
+    report_error_noloc("--out can't be used with -o or -t");
+
+  if (watch && nthreads > 1)
+    report_error_noloc("--watch can't be used with -j");
+
+  if (watch && depfile)
+    report_error_noloc("--watch can't be used with -MD");
+
+  if (watch && cache_dir != NULL)
+    report_error_noloc("--watch can't be used with --cache-dir");
+
+  if (watch)
+    opts.watch = watch_create();
+
+  if (cache_dir != NULL)
+    opts.cache = cache_create(cache_dir, cache_size, argv[0]);
+
+  jobs = (asm_job_t *)xmalloc(sizeof(asm_job_t) * njobs);
+  memset(jobs, 0, sizeof(asm_job_t) * njobs);
+
+  for (int i = 0; i < njobs; i++) {
+    asm_job_t *job = &jobs[i];
+
+    job->infile = argv[optind + i];
+    job->opts = &opts;
+    job->defineopts = defineopts;
+
+    if (outopts != NULL) {
+      job->outputs = (output_file_t *)xmalloc(sizeof(output_file_t) * dynarray_length(outopts));
+
+      for (int j = 0; j < dynarray_length(outopts); j++) {
+        char *arg = dfirst(dynarray_nth_cell(outopts, j));
+        char *file = strchr(arg, '=') + 1;
+        char *kind = xstrdup(arg);
+
+        kind[file - arg - 1] = '\0';
+
+        if (strcasecmp(kind, "map") == 0) {
+          xfree(kind);
+          opts.map_file = file;
+          continue;
+        }
+
+        int target = parse_target(kind);
+        xfree(kind);
+
+        if (target == -1)
+          report_error_noloc("output kind must be one of 'raw', 'object', 'sna', 'hex', 'ranges', 'map'");
+
+        job->outputs[job->noutputs].target = target;
+        job->outputs[job->noutputs++].file = xstrdup(file);
+      }
+
+      if (job->noutputs == 0)
+        report_error_noloc("--out must list at least one of 'raw', 'object', 'sna', 'hex', 'ranges' outputs");
+    } else {
+      // evaluate output filename from input one
+      job->outputs = (output_file_t *)xmalloc(sizeof(output_file_t));
+      job->outputs[0].target = opts.target;
+      job->outputs[0].file = outfile ? xstrdup(outfile) : fs_replace_suffix(job->infile,
+        (opts.target == ASM_TARGET_ELF) ? "obj" :
+        (opts.target == ASM_TARGET_SNA) ? "sna" :
+        (opts.target == ASM_TARGET_HEX) ? "hex" :
+        (opts.target == ASM_TARGET_RANGES) ? "rng" :
+        "bin");
+      job->noutputs = 1;
+    }
+
+    if (depfile)
+      job->depfile = depfile_name ? xstrdup(depfile_name) : fs_replace_suffix(job->outputs[0].file, "d");
+
+    job->depfile_phony = depfile_phony;
   }
 
   // actual work below
-  if (!fs_file_exists(infile))
-    report_error_noloc("%s: file not found", infile);
+  if (nthreads == 1 || njobs == 1) {
+    // messages of cached assembly are collected for its entry
+    for (int i = 0; i < njobs; i++) {
+      run_job(&jobs[i], opts.cache != NULL);
+      print_job_log(&jobs[i]);
+    }
+  } else {
+    run_jobs_parallel(jobs, njobs, nthreads);
+  }
 
-  filesize = fs_file_size(infile);
-  fin = fopen(infile, "r");
-  if (!fin)
-    report_error_noloc("%s: can't open for reading", infile);
+  // --watch runs until it's interrupted
+  while (opts.watch != NULL) {
+    struct timespec start, end;
+    int nparsed = 0;
 
-  source = (char *)xmalloc(filesize + 1);
+    report_info("\x1b[96mWatch\x1b[97m: waiting for changes");
+    watch_wait(opts.watch);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-  sret = fread(source, filesize, 1, fin);
-  if (sret != 1)
-    report_error_noloc("%s: can't read", infile);
+    for (int i = 0; i < njobs; i++) {
+      run_job(&jobs[i], false);
+      nparsed += opts.watch->nparsed;
+    }
 
-  source[filesize] = '\0';
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report_info("\x1b[96mWatch\x1b[97m: files parsed: %d, done in %.1f ms", nparsed,
+      (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+  }
 
-  dynarray *statements = NULL;
+  set_error_context(&error_env);
 
-  ret = parse_source(infile, source, &statements);
-  if (ret != 0)
-    report_error_noloc("parse %s error", infile);
+  int nfailed = 0;
 
-  uint32_t dest_size = compile(opts, defineopts, statements, &dest_buf);
+  for (int i = 0; i < njobs; i++) {
+    if (jobs[i].ret != 0)
+      nfailed++;
+  }
 
-  fout = fopen(outfile, "w");
-  if (!fout)
-    report_error_noloc("%s: can't open for writing", outfile);
+  if (nfailed > 0 && njobs > 1) {
+    report_info("%d of %d files failed:", nfailed, njobs);
 
-  if (dest_size > 0) {
-    sret = fwrite(dest_buf, dest_size, 1, fout);
-    if (sret != 1)
-      report_error_noloc("%s: can't write", outfile);
+    for (int i = 0; i < njobs; i++) {
+      if (jobs[i].ret != 0)
+        report_info("  %s", jobs[i].infile);
+    }
+  }
+
+  ret = (nfailed > 0) ? 1 : 0;
+
+  if (opts.cache != NULL) {
+    int hits = 0, misses = 0;
 
-    report_info("%u bytes written to %s", dest_size, outfile);
+    for (int i = 0; i < njobs; i++) {
+      hits += (jobs[i].cached > 0);
+      misses += (jobs[i].cached < 0);
+    }
+
+    cache_finish(opts.cache, hits, misses);
   }
 
 out:
-  if (fin)
-    fclose(fin);
+  for (int i = 0; i < njobs && jobs != NULL; i++) {
+    for (int j = 0; j < jobs[i].noutputs; j++)
+      xfree(jobs[i].outputs[j].file);
 
-  if (fout)
-    fclose(fin);
-
-  if (source)
-    xfree(source);
+    xfree(jobs[i].outputs);
+    xfree(jobs[i].depfile);
+  }
 
-  if (dest_buf)
-    xfree(dest_buf);
+  dynarray_free(outopts);
 
+  xfree(jobs);
   xfree(outfile);
-  xfree(infile);
   hashmap_free(defineopts);
-  dynarray_free_deep(g_includeopts);
+  dynarray_free_deep(opts.includeopts);
+
+  if (opts.watch != NULL)
+    watch_free(opts.watch);
+
+  if (opts.cache != NULL)
+    cache_free(opts.cache);
 
   mmgr_finish(getenv("MEMSTAT") != NULL);
 
@@ -1,13 +1,20 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct dynarray dynarray;
+struct cache_t;
+struct compile_ctx_t;
+struct deps_t;
+struct watch_t;
 
 enum {
   ASM_TARGET_RAW = 0,
   ASM_TARGET_ELF,
   ASM_TARGET_SNA,
+  ASM_TARGET_HEX,
+  ASM_TARGET_RANGES,
 };
 
 enum {
@@ -16,16 +23,45 @@ enum {
   PROFILE_ALL,
 };
 
-extern dynarray *g_includeopts;
-
+// options which change outputs must be hashed by cache_key() too
 typedef struct {
-  int target;                         // output format: one of ASM_TARGET_RAW, ASM_TARGET_ELF, ASM_TARGET_SNA
+  int target;                         // output format: one of ASM_TARGET_*
+  dynarray *includeopts;              // search paths of INCLUDE and INCBIN (-I)
+
+  // reads INCLUDE and INCBIN files instead of searching them in include paths (NULL for file system):
+  // returns xmalloc'ed contents followed by zero byte which isn't counted by size, or NULL if not found
+  char *(*include_reader)(void *data, char *filename, uint32_t *size);
+  void *include_reader_data;
+
+  // called with context of the final pass before its sections are freed (NULL if not needed)
+  void (*inspect)(struct compile_ctx_t *ctx, void *data);
+  void *inspect_data;
+  bool listing;                       // collect statements of the final pass for inspect hook
+
+  struct watch_t *watch;              // files kept between runs of --watch (NULL if not watching)
+  struct cache_t *cache;              // outputs of previous assemblies (NULL if --cache-dir isn't given)
+  struct deps_t *deps;                // records INCLUDE and INCBIN files which are read (NULL if not needed)
 
   // options for ASM_TARGET_SNA
   bool sna_generic;                   // use generic device (don't initialize RAM areas like UDG and SYSVARS)
   int sna_pc_addr;                    // initial PC value for ASM_TARGET_SNA (-1 if argument omitted)
   int sna_ramtop;                     // RAM top address (suitable for user programs)
 
+  // options for ASM_TARGET_HEX and ASM_TARGET_RANGES
+  int gap_threshold;                  // gaps up to this size are filled instead of starting new record
+                                      // (-1 for break-even size of format)
+
   int profile_mode;                   // how to perform auto profile: for all blocks, only global labels or never
   bool profile_data;                  // display profile information for no-code blocks
+
+  bool rst_opt;                       // replace the most frequent CALLs with RST through free restart vectors
+
+  bool wcet;                          // report worst-case execution time of entry points
+  dynarray *wcet_entries;             // names of entry points for WCET report (NULL for default ones)
+  bool latency;                       // report the longest windows with interrupts disabled
+  dynarray *latency_entries;          // names of interrupt handlers for latency report besides found ones
+  bool perf_lint;                     // report slow instruction idioms
+  bool merge_strings;                 // alias labeled strings into identical or longer ones
+  char *map_file;                     // memory map file (NULL if not requested)
+  bool gc_sections;                   // remove blocks which aren't reachable from entry points
 } compile_opts;
@@ -0,0 +1,640 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "asm/cache.h"
+#include "asm/parse.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+
+// Cache of assembly outputs keyed by SHA-256 of main file, defines and options. INCLUDE and
+// INCBIN files aren't known before parsing, so key has lists of files read by its assemblies
+// with digests of their contents: lookup reads them again by the same names and include
+// paths, and the first list whose files are still the same leads to entry keyed by digest
+// of all inputs (key and the list). So every version of included files has its own entry.
+// Entries and lists are files named by their keys, modification time of file is the time of
+// its last use for LRU eviction. Shared files (lists, stats) are updated under flock().
+
+#define CACHE_MAGIC "bc80asm-cache-2\n"
+#define CACHE_STATS "stats"
+#define CACHE_DEPS_SUFFIX ".deps"
+#define CACHE_DEPS_LISTS 16
+
+typedef struct {
+  char *name;
+  uint64_t size;
+  time_t mtime;
+} cache_file_t;
+
+cache_t *cache_create(const char *dir, int max_size_mb, const char *argv0)
+{
+  struct stat st;
+
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+    report_error_noloc("%s: can't create cache directory: %s", dir, strerror(errno));
+
+  cache_t *cache = (cache_t *)xmalloc(sizeof(cache_t));
+
+  cache->dir = xstrdup(dir);
+  cache->max_size = (uint64_t)max_size_mb << 20;
+
+  // rebuilt assembler could render the same sources differently
+  digest_init(&cache->tool);
+  digest_string(&cache->tool, CACHE_MAGIC);
+
+  if (stat("/proc/self/exe", &st) == 0 || stat(argv0, &st) == 0) {
+    digest_int(&cache->tool, st.st_size);
+    digest_int(&cache->tool, st.st_mtime);
+  }
+
+  return cache;
+}
+
+void cache_free(cache_t *cache)
+{
+  xfree(cache->dir);
+  xfree(cache);
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+// every option which changes outputs has to be hashed here
+digest_t cache_key(cache_t *cache, char *infile, char *source, uint32_t size, compile_opts *opts,
+  hashmap *defineopts, compile_output_t *outputs, int noutputs)
+{
+  digest_t key = cache->tool;
+  dynarray_cell *dc = NULL;
+
+  // messages refer to main file by its name
+  digest_string(&key, infile);
+  digest_int(&key, size);
+  digest_update(&key, source, size);
+
+  digest_int(&key, dynarray_length(opts->includeopts));
+  foreach (dc, opts->includeopts)
+    digest_string(&key, (char *)dfirst(dc));
+
+  // defines are hashed in order of their names, not of hashmap buckets
+  hashmap_scan *scan = hashmap_scan_init(defineopts);
+  hashmap_entry *entry = NULL;
+  dynarray *keys = NULL;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL)
+    keys = dynarray_append_ptr(keys, entry->key);
+
+  int ndefines = dynarray_length(keys);
+  char **names = (char **)xmalloc(sizeof(char *) * (ndefines + 1));
+
+  foreach (dc, keys)
+    names[foreach_current_index(dc)] = (char *)dfirst(dc);
+
+  qsort(names, ndefines, sizeof(char *), compare_strings);
+  dynarray_free(keys);
+
+  digest_int(&key, ndefines);
+  for (int i = 0; i < ndefines; i++) {
+    digest_string(&key, names[i]);
+    digest_string(&key, (char *)hashmap_get(defineopts, names[i]));
+  }
+
+  xfree(names);
+
+  digest_int(&key, noutputs);
+  for (int i = 0; i < noutputs; i++)
+    digest_int(&key, outputs[i].target);
+
+  digest_int(&key, opts->sna_generic);
+  digest_int(&key, opts->sna_pc_addr);
+  digest_int(&key, opts->sna_ramtop);
+  digest_int(&key, opts->gap_threshold);
+  digest_int(&key, opts->profile_mode);
+  digest_int(&key, opts->profile_data);
+  digest_int(&key, opts->rst_opt);
+  digest_int(&key, opts->wcet);
+  digest_int(&key, dynarray_length(opts->wcet_entries));
+  foreach (dc, opts->wcet_entries)
+    digest_string(&key, (char *)dfirst(dc));
+  digest_int(&key, opts->latency);
+  digest_int(&key, dynarray_length(opts->latency_entries));
+  foreach (dc, opts->latency_entries)
+    digest_string(&key, (char *)dfirst(dc));
+  digest_int(&key, opts->perf_lint);
+  digest_int(&key, opts->merge_strings);
+  digest_int(&key, opts->map_file != NULL);
+  digest_int(&key, opts->gc_sections);
+
+  return key;
+}
+
+// entries are named by hex of full key, lists of their files by hex of key with suffix
+static char *entry_path(cache_t *cache, digest_t *key, const char *suffix)
+{
+  char hex[2 * DIGEST_SIZE + 1];
+
+  digest_hex(key, hex);
+
+  return bsprintf("%s/%s%s", cache->dir, hex, suffix);
+}
+
+static bool read_u32(FILE *f, uint32_t *value)
+{
+  return fread(value, sizeof(uint32_t), 1, f) == 1;
+}
+
+// zero-terminated blob, NULL if it can't be read
+static char *read_blob(FILE *f, uint32_t *size)
+{
+  uint32_t len;
+
+  if (!read_u32(f, &len) || len == UINT32_MAX)
+    return NULL;
+
+  char *data = (char *)xmalloc(len + 1);
+
+  if (len > 0 && fread(data, len, 1, f) != 1) {
+    xfree(data);
+    return NULL;
+  }
+
+  data[len] = '\0';
+
+  if (size != NULL)
+    *size = len;
+
+  return data;
+}
+
+// whole file is read under shared lock, so it's never seen in the middle of locked update,
+// NULL if it can't be read
+static char *read_locked(const char *path, uint32_t *size)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  char *data = NULL;
+
+  if (fd < 0)
+    return NULL;
+
+  if (flock(fd, LOCK_SH) == 0 && fstat(fd, &st) == 0) {
+    data = (char *)xmalloc(st.st_size + 1);
+
+    if (read(fd, data, st.st_size) == st.st_size) {
+      data[st.st_size] = '\0';
+      *size = st.st_size;
+    } else {
+      xfree(data);
+      data = NULL;
+    }
+  }
+
+  close(fd);
+
+  return data;
+}
+
+// full key is key of main file with files read by assembly: they're the same as ones of entry
+// if it's true in same (false is returned only if list can't be read)
+static bool check_deps(FILE *f, compile_opts *opts, digest_t *full, bool *same)
+{
+  uint32_t ndeps;
+
+  if (!read_u32(f, &ndeps))
+    return false;
+
+  *same = true;
+
+  for (uint32_t i = 0; i < ndeps; i++) {
+    uint32_t size, cur_size;
+    uint8_t hash[DIGEST_SIZE], cur_hash[DIGEST_SIZE];
+    char *name = read_blob(f, NULL);
+
+    if (name == NULL)
+      return false;
+
+    if (!read_u32(f, &size) || fread(hash, DIGEST_SIZE, 1, f) != 1) {
+      xfree(name);
+      return false;
+    }
+
+    digest_string(full, name);
+    digest_int(full, size);
+    digest_update(full, hash, DIGEST_SIZE);
+
+    // searched by include paths again: the same name could be found elsewhere now
+    char *data = *same ? read_include(opts, name, &cur_size) : NULL;
+    xfree(name);
+
+    if (data == NULL) {
+      *same = false;
+      continue;
+    }
+
+    digest_t digest;
+
+    digest_init(&digest);
+    digest_update(&digest, data, cur_size);
+    digest_final(&digest, cur_hash);
+    xfree(data);
+
+    if (cur_size != size || memcmp(cur_hash, hash, DIGEST_SIZE) != 0)
+      *same = false;
+  }
+
+  return true;
+}
+
+static cache_entry_t *read_entry(const char *path)
+{
+  char magic[sizeof(CACHE_MAGIC) - 1];
+  FILE *f = fopen(path, "rb");
+  cache_entry_t *entry = NULL;
+
+  if (f == NULL)
+    return NULL;
+
+  if (fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0) {
+    uint32_t noutputs = 0, has_map = 0;
+    bool complete = read_u32(f, &noutputs) && noutputs < 256;
+
+    entry = (cache_entry_t *)xmalloc(sizeof(cache_entry_t));
+    memset(entry, 0, sizeof(cache_entry_t));
+
+    if (complete) {
+      entry->outputs = (compile_output_t *)xmalloc(sizeof(compile_output_t) * (noutputs + 1));
+      memset(entry->outputs, 0, sizeof(compile_output_t) * (noutputs + 1));
+    }
+
+    for (uint32_t i = 0; complete && i < noutputs; i++) {
+      uint32_t target;
+
+      complete = read_u32(f, &target);
+      entry->outputs[i].target = target;
+      entry->outputs[i].data = complete ? read_blob(f, &entry->outputs[i].size) : NULL;
+      complete = (entry->outputs[i].data != NULL);
+      entry->noutputs = i + 1;
+    }
+
+    if (complete && read_u32(f, &has_map) && has_map)
+      entry->map = read_blob(f, &entry->map_size);
+
+    if (complete && (!has_map || entry->map != NULL))
+      entry->log = read_blob(f, &entry->log_size);
+
+    // truncated entry is a miss, it's replaced by the next store
+    if (entry->log == NULL) {
+      cache_entry_free(entry);
+      entry = NULL;
+    }
+  }
+
+  fclose(f);
+
+  return entry;
+}
+
+// the first list of files which are the same now leads to entry, files of entry are added
+// to opts->deps only if it's used
+cache_entry_t *cache_lookup(cache_t *cache, digest_t *key, compile_opts *opts)
+{
+  char *lists_path = entry_path(cache, key, CACHE_DEPS_SUFFIX);
+  uint32_t size;
+  char *lists = read_locked(lists_path, &size);
+  cache_entry_t *entry = NULL;
+  uint32_t pos = sizeof(CACHE_MAGIC) - 1;
+
+  if (lists == NULL || size < pos || memcmp(lists, CACHE_MAGIC, pos) != 0) {
+    xfree(lists);
+    xfree(lists_path);
+    return NULL;
+  }
+
+  while (entry == NULL && pos + sizeof(uint32_t) <= size) {
+    uint32_t len;
+
+    memcpy(&len, lists + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+
+    if (len > size - pos)
+      break;
+
+    FILE *f = fmemopen(lists + pos, len, "rb");
+    compile_opts check_opts = *opts;
+    digest_t full = *key;
+    bool same = false;
+
+    pos += len;
+    check_opts.deps = deps_create();
+
+    if (f != NULL && check_deps(f, &check_opts, &full, &same) && same) {
+      char *path = entry_path(cache, &full, "");
+
+      entry = read_entry(path);
+
+      // used entry is the most recent one for eviction
+      if (entry != NULL) {
+        utimes(path, NULL);
+        utimes(lists_path, NULL);
+
+        if (opts->deps != NULL)
+          deps_merge(opts->deps, check_opts.deps);
+      }
+
+      xfree(path);
+    }
+
+    if (f != NULL)
+      fclose(f);
+
+    deps_free(check_opts.deps);
+  }
+
+  xfree(lists);
+  xfree(lists_path);
+
+  return entry;
+}
+
+static void write_blob(FILE *f, const char *data, uint32_t size)
+{
+  fwrite(&size, sizeof(uint32_t), 1, f);
+  if (size > 0)
+    fwrite(data, size, 1, f);
+}
+
+// list of files read by assembly is put first into lists of key under exclusive lock, the same
+// list and the oldest ones over CACHE_DEPS_LISTS are dropped
+static void store_deps(cache_t *cache, digest_t *key, deps_t *deps)
+{
+  char *path = entry_path(cache, key, CACHE_DEPS_SUFFIX);
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  buffer *list = buffer_init();
+  buffer *lists = buffer_init();
+  dynarray_cell *dc = NULL;
+  struct stat st;
+
+  if (fd < 0 || flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+    report_warning_noloc("%s: can't update cache entry: %s", path, strerror(errno));
+    goto out;
+  }
+
+  uint32_t ndeps = dynarray_length(deps->list);
+  uint32_t len = 0;
+
+  buffer_append_binary(list, (char *)&len, sizeof(uint32_t));
+  buffer_append_binary(list, (char *)&ndeps, sizeof(uint32_t));
+
+  foreach (dc, deps->list) {
+    dep_t *dep = (dep_t *)dfirst(dc);
+    uint32_t name_len = strlen(dep->name);
+
+    buffer_append_binary(list, (char *)&name_len, sizeof(uint32_t));
+    buffer_append_binary(list, dep->name, name_len);
+    buffer_append_binary(list, (char *)&dep->size, sizeof(uint32_t));
+    buffer_append_binary(list, (char *)dep->hash, DIGEST_SIZE);
+  }
+
+  len = list->len - sizeof(uint32_t);
+  memcpy(list->data, &len, sizeof(uint32_t));
+
+  buffer_append_binary(lists, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1);
+  buffer_append_binary(lists, list->data, list->len);
+
+  char *old = (char *)xmalloc(st.st_size + 1);
+  uint32_t pos = sizeof(CACHE_MAGIC) - 1;
+  int nlists = 1;
+
+  // lists of other version or partially written are dropped
+  if (read(fd, old, st.st_size) != st.st_size || st.st_size < pos || memcmp(old, CACHE_MAGIC, pos) != 0)
+    pos = st.st_size;
+
+  while (pos + sizeof(uint32_t) <= st.st_size && nlists < CACHE_DEPS_LISTS) {
+    memcpy(&len, old + pos, sizeof(uint32_t));
+
+    if (len > st.st_size - pos - sizeof(uint32_t))
+      break;
+
+    if (len + sizeof(uint32_t) != list->len || memcmp(old + pos, list->data, list->len) != 0) {
+      buffer_append_binary(lists, old + pos, len + sizeof(uint32_t));
+      nlists++;
+    }
+
+    pos += len + sizeof(uint32_t);
+  }
+
+  xfree(old);
+
+  if (ftruncate(fd, 0) != 0 || pwrite(fd, lists->data, lists->len, 0) != lists->len)
+    report_warning_noloc("%s: can't update cache entry: %s", path, strerror(errno));
+
+out:
+  if (fd >= 0)
+    close(fd);
+
+  buffer_free(list);
+  buffer_free(lists);
+  xfree(path);
+}
+
+// entry is written into temporary file and renamed, so concurrent builds never read partial one
+void cache_store(cache_t *cache, digest_t *key, deps_t *deps, cache_entry_t *entry)
+{
+  digest_t full = *key;
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, deps->list) {
+    dep_t *dep = (dep_t *)dfirst(dc);
+
+    digest_string(&full, dep->name);
+    digest_int(&full, dep->size);
+    digest_update(&full, dep->hash, DIGEST_SIZE);
+  }
+
+  char *path = entry_path(cache, &full, "");
+  char *tmp_path = bsprintf("%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  FILE *f = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+
+  if (f == NULL) {
+    report_warning_noloc("%s: can't write cache entry: %s", tmp_path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    unlink(tmp_path);
+    xfree(tmp_path);
+    xfree(path);
+    return;
+  }
+
+  uint32_t noutputs = entry->noutputs;
+  uint32_t has_map = (entry->map != NULL);
+
+  fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1, 1, f);
+  fwrite(&noutputs, sizeof(uint32_t), 1, f);
+
+  for (int i = 0; i < entry->noutputs; i++) {
+    uint32_t target = entry->outputs[i].target;
+
+    fwrite(&target, sizeof(uint32_t), 1, f);
+    write_blob(f, entry->outputs[i].data, entry->outputs[i].size);
+  }
+
+  fwrite(&has_map, sizeof(uint32_t), 1, f);
+  if (has_map)
+    write_blob(f, entry->map, entry->map_size);
+  write_blob(f, entry->log, entry->log_size);
+
+  bool failed = ferror(f);
+
+  // entry is there before list of files which leads to it
+  if (fclose(f) != 0 || failed || rename(tmp_path, path) != 0) {
+    report_warning_noloc("%s: can't write cache entry", path);
+    unlink(tmp_path);
+  } else {
+    store_deps(cache, key, deps);
+  }
+
+  xfree(tmp_path);
+  xfree(path);
+}
+
+void cache_entry_free(cache_entry_t *entry)
+{
+  for (int i = 0; i < entry->noutputs; i++)
+    xfree(entry->outputs[i].data);
+
+  xfree(entry->outputs);
+  xfree(entry->map);
+  xfree(entry->log);
+  xfree(entry);
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+  const cache_file_t *fa = (const cache_file_t *)a;
+  const cache_file_t *fb = (const cache_file_t *)b;
+
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static bool is_entry_name(const char *name)
+{
+  if (strspn(name, "0123456789abcdef") != 2 * DIGEST_SIZE)
+    return false;
+
+  return name[2 * DIGEST_SIZE] == '\0' || strcmp(name + 2 * DIGEST_SIZE, CACHE_DEPS_SUFFIX) == 0;
+}
+
+// removes the least recently used entries until cache fits its size, returns number of them
+static int evict(cache_t *cache, uint64_t *total)
+{
+  DIR *dir = opendir(cache->dir);
+  dynarray *found = NULL;
+  dynarray_cell *dc = NULL;
+  int nevicted = 0;
+  struct dirent *de;
+
+  *total = 0;
+
+  if (dir == NULL)
+    return 0;
+
+  while ((de = readdir(dir)) != NULL) {
+    struct stat st;
+
+    if (!is_entry_name(de->d_name))
+      continue;
+
+    char *path = bsprintf("%s/%s", cache->dir, de->d_name);
+
+    if (stat(path, &st) == 0) {
+      cache_file_t *file = (cache_file_t *)xmalloc(sizeof(cache_file_t));
+
+      file->name = path;
+      file->size = st.st_size;
+      file->mtime = st.st_mtime;
+      found = dynarray_append_ptr(found, file);
+      *total += st.st_size;
+    } else {
+      xfree(path);
+    }
+  }
+
+  closedir(dir);
+
+  int nfiles = dynarray_length(found);
+  cache_file_t *files = (cache_file_t *)xmalloc(sizeof(cache_file_t) * (nfiles + 1));
+
+  foreach (dc, found) {
+    files[foreach_current_index(dc)] = *(cache_file_t *)dfirst(dc);
+    xfree(dfirst(dc));
+  }
+
+  dynarray_free(found);
+
+  qsort(files, nfiles, sizeof(cache_file_t), compare_mtime);
+
+  for (int i = 0; i < nfiles; i++) {
+    if (*total > cache->max_size && unlink(files[i].name) == 0) {
+      *total -= files[i].size;
+      nevicted++;
+    }
+
+    xfree(files[i].name);
+  }
+
+  xfree(files);
+
+  return nevicted;
+}
+
+// totals of concurrent builds are added up under exclusive lock of stats file
+void cache_finish(cache_t *cache, int hits, int misses)
+{
+  long total_hits = 0, total_misses = 0, total_evicted = 0;
+  uint64_t total_size;
+  char *path = bsprintf("%s/%s", cache->dir, CACHE_STATS);
+  int nevicted = evict(cache, &total_size);
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+
+  if (fd >= 0 && flock(fd, LOCK_EX) == 0) {
+    char stats[256];
+    ssize_t len = read(fd, stats, sizeof(stats) - 1);
+
+    stats[(len > 0) ? len : 0] = '\0';
+
+    if (sscanf(stats, "hits %ld misses %ld evicted %ld", &total_hits, &total_misses, &total_evicted) != 3)
+      total_hits = total_misses = total_evicted = 0;
+
+    total_hits += hits;
+    total_misses += misses;
+    total_evicted += nevicted;
+
+    int n = snprintf(stats, sizeof(stats), "hits %ld\nmisses %ld\nevicted %ld\n", total_hits, total_misses,
+      total_evicted);
+
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, stats, n, 0) != n)
+      report_warning_noloc("%s: can't update cache statistics: %s", path, strerror(errno));
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  xfree(path);
+
+  report_info("\x1b[96mCache\x1b[97m: %d hits, %d misses (total: %ld hits, %ld misses, %ld evicted, "
+    "%.1f of %.1f MiB used)", hits, misses, total_hits, total_misses, total_evicted,
+    total_size / 1048576.0, cache->max_size / 1048576.0);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asm/bc80asm.h"
+#include "asm/compile.h"
+#include "asm/deps.h"
+
+typedef struct hashmap hashmap;
+
+#define CACHE_DEFAULT_SIZE_MB 64
+
+typedef struct cache_t {
+  char *dir;
+  uint64_t max_size;            // bytes of entries kept by eviction
+  digest_t tool;                // identity of assembler executable, outputs of other builds are stale
+} cache_t;
+
+// outputs of assembly of one input file
+typedef struct {
+  compile_output_t *outputs;    // images of output files
+  int noutputs;
+  char *map;                    // memory map (NULL if not requested)
+  uint32_t map_size;
+  char *log;                    // messages printed by assembly
+  uint32_t log_size;
+} cache_entry_t;
+
+extern cache_t *cache_create(const char *dir, int max_size_mb, const char *argv0);
+extern void cache_free(cache_t *cache);
+
+extern digest_t cache_key(cache_t *cache, char *infile, char *source, uint32_t size, compile_opts *opts,
+  hashmap *defineopts, compile_output_t *outputs, int noutputs);
+extern cache_entry_t *cache_lookup(cache_t *cache, digest_t *key, compile_opts *opts);
+extern void cache_store(cache_t *cache, digest_t *key, deps_t *deps, cache_entry_t *entry);
+extern void cache_entry_free(cache_entry_t *entry);
+
+// evict the least recently used entries and account hits and misses of run
+extern void cache_finish(cache_t *cache, int hits, int misses);
@@ -0,0 +1,909 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/codegen.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+
+// ==================================================================================================
+// DELAY n[, clobber-set]: cycle-exact delay
+// ==================================================================================================
+
+// longest delay which could be made as straight-line padding; longer ones
+// are always shorter as loops
+#define DELAY_PAD_LIMIT   1024
+
+// longest padding inside of loop body (keeps relative jumps in range)
+#define DELAY_BODY_LIMIT  64
+
+typedef struct {
+  const char *text;
+  uint8_t opcode[2];
+  int nbytes;
+  int cycles;
+  int clobbers;
+} delay_filler_t;
+
+// Instructions to burn T-states in straight-line code. They don't change anything
+// except registers from 'clobbers' mask (push/pop pair writes below SP but
+// restores AF back).
+static const delay_filler_t delay_fillers[] = {
+  { "nop",            { 0x00, 0x00 }, 1,  4, 0 },
+  { "jr $+2",         { 0x18, 0x00 }, 2, 12, 0 },
+  { "jp $+3",         { 0xC3, 0x00 }, 3, 10, 0 },
+  { "push af/pop af", { 0xF5, 0xF1 }, 2, 21, 0 },
+  { "cp (hl)",        { 0xBE, 0x00 }, 1,  7, CLOBBER_F },
+  { "ld a,(hl)",      { 0x7E, 0x00 }, 1,  7, CLOBBER_A },
+  { "inc bc",         { 0x03, 0x00 }, 1,  6, CLOBBER_BC },
+  { "inc de",         { 0x13, 0x00 }, 1,  6, CLOBBER_DE },
+  { "inc hl",         { 0x23, 0x00 }, 1,  6, CLOBBER_HL },
+  { "ld a,i",         { 0xED, 0x57 }, 2,  9, CLOBBER_AF },
+};
+
+#define NUM_DELAY_FILLERS ((int)(sizeof(delay_fillers) / sizeof(delay_fillers[0])))
+
+typedef struct {
+  int limit;
+  int *nbytes;  // minimal size of padding for given number of cycles (INT_MAX if impossible)
+  int *choice;  // filler index to start the minimal padding with
+} delay_pad_t;
+
+typedef enum {
+  DELAY_PAD = 0,  // straight-line padding only
+  DELAY_DJNZ,     // ld b,n / .l: <body> / djnz .l
+  DELAY_DEC_JR,   // ld r,n / .l: <body> / dec r / jr nz,.l
+  DELAY_PAIR,     // ld rr,nn / .l: <body> / dec rr / ld a,rh / or rl / jr nz,.l
+  DELAY_NESTED,   // ld r,m / .o: ld b,n / .l: <body> / djnz .l / dec r / jr nz,.o
+} delay_kind;
+
+typedef struct {
+  delay_kind kind;
+  int reg;            // loop counter: opcode field of 8-bit register or register pair
+  int saved;          // registers preserved on stack around the loop: DELAY_SAVE_* mask
+  int count;          // loop iterations
+  int outer;          // outer loop iterations (DELAY_NESTED only)
+  int body;           // cycles of padding inside of loop body
+  int body_clobbers;  // registers allowed to change inside of loop body
+  int tail;           // cycles of padding after the loop
+  int nbytes;         // total code size
+} delay_plan_t;
+
+// registers which loop could preserve with push/pop pair if they aren't allowed to clobber
+#define DELAY_SAVE_BC  (1 << 0)
+#define DELAY_SAVE_AF  (1 << 1)
+
+static const char *reg8_names[] = { "b", "c", "d", "e", "h", "l", "f", "a" };
+static const char *reg16_names[] = { "bc", "de", "hl" };
+
+static delay_pad_t *delay_pad_init(int limit, int clobbers)
+{
+  delay_pad_t *pad = (delay_pad_t *)xmalloc(sizeof(delay_pad_t));
+
+  pad->limit = limit;
+  pad->nbytes = (int *)xmalloc((limit + 1) * sizeof(int));
+  pad->choice = (int *)xmalloc((limit + 1) * sizeof(int));
+
+  pad->nbytes[0] = 0;
+  pad->choice[0] = -1;
+
+  // unbounded knapsack: fewest bytes for exact number of cycles
+  for (int t = 1; t <= limit; t++) {
+    pad->nbytes[t] = INT_MAX;
+    pad->choice[t] = -1;
+
+    for (int i = 0; i < NUM_DELAY_FILLERS; i++) {
+      const delay_filler_t *f = &delay_fillers[i];
+
+      if ((f->clobbers & ~clobbers) || f->cycles > t)
+        continue;
+
+      int prev = pad->nbytes[t - f->cycles];
+      if (prev != INT_MAX && prev + f->nbytes < pad->nbytes[t]) {
+        pad->nbytes[t] = prev + f->nbytes;
+        pad->choice[t] = i;
+      }
+    }
+  }
+
+  return pad;
+}
+
+static void delay_pad_free(delay_pad_t *pad)
+{
+  xfree(pad->nbytes);
+  xfree(pad->choice);
+  xfree(pad);
+}
+
+static inline int delay_pad_size(delay_pad_t *pad, int cycles)
+{
+  if (cycles < 0 || cycles > pad->limit)
+    return INT_MAX;
+
+  return pad->nbytes[cycles];
+}
+
+// JP, JP cc or LD HL,nn with address of generated code of the current section, object output
+// relocates it
+static void emit_local_addr(compile_ctx_t *ctx, int opcode, uint32_t addr, int cycles)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  LITERAL *target = make_node_internal(LITERAL);
+
+  target->kind = INT;
+  target->ival = addr;
+  target->section = ctx->curr_section_id + 1;
+
+  register_addr_lookup(ctx, (parse_node *)target, section->curr_pc - section->start + 1, 2, false, 0);
+  render_3bytes(ctx, opcode, addr & 0xff, (addr >> 8) & 0xff, cycles);
+}
+
+static void emit_delay_pad(compile_ctx_t *ctx, delay_pad_t *pad, int cycles)
+{
+  while (cycles > 0) {
+    const delay_filler_t *f = &delay_fillers[pad->choice[cycles]];
+
+    if (f->nbytes == 3) {
+      // jp $+3
+      emit_local_addr(ctx, f->opcode[0], get_current_section(ctx)->curr_pc + 3, f->cycles);
+    } else if (f->nbytes == 2) {
+      render_2bytes(ctx, f->opcode[0], f->opcode[1], f->cycles);
+    } else {
+      render_byte(ctx, f->opcode[0], f->cycles);
+    }
+
+    cycles -= f->cycles;
+  }
+}
+
+// find best iterations count for a single loop which costs 'base + count * period' cycles
+static void delay_try_loop(delay_plan_t *best, delay_plan_t *cand, delay_pad_t *tail_pad,
+                           int cycles, int base, int period, int max_count, int nbytes)
+{
+  int count = (cycles - base) / period;
+  if (count > max_count)
+    count = max_count;
+
+  // few iterations less than maximum could give cheaper tail
+  for (int i = 0; i < 8 && count >= 1; i++, count--) {
+    int tail = cycles - base - count * period;
+    int tail_bytes = delay_pad_size(tail_pad, tail);
+
+    if (tail_bytes == INT_MAX || nbytes + tail_bytes >= best->nbytes)
+      continue;
+
+    *best = *cand;
+    best->count = count;
+    best->tail = tail;
+    best->nbytes = nbytes + tail_bytes;
+  }
+}
+
+static void delay_try_nested(delay_plan_t *best, delay_plan_t *cand, delay_pad_t *tail_pad,
+                             int cycles, int period, int nbytes)
+{
+  for (int outer = 1; outer <= 256; outer++) {
+    // total = 2 + outer * (18 + count * period)
+    int count = ((cycles - 2) / outer - 18) / period;
+    if (count > 256)
+      count = 256;
+
+    for (int i = 0; i < 4 && count >= 1; i++, count--) {
+      int tail = cycles - 2 - outer * (18 + count * period);
+      int tail_bytes = delay_pad_size(tail_pad, tail);
+
+      if (tail_bytes == INT_MAX || nbytes + tail_bytes >= best->nbytes)
+        continue;
+
+      *best = *cand;
+      best->count = count;
+      best->outer = outer;
+      best->tail = tail;
+      best->nbytes = nbytes + tail_bytes;
+    }
+  }
+}
+
+// try all padding sizes inside of loop body for given loop kind
+static void delay_try_kind(delay_plan_t *best, delay_kind kind, int reg, int counter_regs, int saved,
+                           int cycles, int clobbers, delay_pad_t *tail_pad)
+{
+  delay_plan_t cand = { 0 };
+  int body_clobbers = clobbers & ~counter_regs;
+  delay_pad_t *body_pad = delay_pad_init(DELAY_BODY_LIMIT, body_clobbers);
+
+  // every push/pop pair around the loop
+  int save_cycles = 0, save_bytes = 0;
+  for (int i = 0; i < 2; i++) {
+    if (saved & (1 << i)) {
+      save_cycles += 21;
+      save_bytes += 2;
+    }
+  }
+
+  cand.kind = kind;
+  cand.reg = reg;
+  cand.saved = saved;
+  cand.body_clobbers = body_clobbers;
+
+  for (int body = 0; body <= DELAY_BODY_LIMIT; body++) {
+    int body_bytes = delay_pad_size(body_pad, body);
+    if (body_bytes == INT_MAX)
+      continue;
+
+    cand.body = body;
+
+    switch (kind) {
+      case DELAY_DJNZ:
+        delay_try_loop(best, &cand, tail_pad, cycles, 2 + save_cycles, body + 13, 256, 4 + save_bytes + body_bytes);
+        break;
+      case DELAY_DEC_JR:
+        delay_try_loop(best, &cand, tail_pad, cycles, 2, body + 16, 256, 5 + body_bytes);
+        break;
+      case DELAY_PAIR:
+        delay_try_loop(best, &cand, tail_pad, cycles, 5 + save_cycles, body + 26, 65536, 8 + save_bytes + body_bytes);
+        break;
+      case DELAY_NESTED:
+        delay_try_nested(best, &cand, tail_pad, cycles, body + 13, 9 + body_bytes);
+        break;
+      default:
+        break;
+    }
+  }
+
+  delay_pad_free(body_pad);
+}
+
+static char *delay_plan_describe(delay_plan_t *plan)
+{
+  buffer *buf = buffer_init();
+
+  switch (plan->kind) {
+    case DELAY_PAD:
+      buffer_append(buf, "straight-line padding");
+      break;
+    case DELAY_DJNZ:
+      buffer_append(buf, "djnz loop, b=%d", plan->count);
+      break;
+    case DELAY_DEC_JR:
+      buffer_append(buf, "dec/jr loop, %s=%d", reg8_names[plan->reg], plan->count);
+      break;
+    case DELAY_PAIR:
+      buffer_append(buf, "register pair loop, %s=%d", reg16_names[plan->reg], plan->count);
+      break;
+    case DELAY_NESTED:
+      buffer_append(buf, "nested djnz loop, %s=%d, b=%d", reg8_names[plan->reg], plan->outer, plan->count);
+      break;
+  }
+
+  if (plan->saved) {
+    buffer_append(buf, ", %s%s%s saved on stack",
+      (plan->saved & DELAY_SAVE_AF) ? "af" : "",
+      (plan->saved == (DELAY_SAVE_AF | DELAY_SAVE_BC)) ? " and " : "",
+      (plan->saved & DELAY_SAVE_BC) ? "bc" : "");
+  }
+
+  if (plan->body)
+    buffer_append(buf, ", %d cycles in loop body", plan->body);
+
+  if (plan->kind != DELAY_PAD && plan->tail)
+    buffer_append(buf, ", %d cycles tail", plan->tail);
+
+  buffer_append_char(buf, '\0');
+
+  char *result = buffer_dup(buf);
+  buffer_free(buf);
+
+  return result;
+}
+
+static void emit_delay_plan(compile_ctx_t *ctx, delay_plan_t *plan, delay_pad_t *tail_pad)
+{
+  delay_pad_t *body_pad = delay_pad_init(DELAY_BODY_LIMIT, plan->body_clobbers);
+  int body_bytes = delay_pad_size(body_pad, plan->body);
+
+  if (plan->saved & DELAY_SAVE_AF)
+    render_byte(ctx, 0xF5, 11);                                           // push af
+  if (plan->saved & DELAY_SAVE_BC)
+    render_byte(ctx, 0xC5, 11);                                           // push bc
+
+  switch (plan->kind) {
+    case DELAY_PAD:
+      break;
+
+    case DELAY_DJNZ:
+      render_2bytes(ctx, 0x06, plan->count & 0xff, 7);                    // ld b,n
+      emit_delay_pad(ctx, body_pad, plan->body);
+      render_2bytes(ctx, 0x10, -(2 + body_bytes), 13);                    // djnz .l
+      break;
+
+    case DELAY_DEC_JR:
+      render_2bytes(ctx, 0x06 | (plan->reg << 3), plan->count & 0xff, 7); // ld r,n
+      emit_delay_pad(ctx, body_pad, plan->body);
+      render_byte(ctx, 0x05 | (plan->reg << 3), 4);                       // dec r
+      render_2bytes(ctx, 0x20, -(3 + body_bytes), 12);                    // jr nz,.l
+      break;
+
+    case DELAY_PAIR:
+      render_3bytes(ctx, 0x01 | (plan->reg << 4),                         // ld rr,nn
+        plan->count & 0xff, (plan->count >> 8) & 0xff, 10);
+      emit_delay_pad(ctx, body_pad, plan->body);
+      render_byte(ctx, 0x0B | (plan->reg << 4), 6);                       // dec rr
+      render_byte(ctx, 0x78 | (plan->reg * 2), 4);                        // ld a,rh
+      render_byte(ctx, 0xB0 | (plan->reg * 2 + 1), 4);                    // or rl
+      render_2bytes(ctx, 0x20, -(5 + body_bytes), 12);                    // jr nz,.l
+      break;
+
+    case DELAY_NESTED:
+      render_2bytes(ctx, 0x06 | (plan->reg << 3), plan->outer & 0xff, 7); // ld r,m
+      render_2bytes(ctx, 0x06, plan->count & 0xff, 7);                    // ld b,n
+      emit_delay_pad(ctx, body_pad, plan->body);
+      render_2bytes(ctx, 0x10, -(2 + body_bytes), 13);                    // djnz .l
+      render_byte(ctx, 0x05 | (plan->reg << 3), 4);                       // dec r
+      render_2bytes(ctx, 0x20, -(7 + body_bytes), 12);                    // jr nz,.o
+      break;
+  }
+
+  if (plan->saved & DELAY_SAVE_BC)
+    render_byte(ctx, 0xC1, 10);                                           // pop bc
+  if (plan->saved & DELAY_SAVE_AF)
+    render_byte(ctx, 0xF1, 10);                                           // pop af
+
+  emit_delay_pad(ctx, tail_pad, plan->tail);
+
+  delay_pad_free(body_pad);
+}
+
+void gen_delay(compile_ctx_t *ctx, int cycles, int clobbers)
+{
+  if (cycles < 0)
+    report_error(ctx, "DELAY value %d must not be negative", cycles);
+
+  if (cycles == 0)
+    return;
+
+  delay_plan_t best = { 0 };
+  int tail_limit = (cycles < DELAY_PAD_LIMIT) ? cycles : DELAY_PAD_LIMIT;
+  delay_pad_t *tail_pad = delay_pad_init(tail_limit, clobbers);
+
+  best.nbytes = INT_MAX;
+
+  // straight-line padding
+  if (delay_pad_size(tail_pad, cycles) != INT_MAX) {
+    best.kind = DELAY_PAD;
+    best.tail = cycles;
+    best.nbytes = tail_pad->nbytes[cycles];
+  }
+
+  if (clobbers & CLOBBER_B)
+    delay_try_kind(&best, DELAY_DJNZ, 0, CLOBBER_B, 0, cycles, clobbers, tail_pad);
+  else
+    delay_try_kind(&best, DELAY_DJNZ, 0, CLOBBER_B, DELAY_SAVE_BC, cycles, clobbers, tail_pad);
+
+  bool pair_tried = false;
+
+  if (clobbers & CLOBBER_F) {
+    // any 8-bit register could be a counter for dec/jr loop: prefer accumulator
+    static const int counter_order[] = { 7, 1, 2, 3, 4, 5, 0 };
+
+    for (int i = 0; i < 7; i++) {
+      int reg = counter_order[i];
+
+      if (clobbers & (1 << reg)) {
+        delay_try_kind(&best, DELAY_DEC_JR, reg, 1 << reg, 0, cycles, clobbers, tail_pad);
+        break;
+      }
+    }
+
+    if (clobbers & CLOBBER_A) {
+      for (int rp = 0; rp < 3; rp++) {
+        int pair_mask = (1 << (rp * 2)) | (1 << (rp * 2 + 1));
+
+        if ((clobbers & pair_mask) == pair_mask) {
+          delay_try_kind(&best, DELAY_PAIR, rp, pair_mask, 0, cycles, clobbers, tail_pad);
+          pair_tried = true;
+          break;
+        }
+      }
+    }
+
+    if (clobbers & CLOBBER_B) {
+      for (int reg = 1; reg < 8; reg++) {
+        if (reg != 6 && (clobbers & (1 << reg))) {
+          delay_try_kind(&best, DELAY_NESTED, reg, CLOBBER_B | (1 << reg), 0, cycles, clobbers, tail_pad);
+          break;
+        }
+      }
+    }
+  }
+
+  // long delays without enough free registers: save them around register pair loop
+  if (!pair_tried) {
+    int saved = 0;
+
+    if ((clobbers & CLOBBER_BC) != CLOBBER_BC)
+      saved |= DELAY_SAVE_BC;
+    if ((clobbers & CLOBBER_AF) != CLOBBER_AF)
+      saved |= DELAY_SAVE_AF;
+
+    delay_try_kind(&best, DELAY_PAIR, 0, CLOBBER_BC, saved, cycles, clobbers, tail_pad);
+  }
+
+  if (best.nbytes == INT_MAX)
+    report_error(ctx, "can't generate exact delay for %d cycles, try to allow more registers to clobber", cycles);
+
+  profile_data_t saved_profile = ctx->current_profile;
+
+  emit_delay_plan(ctx, &best, tail_pad);
+
+  // loops execute more cycles than rendered instructions declare: account exact value
+  if (ctx->in_profile)
+    ctx->current_profile.cycles = saved_profile.cycles + cycles;
+
+  char *description = delay_plan_describe(&best);
+  report_info("\x1b[96mDelay\x1b[97m at %s:%d: %d cycles in %d bytes (%s)",
+    ctx->node->fn, ctx->node->line - 1, cycles, best.nbytes, description);
+  xfree(description);
+
+  delay_pad_free(tail_pad);
+}
+
+// ==================================================================================================
+// FASTCOPY src, dst, len[, unroll] / FASTFILL dst, len, value: block copy and fill
+// ==================================================================================================
+
+// minimal number of LDI per loop iteration: loop overhead is 10/16 T-states per byte
+#define FASTCOPY_UNROLL_DEFAULT  16
+
+// minimal number of PUSH per loop iteration; DJNZ range limits it from above
+#define FASTFILL_UNROLL_DEFAULT  16
+#define FASTFILL_UNROLL_MAX      126
+
+// pick unroll factor in [lo, hi] range with the shortest loop body plus tail,
+// the larger one (i.e. with less iterations) if there are several of them
+static int pick_unroll(int total, int lo, int hi)
+{
+  int best = lo;
+
+  for (int unroll = lo + 1; unroll <= hi; unroll++) {
+    if (unroll + total % unroll <= best + total % best)
+      best = unroll;
+  }
+
+  return best;
+}
+
+// iterations of unrolled loop and number of instructions in front of it,
+// loop of single iteration isn't needed
+static void split_unroll(int total, int unroll, int *iterations, int *tail)
+{
+  *iterations = total / unroll;
+  *tail = total % unroll;
+
+  if (*iterations == 1) {
+    *tail = total;
+    *iterations = 0;
+  }
+}
+
+static int fastcopy_cycles(int len, int iterations)
+{
+  return 30 + 16 * len + 10 * iterations;
+}
+
+static int fastcopy_bytes(int unroll, int iterations, int tail)
+{
+  return 9 + 2 * tail + (iterations > 0 ? 2 * unroll + 3 : 0);
+}
+
+// ld a,i / push af / di ... pop af / jp po / ei restore interrupts as they were
+static int fastfill_cycles(int len, int iterations)
+{
+  return 107 + 11 * (len / 2) + (iterations > 0 ? 2 + 13 * iterations : 0) + ((len & 1) ? 16 : 0);
+}
+
+static int fastfill_bytes(int len, int unroll, int iterations, int tail)
+{
+  return 23 + tail + (iterations > 0 ? unroll + 4 : 0) + ((len & 1) ? 3 : 0);
+}
+
+// the fastest unroll factor whose code fits into budget (0 if none does), the shorter code
+// of the same speed is preferred
+static int budget_unroll(int len, int budget, bool fill)
+{
+  int total = fill ? len / 2 : len;
+  int max = (fill && total > FASTFILL_UNROLL_MAX) ? FASTFILL_UNROLL_MAX : total;
+  int best = 0, best_cycles = INT_MAX, best_bytes = INT_MAX;
+
+  for (int unroll = 1; unroll <= max; unroll++) {
+    int iterations, tail;
+
+    split_unroll(total, unroll, &iterations, &tail);
+
+    // DJNZ counts up to 256 iterations
+    if (fill && iterations > 256)
+      continue;
+
+    int cycles = fill ? fastfill_cycles(len, iterations) : fastcopy_cycles(len, iterations);
+    int bytes = fill ? fastfill_bytes(len, unroll, iterations, tail) : fastcopy_bytes(unroll, iterations, tail);
+
+    if (bytes <= budget && (cycles < best_cycles || (cycles == best_cycles && bytes < best_bytes))) {
+      best = unroll;
+      best_cycles = cycles;
+      best_bytes = bytes;
+    }
+  }
+
+  return best;
+}
+
+// render instruction with 16-bit immediate operand which may be forward referenced
+static void emit_imm16(compile_ctx_t *ctx, int prefix, int opcode, parse_node *value, int cycles)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t imm_pos = section->curr_pc - section->start + (prefix ? 2 : 1);
+  parse_node *node = expr_eval(ctx, value);
+  int ival = 0;
+
+  if (IS_INT_LITERAL(node)) {
+    ival = ((LITERAL *)node)->ival;
+    register_addr_lookup(ctx, node, imm_pos, 2, false, 0);
+  } else {
+    // will patch operand position with literal value at 2nd pass
+    register_fwd_lookup(ctx, node, imm_pos, 2, false, 0);
+  }
+
+  if (prefix)
+    render_4bytes(ctx, prefix, opcode, ival & 0xff, (ival >> 8) & 0xff, cycles);
+  else
+    render_3bytes(ctx, opcode, ival & 0xff, (ival >> 8) & 0xff, cycles);
+}
+
+// make 'base + offset' expression for operand which may be forward referenced
+static parse_node *make_offset_expr(compile_ctx_t *ctx, parse_node *base, int offset)
+{
+  parse_node *node = expr_eval(ctx, base);
+
+  LITERAL *l = make_node_internal(LITERAL);
+  l->kind = INT;
+
+  if (IS_INT_LITERAL(node)) {
+    l->ival = ((LITERAL *)node)->ival + offset;
+    return (parse_node *)l;
+  }
+
+  l->ival = offset;
+
+  EXPR *e = make_node_internal(EXPR);
+  e->hdr.line = ctx->node->line;
+  e->hdr.pos = ctx->node->pos;
+  e->hdr.fn = ctx->node->fn;
+  e->kind = BINARY_PLUS;
+  e->left = node;
+  e->right = (parse_node *)l;
+
+  return (parse_node *)e;
+}
+
+// Copy 'len' bytes the same way as LDIR does (HL and DE advanced, BC = 0 on exit),
+// but with unrolled LDI: 16 T-states per byte plus 10 per JP PE instead of 21.
+// LDI clears P/V flag as soon as BC reaches zero, so tail copies go first and
+// loop makes exactly 'len / unroll' iterations. Budget (-1 if not given) limits bytes of code.
+void gen_fastcopy(compile_ctx_t *ctx, parse_node *src, parse_node *dst, int len, int unroll, int budget)
+{
+  if (len < 1 || len > 0xFFFF)
+    report_error(ctx, "FASTCOPY length %d is out of range 1..65535", len);
+
+  if (unroll < 0)
+    report_error(ctx, "FASTCOPY unroll factor %d must not be negative", unroll);
+
+  if (unroll > 0 && budget != -1)
+    report_error(ctx, "FASTCOPY can't have both unroll factor and budget");
+
+  if (budget != -1) {
+    unroll = budget_unroll(len, budget, false);
+    if (unroll == 0)
+      report_error(ctx, "FASTCOPY of %d bytes doesn't fit into budget of %d bytes", len, budget);
+  } else if (unroll == 0) {
+    if (len <= FASTCOPY_UNROLL_DEFAULT)
+      unroll = len;
+    else
+      unroll = pick_unroll(len, FASTCOPY_UNROLL_DEFAULT, (len < 2 * FASTCOPY_UNROLL_DEFAULT) ? len : 2 * FASTCOPY_UNROLL_DEFAULT - 1);
+  }
+
+  if (unroll > len)
+    unroll = len;
+
+  int iterations, tail;
+  split_unroll(len, unroll, &iterations, &tail);
+
+  profile_data_t saved_profile = ctx->current_profile;
+
+  emit_imm16(ctx, 0, 0x21, src, 10);                                    // ld hl,src
+  emit_imm16(ctx, 0, 0x11, dst, 10);                                    // ld de,dst
+  render_3bytes(ctx, 0x01, len & 0xff, (len >> 8) & 0xff, 10);          // ld bc,len
+
+  for (int i = 0; i < tail; i++)
+    render_2bytes(ctx, 0xED, 0xA0, 16);                                 // ldi
+
+  if (iterations > 0) {
+    uint32_t loop_pc = get_current_section(ctx)->curr_pc;
+
+    for (int i = 0; i < unroll; i++)
+      render_2bytes(ctx, 0xED, 0xA0, 16);                               // ldi
+    emit_local_addr(ctx, 0xEA, loop_pc, 10);                            // jp pe,.l
+  }
+
+  int cycles = fastcopy_cycles(len, iterations);
+  int nbytes = fastcopy_bytes(unroll, iterations, tail);
+
+  if (ctx->in_profile)
+    ctx->current_profile.cycles = saved_profile.cycles + cycles;
+
+  char *strategy = (iterations > 0)
+    ? bsprintf("%d x %d ldi loop, %d ldi tail", iterations, unroll, tail)
+    : bsprintf("%d ldi", tail);
+
+  report_info("\x1b[96mFastcopy\x1b[97m at %s:%d: %d bytes with %s: %d cycles in %d bytes (LDIR: %d cycles in %d bytes)",
+    ctx->node->fn, ctx->node->line - 1, len, strategy, cycles, nbytes, 30 + 21 * len - 5, 11);
+  xfree(strategy);
+}
+
+// Fill 'len' bytes with PUSH HL going down from the end of block: 5.5 T-states per byte.
+// SP is saved in IX and interrupts are disabled while stack points into the block, then
+// they are enabled again only if they were enabled before (IFF2 is read by LD A,I).
+// HL, B, IX and AF are changed: A is left with I and F with flags of LD A,I. Budget (-1 if not
+// given) limits bytes of code.
+void gen_fastfill(compile_ctx_t *ctx, parse_node *dst, int len, int value, int unroll, int budget)
+{
+  if (len < 2 || len > 2 * FASTFILL_UNROLL_MAX * 256)
+    report_error(ctx, "FASTFILL length %d is out of range 2..%d", len, 2 * FASTFILL_UNROLL_MAX * 256);
+
+  if (value < -128 || value > 255)
+    report_error(ctx, "FASTFILL value %d doesn't fit into byte", value);
+
+  int words = len / 2;
+
+  if (unroll > 0 && budget != -1)
+    report_error(ctx, "FASTFILL can't have both unroll factor and budget");
+
+  if (unroll < 0 || unroll > FASTFILL_UNROLL_MAX)
+    report_error(ctx, "FASTFILL unroll factor %d is out of range 1..%d", unroll, FASTFILL_UNROLL_MAX);
+
+  if (unroll > words)
+    unroll = words;
+
+  if (unroll > 0 && words / unroll > 256)
+    report_error(ctx, "FASTFILL unroll factor %d makes more than 256 iterations", unroll);
+
+  if (budget != -1) {
+    unroll = budget_unroll(len, budget, true);
+    if (unroll == 0)
+      report_error(ctx, "FASTFILL of %d bytes doesn't fit into budget of %d bytes", len, budget);
+  } else if (unroll == 0 && words <= FASTFILL_UNROLL_DEFAULT) {
+    unroll = words;
+  } else if (unroll == 0) {
+    // DJNZ counts up to 256 iterations: unroll more for longer blocks
+    int lo = (words + 255) / 256;
+    if (lo < FASTFILL_UNROLL_DEFAULT)
+      lo = FASTFILL_UNROLL_DEFAULT;
+
+    int hi = (words < 2 * lo - 1) ? words : 2 * lo - 1;
+    if (hi > FASTFILL_UNROLL_MAX)
+      hi = FASTFILL_UNROLL_MAX;
+
+    unroll = pick_unroll(words, lo, hi);
+  }
+
+  int iterations, tail;
+  split_unroll(words, unroll, &iterations, &tail);
+
+  profile_data_t saved_profile = ctx->current_profile;
+  int pattern = (value & 0xff) * 0x101;
+
+  render_2bytes(ctx, 0xED, 0x57, 9);                                    // ld a,i
+  render_byte(ctx, 0xF5, 11);                                           // push af
+  render_byte(ctx, 0xF3, 4);                                            // di
+  render_4bytes(ctx, 0xDD, 0x21, 0x00, 0x00, 14);                       // ld ix,0
+  render_2bytes(ctx, 0xDD, 0x39, 15);                                   // add ix,sp
+  emit_imm16(ctx, 0, 0x31, make_offset_expr(ctx, dst, len), 10);        // ld sp,dst+len
+  render_3bytes(ctx, 0x21, pattern & 0xff, (pattern >> 8) & 0xff, 10);  // ld hl,value*0x101
+
+  for (int i = 0; i < tail; i++)
+    render_byte(ctx, 0xE5, 11);                                         // push hl
+
+  if (iterations > 0) {
+    render_2bytes(ctx, 0x06, iterations & 0xff, 7);                     // ld b,n
+    for (int i = 0; i < unroll; i++)
+      render_byte(ctx, 0xE5, 11);                                       // push hl
+    render_2bytes(ctx, 0x10, -(unroll + 2), 13);                        // djnz .l
+  }
+
+  // the first byte of odd-sized block: next one is already filled
+  if (len & 1)
+    emit_imm16(ctx, 0, 0x22, dst, 16);                                  // ld (dst),hl
+
+  render_2bytes(ctx, 0xDD, 0xF9, 10);                                   // ld sp,ix
+  render_byte(ctx, 0xF1, 10);                                           // pop af
+
+  emit_local_addr(ctx, 0xE2, get_current_section(ctx)->curr_pc + 4, 10); // jp po,.skip
+  render_byte(ctx, 0xFB, 4);                                            // ei
+
+  int cycles = fastfill_cycles(len, iterations);
+  int nbytes = fastfill_bytes(len, unroll, iterations, tail);
+
+  if (ctx->in_profile)
+    ctx->current_profile.cycles = saved_profile.cycles + cycles;
+
+  char *strategy = (iterations > 0)
+    ? bsprintf("%d x %d push loop, %d push tail", iterations, unroll, tail)
+    : bsprintf("%d push", tail);
+
+  report_info("\x1b[96mFastfill\x1b[97m at %s:%d: %d bytes with %s: %d cycles in %d bytes (LDIR: %d cycles in %d bytes)",
+    ctx->node->fn, ctx->node->line - 1, len, strategy, cycles, nbytes, 35 + 21 * (len - 1), 13);
+  xfree(strategy);
+}
+
+// ==================================================================================================
+// SWITCH reg, label0, label1, ...: constant time dispatch through jump table
+// ==================================================================================================
+
+// ADD A,A limits index to 7 bits
+#define SWITCH_MAX_CASES  128
+
+// dispatch code between index in A and jump table
+#define SWITCH_PAGE_BYTES     9   // add a,a / ld l,a / ld h,hi / ld a,(hl) / inc l / ld h,(hl) / ld l,a / jp (hl)
+#define SWITCH_PAGE_CYCLES    41
+#define SWITCH_OFFSET_BYTES   11  // the same with add a,lo after add a,a
+#define SWITCH_OFFSET_CYCLES  48
+#define SWITCH_RELOC_BYTES    14  // ld hl,table / add a,a / add a,l / ld l,a / adc a,h / sub l / ld h,a /
+#define SWITCH_RELOC_CYCLES   62  // ld a,(hl) / inc hl / ld h,(hl) / ld l,a / jp (hl)
+
+// Jump to 'cases[reg]' with table of addresses right after dispatch code. Table
+// starting at page boundary needs no low byte of address to be added to index;
+// the table which fits into the page without crossing it could start anywhere
+// for 2 bytes and 7 T-states more. If none of them fits, padding is inserted
+// between JP (HL) and table to align it. Object output doesn't know the page of
+// table, so it's addressed by relocated LD HL,nn with 16-bit addition of index.
+// A, HL and flags are changed, index isn't checked against the number of cases.
+void gen_switch(compile_ctx_t *ctx, parse_node *reg, LIST *cases)
+{
+  static const char *index_regs = "bcdehl a";
+
+  parse_node *r = expr_eval(ctx, reg);
+  int ncases = dynarray_length(cases->list);
+  int reg_code = -1;
+
+  if (r->type == NODE_ID && strlen(((ID *)r)->name) == 1) {
+    const char *p = strchr(index_regs, tolower(((ID *)r)->name[0]));
+    if (p != NULL && *p != ' ')
+      reg_code = p - index_regs;
+  }
+
+  if (reg_code == -1)
+    report_error(ctx, "SWITCH index must be 8-bit register A, B, C, D, E, H or L (got %s)", node_to_string(r));
+
+  if (ncases < 2 || ncases > SWITCH_MAX_CASES)
+    report_error(ctx, "SWITCH supports 2..%d cases (got %d)", SWITCH_MAX_CASES, ncases);
+
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t code_pc = section->curr_pc + (reg_code != 7 ? 1 : 0);
+  uint32_t table_size = 2 * ncases;
+  bool relocatable = (ctx->opts.target == ASM_TARGET_ELF);
+  bool offset_form = false;
+  uint32_t padding = 0;
+  uint32_t table_pc = code_pc + SWITCH_RELOC_BYTES;
+
+  if (!relocatable) {
+    // padding for page aligned table (2 bytes is a break-even point with offset form)
+    padding = (0x100 - ((code_pc + SWITCH_PAGE_BYTES) & 0xff)) & 0xff;
+
+    if (padding > 2 && ((code_pc + SWITCH_OFFSET_BYTES) & 0xff) + table_size <= 0x100) {
+      offset_form = true;
+      padding = 0;
+    }
+
+    table_pc = code_pc + (offset_form ? SWITCH_OFFSET_BYTES : SWITCH_PAGE_BYTES) + padding;
+  }
+
+  if (reg_code != 7)
+    render_byte(ctx, 0x78 | reg_code, 4);                               // ld a,r
+
+  if (relocatable) {
+    emit_local_addr(ctx, 0x21, table_pc, 10);                           // ld hl,table
+    render_byte(ctx, 0x87, 4);                                          // add a,a
+    render_byte(ctx, 0x85, 4);                                          // add a,l
+    render_byte(ctx, 0x6F, 4);                                          // ld l,a
+    render_byte(ctx, 0x8C, 4);                                          // adc a,h
+    render_byte(ctx, 0x95, 4);                                          // sub l
+    render_byte(ctx, 0x67, 4);                                          // ld h,a
+    render_byte(ctx, 0x7E, 7);                                          // ld a,(hl)
+    render_byte(ctx, 0x23, 6);                                          // inc hl
+  } else {
+    render_byte(ctx, 0x87, 4);                                          // add a,a
+    if (offset_form)
+      render_2bytes(ctx, 0xC6, table_pc & 0xff, 7);                     // add a,lo
+    render_byte(ctx, 0x6F, 4);                                          // ld l,a
+    render_2bytes(ctx, 0x26, (table_pc >> 8) & 0xff, 7);                // ld h,hi
+    render_byte(ctx, 0x7E, 7);                                          // ld a,(hl)
+    render_byte(ctx, 0x2C, 4);                                          // inc l
+  }
+
+  render_byte(ctx, 0x66, 7);                                            // ld h,(hl)
+  render_byte(ctx, 0x6F, 4);                                            // ld l,a
+  render_byte(ctx, 0xE9, 4);                                            // jp (hl)
+
+  if (padding > 0)
+    render_padding(ctx, padding);
+
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, cases->list) {
+    parse_node *target = expr_eval(ctx, (parse_node *)dfirst(dc));
+    int ival = 0;
+
+    if (IS_INT_LITERAL(target)) {
+      ival = ((LITERAL *)target)->ival;
+      register_addr_lookup(ctx, target, section->curr_pc - section->start, 2, false, 0);
+    } else {
+      register_fwd_lookup(ctx, target, section->curr_pc - section->start, 2, false, 0);
+    }
+
+    render_word(ctx, ival);
+  }
+
+  int load_cycles = (reg_code != 7) ? 4 : 0;
+  int cycles = load_cycles + (relocatable ? SWITCH_RELOC_CYCLES : offset_form ? SWITCH_OFFSET_CYCLES : SWITCH_PAGE_CYCLES);
+  int nbytes = section->curr_pc - (code_pc - (reg_code != 7 ? 1 : 0));
+
+  // cp n / jp z,label for every case except the last one which is reached by jp label
+  int chain_max = load_cycles + 17 * (ncases - 1) + 10;
+  int chain_bytes = (reg_code != 7 ? 1 : 0) + 5 * (ncases - 1) + 3;
+
+  char *padding_note = (padding > 0) ? bsprintf(", %d bytes of padding", padding) : xstrdup("");
+
+  report_info("\x1b[96mSwitch\x1b[97m at %s:%d: %d cases, %s table: %d cycles in %d bytes%s (compare chain: %d..%d cycles in %d bytes)",
+    ctx->node->fn, ctx->node->line - 1, ncases, relocatable ? "relocatable" : offset_form ? "in-page" : "page aligned",
+    cycles, nbytes, padding_note,
+    load_cycles + 17, chain_max, chain_bytes);
+  xfree(padding_note);
+}
+
+int codegen_clobber_mask(compile_ctx_t *ctx, LIST *regs)
+{
+  static const struct {
+    const char *name;
+    int mask;
+  } names[] = {
+    { "a", CLOBBER_A }, { "f", CLOBBER_F }, { "b", CLOBBER_B }, { "c", CLOBBER_C },
+    { "d", CLOBBER_D }, { "e", CLOBBER_E }, { "h", CLOBBER_H }, { "l", CLOBBER_L },
+    { "af", CLOBBER_AF }, { "bc", CLOBBER_BC }, { "de", CLOBBER_DE }, { "hl", CLOBBER_HL },
+  };
+
+  dynarray_cell *dc = NULL;
+  int mask = 0;
+
+  foreach(dc, regs->list) {
+    parse_node *reg = expr_eval(ctx, (parse_node *)dfirst(dc));
+    bool found = false;
+
+    if (reg->type != NODE_ID)
+      report_error(ctx, "register name expected in clobber list (got %s)", node_to_string(reg));
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+      if (strcasecmp(((ID *)reg)->name, names[i].name) == 0) {
+        mask |= names[i].mask;
+        found = true;
+        break;
+      }
+    }
+
+    if (!found)
+      report_error(ctx, "unsupported register '%s' in clobber list", ((ID *)reg)->name);
+  }
+
+  return mask;
+}
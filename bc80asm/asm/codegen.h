@@ -0,0 +1,27 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// Register masks for code generators. Bit number is the register opcode field
+// (B=0, C=1, D=2, E=3, H=4, L=5, A=7); bit 6 which stands for (HL) in opcodes
+// is used for flags register.
+#define CLOBBER_B   (1 << 0)
+#define CLOBBER_C   (1 << 1)
+#define CLOBBER_D   (1 << 2)
+#define CLOBBER_E   (1 << 3)
+#define CLOBBER_H   (1 << 4)
+#define CLOBBER_L   (1 << 5)
+#define CLOBBER_F   (1 << 6)
+#define CLOBBER_A   (1 << 7)
+
+#define CLOBBER_BC  (CLOBBER_B | CLOBBER_C)
+#define CLOBBER_DE  (CLOBBER_D | CLOBBER_E)
+#define CLOBBER_HL  (CLOBBER_H | CLOBBER_L)
+#define CLOBBER_AF  (CLOBBER_A | CLOBBER_F)
+
+extern int codegen_clobber_mask(compile_ctx_t *ctx, LIST *regs);
+
+extern void gen_delay(compile_ctx_t *ctx, int cycles, int clobbers);
+extern void gen_fastcopy(compile_ctx_t *ctx, parse_node *src, parse_node *dst, int len, int unroll, int budget);
+extern void gen_fastfill(compile_ctx_t *ctx, parse_node *dst, int len, int value, int unroll, int budget);
+extern void gen_switch(compile_ctx_t *ctx, parse_node *reg, LIST *cases);
@@ -2,8 +2,18 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "asm/analysis.h"
 #include "asm/bc80asm.h"
+#include "asm/codegen.h"
 #include "asm/compile.h"
+#include "asm/gc.h"
+#include "asm/layout.h"
+#include "asm/lint.h"
+#include "asm/listing.h"
+#include "asm/lz.h"
+#include "asm/map.h"
+#include "asm/rst.h"
+#include "asm/strmerge.h"
 #include "asm/render.h"
 #include "asm/symtab.h"
 #include "bits/buffer.h"
@@ -55,9 +65,14 @@ static void compile_equ(compile_ctx_t *ctx, EQU *equ)
   add_sym_variable_node(ctx, equ->name->name, expr_eval(ctx, (parse_node *)equ->value));
 }
 
+static inline bool is_valid_alignment(int align)
+{
+  return align >= 1 && align <= 0x8000 && (align & (align - 1)) == 0;
+}
+
 static void compile_section(compile_ctx_t *ctx, SECTION *section)
 {
-  // syntax: section name [base=addr, fill=val]
+  // syntax: section name [base=addr, fill=val, align=n, pack=bool]
 
   dynarray_cell *dc = NULL;
   section_ctx_t *curr_section = get_current_section(ctx);
@@ -79,8 +94,10 @@ static void compile_section(compile_ctx_t *ctx, SECTION *section)
   }
 
   // section parameters defaults
-  int address = curr_section->curr_pc;  // new section seamless continues the current one
+  int address = -1;                     // new section seamless continues the current one
   uint8_t fill = 0;                     // filler is zero byte
+  int align = 1;                        // no alignment
+  bool pack = false;                    // blocks are placed in source order
 
   if (section->params) {
     foreach(dc, section->params->list) {
@@ -105,6 +122,20 @@ static void compile_section(compile_ctx_t *ctx, SECTION *section)
         if (fill_value->ival & (int)~0xff)
           report_warning(ctx, "cutting down 'fill' parameter value 0x%02x to 0x%02x",
             fill_value->ival, fill);
+      } else if (strcasecmp(equ->name->name, "align") == 0) {
+        LITERAL *align_value = (LITERAL *)expr_eval(ctx, (parse_node *)equ->value);
+        if (!IS_INT_LITERAL(align_value))
+          report_error(ctx, "can't evaluate 'align' parameter as integer value");
+
+        align = align_value->ival;
+        if (!is_valid_alignment(align))
+          report_error(ctx, "'align' parameter value %d must be a power of 2 (1..32768)", align);
+      } else if (strcasecmp(equ->name->name, "pack") == 0) {
+        LITERAL *pack_value = (LITERAL *)expr_eval(ctx, (parse_node *)equ->value);
+        if (!IS_INT_LITERAL(pack_value))
+          report_error(ctx, "can't evaluate 'pack' parameter as integer value");
+
+        pack = (pack_value->ival != 0);
       } else {
         report_warning(ctx, "ignore unknown section parameter '%s'", equ->name->name);
       }
@@ -114,8 +145,16 @@ static void compile_section(compile_ctx_t *ctx, SECTION *section)
   // create a new section
   section_ctx_t *new_sect = (section_ctx_t *)xmalloc(sizeof(section_ctx_t));
 
+  if (address == -1)
+    address = (curr_section->curr_pc + align - 1) & ~(align - 1);
+
   new_sect->start = new_sect->curr_pc = address;
   new_sect->filler = fill;
+  new_sect->align = align;
+  new_sect->padding = 0;
+  new_sect->pack = pack;
+  new_sect->falls_through = false;
+  new_sect->gaps = NULL;
   new_sect->name = xstrdup(name);
   new_sect->content = buffer_init();
 
@@ -129,6 +168,9 @@ static void compile_org(compile_ctx_t *ctx, ORG *org)
 {
   parse_node *org_val = expr_eval(ctx, org->value);
 
+  if (get_current_section(ctx)->pack)
+    report_error(ctx, "ORG isn't allowed in packed section, use ALIGN instead");
+
   if (org_val->type == NODE_LITERAL) {
     LITERAL *l = (LITERAL *)org_val;
     if (l->kind == INT) {
@@ -154,10 +196,42 @@ static void compile_org(compile_ctx_t *ctx, ORG *org)
   }
 }
 
+// DB_LZ: values are packed as a whole, so they must be known here; patching of
+// forward references doesn't work for compressed data
+static void compile_def_lz(compile_ctx_t *ctx, DEF *def)
+{
+  dynarray_cell *def_dc = NULL;
+  buffer *data = buffer_init();
+
+  foreach(def_dc, def->values->list) {
+    LITERAL *l = (LITERAL *)expr_eval(ctx, (parse_node *)dfirst(def_dc));
+
+    if (l->hdr.type != NODE_LITERAL) {
+      buffer_free(data);
+      report_error(ctx, "DB_LZ values must be known at this point, forward references can't be compressed");
+    }
+
+    if (l->kind == INT)
+      buffer_append_char(data, l->ival);
+    else if (l->kind == STR)
+      buffer_append_binary(data, l->strval, strlen(l->strval));
+    else
+      assert(0);
+  }
+
+  render_lz(ctx, "DB_LZ", data->data, data->len);
+  buffer_free(data);
+}
+
 static void compile_def(compile_ctx_t *ctx, DEF *def)
 {
   dynarray_cell *def_dc = NULL;
 
+  if (def->compressed) {
+    compile_def_lz(ctx, def);
+    return;
+  }
+
   if (def->kind == DEFKIND_DS) {
     parse_node *nrep, *filler;
 
@@ -188,13 +262,16 @@ static void compile_def(compile_ctx_t *ctx, DEF *def)
 
     render_block(ctx, fill_ival, ((LITERAL *)nrep)->ival);
 
+    section_ctx_t *section = get_current_section(ctx);
+
+    register_addr_lookup(ctx, filler, section->curr_pc - section->start - ((LITERAL *)nrep)->ival,
+      ((LITERAL *)nrep)->ival, false, 0);
+
     // remember position for further patching in case of unresolved filler identifier
     if (filler->type != NODE_LITERAL) {
-      section_ctx_t *section = get_current_section(ctx);
-
       register_fwd_lookup(ctx,
                            filler,
-                           section->curr_pc - ((LITERAL *)nrep)->ival,
+                           section->curr_pc - section->start - ((LITERAL *)nrep)->ival,
                            ((LITERAL *)nrep)->ival,
                            false,
                            0);
@@ -208,9 +285,13 @@ static void compile_def(compile_ctx_t *ctx, DEF *def)
 
       LITERAL *l;
 
-      if (def_elem->type == NODE_LITERAL)
+      if (def_elem->type == NODE_LITERAL) {
         l = (LITERAL *)def_elem;
-      else if (def_elem->type == NODE_ID) {
+
+        section_ctx_t *section = get_current_section(ctx);
+        register_addr_lookup(ctx, def_elem, section->curr_pc - section->start,
+          (def->kind == DEFKIND_DW) ? 2 : 1, false, 0);
+      } else if (def_elem->type == NODE_ID) {
         l = make_node_internal(LITERAL);
         l->kind = INT;
         l->ival = 0;
@@ -220,7 +301,7 @@ static void compile_def(compile_ctx_t *ctx, DEF *def)
 
         register_fwd_lookup(ctx,
                              def_elem,
-                             section->curr_pc,
+                             section->curr_pc - section->start,
                              (def->kind == DEFKIND_DW) ? 2 : 1,
                              false,
                              0);
@@ -245,12 +326,114 @@ static void compile_def(compile_ctx_t *ctx, DEF *def)
   } // !DEFKIND_DS
 }
 
+static void compile_align(compile_ctx_t *ctx, ALIGN *align)
+{
+  LITERAL *value = (LITERAL *)expr_eval(ctx, (parse_node *)align->value);
+  if (!IS_INT_LITERAL(value))
+    report_error(ctx, "can't evaluate ALIGN argument as integer value");
+
+  if (!is_valid_alignment(value->ival))
+    report_error(ctx, "ALIGN value %d must be a power of 2 (1..32768)", value->ival);
+
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t padding = (value->ival - (section->curr_pc & (value->ival - 1))) & (value->ival - 1);
+
+  render_padding(ctx, padding);
+
+  if ((uint32_t)value->ival > section->align)
+    section->align = value->ival;
+
+  // measure alignment of the next block in packed section
+  if (ctx->align_run_stmt != -1 && (uint32_t)value->ival > ctx->align_run_value)
+    ctx->align_run_value = value->ival;
+}
+
+static void compile_loopbound(compile_ctx_t *ctx, LOOPBOUND *loopbound)
+{
+  LITERAL *count = (LITERAL *)expr_eval(ctx, (parse_node *)loopbound->count);
+  if (!IS_INT_LITERAL(count))
+    report_error(ctx, "can't evaluate LOOPBOUND argument as integer value");
+
+  if (count->ival < 1)
+    report_error(ctx, "LOOPBOUND value %d must be positive", count->ival);
+
+  analysis_bound(ctx, count->ival);
+}
+
+static void compile_keep(compile_ctx_t *ctx, KEEP *keep)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, keep->labels->list) {
+    parse_node *node = (parse_node *)dfirst(dc);
+
+    if (node->type == NODE_EXPR && ((EXPR *)node)->kind == SIMPLE)
+      node = (parse_node *)((EXPR *)node)->left;
+
+    if (node->type != NODE_ID || ((ID *)node)->name[0] == '.')
+      report_error(ctx, "KEEP arguments must be global labels");
+
+    gc_keep(ctx, ((ID *)node)->name);
+  }
+}
+
+static void compile_table(compile_ctx_t *ctx, TABLE *table)
+{
+  LITERAL *count = (LITERAL *)expr_eval(ctx, (parse_node *)table->count);
+  if (!IS_INT_LITERAL(count))
+    report_error(ctx, "can't evaluate TABLE size as integer value");
+
+  if (count->ival < 0)
+    report_error(ctx, "TABLE size %d must not be negative", count->ival);
+
+  ctx->in_table = true;
+
+  for (int i = 0; i < count->ival; i++) {
+    ctx->table_index = i;
+
+    parse_node *value = expr_eval(ctx, (parse_node *)table->value);
+    int ival = 0;
+
+    section_ctx_t *section = get_current_section(ctx);
+
+    if (IS_INT_LITERAL(value)) {
+      ival = ((LITERAL *)value)->ival;
+      register_addr_lookup(ctx, value, section->curr_pc - section->start,
+        (table->kind == DEFKIND_DW) ? 2 : 1, false, 0);
+    } else {
+      // index is already substituted, so the rest could be resolved at 2nd pass
+
+      register_fwd_lookup(ctx,
+                           value,
+                           section->curr_pc - section->start,
+                           (table->kind == DEFKIND_DW) ? 2 : 1,
+                           false,
+                           0);
+    }
+
+    if (table->kind == DEFKIND_DW)
+      render_word(ctx, ival);
+    else
+      render_byte(ctx, ival, 0);
+  }
+
+  ctx->in_table = false;
+}
+
 static void compile_incbin(compile_ctx_t *ctx, INCBIN *incbin)
 {
-  if (incbin->filename->kind == STR)
-    render_from_file(ctx, incbin->filename->strval, g_includeopts);
-  else
+  if (incbin->filename->kind != STR)
     report_error(ctx, "incbin filename must be a string literal");
+
+  if (incbin->compressed) {
+    uint32_t size;
+    char *data = load_from_file(ctx, incbin->filename->strval, &size);
+
+    render_lz(ctx, incbin->filename->strval, data, size);
+    xfree(data);
+  } else {
+    render_from_file(ctx, incbin->filename->strval);
+  }
 }
 
 static void compile_label(compile_ctx_t *ctx, int profile_mode, bool profile_data, LABEL *label)
@@ -293,7 +476,16 @@ static void compile_label(compile_ctx_t *ctx, int profile_mode, bool profile_dat
     xfree(tmp);
   }
 
-  add_sym_variable_integer(ctx, localized_name, section->curr_pc);
+  add_sym_variable_address(ctx, localized_name, section->curr_pc);
+  analysis_label(ctx, localized_name, section->curr_pc);
+
+  if (!label_is_local) {
+    map_label(ctx, localized_name, section->curr_pc, false);
+    gc_label(ctx, label_name);
+  }
+
+  // labels of REPT iterations can't be referenced from other sources
+  render_elf_symbol(ctx, localized_name, section->curr_pc, label_is_local || dynarray_length(ctx->repts) > 0);
 
   xfree(localized_name);
 
@@ -314,6 +506,9 @@ static void compile_instr(compile_ctx_t *ctx, INSTR *instr)
   char *name = name_id->name;
   dynarray *arglist = NULL;
 
+  if (rst_substitute(ctx, instr))
+    return;
+
   // evaluate all instruction arguments
   if (instr->args && instr->args->list) {
     foreach(dc, instr->args->list) {
@@ -419,7 +614,8 @@ static void compile_profile(compile_ctx_t *ctx, int profile_mode, PROFILE *profi
 
 static void compile_endprofile(compile_ctx_t *ctx, int profile_mode, ENDPROFILE *endprofile)
 {
-  if (profile_mode != PROFILE_NONE)
+  // explicit blocks are used only if profiling of labels is off
+  if (profile_mode == PROFILE_NONE)
     profile_end(ctx, false, NULL, true);
 }
 
@@ -460,6 +656,79 @@ static void compile_endif(compile_ctx_t *ctx, ENDIF *node_endif)
   xfree(last_condition_ctx);
 }
 
+static void compile_delay(compile_ctx_t *ctx, DELAY *delay)
+{
+  LITERAL *cycles = (LITERAL *)expr_eval(ctx, (parse_node *)delay->cycles);
+  if (!IS_INT_LITERAL(cycles))
+    report_error(ctx, "can't evaluate DELAY argument as integer value");
+
+  int clobbers = 0;
+  if (delay->clobbers)
+    clobbers = codegen_clobber_mask(ctx, delay->clobbers);
+
+  gen_delay(ctx, cycles->ival, clobbers);
+}
+
+// 'unroll = n' or 'budget = n' option of FASTCOPY and FASTFILL
+static void eval_block_option(compile_ctx_t *ctx, const char *directive, EQU *option, int *unroll, int *budget)
+{
+  if (option == NULL)
+    return;
+
+  LITERAL *l = (LITERAL *)expr_eval(ctx, (parse_node *)option->value);
+  if (!IS_INT_LITERAL(l))
+    report_error(ctx, "can't evaluate %s option '%s' as integer value", directive, option->name->name);
+
+  if (strcasecmp(option->name->name, "unroll") == 0)
+    *unroll = l->ival;
+  else if (strcasecmp(option->name->name, "budget") == 0)
+    *budget = l->ival;
+  else
+    report_error(ctx, "unknown %s option '%s' (must be 'unroll' or 'budget')", directive, option->name->name);
+}
+
+static void compile_fastcopy(compile_ctx_t *ctx, FASTCOPY *copy)
+{
+  LITERAL *len = (LITERAL *)expr_eval(ctx, (parse_node *)copy->len);
+  if (!IS_INT_LITERAL(len))
+    report_error(ctx, "can't evaluate FASTCOPY length as integer value");
+
+  int unroll = 0;
+  if (copy->unroll) {
+    LITERAL *l = (LITERAL *)expr_eval(ctx, (parse_node *)copy->unroll);
+    if (!IS_INT_LITERAL(l))
+      report_error(ctx, "can't evaluate FASTCOPY unroll factor as integer value");
+    unroll = l->ival;
+  }
+
+  int budget = -1;
+  eval_block_option(ctx, "FASTCOPY", copy->option, &unroll, &budget);
+
+  gen_fastcopy(ctx, (parse_node *)copy->src, (parse_node *)copy->dst, len->ival, unroll, budget);
+}
+
+static void compile_fastfill(compile_ctx_t *ctx, FASTFILL *fill)
+{
+  LITERAL *len = (LITERAL *)expr_eval(ctx, (parse_node *)fill->len);
+  if (!IS_INT_LITERAL(len))
+    report_error(ctx, "can't evaluate FASTFILL length as integer value");
+
+  LITERAL *value = (LITERAL *)expr_eval(ctx, (parse_node *)fill->value);
+  if (!IS_INT_LITERAL(value))
+    report_error(ctx, "can't evaluate FASTFILL value as integer value");
+
+  int unroll = 0;
+  int budget = -1;
+  eval_block_option(ctx, "FASTFILL", fill->option, &unroll, &budget);
+
+  gen_fastfill(ctx, (parse_node *)fill->dst, len->ival, value->ival, unroll, budget);
+}
+
+static void compile_switch(compile_ctx_t *ctx, SWITCH *sw)
+{
+  gen_switch(ctx, (parse_node *)sw->reg, sw->cases);
+}
+
 static bool condition_allow(compile_ctx_t *ctx)
 {
   int num_conditions = dynarray_length(ctx->conditions);
@@ -474,122 +743,190 @@ static bool condition_allow(compile_ctx_t *ctx)
   return last_condition_ctx->cond_value;
 }
 
-uint32_t compile(compile_opts opts, hashmap *defineopts, dynarray *statements, char **dest_buf)
+static void compile_pass(compile_ctx_t *ctx, compile_opts opts, hashmap *defineopts, dynarray *statements,
+                         gc_t *gc, rst_plan_t *rst, strmerge_t *strmerge, analysis_t *analysis, lint_t *lint, map_t *map,
+                         listing_t *listing)
 {
   dynarray_cell *dc = NULL;
 
-  compile_ctx_t compile_ctx;
+  memset(ctx, 0, sizeof(*ctx));
 
-  memset(&compile_ctx, 0, sizeof(compile_ctx));
+  ctx->symtab = make_symtab(defineopts);
+  ctx->opts = opts;
 
-  compile_ctx.symtab = make_symtab(defineopts);
-  compile_ctx.opts = opts;
+  ctx->align_run_stmt = -1;
+  ctx->gc = gc;
+  ctx->rst = rst;
+  ctx->strmerge = strmerge;
+  ctx->analysis = analysis;
+  ctx->lint = lint;
+  ctx->map = map;
+  ctx->listing = listing;
 
-  render_start(&compile_ctx);
+  render_start(ctx);
+  rst_start(ctx);
+  strmerge_start(ctx);
+  analysis_start(ctx);
 
   // ==================================================================================================
   // 1st pass: render code itself and collect patches to resolve forward declared constants at 2nd pass
   // ==================================================================================================
 
   foreach(dc, statements) {
+    // routines placed at restart vectors are compiled there instead of their place (see rst.c)
+    int next_stmt = rst_route(ctx, foreach_current_index(dc));
+    if (next_stmt != foreach_current_index(dc)) {
+      foreach_current_index(dc) = next_stmt - 1;
+      continue;
+    }
+
     parse_node *node = (parse_node *)dfirst(dc);
-    compile_ctx.node = node;
+    ctx->node = node;
 
     // if current condition state is false, skip all statement except 'else' of 'endif'
-    if (!condition_allow(&compile_ctx) &&
+    if (!condition_allow(ctx) &&
       !(node->type == NODE_ELSE || node->type == NODE_ENDIF))
     {
       continue;
     }
 
+    // DB/DM statements of string aliased into another one
+    if (strmerge_skip(ctx, foreach_current_index(dc)))
+      continue;
+
+    layout_track(ctx, node, foreach_current_index(dc));
+    gc_track(ctx, node, foreach_current_index(dc));
+
+    uint32_t stmt_pc = get_current_section(ctx)->curr_pc;
+    uint32_t stmt_pos = get_current_section(ctx)->content->len;
+    int stmt_section_id = ctx->curr_section_id;
+    long stmt_start_cycles = ctx->cycles;
+
     switch (node->type) {
       case NODE_EQU:
-        compile_equ(&compile_ctx, (EQU *)node);
+        compile_equ(ctx, (EQU *)node);
         break;
 
       case NODE_SECTION:
-        compile_section(&compile_ctx, (SECTION *)node);
+        compile_section(ctx, (SECTION *)node);
         break;
 
       case NODE_ORG:
-        compile_org(&compile_ctx, (ORG *)node);
+        compile_org(ctx, (ORG *)node);
         break;
 
       case NODE_DEF:
-        compile_def(&compile_ctx, (DEF *)node);
+        compile_def(ctx, (DEF *)node);
         break;
 
       case NODE_INCBIN:
-        compile_incbin(&compile_ctx, (INCBIN *)node);
+        compile_incbin(ctx, (INCBIN *)node);
         break;
 
       case NODE_LABEL:
-        compile_label(&compile_ctx, opts.profile_mode, opts.profile_data, (LABEL *)node);
+        if (!strmerge_label(ctx, statements, foreach_current_index(dc)))
+          compile_label(ctx, opts.profile_mode, opts.profile_data, (LABEL *)node);
         break;
 
-      case NODE_INSTR:
-        compile_instr(&compile_ctx, (INSTR *)node);
+      case NODE_INSTR: {
+        long stmt_cycles = ctx->cycles;
+
+        compile_instr(ctx, (INSTR *)node);
+        lint_instr(ctx, statements, foreach_current_index(dc), stmt_pc,
+          get_current_section(ctx)->curr_pc - stmt_pc, ctx->cycles - stmt_cycles);
         break;
+      }
 
       case NODE_REPT:
-        compile_rept(&compile_ctx, (REPT *)node, foreach_current_index(dc));
+        compile_rept(ctx, (REPT *)node, foreach_current_index(dc));
         break;
 
       case NODE_ENDR:
-        if (compile_endr(&compile_ctx, (ENDR *)node, &foreach_current_index(dc)))
+        if (compile_endr(ctx, (ENDR *)node, &foreach_current_index(dc)))
           continue;
         break;
 
       case NODE_PROFILE:
-        compile_profile(&compile_ctx, opts.profile_mode, (PROFILE *)node);
+        compile_profile(ctx, opts.profile_mode, (PROFILE *)node);
         break;
 
       case NODE_ENDPROFILE:
-        compile_endprofile(&compile_ctx, opts.profile_mode, (ENDPROFILE *)node);
+        compile_endprofile(ctx, opts.profile_mode, (ENDPROFILE *)node);
         break;
 
       case NODE_IF:
-        compile_if(&compile_ctx, (IF *)node);
+        compile_if(ctx, (IF *)node);
         break;
 
       case NODE_ELSE:
-        compile_else(&compile_ctx, (ELSE *)node);
+        compile_else(ctx, (ELSE *)node);
         break;
 
       case NODE_ENDIF:
-        compile_endif(&compile_ctx, (ENDIF *)node);
+        compile_endif(ctx, (ENDIF *)node);
+        break;
+
+      case NODE_DELAY:
+        compile_delay(ctx, (DELAY *)node);
+        break;
+      case NODE_FASTCOPY:
+        compile_fastcopy(ctx, (FASTCOPY *)node);
+        break;
+      case NODE_FASTFILL:
+        compile_fastfill(ctx, (FASTFILL *)node);
+        break;
+      case NODE_SWITCH:
+        compile_switch(ctx, (SWITCH *)node);
+        break;
+      case NODE_TABLE:
+        compile_table(ctx, (TABLE *)node);
+        break;
+      case NODE_ALIGN:
+        compile_align(ctx, (ALIGN *)node);
+        break;
+      case NODE_LOOPBOUND:
+        compile_loopbound(ctx, (LOOPBOUND *)node);
+        break;
+      case NODE_KEEP:
+        compile_keep(ctx, (KEEP *)node);
         break;
       default:
         break;
     }
 
+    rst_track(ctx, node, foreach_current_index(dc), stmt_section_id, stmt_pc);
+    listing_track(ctx, node, stmt_section_id, stmt_pc, stmt_pos, ctx->cycles - stmt_start_cycles);
+
     if (node->type == NODE_END)
       break;
   }
 
+  layout_finish(ctx, dynarray_length(statements));
+  gc_finish(ctx, dynarray_length(statements));
+
   if (opts.profile_mode != PROFILE_NONE) {
     // flush the last profile block if any
-    profile_end(&compile_ctx, true, "EOF", opts.profile_data);
+    profile_end(ctx, true, "EOF", opts.profile_data);
   }
 
-  if (dynarray_length(compile_ctx.repts) > 0) {
-    int saved_line = compile_ctx.node->line;
+  if (dynarray_length(ctx->repts) > 0) {
+    int saved_line = ctx->node->line;
 
-    rept_ctx_t *unterm_rept_ctx = (rept_ctx_t *)dfirst(dynarray_last_cell(compile_ctx.repts));
+    rept_ctx_t *unterm_rept_ctx = (rept_ctx_t *)dfirst(dynarray_last_cell(ctx->repts));
 
-    compile_ctx.node->line = unterm_rept_ctx->rept_node_line;
-    report_error_nopos(&compile_ctx, "unterminated REPT block");
-    compile_ctx.node->line = saved_line;
+    ctx->node->line = unterm_rept_ctx->rept_node_line;
+    report_error_nopos(ctx, "unterminated REPT block");
+    ctx->node->line = saved_line;
   }
 
-  if (dynarray_length(compile_ctx.conditions) > 0) {
-    int saved_line = compile_ctx.node->line;
+  if (dynarray_length(ctx->conditions) > 0) {
+    int saved_line = ctx->node->line;
 
-    condition_ctx_t *unterm_cond_ctx = (condition_ctx_t *)dfirst(dynarray_last_cell(compile_ctx.conditions));
+    condition_ctx_t *unterm_cond_ctx = (condition_ctx_t *)dfirst(dynarray_last_cell(ctx->conditions));
 
-    compile_ctx.node->line = unterm_cond_ctx->if_node_line;
-    report_error_nopos(&compile_ctx, "unterminated IF block");
-    compile_ctx.node->line = saved_line;
+    ctx->node->line = unterm_cond_ctx->if_node_line;
+    report_error_nopos(ctx, "unterminated IF block");
+    ctx->node->line = saved_line;
   }
 
 
@@ -597,39 +934,281 @@ uint32_t compile(compile_opts opts, hashmap *defineopts, dynarray *statements, c
   // 2nd pass: patch code with unresolved constants values as soon as symtab is fully populated now
   // ==================================================================================================
 
-  foreach(dc, compile_ctx.patches) {
+  foreach(dc, ctx->patches) {
     patch_t *patch = (patch_t *)dfirst(dc);
 
-    compile_ctx.lookup_rept_suffix = patch->rept_suffix;
-    parse_node *resolved_node = expr_eval(&compile_ctx, patch->node);
-    compile_ctx.lookup_rept_suffix = NULL;
+    ctx->lookup_rept_suffix = patch->rept_suffix;
+    parse_node *resolved_node = expr_eval(ctx, patch->node);
+    ctx->lookup_rept_suffix = NULL;
+
+    if (resolved_node->type != NODE_LITERAL && opts.target == ASM_TARGET_ELF) {
+      // symbol is defined by another object
+      render_elf_reloc(ctx, patch, resolved_node);
+      continue;
+    }
 
     if (resolved_node->type != NODE_LITERAL) {
-      parse_node *saved_node = compile_ctx.node;
+      parse_node *saved_node = ctx->node;
 
-      compile_ctx.node = resolved_node;
-      report_error(&compile_ctx, "unresolved symbol %s", node_to_string(patch->node));
-      compile_ctx.node = saved_node;
+      ctx->node = resolved_node;
+      report_error(ctx, "unresolved symbol %s", node_to_string(patch->node));
+      ctx->node = saved_node;
     }
 
     LITERAL *l = (LITERAL *)resolved_node;
     if (l->kind != INT)
-      report_error(&compile_ctx, "unexpected literal type at 2nd pass");
+      report_error(ctx, "unexpected literal type at 2nd pass");
 
-    render_patch(&compile_ctx, patch, l->ival);
+    if (opts.target == ASM_TARGET_ELF && (l->section != 0 || patch->relative))
+      render_elf_address(ctx, patch, l);
+
+    render_patch(ctx, patch, l->ival);
   }
 
-  uint32_t dest_size = render_finish(&compile_ctx, dest_buf);
+  rst_finish(ctx);
+  lint_finish(ctx);
+}
 
-  foreach (dc, compile_ctx.sections) {
+static void free_sections(compile_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, ctx->sections) {
     section_ctx_t *section = (section_ctx_t *)dfirst(dc);
 
     xfree(section->name);
     buffer_free(section->content);
+    dynarray_free(section->gaps);
     xfree(section);
   }
 
-  return dest_size;
+  dynarray_free(ctx->sections);
+  ctx->sections = NULL;
+
+  // symbols and relocations refer to sections
+  render_elf_free(ctx);
+}
+
+uint32_t compile(compile_opts opts, hashmap *defineopts, dynarray *statements, char **dest_buf)
+{
+  compile_output_t output = {.target = opts.target};
+
+  compile_outputs(opts, defineopts, statements, &output, 1);
+  *dest_buf = output.data;
+
+  return output.size;
+}
+
+// all outputs are rendered from the same sections, so source is compiled once for all of them
+void compile_outputs(compile_opts opts, hashmap *defineopts, dynarray *statements,
+                     compile_output_t *outputs, int noutputs)
+{
+  compile_ctx_t compile_ctx;
+  dynarray *source_statements = statements;
+  int *source_padding = NULL;
+  int num_source_sections = 0;
+
+  // object keeps symbols defined elsewhere for relocations, snapshot start address is an entry
+  // point for section GC: target of compilation is the one of outputs which needs the most
+  opts.target = ASM_TARGET_RAW;
+
+  for (int i = 0; i < noutputs; i++) {
+    if (outputs[i].target == ASM_TARGET_ELF)
+      opts.target = ASM_TARGET_ELF;
+    else if (outputs[i].target == ASM_TARGET_SNA && opts.target != ASM_TARGET_ELF)
+      opts.target = ASM_TARGET_SNA;
+  }
+
+  // ==================================================================================================
+  // Section GC: measuring pass collects blocks and their references, unreachable ones are removed
+  // from source before layout and the other passes see it
+  // ==================================================================================================
+
+  gc_t gc_data = {0};
+  gc_t *gc = NULL;
+
+  if (opts.gc_sections) {
+    // references from other objects are unknown until link time
+    if (opts.target == ASM_TARGET_ELF)
+      report_error_noloc("--gc-sections can't be used for object target");
+
+    gc = &gc_data;
+    gc->labels = hashmap_create(256, "gc_labels");
+    gc->equ_names = hashmap_create(256, "gc_equs");
+
+    set_error_quiet(true);
+    compile_pass(&compile_ctx, opts, defineopts, statements, gc, NULL, NULL, NULL, NULL, NULL, NULL);
+    set_error_quiet(false);
+
+    dynarray *reduced = gc_plan(&compile_ctx, statements);
+
+    free_sections(&compile_ctx);
+    layout_free(&compile_ctx);
+
+    if (reduced != NULL)
+      statements = reduced;
+  }
+
+  // ==================================================================================================
+  // Layout passes: sources with packed sections are compiled quietly to measure blocks and
+  // reorder them until alignment padding can't be reduced anymore
+  // ==================================================================================================
+
+  if (layout_has_packed_sections(statements)) {
+    set_error_quiet(true);
+
+    for (int layout_pass = 0; layout_pass < LAYOUT_MAX_PASSES; layout_pass++) {
+      compile_pass(&compile_ctx, opts, defineopts, statements, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+      if (layout_pass == 0) {
+        // remember padding of source order to report the difference
+        dynarray_cell *dc = NULL;
+
+        num_source_sections = dynarray_length(compile_ctx.sections);
+        source_padding = (int *)xmalloc(sizeof(int) * num_source_sections);
+
+        foreach (dc, compile_ctx.sections)
+          source_padding[foreach_current_index(dc)] = ((section_ctx_t *)dfirst(dc))->padding;
+      }
+
+      dynarray *reordered = layout_plan(&compile_ctx, statements);
+
+      free_sections(&compile_ctx);
+      layout_free(&compile_ctx);
+
+      if (reordered == NULL)
+        break;
+
+      if (statements != source_statements)
+        dynarray_free(statements);
+      statements = reordered;
+    }
+
+    set_error_quiet(false);
+  }
+
+  // ==================================================================================================
+  // String merging: measuring pass collects labeled DB/DM blocks to alias them into longer ones
+  // ==================================================================================================
+
+  strmerge_t strmerge_data = {0};
+  strmerge_t *strmerge = NULL;
+
+  if (opts.merge_strings) {
+    strmerge = &strmerge_data;
+    strmerge->measure = true;
+
+    set_error_quiet(true);
+    compile_pass(&compile_ctx, opts, defineopts, statements, NULL, NULL, strmerge, NULL, NULL, NULL, NULL);
+    set_error_quiet(false);
+
+    strmerge_plan(strmerge);
+
+    free_sections(&compile_ctx);
+    layout_free(&compile_ctx);
+  }
+
+  // ==================================================================================================
+  // RST substitution: measuring pass counts call sites and finds free restart vectors
+  // ==================================================================================================
+
+  rst_plan_t rst_plan_data = {0};
+  rst_plan_t *rst = NULL;
+
+  if (opts.rst_opt) {
+    rst = &rst_plan_data;
+    rst->calls = hashmap_create(256, "rst_calls");
+    rst->measure = true;
+
+    set_error_quiet(true);
+    compile_pass(&compile_ctx, opts, defineopts, statements, NULL, rst, strmerge, NULL, NULL, NULL, NULL);
+    set_error_quiet(false);
+
+    rst_plan(rst, compile_ctx.sections);
+
+    free_sections(&compile_ctx);
+    layout_free(&compile_ctx);
+  }
+
+  // ==================================================================================================
+  // Final pass: instructions are recorded for code analysis and memory map if they are requested
+  // ==================================================================================================
+
+  analysis_t analysis_data = {0};
+  analysis_t *analysis = NULL;
+
+  if (opts.wcet || opts.latency) {
+    analysis = &analysis_data;
+    analysis->entries = opts.wcet_entries;
+    analysis->isr_entries = opts.latency_entries;
+  }
+
+  lint_t lint_data = {0};
+  lint_t *lint = opts.perf_lint ? &lint_data : NULL;
+
+  map_t map_data = {0};
+  map_t *map = opts.map_file ? &map_data : NULL;
+
+  listing_t listing_data = {0};
+  listing_t *listing = opts.listing ? &listing_data : NULL;
+
+  compile_pass(&compile_ctx, opts, defineopts, statements, NULL, rst, strmerge, analysis, lint, map, listing);
+
+  if (gc)
+    gc_report(gc);
+
+  if (source_padding) {
+    layout_report(&compile_ctx, source_padding, num_source_sections);
+    xfree(source_padding);
+  }
+
+  if (rst)
+    rst_report(&compile_ctx);
+
+  if (strmerge)
+    strmerge_report(&compile_ctx);
+
+  if (analysis)
+    analysis_report(&compile_ctx);
+
+  if (lint)
+    lint_report(&compile_ctx);
+
+  for (int i = 0; i < noutputs; i++)
+    outputs[i].size = render_finish(&compile_ctx, outputs[i].target, &outputs[i].data);
+
+  if (opts.inspect)
+    opts.inspect(&compile_ctx, opts.inspect_data);
+
+  if (map)
+    map_write(&compile_ctx, opts.map_file);
+
+  free_sections(&compile_ctx);
+  layout_free(&compile_ctx);
+
+  if (gc)
+    gc_free(gc);
+
+  if (rst)
+    rst_free(rst);
+
+  if (strmerge)
+    strmerge_free(strmerge);
+
+  if (analysis)
+    analysis_free(analysis);
+
+  if (lint)
+    lint_free(lint);
+
+  if (map)
+    map_free(map);
+
+  if (listing)
+    listing_free(listing);
+
+  if (statements != source_statements)
+    dynarray_free(statements);
 }
 
 void register_fwd_lookup(compile_ctx_t *ctx,
@@ -639,6 +1218,18 @@ void register_fwd_lookup(compile_ctx_t *ctx,
                           bool relative,
                           uint32_t instr_pc)
 {
+  // operand forms tried before the matching one could leave a patch of the same bytes behind
+  while (dynarray_length(ctx->patches) > 0) {
+    patch_t *last = (patch_t *)dlast(ctx->patches);
+
+    if (last->section_id != ctx->curr_section_id || last->pos + last->nbytes <= pos || pos + nbytes <= last->pos)
+      break;
+
+    dynarray_remove_last_cell(ctx->patches);
+    xfree(last->rept_suffix);
+    xfree(last);
+  }
+
   patch_t *patch = (patch_t *)xmalloc(sizeof(patch_t));
 
   if (unresolved_node->type == NODE_ID) {
@@ -675,3 +1266,32 @@ void register_fwd_lookup(compile_ctx_t *ctx,
 
   ctx->patches = dynarray_append_ptr(ctx->patches, patch);
 }
+
+// Object target: address of label written to output is patched at 2nd pass as well as
+// forward reference, so it gets relocation against its section. So does relative jump
+// which isn't within the same section with its target.
+void register_addr_lookup(compile_ctx_t *ctx,
+                          parse_node *value,
+                          uint32_t pos,
+                          int nbytes,
+                          bool relative,
+                          uint32_t instr_pc)
+{
+  if (ctx->opts.target != ASM_TARGET_ELF || !IS_INT_LITERAL(value))
+    return;
+
+  int section = ((LITERAL *)value)->section;
+
+  // number and relative jump within the same section don't depend on placement
+  if (section == 0 ? !relative : (relative && section == ctx->curr_section_id + 1))
+    return;
+
+  if (section == -1)
+    report_error(ctx, "can't relocate %s: only label address plus or minus constant is allowed in object file",
+      node_to_string(ctx->node));
+
+  if (nbytes > 2)
+    report_error(ctx, "can't relocate %s: DS filler can't be address", node_to_string(ctx->node));
+
+  register_fwd_lookup(ctx, value, pos, nbytes, relative, instr_pc);
+}
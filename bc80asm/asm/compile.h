@@ -10,6 +10,13 @@
 typedef struct buffer buffer;
 typedef struct dynarray dynarray;
 typedef struct hashmap hashmap;
+typedef struct rst_plan_t rst_plan_t;
+typedef struct analysis_t analysis_t;
+typedef struct lint_t lint_t;
+typedef struct strmerge_t strmerge_t;
+typedef struct map_t map_t;
+typedef struct gc_t gc_t;
+typedef struct listing_t listing_t;
 
 typedef struct {
   uint32_t start;
@@ -17,6 +24,12 @@ typedef struct {
   buffer *content;
   char *name;
   uint8_t filler;
+  uint32_t align;     // the largest alignment requested for section content
+  uint32_t padding;   // bytes inserted by ALIGN directives
+  bool pack;          // blocks of section could be reordered to reduce padding
+  bool falls_through; // the last rendered instruction could continue to the next one
+  dynarray *gaps;     // offsets and sizes (int pairs) of filler rendered by ORG and ALIGN, sparse
+                      // outputs don't write it
 } section_ctx_t;
 
 typedef struct {
@@ -62,6 +75,45 @@ typedef struct compile_ctx_t {
   bool in_profile;
   profile_data_t current_profile;
   char *current_profile_name;
+
+  // index of TABLE element being evaluated, available in expressions as I
+  bool in_table;
+  int table_index;
+
+  // blocks of packed sections measured for layout planning (see layout.c)
+  dynarray *layout_blocks;
+  int align_run_stmt;       // first statement of ALIGN run preceding a global label or -1
+  uint32_t align_run_pc;    // position before ALIGN run
+  uint32_t align_run_value; // the largest alignment in ALIGN run
+
+  // CALL to RST substitution plan shared between passes (see rst.c), NULL if disabled
+  rst_plan_t *rst;
+
+  // instructions and labels of the final pass for code analysis (see analysis.c), NULL if disabled
+  analysis_t *analysis;
+
+  // T-states of instructions rendered by the pass
+  long cycles;
+
+  // slow idioms found by the final pass (see lint.c), NULL if disabled
+  lint_t *lint;
+
+  // labeled strings aliased into identical or longer ones (see strmerge.c), NULL if disabled
+  strmerge_t *strmerge;
+
+  // global labels and instruction bytes of the final pass for memory map (see map.c), NULL if disabled
+  map_t *map;
+
+  // blocks and their references measured for garbage collection (see gc.c), NULL if disabled
+  gc_t *gc;
+
+  // statements of the final pass with their addresses and sizes (see listing.c), NULL if disabled
+  listing_t *listing;
+
+  // object target only: labels for ELF symbol table and references to symbols which aren't
+  // defined in this source for relocations (see render_elf.c)
+  dynarray *symbols;
+  dynarray *relocs;
 } compile_ctx_t;
 
 typedef struct {
@@ -74,8 +126,34 @@ typedef struct {
   char *rept_suffix;
 } patch_t;
 
+typedef struct {
+  char *name;
+  int section_id;
+  uint32_t addr;
+  bool local;
+} symbol_t;
+
+typedef struct {
+  int section_id;
+  uint32_t pos;       // from section start
+  int nbytes;
+  bool relative;      // JR/DJNZ displacement
+  char *name;         // undefined symbol, NULL for address of this source
+  int target_section; // section of address (relocated against symbol of section), -1 for number
+  int addend;
+} reloc_t;
+
 extern parse_node *expr_eval(compile_ctx_t *ctx, parse_node *node);
+// image rendered from sections of the final pass
+typedef struct {
+  int target;         // one of ASM_TARGET_*
+  char *data;         // xmalloc'ed by compile_outputs()
+  uint32_t size;
+} compile_output_t;
+
 extern uint32_t compile(compile_opts opts, hashmap *defineopts, dynarray *statements, char **dest_buf);
+extern void compile_outputs(compile_opts opts, hashmap *defineopts, dynarray *statements,
+                            compile_output_t *outputs, int noutputs);
 extern void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_args);
 extern void register_fwd_lookup(compile_ctx_t *ctx,
                           parse_node *unresolved_node,
@@ -83,3 +161,9 @@ extern void register_fwd_lookup(compile_ctx_t *ctx,
                           int nbytes,
                           bool relative,
                           uint32_t instr_pc);
+extern void register_addr_lookup(compile_ctx_t *ctx,
+                          parse_node *value,
+                          uint32_t pos,
+                          int nbytes,
+                          bool relative,
+                          uint32_t instr_pc);
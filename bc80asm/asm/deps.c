@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/deps.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+
+// Files read by assembly through read_include(): INCLUDE sources are read once, INCBIN files
+// by every pass, so they are recorded by their resolved paths once. They are dependencies of
+// cached outputs and of depfiles for build systems.
+
+void digest_init(digest_t *digest)
+{
+  sha256_init(digest);
+}
+
+void digest_update(digest_t *digest, const void *data, size_t size)
+{
+  sha256_update(digest, data, size);
+}
+
+// terminating zero is hashed too, so consecutive strings can't shift into each other
+void digest_string(digest_t *digest, const char *str)
+{
+  digest_update(digest, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+void digest_int(digest_t *digest, int64_t value)
+{
+  digest_update(digest, &value, sizeof(value));
+}
+
+// hash of a copy, digest itself could be updated further
+void digest_final(const digest_t *digest, uint8_t *hash)
+{
+  digest_t copy = *digest;
+
+  sha256_final(&copy, hash);
+}
+
+// hex must have room for 2 * DIGEST_SIZE + 1 characters
+void digest_hex(const digest_t *digest, char *hex)
+{
+  uint8_t hash[DIGEST_SIZE];
+
+  digest_final(digest, hash);
+
+  for (int i = 0; i < DIGEST_SIZE; i++)
+    snprintf(hex + 2 * i, 3, "%02x", hash[i]);
+}
+
+deps_t *deps_create()
+{
+  deps_t *deps = (deps_t *)xmalloc(sizeof(deps_t));
+
+  deps->paths = hashmap_create(64, "deps");
+  deps->list = NULL;
+
+  return deps;
+}
+
+static void add_dep(deps_t *deps, dep_t *from)
+{
+  dep_t *dep = (dep_t *)xmalloc(sizeof(dep_t));
+
+  dep->name = xstrdup(from->name);
+  dep->path = xstrdup(from->path);
+  dep->size = from->size;
+  memcpy(dep->hash, from->hash, DIGEST_SIZE);
+
+  hashmap_set(deps->paths, dep->path, dep);
+  deps->list = dynarray_append_ptr(deps->list, dep);
+}
+
+void deps_add(deps_t *deps, const char *name, const char *path, const char *data, uint32_t size)
+{
+  if (hashmap_get(deps->paths, (void *)path) != NULL)
+    return;
+
+  dep_t dep = {.name = (char *)name, .path = (char *)path, .size = size};
+  digest_t digest;
+
+  digest_init(&digest);
+  digest_update(&digest, data, size);
+  digest_final(&digest, dep.hash);
+
+  add_dep(deps, &dep);
+}
+
+void deps_merge(deps_t *deps, deps_t *from)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, from->list) {
+    dep_t *dep = (dep_t *)dfirst(dc);
+
+    if (hashmap_get(deps->paths, dep->path) == NULL)
+      add_dep(deps, dep);
+  }
+}
+
+void deps_free(deps_t *deps)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, deps->list) {
+    dep_t *dep = (dep_t *)dfirst(dc);
+
+    xfree(dep->name);
+    xfree(dep->path);
+    xfree(dep);
+  }
+
+  dynarray_free(deps->list);
+  hashmap_free(deps->paths);
+  xfree(deps);
+}
+
+// file names are escaped for make: spaces and hashes by backslash, dollars by doubling
+static void write_escaped(FILE *f, const char *name)
+{
+  for (const char *p = name; *p; p++) {
+    if (*p == ' ' || *p == '#')
+      fputc('\\', f);
+    else if (*p == '$')
+      fputc('$', f);
+
+    fputc(*p, f);
+  }
+}
+
+// rule for make and ninja: targets depend on input file and every file it has read, phony
+// rules of these files keep make working when any of them is removed
+void deps_write(deps_t *deps, char *depfile, char **targets, int ntargets, char *infile, bool phony)
+{
+  dynarray_cell *dc = NULL;
+  FILE *f = fopen(depfile, "w");
+
+  if (f == NULL)
+    report_error_noloc("%s: can't open for writing", depfile);
+
+  for (int i = 0; i < ntargets; i++) {
+    write_escaped(f, targets[i]);
+    fputs((i < ntargets - 1) ? " " : ": ", f);
+  }
+
+  write_escaped(f, infile);
+
+  foreach (dc, deps->list) {
+    fputs(" \\\n  ", f);
+    write_escaped(f, ((dep_t *)dfirst(dc))->path);
+  }
+
+  fputs("\n", f);
+
+  if (phony) {
+    foreach (dc, deps->list) {
+      fputs("\n", f);
+      write_escaped(f, ((dep_t *)dfirst(dc))->path);
+      fputs(":\n", f);
+    }
+  }
+
+  bool failed = ferror(f);
+
+  if (fclose(f) != 0 || failed)
+    report_error_noloc("%s: can't write", depfile);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bits/sha256.h"
+
+typedef struct dynarray dynarray;
+typedef struct hashmap hashmap;
+
+#define DIGEST_SIZE SHA256_SIZE
+
+// SHA-256 of data hashed so far, hash of it could be taken at any point
+typedef sha256_ctx digest_t;
+
+// INCLUDE or INCBIN file read by assembly
+typedef struct {
+  char *name;                   // filename as written in source
+  char *path;                   // path resolved by fs_abs_path()
+  uint32_t size;
+  uint8_t hash[DIGEST_SIZE];    // of contents which were read
+} dep_t;
+
+typedef struct deps_t {
+  hashmap *paths;               // resolved path -> dep_t
+  dynarray *list;               // dep_t in order of the first reading
+} deps_t;
+
+extern void digest_init(digest_t *digest);
+extern void digest_update(digest_t *digest, const void *data, size_t size);
+extern void digest_string(digest_t *digest, const char *str);
+extern void digest_int(digest_t *digest, int64_t value);
+extern void digest_final(const digest_t *digest, uint8_t *hash);
+extern void digest_hex(const digest_t *digest, char *hex);
+
+extern deps_t *deps_create();
+extern void deps_add(deps_t *deps, const char *name, const char *path, const char *data, uint32_t size);
+extern void deps_merge(deps_t *deps, deps_t *from);
+extern void deps_free(deps_t *deps);
+
+extern void deps_write(deps_t *deps, char *depfile, char **targets, int ntargets, char *infile, bool phony);
@@ -25,6 +25,7 @@ typedef struct {
     uint16_t      e_type;
 
 #define EM_NONE 0
+#define EM_Z80 220
     uint16_t      e_machine;
 
 #define EV_CURRENT 1
@@ -85,3 +86,44 @@ typedef struct {
     uint32_t   sh_addralign;
     uint32_t   sh_entsize;
 } elf_section_header;
+
+#define SHN_UNDEF 0
+#define SHN_ABS 0xfff1
+
+typedef struct {
+    uint32_t   st_name;
+    uint32_t   st_value;
+    uint32_t   st_size;
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+
+#define ELF32_ST_BIND(i) ((i) >> 4)
+#define ELF32_ST_TYPE(i) ((i) & 0xf)
+#define ELF32_ST_INFO(b, t) (((b) << 4) + ((t) & 0xf))
+    uint8_t    st_info;
+    uint8_t    st_other;
+    uint16_t   st_shndx;
+} elf_symbol;
+
+// relocation types as defined for Z80 by binutils
+#define R_Z80_NONE 0
+#define R_Z80_8 1
+#define R_Z80_8_DIS 2
+#define R_Z80_8_PCREL 3
+#define R_Z80_16 4
+
+typedef struct {
+    uint32_t   r_offset;
+
+#define ELF32_R_SYM(i) ((i) >> 8)
+#define ELF32_R_TYPE(i) ((uint8_t)(i))
+#define ELF32_R_INFO(s, t) (((s) << 8) + (uint8_t)(t))
+    uint32_t   r_info;
+    int32_t    r_addend;
+} elf_rela;
@@ -1,10 +1,13 @@
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #include "asm/compile.h"
+#include "asm/gc.h"
 #include "asm/parse.h"
 #include "asm/render.h"
 #include "bits/buffer.h"
+#include "bits/dynarray.h"
 #include "bits/hashmap.h"
 
 static parse_node *eval_literal(compile_ctx_t *ctx, parse_node *node)
@@ -14,12 +17,18 @@ static parse_node *eval_literal(compile_ctx_t *ctx, parse_node *node)
   LITERAL *l = (LITERAL *)node;
 
   // replace DOLLAR-kind literal with current position value
-  // everywhere but not in EQU statements
+  // everywhere but not in EQU statements (source node is kept intact
+  // because the same statement could be compiled at another position)
   if (ctx->node->type != NODE_EQU && l->kind == DOLLAR) {
     section_ctx_t *section = get_current_section(ctx);
+    LITERAL *pos = make_node_internal(LITERAL);
 
-    l->ival = section->curr_pc;
-    l->kind = INT;
+    pos->hdr.is_ref = l->hdr.is_ref;
+    pos->kind = INT;
+    pos->ival = section->curr_pc;
+    pos->section = ctx->curr_section_id + 1;
+
+    return (parse_node *)pos;
   }
 
   // replace single char string value with ASCII code (integer)
@@ -62,6 +71,35 @@ make_int_literal(int value, bool is_ref)
   return (parse_node *)l;
 }
 
+static inline int
+get_literal_section(parse_node *l)
+{
+  return (l != NULL) ? ((LITERAL *)l)->section : 0;
+}
+
+// label address plus or minus number stays address, difference of addresses in the same
+// section is number, anything else computed from addresses can't be relocated
+static int result_section(EXPR *expr, parse_node *arg1, parse_node *arg2)
+{
+  int s1 = get_literal_section(arg1);
+  int s2 = get_literal_section(arg2);
+
+  if (s1 == 0 && s2 == 0)
+    return 0;
+
+  if (expr->kind == BINARY_PLUS && (s1 == 0 || s2 == 0))
+    return s1 + s2;
+
+  if (expr->kind == BINARY_MINUS && s2 == 0)
+    return s1;
+
+  // placement of section doesn't change distances between its addresses
+  if (s1 == s2 && s1 > 0 && (expr->kind == BINARY_MINUS || expr->kind >= COND_EQ))
+    return 0;
+
+  return -1;
+}
+
 static inline int
 get_int_literal_value(parse_node *l)
 {
@@ -71,6 +109,157 @@ get_int_literal_value(parse_node *l)
   return ((LITERAL *)l)->ival;
 }
 
+// ==================================================================================================
+// Builtin functions for table generators. Results are rounded to nearest integer,
+// fixed-point scaling is specified by explicit multiplier argument.
+// ==================================================================================================
+
+typedef int (*builtin_fn)(compile_ctx_t *ctx, int *args, int nargs);
+
+// sin(x, period, amplitude): amplitude * sin(2 * pi * x / period)
+static int builtin_sin(compile_ctx_t *ctx, int *args, int nargs)
+{
+  if (args[1] == 0)
+    report_error(ctx, "sin() period must not be zero");
+
+  return (int)lround(args[2] * sin(2.0 * M_PI * args[0] / args[1]));
+}
+
+// cos(x, period, amplitude): amplitude * cos(2 * pi * x / period)
+static int builtin_cos(compile_ctx_t *ctx, int *args, int nargs)
+{
+  if (args[1] == 0)
+    report_error(ctx, "cos() period must not be zero");
+
+  return (int)lround(args[2] * cos(2.0 * M_PI * args[0] / args[1]));
+}
+
+// sqrt(x[, scale]): square root of x multiplied by scale
+static int builtin_sqrt(compile_ctx_t *ctx, int *args, int nargs)
+{
+  if (args[0] < 0)
+    report_error(ctx, "sqrt() argument %d must not be negative", args[0]);
+
+  return (int)lround(sqrt((double)args[0]) * ((nargs > 1) ? args[1] : 1));
+}
+
+// log2(x[, scale]): binary logarithm of x multiplied by scale
+static int builtin_log2(compile_ctx_t *ctx, int *args, int nargs)
+{
+  if (args[0] <= 0)
+    report_error(ctx, "log2() argument %d must be positive", args[0]);
+
+  return (int)lround(log2((double)args[0]) * ((nargs > 1) ? args[1] : 1));
+}
+
+static int builtin_abs(compile_ctx_t *ctx, int *args, int nargs)
+{
+  return (args[0] < 0) ? -args[0] : args[0];
+}
+
+static int builtin_min(compile_ctx_t *ctx, int *args, int nargs)
+{
+  return (args[0] < args[1]) ? args[0] : args[1];
+}
+
+static int builtin_max(compile_ctx_t *ctx, int *args, int nargs)
+{
+  return (args[0] > args[1]) ? args[0] : args[1];
+}
+
+// bitrev(x, bits): reverse order of lower 'bits' bits of x
+static int builtin_bitrev(compile_ctx_t *ctx, int *args, int nargs)
+{
+  if (args[1] < 1 || args[1] > 16)
+    report_error(ctx, "bitrev() width %d is out of range 1..16", args[1]);
+
+  int result = 0;
+  for (int i = 0; i < args[1]; i++)
+    result |= ((args[0] >> i) & 1) << (args[1] - 1 - i);
+
+  return result;
+}
+
+static const struct {
+  const char *name;
+  int min_args;
+  int max_args;
+  builtin_fn fn;
+} builtins[] = {
+  { "sin",    3, 3, builtin_sin },
+  { "cos",    3, 3, builtin_cos },
+  { "sqrt",   1, 2, builtin_sqrt },
+  { "log2",   1, 2, builtin_log2 },
+  { "abs",    1, 1, builtin_abs },
+  { "min",    2, 2, builtin_min },
+  { "max",    2, 2, builtin_max },
+  { "bitrev", 2, 2, builtin_bitrev },
+};
+
+#define MAX_BUILTIN_ARGS 3
+
+static parse_node *eval_func(compile_ctx_t *ctx, FUNC *func)
+{
+  int builtin_idx = -1;
+
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+    if (strcasecmp(func->name->name, builtins[i].name) == 0) {
+      builtin_idx = (int)i;
+      break;
+    }
+  }
+
+  if (builtin_idx == -1)
+    report_error(ctx, "unknown function %s()", func->name->name);
+
+  int nargs = dynarray_length(func->args->list);
+  if (nargs < builtins[builtin_idx].min_args || nargs > builtins[builtin_idx].max_args)
+    report_error(ctx, "wrong number of arguments for %s(): %d", func->name->name, nargs);
+
+  LIST *args = make_node_internal(LIST);
+  dynarray_cell *dc = NULL;
+  int ivals[MAX_BUILTIN_ARGS];
+  bool can_eval_to_literal = true;
+
+  args->list = NULL;
+
+  foreach(dc, func->args->list) {
+    parse_node *arg = expr_eval(ctx, (parse_node *)dfirst(dc));
+
+    if (IS_INT_LITERAL(arg))
+      ivals[foreach_current_index(dc)] = get_int_literal_value(arg);
+    else
+      can_eval_to_literal = false;
+
+    args->list = dynarray_append_ptr(args->list, arg);
+  }
+
+  if (!can_eval_to_literal) {
+    // return function call copy with evaluated arguments to be resolved later
+    FUNC *result = make_node_internal(FUNC);
+
+    result->hdr.line = func->hdr.line;
+    result->hdr.pos = func->hdr.pos;
+    result->hdr.fn = func->hdr.fn;
+    result->hdr.is_ref = func->hdr.is_ref;
+    result->name = func->name;
+    result->args = args;
+
+    return (parse_node *)result;
+  }
+
+  ctx->was_literal_evals = true;
+
+  LITERAL *result = (LITERAL *)make_int_literal(builtins[builtin_idx].fn(ctx, ivals, nargs), func->hdr.is_ref);
+
+  foreach(dc, args->list) {
+    if (get_literal_section((parse_node *)dfirst(dc)) != 0)
+      result->section = -1;
+  }
+
+  return (parse_node *)result;
+}
+
 // evaluate source expression to its simplest form
 parse_node *expr_eval(compile_ctx_t *ctx, parse_node *node)
 {
@@ -80,6 +269,13 @@ parse_node *expr_eval(compile_ctx_t *ctx, parse_node *node)
   // try to resolve (replace to literal) identifier via symtab
   if (node->type == NODE_ID) {
     ID *id = (ID *)node;
+
+    // element index inside of TABLE generator
+    if (ctx->in_table && strcasecmp(id->name, "i") == 0)
+      return make_int_literal(ctx->table_index, id->hdr.is_ref);
+
+    gc_reference(ctx, id->name);
+
     parse_node *nval = hashmap_get(ctx->symtab, id->name);
     if (nval) {
       if (nval->type == NODE_LITERAL)
@@ -100,6 +296,9 @@ parse_node *expr_eval(compile_ctx_t *ctx, parse_node *node)
     }
   }
 
+  if (node->type == NODE_FUNC)
+    return eval_func(ctx, (FUNC *)node);
+
   // can't to evaluate node: leave it as is
   if (node->type != NODE_EXPR)
     return node;
@@ -148,94 +347,113 @@ parse_node *expr_eval(compile_ctx_t *ctx, parse_node *node)
 
   switch (expr->kind) {
     case UNARY_MINUS:
-      return make_int_literal(-1 * get_int_literal_value(arg1), expr->hdr.is_ref);
+      result = make_int_literal(-1 * get_int_literal_value(arg1), expr->hdr.is_ref);
+      break;
 
     case UNARY_INV:
-      return make_int_literal(~get_int_literal_value(arg1), expr->hdr.is_ref);
+      result = make_int_literal(~get_int_literal_value(arg1), expr->hdr.is_ref);
+      break;
 
     case UNARY_NOT:
-      return make_int_literal(!get_int_literal_value(arg1), expr->hdr.is_ref);
+      result = make_int_literal(!get_int_literal_value(arg1), expr->hdr.is_ref);
+      break;
 
     case BINARY_PLUS:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) + get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_MINUS:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) - get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_MUL:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) * get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_DIV:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) / get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_AND:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) & get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_OR:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) | get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_MOD:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) % get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_SHL:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) << get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case BINARY_SHR:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) >> get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_EQ:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) == get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_NE:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) != get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_LT:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) < get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_LE:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) <= get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_GT:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) > get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     case COND_GE:
-      return make_int_literal(
+      result = make_int_literal(
         get_int_literal_value(arg1) >= get_int_literal_value(arg2),
         expr->hdr.is_ref);
+      break;
 
     default:
-      break;
+      // unreachable
+      abort();
   }
 
-  // unreachable
-  abort();
-  return NULL;
+  ((LITERAL *)result)->section = result_section(expr, arg1, arg2);
+
+  return result;
 }
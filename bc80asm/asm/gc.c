@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/gc.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+
+// Garbage collection of unreferenced blocks (--gc-sections). Blocks are started by global
+// labels at top level together with ALIGN directives immediately preceding them, like blocks
+// of packed sections, and end at the next block, SECTION or ORG. Statements in front of the
+// first label of section or ORG are always kept.
+//
+// Measuring pass records names referenced by statements of every block (forward references
+// included, they are looked up at the 1st pass as well). Names referenced by EQU are followed
+// through to the labels they depend on, names referenced by statements which are never removed
+// (SECTION, ORG, IF, REPT, ...) are roots. Other roots are blocks at reset, restart and NMI
+// vectors, at the lowest section address and at --sna-pc, and KEEP labels. Block which doesn't
+// end with JP, JR, RET, RETI, RETN or JP (rr) could continue into the next block, so it keeps
+// that block as well.
+//
+// Unreached blocks are removed from source before layout and the other passes: their labels,
+// instructions and data go away, EQU and structural statements stay. Addresses are taken by
+// labels only: code reached through a computed or literal address must be marked with KEEP.
+
+// reset, restart vectors and NMI handler
+static const uint32_t vectors[] = {0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0x66};
+
+static inline bool is_removable(parse_type type)
+{
+  switch (type) {
+    case NODE_LABEL:
+    case NODE_INSTR:
+    case NODE_DEF:
+    case NODE_INCBIN:
+    case NODE_TABLE:
+    case NODE_ALIGN:
+    case NODE_DELAY:
+    case NODE_FASTCOPY:
+    case NODE_FASTFILL:
+    case NODE_SWITCH:
+    case NODE_LOOPBOUND:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static gc_block_t *open_block(gc_t *gc)
+{
+  if (dynarray_length(gc->blocks) == 0)
+    return NULL;
+
+  gc_block_t *block = (gc_block_t *)dlast(gc->blocks);
+  return (block->end_stmt == -1) ? block : NULL;
+}
+
+static void new_block(compile_ctx_t *ctx, char *name, int stmt_idx, uint32_t pre_pc)
+{
+  gc_t *gc = ctx->gc;
+  gc_block_t *block = (gc_block_t *)xmalloc(sizeof(gc_block_t));
+
+  memset(block, 0, sizeof(gc_block_t));
+  block->name = name ? xstrdup(name) : NULL;
+  block->index = dynarray_length(gc->blocks);
+  block->section_id = ctx->curr_section_id;
+  block->first_stmt = stmt_idx;
+  block->end_stmt = -1;
+  block->pre_pc = pre_pc;
+  block->start_pc = get_current_section(ctx)->curr_pc;
+  block->stop_pc = (uint32_t)-1;
+
+  gc->blocks = dynarray_append_ptr(gc->blocks, block);
+}
+
+static void close_block(compile_ctx_t *ctx, gc_block_t *block, int stmt_idx, uint32_t pc)
+{
+  // statements in front of the first label belong to the section they switch to
+  block->section_id = ctx->curr_section_id;
+  block->end_stmt = stmt_idx;
+  block->end_pc = pc;
+  block->falls_through = (block->stop_pc != pc);
+}
+
+void gc_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx)
+{
+  gc_t *gc = ctx->gc;
+
+  if (gc == NULL)
+    return;
+
+  section_ctx_t *section = get_current_section(ctx);
+
+  if (dynarray_length(gc->blocks) == 0) {
+    gc->align_run_stmt = -1;
+    new_block(ctx, NULL, stmt_idx, section->curr_pc);
+  }
+
+  gc_block_t *block = open_block(gc);
+  gc->stmt = node;
+
+  if (node->type == NODE_SECTION || node->type == NODE_ORG || node->type == NODE_END) {
+    close_block(ctx, block, stmt_idx, section->curr_pc);
+    new_block(ctx, NULL, stmt_idx, section->curr_pc);
+    gc->align_run_stmt = -1;
+    return;
+  }
+
+  // blocks are split only by top level labels
+  if (dynarray_length(ctx->repts) > 0 || dynarray_length(ctx->conditions) > 0)
+    return;
+
+  if (node->type == NODE_ALIGN) {
+    if (gc->align_run_stmt == -1) {
+      gc->align_run_stmt = stmt_idx;
+      gc->align_run_pc = section->curr_pc;
+    }
+    return;
+  }
+
+  if (node->type != NODE_LABEL || ((LABEL *)node)->name->name[0] == '.') {
+    gc->align_run_stmt = -1;
+    return;
+  }
+
+  int first_stmt = (gc->align_run_stmt != -1) ? gc->align_run_stmt : stmt_idx;
+  uint32_t pre_pc = (gc->align_run_stmt != -1) ? gc->align_run_pc : section->curr_pc;
+
+  close_block(ctx, block, first_stmt, pre_pc);
+  new_block(ctx, ((LABEL *)node)->name->name, first_stmt, pre_pc);
+  gc->align_run_stmt = -1;
+}
+
+void gc_finish(compile_ctx_t *ctx, int stmt_idx)
+{
+  gc_t *gc = ctx->gc;
+
+  if (gc == NULL)
+    return;
+
+  gc_block_t *block = open_block(gc);
+
+  if (block)
+    close_block(ctx, block, stmt_idx, get_current_section(ctx)->curr_pc);
+
+  // lookups of patches at the 2nd pass are recorded by the 1st one already
+  gc->stmt = NULL;
+}
+
+void gc_code(compile_ctx_t *ctx, int size, int cycles)
+{
+  gc_t *gc = ctx->gc;
+
+  if (gc == NULL)
+    return;
+
+  gc_block_t *block = open_block(gc);
+
+  if (block == NULL)
+    return;
+
+  section_ctx_t *section = get_current_section(ctx);
+  uint8_t *op = (uint8_t *)section->content->data + section->content->len - size;
+
+  // jp nn, jr e, ret, jp (hl), jp (ix), jp (iy), retn, reti
+  if (op[0] == 0xC3 || op[0] == 0x18 || op[0] == 0xC9 || op[0] == 0xE9 ||
+    (size == 2 && (op[0] == 0xDD || op[0] == 0xFD) && op[1] == 0xE9) ||
+    (size == 2 && op[0] == 0xED && (op[1] == 0x45 || op[1] == 0x4D)))
+  {
+    block->stop_pc = section->curr_pc;
+  }
+}
+
+void gc_label(compile_ctx_t *ctx, const char *name)
+{
+  gc_t *gc = ctx->gc;
+
+  if (gc == NULL)
+    return;
+
+  gc_block_t *block = open_block(gc);
+
+  if (block != NULL && hashmap_get(gc->labels, (void *)name) == NULL)
+    hashmap_set(gc->labels, (void *)name, block);
+}
+
+static dynarray *add_ref(dynarray *refs, char *name)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, refs) {
+    if (strcmp((char *)dfirst(dc), name) == 0) {
+      xfree(name);
+      return refs;
+    }
+  }
+
+  return dynarray_append_ptr(refs, name);
+}
+
+void gc_reference(compile_ctx_t *ctx, const char *name)
+{
+  gc_t *gc = ctx->gc;
+
+  // local labels are referenced from their own block
+  if (gc == NULL || gc->stmt == NULL || name[0] == '.')
+    return;
+
+  // local and REPT labels belong to block of their global label
+  char *global = xstrdup(name);
+  global[strcspn(global + 1, ".#") + 1] = '\0';
+
+  if (gc->stmt->type == NODE_EQU) {
+    char *equ_name = ((EQU *)gc->stmt)->name->name;
+    gc_equ_t *equ = (gc_equ_t *)hashmap_get(gc->equ_names, equ_name);
+
+    if (equ == NULL) {
+      equ = (gc_equ_t *)xmalloc(sizeof(gc_equ_t));
+      equ->name = xstrdup(equ_name);
+      equ->refs = NULL;
+
+      gc->equs = dynarray_append_ptr(gc->equs, equ);
+      hashmap_set(gc->equ_names, equ_name, equ);
+    }
+
+    equ->refs = add_ref(equ->refs, global);
+  } else if (is_removable(gc->stmt->type)) {
+    gc_block_t *block = open_block(gc);
+    block->refs = add_ref(block->refs, global);
+  } else {
+    gc->root_refs = add_ref(gc->root_refs, global);
+  }
+}
+
+void gc_keep(compile_ctx_t *ctx, const char *name)
+{
+  gc_t *gc = ctx->gc;
+
+  if (gc != NULL)
+    gc->keep = dynarray_append_ptr(gc->keep, xstrdup(name));
+}
+
+static void reach_block(gc_block_t *block, dynarray **stack)
+{
+  if (block->reached)
+    return;
+
+  block->reached = true;
+  *stack = dynarray_append_ptr(*stack, block);
+}
+
+static void reach_name(gc_t *gc, const char *name, hashmap *followed, dynarray **stack)
+{
+  gc_block_t *block = (gc_block_t *)hashmap_get(gc->labels, (void *)name);
+
+  if (block != NULL) {
+    reach_block(block, stack);
+    return;
+  }
+
+  gc_equ_t *equ = (gc_equ_t *)hashmap_get(gc->equ_names, (void *)name);
+  dynarray_cell *dc = NULL;
+
+  if (equ == NULL || hashmap_get(followed, (void *)name) != NULL)
+    return;
+
+  hashmap_set(followed, (void *)name, XMMGR_DUMMY_PTR);
+
+  foreach (dc, equ->refs)
+    reach_name(gc, (char *)dfirst(dc), followed, stack);
+}
+
+static void reach_address(gc_t *gc, uint32_t addr, dynarray **stack)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, gc->blocks) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+
+    if (block->name != NULL && block->start_pc <= addr && (addr < block->end_pc || addr == block->start_pc))
+      reach_block(block, stack);
+  }
+}
+
+// returns statements without unreached blocks or NULL if every block is reached
+dynarray *gc_plan(compile_ctx_t *ctx, dynarray *statements)
+{
+  gc_t *gc = ctx->gc;
+  dynarray *stack = NULL;
+  hashmap *followed = hashmap_create(256, "gc_followed");
+  dynarray_cell *dc = NULL;
+  uint32_t lowest_start = (uint32_t)-1;
+
+  // entry points
+
+  foreach (dc, gc->blocks) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+
+    if (block->name == NULL)
+      reach_block(block, &stack);
+  }
+
+  for (int i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    reach_address(gc, vectors[i], &stack);
+
+  foreach (dc, ctx->sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+
+    if (section->content->len > 0 && section->start < lowest_start)
+      lowest_start = section->start;
+  }
+
+  reach_address(gc, lowest_start, &stack);
+
+  if (ctx->opts.target == ASM_TARGET_SNA && ctx->opts.sna_pc_addr != -1)
+    reach_address(gc, ctx->opts.sna_pc_addr, &stack);
+
+  foreach (dc, gc->keep) {
+    char *name = (char *)dfirst(dc);
+
+    if (hashmap_get(gc->labels, name) == NULL)
+      report_error_noloc("KEEP label '%s' isn't defined", name);
+
+    reach_name(gc, name, followed, &stack);
+  }
+
+  foreach (dc, gc->root_refs)
+    reach_name(gc, (char *)dfirst(dc), followed, &stack);
+
+  // references and fall through into the next block
+
+  while (dynarray_length(stack) > 0) {
+    gc_block_t *block = (gc_block_t *)dlast(stack);
+    dynarray_remove_last_cell(stack);
+
+    foreach (dc, block->refs)
+      reach_name(gc, (char *)dfirst(dc), followed, &stack);
+
+    if (block->falls_through && block->index + 1 < dynarray_length(gc->blocks)) {
+      gc_block_t *next = (gc_block_t *)dfirst(dynarray_nth_cell(gc->blocks, block->index + 1));
+
+      if (next->section_id == block->section_id && next->first_stmt == block->end_stmt)
+        reach_block(next, &stack);
+    }
+  }
+
+  dynarray_free(stack);
+  hashmap_free(followed);
+
+  // remove statements of unreached blocks
+
+  int nstatements = dynarray_length(statements);
+  bool *removed = (bool *)xmalloc(sizeof(bool) * (nstatements + 1));
+
+  memset(removed, 0, sizeof(bool) * (nstatements + 1));
+
+  foreach (dc, gc->blocks) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+
+    if (block->reached)
+      continue;
+
+    for (int i = block->first_stmt; i < block->end_stmt; i++)
+      removed[i] = is_removable(((parse_node *)dfirst(dynarray_nth_cell(statements, i)))->type);
+
+    gc->removed = dynarray_append_ptr(gc->removed, block);
+  }
+
+  dynarray *kept = NULL;
+
+  if (gc->removed != NULL) {
+    foreach (dc, statements) {
+      if (!removed[foreach_current_index(dc)])
+        kept = dynarray_append_ptr(kept, dfirst(dc));
+    }
+  }
+
+  xfree(removed);
+
+  return kept;
+}
+
+void gc_report(gc_t *gc)
+{
+  dynarray_cell *dc = NULL;
+  int nblocks = 0;
+  uint32_t reclaimed = 0;
+
+  foreach (dc, gc->blocks) {
+    if (((gc_block_t *)dfirst(dc))->name != NULL)
+      nblocks++;
+  }
+
+  foreach (dc, gc->removed) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+    reclaimed += block->end_pc - block->pre_pc;
+  }
+
+  report_info("\x1b[96mSection GC\x1b[97m: %d of %d blocks removed, %u bytes reclaimed",
+    dynarray_length(gc->removed), nblocks, reclaimed);
+
+  foreach (dc, gc->removed) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+    report_info("  %s (%u bytes)", block->name, block->end_pc - block->pre_pc);
+  }
+}
+
+void gc_free(gc_t *gc)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, gc->blocks) {
+    gc_block_t *block = (gc_block_t *)dfirst(dc);
+
+    xfree(block->name);
+    dynarray_free_deep(block->refs);
+    xfree(block);
+  }
+
+  foreach (dc, gc->equs) {
+    gc_equ_t *equ = (gc_equ_t *)dfirst(dc);
+
+    xfree(equ->name);
+    dynarray_free_deep(equ->refs);
+    xfree(equ);
+  }
+
+  dynarray_free(gc->blocks);
+  dynarray_free(gc->equs);
+  dynarray_free(gc->removed);
+  dynarray_free_deep(gc->root_refs);
+  dynarray_free_deep(gc->keep);
+  hashmap_free(gc->labels);
+  hashmap_free(gc->equ_names);
+
+  memset(gc, 0, sizeof(*gc));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "asm/compile.h"
+
+typedef struct {
+  char *name;                   // global label, NULL for statements in front of the first one
+  int index;
+  int section_id;
+  int first_stmt;               // the first statement of block (including leading ALIGN directives)
+  int end_stmt;                 // statement next to the last one (-1 for still open block)
+  uint32_t pre_pc;              // position before leading alignment padding
+  uint32_t start_pc;            // position of block's global label
+  uint32_t end_pc;
+  uint32_t stop_pc;             // end of the last JP, JR, RET, RETI, RETN or JP (rr) of block
+  bool falls_through;           // execution or data could continue into the next block
+  dynarray *refs;               // names referenced by statements of block
+  bool reached;
+} gc_block_t;
+
+typedef struct {
+  char *name;
+  dynarray *refs;               // names referenced by EQU value
+} gc_equ_t;
+
+typedef struct gc_t {
+  dynarray *blocks;             // gc_block_t in source order
+  hashmap *labels;              // global label name -> gc_block_t
+  dynarray *equs;               // gc_equ_t
+  hashmap *equ_names;           // EQU name -> gc_equ_t
+  dynarray *root_refs;          // names referenced by statements which are never removed
+  dynarray *keep;               // names of KEEP directives
+  parse_node *stmt;             // statement being compiled, NULL after the 1st pass
+  int align_run_stmt;           // first statement of ALIGN run in front of a global label or -1
+  uint32_t align_run_pc;
+  dynarray *removed;            // gc_block_t removed by plan
+} gc_t;
+
+extern void gc_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx);
+extern void gc_finish(compile_ctx_t *ctx, int stmt_idx);
+extern void gc_code(compile_ctx_t *ctx, int size, int cycles);
+extern void gc_label(compile_ctx_t *ctx, const char *name);
+extern void gc_reference(compile_ctx_t *ctx, const char *name);
+extern void gc_keep(compile_ctx_t *ctx, const char *name);
+extern dynarray *gc_plan(compile_ctx_t *ctx, dynarray *statements);
+extern void gc_report(gc_t *gc);
+extern void gc_free(gc_t *gc);
@@ -269,6 +269,10 @@ static bool try_get_arg_8imm(compile_ctx_t *ctx, parse_node *node, int *ival, bo
     if (l->kind == INT) {
       *ival = l->ival;
       *is_ref = l->hdr.is_ref;
+
+      if (imm_pos != -1)
+        register_addr_lookup(ctx, node, imm_pos, 1, false, 0);
+
       return true;
     }
   } else if ((imm_pos != -1) && !contains_reserved_ids(node)) {
@@ -298,6 +302,10 @@ static bool try_get_arg_16imm(compile_ctx_t *ctx,
       *orig_val = l->ival;
       *lsb = l->ival & 0xFF;
       *msb = (l->ival >> 8) & 0xFF;
+
+      if (imm_pos != -1)
+        register_addr_lookup(ctx, node, imm_pos, 2, false, 0);
+
       return true;
     }
   } else if ((imm_pos != -1) && !contains_reserved_ids(node)) {
@@ -418,8 +426,12 @@ static bool try_get_arg_reladdr(compile_ctx_t *ctx, parse_node *node, int *relad
     if (l->kind == INT) {
       int addr = l->ival;
       *reladdr = addr - section->curr_pc - JUMP_REL_INSTR_SIZE;
-      if ((*reladdr >= -128) && (*reladdr <= 127))
+      if ((*reladdr >= -128) && (*reladdr <= 127)) {
+        if (imm_pos != -1)
+          register_addr_lookup(ctx, node, imm_pos, 1, true, section->curr_pc + JUMP_REL_INSTR_SIZE);
+
         return true;
+      }
     }
   } else if ((imm_pos != -1) && !contains_reserved_ids(node)) {
     // will patch operand position with literal value at 2nd pass
@@ -528,12 +540,12 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
       if (try_get_arg_accum(arg1)) {
         if (try_get_arg_gpr8(arg2, &opc, &is_ref) && !is_ref)
           render_byte(ctx, 0x88 | opc, 4);
-        else if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc + 2) && !is_ref) {
+        else if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc - section->start + 1) && !is_ref) {
           check_integer_overflow(ctx, opc, 1);
           render_2bytes(ctx, 0xCE, opc, 7);
         } else if (try_get_arg_hl(arg2, &is_ref) && is_ref)
           render_byte(ctx, 0x8E, 7);
-        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc + 2)) {
+        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc - section->start + 2)) {
           check_integer_overflow(ctx, opc2, 1);
           render_3bytes(ctx, 0xDD | (opc << 5), 0x8E, opc2, 19);
         } else if (try_get_arg_ixy_half(arg2, &opc, &opc2))
@@ -559,12 +571,12 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
       if (try_get_arg_accum(arg1)) {
         if (try_get_arg_gpr8(arg2, &opc, &is_ref) && !is_ref)
           render_byte(ctx, 0x80 | opc, 4);
-        else if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc + 2) && !is_ref) {
+        else if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc - section->start + 1) && !is_ref) {
           check_integer_overflow(ctx, opc, 1);
           render_2bytes(ctx, 0xC6, opc, 7);
         } else if (try_get_arg_hl(arg2, &is_ref) && is_ref)
           render_byte(ctx, 0x86, 7);
-        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc + 2)) {
+        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc - section->start + 2)) {
           check_integer_overflow(ctx, opc2, 1);
           render_3bytes(ctx, 0xDD | (opc << 5), 0x86, opc2, 19);
         } else if (try_get_arg_ixy_half(arg2, &opc, &opc2))
@@ -593,12 +605,12 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
 
       if (try_get_arg_gpr8(arg1, &opc, &is_ref) && !is_ref)
         render_byte(ctx, 0xA0 | opc, 4);
-      else if (try_get_arg_8imm(ctx, arg1, &opc, &is_ref, section->curr_pc + 2) && !is_ref) {
+      else if (try_get_arg_8imm(ctx, arg1, &opc, &is_ref, section->curr_pc - section->start + 1) && !is_ref) {
         check_integer_overflow(ctx, opc, 1);
         render_2bytes(ctx, 0xE6, opc, 7);
       } else if (try_get_arg_hl(arg1, &is_ref) && is_ref)
         render_byte(ctx, 0xA6, 7);
-      else if (try_get_arg_index_offset8(ctx, arg1, &opc, &opc2, section->curr_pc + 2))
+      else if (try_get_arg_index_offset8(ctx, arg1, &opc, &opc2, section->curr_pc - section->start + 2))
         render_3bytes(ctx, 0xDD | (opc << 5), 0xA6, opc2, 19);
       else if (try_get_arg_ixy_half(arg1, &opc, &opc2))
         render_2bytes(ctx, opc, 0xA0 | opc2, 8);
@@ -620,7 +632,7 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
           render_2bytes(ctx, 0xCB, 0x40 | (b << 3) | opc, 8);
         else if (try_get_arg_hl(arg2, &is_ref) && is_ref)
           render_2bytes(ctx, 0xCB, 0x46 | (b << 3), 12);
-        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc + 2))
+        else if (try_get_arg_index_offset8(ctx, arg2, &opc, &opc2, section->curr_pc - section->start + 2))
           render_4bytes(ctx, 0xDD | (opc << 5), 0xCB, opc2, 0x46 | (b << 3), 20);
         else
           ERR_UNEXPECTED_ARGUMENT(2);
@@ -674,7 +686,7 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
 
       if (try_get_arg_gpr8(arg1, &opc, &is_ref) && !is_ref)
         render_byte(ctx, 0xB8 | opc, 4);
-      else if (try_get_arg_8imm(ctx, arg1, &opc, &is_ref, section->curr_pc - section->start + 2) && !is_ref) {
+      else if (try_get_arg_8imm(ctx, arg1, &opc, &is_ref, section->curr_pc - section->start + 1) && !is_ref) {
         check_integer_overflow(ctx, opc, 1);
         render_2bytes(ctx, 0xFE, opc, 7);
       } else if (try_get_arg_hl(arg1, &is_ref) && is_ref)
@@ -726,7 +738,7 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
         render_byte(ctx, 0x05 | (opc << 3), 4);
       else if (try_get_arg_hl(arg1, &is_ref) && is_ref)
         render_byte(ctx, 0x35, 11);
-      else if (try_get_arg_index_offset8(ctx, arg1, &opc, &opc2, section->curr_pc + 2))
+      else if (try_get_arg_index_offset8(ctx, arg1, &opc, &opc2, section->curr_pc - section->start + 2))
         render_3bytes(ctx, 0xDD | (opc << 5), 0x35, opc2, 23);
       else if (try_get_arg_qreg16(arg1, &opc2, &is_ref) && !is_ref)
         render_byte(ctx, 0x0B | (opc2 << 4), 6);
@@ -823,7 +835,7 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
       check_arg_presence(ctx, arg2, 2);
 
       if (try_get_arg_accum(arg1)) {
-        if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc - section->start + 2) && is_ref) {
+        if (try_get_arg_8imm(ctx, arg2, &opc, &is_ref, section->curr_pc - section->start + 1) && is_ref) {
           check_integer_overflow(ctx, opc, 1);
           render_2bytes(ctx, 0xDB, opc, 11);
         } else if (try_get_arg_gpr8(arg2, &opc2, &is_ref) && is_ref && (opc2 == REG_C))
@@ -981,7 +993,7 @@ void compile_instruction_impl(compile_ctx_t *ctx, char *name, dynarray *instr_ar
           render_2bytes(ctx, 0xED, 0x5F, 9);
         else if (try_get_arg_gpr8(arg2, &opc2, &is_ref) && !is_ref)
           render_byte(ctx, 0x40 | (opc << 3) | opc2, 4);
-        else if (try_get_arg_8imm(ctx, arg2, &opc2, &is_ref, section->curr_pc - section->start + 2) && !is_ref) {
+        else if (try_get_arg_8imm(ctx, arg2, &opc2, &is_ref, section->curr_pc - section->start + 1) && !is_ref) {
           check_integer_overflow(ctx, opc2, 1);
           render_2bytes(ctx, 0x06 | (opc << 3), opc2, 7);
         } else if (try_get_arg_hl(arg2, &is_ref) && is_ref)
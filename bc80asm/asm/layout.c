@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/layout.h"
+#include "asm/render.h"
+#include "bits/dynarray.h"
+
+// Packed sections (SECTION name pack=1) consist of blocks started by global labels
+// together with ALIGN directives immediately preceding them. Statements before the
+// first block and the first block itself keep their position, the rest of blocks
+// could be placed in any order. Label following code which could continue into it
+// (anything but unconditional JP, JR, RET and HALT) doesn't start a new block, so
+// fall through is kept, or it's an error if ALIGN is in between.
+//
+// Every layout pass compiles source as is and measures blocks, then the planner
+// reorders statements of blocks to fill gaps in front of aligned blocks with
+// unaligned ones. Final pass just compiles the reordered statements, so labels,
+// forward references and ALIGN padding are always consistent with output.
+
+static inline uint32_t align_up(uint32_t pc, uint32_t align)
+{
+  return (pc + align - 1) & ~(align - 1);
+}
+
+static inline uint32_t block_size(layout_block_t *block)
+{
+  return block->end_pc - block->start_pc;
+}
+
+bool layout_has_packed_sections(dynarray *statements)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach(dc, statements) {
+    parse_node *node = (parse_node *)dfirst(dc);
+    dynarray_cell *pc = NULL;
+
+    if (node->type != NODE_SECTION || ((SECTION *)node)->params == NULL)
+      continue;
+
+    foreach(pc, ((SECTION *)node)->params->list) {
+      EQU *equ = (EQU *)dfirst(pc);
+
+      if (strcasecmp(equ->name->name, "pack") == 0)
+        return true;
+    }
+  }
+
+  return false;
+}
+
+static layout_block_t *open_block(compile_ctx_t *ctx)
+{
+  if (dynarray_length(ctx->layout_blocks) == 0)
+    return NULL;
+
+  layout_block_t *block = (layout_block_t *)dlast(ctx->layout_blocks);
+  return (block->end_stmt == -1) ? block : NULL;
+}
+
+static void close_block(compile_ctx_t *ctx, layout_block_t *block, int stmt_idx, uint32_t pc)
+{
+  block->end_stmt = stmt_idx;
+  block->end_pc = pc;
+}
+
+void layout_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx)
+{
+  section_ctx_t *section = get_current_section(ctx);
+
+  if (node->type == NODE_END ||
+    (node->type == NODE_SECTION && strcmp(((SECTION *)node)->name->strval, section->name) != 0))
+  {
+    layout_finish(ctx, stmt_idx);
+    return;
+  }
+
+  // blocks are split only by top level labels
+  if (!section->pack || dynarray_length(ctx->repts) > 0 || dynarray_length(ctx->conditions) > 0)
+    return;
+
+  if (node->type == NODE_ALIGN) {
+    if (ctx->align_run_stmt == -1) {
+      ctx->align_run_stmt = stmt_idx;
+      ctx->align_run_pc = section->curr_pc;
+      ctx->align_run_value = 1;
+    }
+    return;
+  }
+
+  if (node->type != NODE_LABEL || ((LABEL *)node)->name->name[0] == '.') {
+    ctx->align_run_stmt = -1;
+    return;
+  }
+
+  layout_block_t *prev = open_block(ctx);
+
+  // code continuing into the label keeps it in the block of preceding one
+  if (prev && section->falls_through) {
+    if (ctx->align_run_stmt != -1) {
+      report_error(ctx, "code in packed section falls through ALIGN into %s (end it with JP, JR, RET or HALT)",
+        ((LABEL *)node)->name->name);
+    }
+
+    return;
+  }
+
+  // global label: start a new block including ALIGN run in front of it
+  layout_block_t *block = (layout_block_t *)xmalloc(sizeof(layout_block_t));
+
+  block->section_id = ctx->curr_section_id;
+  block->end_stmt = -1;
+  block->start_pc = block->end_pc = section->curr_pc;
+
+  if (ctx->align_run_stmt != -1) {
+    block->first_stmt = ctx->align_run_stmt;
+    block->pre_pc = ctx->align_run_pc;
+    block->align = ctx->align_run_value;
+  } else {
+    block->first_stmt = stmt_idx;
+    block->pre_pc = section->curr_pc;
+    block->align = 1;
+  }
+
+  if (prev)
+    close_block(ctx, prev, block->first_stmt, block->pre_pc);
+
+  ctx->layout_blocks = dynarray_append_ptr(ctx->layout_blocks, block);
+  ctx->align_run_stmt = -1;
+
+  // empty block continues into the next one
+  section->falls_through = true;
+}
+
+void layout_finish(compile_ctx_t *ctx, int stmt_idx)
+{
+  layout_block_t *block = open_block(ctx);
+
+  if (block) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, block->section_id));
+    close_block(ctx, block, stmt_idx, section->curr_pc);
+  }
+
+  ctx->align_run_stmt = -1;
+}
+
+// choose subset of unaligned blocks which fills 'gap' bytes as much as possible
+static uint32_t fill_gap(layout_block_t **blocks, int nblocks, bool *placed, int *order, int *norder, uint32_t gap)
+{
+  int *from = (int *)xmalloc(sizeof(int) * (gap + 1));
+
+  // from[s]: the last block of subset with total size 's' (-1 if there is no such subset)
+  for (uint32_t s = 0; s <= gap; s++)
+    from[s] = -1;
+  from[0] = nblocks;
+
+  for (int i = 0; i < nblocks; i++) {
+    uint32_t size = block_size(blocks[i]);
+
+    if (placed[i] || blocks[i]->align > 1 || size == 0 || size > gap)
+      continue;
+
+    for (uint32_t s = gap; s >= size; s--) {
+      if (from[s] == -1 && from[s - size] != -1)
+        from[s] = i;
+    }
+  }
+
+  uint32_t best = gap;
+  while (from[best] == -1)
+    best--;
+
+  bool *chosen = (bool *)xmalloc(sizeof(bool) * nblocks);
+  memset(chosen, 0, sizeof(bool) * nblocks);
+
+  for (uint32_t s = best; s > 0; s -= block_size(blocks[from[s]]))
+    chosen[from[s]] = true;
+
+  // keep source order of chosen blocks, empty ones could go anywhere
+  for (int i = 0; i < nblocks; i++) {
+    if (!placed[i] && (chosen[i] || (blocks[i]->align == 1 && block_size(blocks[i]) == 0))) {
+      placed[i] = true;
+      order[(*norder)++] = i;
+    }
+  }
+
+  xfree(chosen);
+  xfree(from);
+
+  return best;
+}
+
+// returns true if the planned order differs from the current one
+static bool plan_section(layout_block_t **blocks, int nblocks, int *order)
+{
+  bool *placed = (bool *)xmalloc(sizeof(bool) * nblocks);
+  int norder = 0;
+
+  memset(placed, 0, sizeof(bool) * nblocks);
+
+  // the first block stays in place
+  uint32_t pc = align_up(blocks[0]->pre_pc, blocks[0]->align) + block_size(blocks[0]);
+  placed[0] = true;
+  order[norder++] = 0;
+
+  while (norder < nblocks) {
+    int best = -1;
+
+    // the most constrained block which doesn't need padding at current position
+    for (int i = 0; i < nblocks; i++) {
+      if (placed[i] || blocks[i]->align == 1 || (pc & (blocks[i]->align - 1)) != 0)
+        continue;
+
+      if (best == -1 || blocks[i]->align > blocks[best]->align ||
+        (blocks[i]->align == blocks[best]->align && block_size(blocks[i]) > block_size(blocks[best])))
+      {
+        best = i;
+      }
+    }
+
+    if (best != -1) {
+      placed[best] = true;
+      order[norder++] = best;
+      pc += block_size(blocks[best]);
+      continue;
+    }
+
+    // otherwise the nearest alignment boundary
+    uint32_t best_gap = 0;
+
+    for (int i = 0; i < nblocks; i++) {
+      if (placed[i] || blocks[i]->align == 1)
+        continue;
+
+      uint32_t gap = align_up(pc, blocks[i]->align) - pc;
+
+      if (best == -1 || gap < best_gap || (gap == best_gap && blocks[i]->align > blocks[best]->align)) {
+        best = i;
+        best_gap = gap;
+      }
+    }
+
+    if (best == -1) {
+      // only unaligned blocks left
+      for (int i = 0; i < nblocks; i++) {
+        if (!placed[i]) {
+          placed[i] = true;
+          order[norder++] = i;
+        }
+      }
+      break;
+    }
+
+    pc += fill_gap(blocks, nblocks, placed, order, &norder, best_gap);
+
+    placed[best] = true;
+    order[norder++] = best;
+    pc = align_up(pc, blocks[best]->align) + block_size(blocks[best]);
+  }
+
+  xfree(placed);
+
+  for (int i = 0; i < nblocks; i++) {
+    if (order[i] != i)
+      return true;
+  }
+
+  return false;
+}
+
+static dynarray *append_statements(dynarray *dest, dynarray *statements, int first, int end)
+{
+  for (int i = first; i < end; i++)
+    dest = dynarray_append_ptr(dest, dfirst(dynarray_nth_cell(statements, i)));
+
+  return dest;
+}
+
+dynarray *layout_plan(compile_ctx_t *ctx, dynarray *statements)
+{
+  int nblocks = dynarray_length(ctx->layout_blocks);
+
+  if (nblocks == 0)
+    return NULL;
+
+  layout_block_t **blocks = (layout_block_t **)xmalloc(sizeof(layout_block_t *) * nblocks);
+  int *order = (int *)xmalloc(sizeof(int) * nblocks);
+  dynarray *result = NULL;
+  bool changed = false;
+  int cursor = 0;
+
+  for (int i = 0; i < nblocks; i++)
+    blocks[i] = (layout_block_t *)dfirst(dynarray_nth_cell(ctx->layout_blocks, i));
+
+  // blocks of every section go one by one without gaps between them
+  for (int first = 0, last; first < nblocks; first = last) {
+    for (last = first + 1; last < nblocks; last++) {
+      if (blocks[last]->section_id != blocks[first]->section_id)
+        break;
+    }
+
+    result = append_statements(result, statements, cursor, blocks[first]->first_stmt);
+
+    if (plan_section(blocks + first, last - first, order))
+      changed = true;
+
+    for (int i = 0; i < last - first; i++) {
+      layout_block_t *block = blocks[first + order[i]];
+      result = append_statements(result, statements, block->first_stmt, block->end_stmt);
+    }
+
+    cursor = blocks[last - 1]->end_stmt;
+  }
+
+  result = append_statements(result, statements, cursor, dynarray_length(statements));
+
+  xfree(order);
+  xfree(blocks);
+
+  if (!changed) {
+    dynarray_free(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+void layout_report(compile_ctx_t *ctx, int *source_padding, int num_source_sections)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, ctx->sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+    int section_id = foreach_current_index(dc);
+    dynarray_cell *bc = NULL;
+    int nblocks = 0;
+
+    if (!section->pack || section_id >= num_source_sections)
+      continue;
+
+    foreach (bc, ctx->layout_blocks) {
+      if (((layout_block_t *)dfirst(bc))->section_id == section_id)
+        nblocks++;
+    }
+
+    report_info("\x1b[96mPacked section\x1b[97m '%s': %d blocks, %d bytes of alignment padding (%d in source order)",
+      section->name, nblocks, section->padding, source_padding[section_id]);
+  }
+}
+
+void layout_free(compile_ctx_t *ctx)
+{
+  dynarray_free_deep(ctx->layout_blocks);
+  ctx->layout_blocks = NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// maximal number of quiet compilation passes to find the final layout
+#define LAYOUT_MAX_PASSES 4
+
+typedef struct {
+  int section_id;
+  int first_stmt;       // the first statement of block (including leading ALIGN directives)
+  int end_stmt;         // statement next to the last one (-1 for still open block)
+  uint32_t pre_pc;      // position before leading alignment padding
+  uint32_t start_pc;    // position of block's global label
+  uint32_t end_pc;
+  uint32_t align;
+} layout_block_t;
+
+extern bool layout_has_packed_sections(dynarray *statements);
+extern void layout_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx);
+extern void layout_finish(compile_ctx_t *ctx, int stmt_idx);
+extern dynarray *layout_plan(compile_ctx_t *ctx, dynarray *statements);
+extern void layout_report(compile_ctx_t *ctx, int *source_padding, int num_source_sections);
+extern void layout_free(compile_ctx_t *ctx);
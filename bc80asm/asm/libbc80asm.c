@@ -0,0 +1,263 @@
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/bc80asm.h"
+#include "asm/compile.h"
+#include "asm/libbc80asm.h"
+#include "asm/parse.h"
+#include "asm/snafmt.h"
+#include "bits/buffer.h"
+#include "bits/common.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+
+// Assembly runs like a job of bc80asm with its own error context: errors longjmp back into
+// bc80asm_assemble() and messages are collected by error handler. Unless the calling thread
+// tracks allocations already, memory of assembly is tracked for the call only and everything
+// left after it is released by mmgr. So results are allocated by malloc() to outlive it.
+
+typedef struct {
+  const bc80asm_options *opts;
+  bc80asm_result *result;
+  int diagnostics_capacity;
+} lib_job_t;
+
+static char *lib_strdup(const char *str)
+{
+  return (str != NULL) ? strdup(str) : NULL;
+}
+
+static void collect_message(void *data, int kind, const char *filename, int line, int pos, const char *msg)
+{
+  lib_job_t *job = (lib_job_t *)data;
+  bc80asm_result *result = job->result;
+
+  if (result->ndiagnostics == job->diagnostics_capacity) {
+    job->diagnostics_capacity = job->diagnostics_capacity ? job->diagnostics_capacity * 2 : 8;
+    result->diagnostics = (bc80asm_diagnostic *)realloc(result->diagnostics,
+      sizeof(bc80asm_diagnostic) * job->diagnostics_capacity);
+  }
+
+  bc80asm_diagnostic *diag = &result->diagnostics[result->ndiagnostics++];
+
+  diag->kind = (kind == MESSAGE_ERROR) ? BC80ASM_ERROR :
+               (kind == MESSAGE_WARNING) ? BC80ASM_WARNING :
+               BC80ASM_INFO;
+  diag->filename = lib_strdup(filename);
+  diag->line = line;
+  diag->pos = pos;
+  diag->message = lib_strdup(msg);
+}
+
+static char *read_resolved(void *data, char *filename, uint32_t *size)
+{
+  lib_job_t *job = (lib_job_t *)data;
+  size_t len;
+
+  if (job->opts->resolver == NULL)
+    return NULL;
+
+  void *contents = job->opts->resolver(job->opts->resolver_data, filename, &len);
+  if (contents == NULL)
+    return NULL;
+
+  char *buf = (char *)xmalloc(len + 1);
+  memcpy(buf, contents, len);
+  buf[len] = '\0';
+  free(contents);
+
+  *size = len;
+  return buf;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+  return strcmp(((const bc80asm_symbol *)a)->name, ((const bc80asm_symbol *)b)->name);
+}
+
+// sections and symbols of the final pass
+static void collect_output(compile_ctx_t *ctx, void *data)
+{
+  lib_job_t *job = (lib_job_t *)data;
+  bc80asm_result *result = job->result;
+  dynarray_cell *dc = NULL;
+
+  result->sections = (bc80asm_section *)calloc(dynarray_length(ctx->sections) + 1, sizeof(bc80asm_section));
+
+  foreach (dc, ctx->sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+    bc80asm_section *out = &result->sections[result->nsections++];
+
+    out->name = lib_strdup(section->name);
+    out->start = section->start;
+    out->size = section->content->len;
+    out->data = (uint8_t *)malloc(out->size + 1);
+    memcpy(out->data, section->content->data, out->size);
+  }
+
+  hashmap_scan *scan = hashmap_scan_init(ctx->symtab);
+  hashmap_entry *entry = NULL;
+  int capacity = 0;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    LITERAL *value = (LITERAL *)entry->value;
+
+    if (!IS_INT_LITERAL(value))
+      continue;
+
+    if (result->nsymbols == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      result->symbols = (bc80asm_symbol *)realloc(result->symbols, sizeof(bc80asm_symbol) * capacity);
+    }
+
+    result->symbols[result->nsymbols].name = lib_strdup((char *)entry->key);
+    result->symbols[result->nsymbols].value = value->ival;
+    result->nsymbols++;
+  }
+
+  if (result->nsymbols > 0)
+    qsort(result->symbols, result->nsymbols, sizeof(bc80asm_symbol), compare_symbols);
+}
+
+static void assemble(lib_job_t *job, const char *filename, const char *source, size_t size)
+{
+  const bc80asm_options *opts = job->opts;
+  compile_opts copts = {0};
+  hashmap *defineopts = hashmap_create(128, "defineopts");
+  dynarray *statements = NULL;
+  char *dest_buf = NULL;
+
+  switch (opts->target) {
+    case BC80ASM_TARGET_RAW:
+      copts.target = ASM_TARGET_RAW;
+      break;
+    case BC80ASM_TARGET_OBJECT:
+      copts.target = ASM_TARGET_ELF;
+      break;
+    case BC80ASM_TARGET_SNA:
+      copts.target = ASM_TARGET_SNA;
+      break;
+    case BC80ASM_TARGET_HEX:
+      copts.target = ASM_TARGET_HEX;
+      break;
+    case BC80ASM_TARGET_RANGES:
+      copts.target = ASM_TARGET_RANGES;
+      break;
+    default:
+      report_error_noloc("unknown target %d", opts->target);
+  }
+
+  copts.sna_generic = opts->sna_generic;
+  copts.sna_pc_addr = opts->sna_pc_addr;
+  copts.sna_ramtop = opts->sna_ramtop;
+  copts.gap_threshold = opts->gap_threshold;
+  copts.rst_opt = opts->rst_opt;
+  copts.merge_strings = opts->merge_strings;
+  copts.gc_sections = opts->gc_sections;
+
+  if (copts.sna_ramtop == -1)
+    copts.sna_ramtop = copts.sna_generic ? SNA_DEFAULT_RAMTOP : ZX_DEFAULT_RAMTOP;
+
+  for (int i = 0; opts->defines != NULL && opts->defines[i] != NULL; i++) {
+    dynarray *kvparts = split_string_sep((char *)opts->defines[i], '=', true);
+
+    hashmap_set(defineopts, dinitial(kvparts),
+      (dynarray_length(kvparts) == 1) ? xstrdup("") : xstrdup(dsecond(kvparts)));
+    dynarray_free_deep(kvparts);
+  }
+
+  copts.include_reader = read_resolved;
+  copts.include_reader_data = job;
+  copts.inspect = collect_output;
+  copts.inspect_data = job;
+
+  // source isn't required to be zero terminated
+  char *fn = xstrdup(filename);
+  char *text = (char *)xmalloc(size + 1);
+
+  memcpy(text, source, size);
+  text[size] = '\0';
+
+  if (parse_source(fn, text, &copts, &statements) != 0)
+    report_error_noloc("parse %s error", fn);
+
+  uint32_t dest_size = compile(copts, defineopts, statements, &dest_buf);
+
+  job->result->image = (uint8_t *)malloc(dest_size + 1);
+  job->result->image_size = dest_size;
+  memcpy(job->result->image, dest_buf, dest_size);
+  job->result->ok = true;
+
+  xfree(dest_buf);
+  xfree(text);
+  hashmap_free(defineopts);
+}
+
+void bc80asm_options_init(bc80asm_options *opts)
+{
+  memset(opts, 0, sizeof(bc80asm_options));
+  opts->sna_pc_addr = -1;
+  opts->sna_ramtop = -1;
+  opts->gap_threshold = -1;
+}
+
+bc80asm_result *bc80asm_assemble(const char *filename, const char *source, size_t size,
+                                 const bc80asm_options *opts)
+{
+  bc80asm_result *result = (bc80asm_result *)calloc(1, sizeof(bc80asm_result));
+  lib_job_t job = {.opts = opts, .result = result};
+  bool own_mmgr = !mmgr_active();
+  jmp_buf error_env;
+
+  if (own_mmgr)
+    mmgr_init();
+
+  error_handler prev_handler;
+  void *prev_handler_data;
+
+  get_error_handler(&prev_handler, &prev_handler_data);
+
+  jmp_buf *prev_env = set_error_context(&error_env);
+  set_error_handler(collect_message, &job);
+
+  if (setjmp(error_env) == 0)
+    assemble(&job, filename, source, size);
+
+  // error could interrupt quiet pass
+  set_error_quiet(false);
+  set_error_handler(prev_handler, prev_handler_data);
+  set_error_context(prev_env);
+
+  if (own_mmgr)
+    mmgr_finish(false);
+
+  return result;
+}
+
+void bc80asm_result_free(bc80asm_result *result)
+{
+  if (result == NULL)
+    return;
+
+  for (int i = 0; i < result->nsections; i++) {
+    free(result->sections[i].name);
+    free(result->sections[i].data);
+  }
+
+  for (int i = 0; i < result->nsymbols; i++)
+    free(result->symbols[i].name);
+
+  for (int i = 0; i < result->ndiagnostics; i++) {
+    free(result->diagnostics[i].filename);
+    free(result->diagnostics[i].message);
+  }
+
+  free(result->image);
+  free(result->sections);
+  free(result->symbols);
+  free(result->diagnostics);
+  free(result);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// In-memory assembler API. Sources are assembled from memory buffers, INCLUDE and INCBIN
+// files are read by resolver callback only, results are returned as plain structures.
+// The library doesn't touch file system, doesn't print anything and never exits: errors
+// are returned as diagnostics. Calls from different threads are independent.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  BC80ASM_TARGET_RAW = 0,
+  BC80ASM_TARGET_OBJECT,
+  BC80ASM_TARGET_SNA,
+  BC80ASM_TARGET_HEX,
+  BC80ASM_TARGET_RANGES,
+};
+
+enum {
+  BC80ASM_ERROR = 0,
+  BC80ASM_WARNING,
+  BC80ASM_INFO,
+};
+
+// returns contents of INCLUDE or INCBIN file allocated by malloc() (library frees it),
+// or NULL if file isn't found
+typedef void *(*bc80asm_resolver)(void *data, const char *filename, size_t *size);
+
+typedef struct {
+  int target;                         // image format: one of BC80ASM_TARGET_*
+  const char **defines;               // NULL terminated list of "key" or "key=value" (may be NULL)
+  bc80asm_resolver resolver;          // NULL if sources don't include other files
+  void *resolver_data;
+
+  bool sna_generic;                   // see options of bc80asm with the same names
+  int sna_pc_addr;                    // -1 for the lowest section address
+  int sna_ramtop;                     // -1 for default of device
+  int gap_threshold;                  // -1 for break-even size of hex or ranges format
+  bool rst_opt;
+  bool merge_strings;
+  bool gc_sections;
+} bc80asm_options;
+
+typedef struct {
+  char *name;
+  uint32_t start;
+  uint32_t size;
+  uint8_t *data;
+} bc80asm_section;
+
+typedef struct {
+  char *name;                         // labels of REPT iterations are suffixed as 'name#n'
+  int32_t value;
+} bc80asm_symbol;
+
+typedef struct {
+  int kind;                           // one of BC80ASM_ERROR, BC80ASM_WARNING, BC80ASM_INFO
+  char *filename;                     // NULL if message isn't related to source
+  int line;                           // zero if not known
+  int pos;
+  char *message;
+} bc80asm_diagnostic;
+
+typedef struct {
+  bool ok;                            // false if assembly failed, see diagnostics
+  uint8_t *image;                     // rendered target (NULL if assembly failed)
+  uint32_t image_size;
+  bc80asm_section *sections;          // in order of definition
+  int nsections;
+  bc80asm_symbol *symbols;            // integer symbols sorted by name
+  int nsymbols;
+  bc80asm_diagnostic *diagnostics;    // in order of reporting
+  int ndiagnostics;
+} bc80asm_result;
+
+// fill options with defaults
+extern void bc80asm_options_init(bc80asm_options *opts);
+
+// assemble source of given size, filename is used by diagnostics. Result is never NULL
+// and must be freed by bc80asm_result_free()
+extern bc80asm_result *bc80asm_assemble(const char *filename, const char *source, size_t size,
+                                        const bc80asm_options *opts);
+
+extern void bc80asm_result_free(bc80asm_result *result);
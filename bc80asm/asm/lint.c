@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/analysis.h"
+#include "asm/lint.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+
+// Performance lint (--perf-lint): instructions of the final pass are checked for slow
+// idioms. Both the instruction and its replacement are measured with the assembler's
+// own tables: the original one while it's rendered, the replacement by rendering it
+// and dropping the output. Replacements changing flags are suggested only if flags are
+// overwritten by the following straight-line code before they are read. Findings in
+// PROFILE blocks (or blocks of --profile) are hot and ranked first.
+
+enum {
+  FLAGS_READ_C   = 1 << 0,
+  FLAGS_READ_Z   = 1 << 1,
+  FLAGS_READ_S   = 1 << 2,
+  FLAGS_READ_PV  = 1 << 3,
+  FLAGS_READ_ALL = 0x0f,    // unknown code follows
+};
+
+typedef struct {
+  char *fn;
+  int line;
+  char *block;              // PROFILE block or NULL
+  char *text;
+  char *note;               // condition of replacement or NULL
+  int bytes;                // replacement's delta
+  int cycles;
+} lint_finding_t;
+
+typedef struct {
+  parse_node *target;
+  uint32_t pc;
+  lint_finding_t *finding;
+} lint_near_jump_t;
+
+typedef struct {
+  int bytes;
+  int cycles;
+} lint_cost_t;
+
+static inline bool is_name(const char *name, const char *expected)
+{
+  return strcasecmp(name, expected) == 0;
+}
+
+// parser wraps identifiers into simple expressions
+static parse_node *unwrap(parse_node *node, bool *is_ref)
+{
+  *is_ref = node->is_ref;
+
+  if (node->type == NODE_EXPR && ((EXPR *)node)->kind == SIMPLE) {
+    node = ((EXPR *)node)->left;
+    *is_ref |= node->is_ref;
+  }
+
+  return node;
+}
+
+static bool arg_is_reg(parse_node *node, const char *reg)
+{
+  bool is_ref;
+
+  if (node == NULL)
+    return false;
+
+  node = unwrap(node, &is_ref);
+  return node->type == NODE_ID && !is_ref && is_name(((ID *)node)->name, reg);
+}
+
+static const char *arg_reg16(parse_node *node)
+{
+  static const char *regs[] = {"bc", "de", "hl", NULL};
+
+  for (int i = 0; regs[i]; i++) {
+    if (arg_is_reg(node, regs[i]))
+      return regs[i];
+  }
+
+  return NULL;
+}
+
+static bool arg_is_int(parse_node *node, int *value)
+{
+  if (node == NULL || node->type != NODE_LITERAL || node->is_ref || ((LITERAL *)node)->kind != INT)
+    return false;
+
+  *value = ((LITERAL *)node)->ival;
+  return true;
+}
+
+// (IX+d), (IY+d), (IX) or (IY)
+static bool arg_is_indexed(parse_node *node)
+{
+  if (node == NULL || !node->is_ref)
+    return false;
+
+  if (node->type == NODE_EXPR) {
+    EXPR *expr = (EXPR *)node;
+
+    if (expr->kind != BINARY_PLUS && expr->kind != BINARY_MINUS && expr->kind != SIMPLE)
+      return false;
+
+    node = expr->left;
+  }
+
+  return node->type == NODE_ID && (is_name(((ID *)node)->name, "ix") || is_name(((ID *)node)->name, "iy"));
+}
+
+static const char *index_reg(parse_node *node)
+{
+  if (node->type == NODE_EXPR)
+    node = ((EXPR *)node)->left;
+
+  return is_name(((ID *)node)->name, "ix") ? "ix" : "iy";
+}
+
+static int cond_flags(parse_node *node)
+{
+  if (arg_is_reg(node, "nz") || arg_is_reg(node, "z"))
+    return FLAGS_READ_Z;
+  if (arg_is_reg(node, "nc") || arg_is_reg(node, "c"))
+    return FLAGS_READ_C;
+  if (arg_is_reg(node, "po") || arg_is_reg(node, "pe"))
+    return FLAGS_READ_PV;
+  if (arg_is_reg(node, "p") || arg_is_reg(node, "m"))
+    return FLAGS_READ_S;
+
+  return 0;
+}
+
+static parse_node *mk_reg(const char *name, bool is_ref)
+{
+  ID *id = make_node_internal(ID);
+  id->name = xstrdup(name);
+  id->hdr.is_ref = is_ref;
+
+  return (parse_node *)id;
+}
+
+static parse_node *mk_int(int value)
+{
+  LITERAL *l = make_node_internal(LITERAL);
+  l->kind = INT;
+  l->ival = value;
+
+  return (parse_node *)l;
+}
+
+// flags read by the code following statement before they are overwritten
+static int flags_read_after(dynarray *statements, int stmt_idx)
+{
+  int read = 0;
+
+  for (int i = stmt_idx + 1; i < dynarray_length(statements) && i <= stmt_idx + LINT_FLAGS_LOOKAHEAD; i++) {
+    parse_node *node = (parse_node *)dfirst(dynarray_nth_cell(statements, i));
+
+    if (node->type == NODE_EQU || node->type == NODE_PROFILE || node->type == NODE_ENDPROFILE)
+      continue;
+
+    // labels join paths, directives could render anything
+    if (node->type != NODE_INSTR)
+      return read | FLAGS_READ_ALL;
+
+    INSTR *instr = (INSTR *)node;
+    char *name = ((ID *)instr->name)->name;
+    dynarray *args = instr->args ? instr->args->list : NULL;
+    int nargs = dynarray_length(args);
+    parse_node *a0 = nargs > 0 ? (parse_node *)dinitial(args) : NULL;
+
+    // routines are assumed to take no arguments in flags
+    if (is_name(name, "call") && nargs == 1)
+      return read;
+
+    if (is_name(name, "jp") || is_name(name, "jr") || is_name(name, "call") || is_name(name, "ret")) {
+      bool conditional = is_name(name, "ret") ? (nargs == 1) : (nargs == 2);
+
+      if (!conditional)
+        return read | FLAGS_READ_ALL;
+
+      read |= cond_flags(a0);
+    } else if (is_name(name, "reti") || is_name(name, "retn") || is_name(name, "rst") ||
+      is_name(name, "djnz") || is_name(name, "halt") || is_name(name, "daa"))
+    {
+      return read | FLAGS_READ_ALL;
+    } else if ((is_name(name, "push") || is_name(name, "ex")) && arg_is_reg(a0, "af")) {
+      return read | FLAGS_READ_ALL;
+    } else if (is_name(name, "pop") && arg_is_reg(a0, "af")) {
+      return read;
+    } else if (is_name(name, "adc") || is_name(name, "sbc")) {
+      return read | FLAGS_READ_C;
+    } else if (is_name(name, "rla") || is_name(name, "rra") || is_name(name, "rl") || is_name(name, "rr") ||
+      is_name(name, "ccf"))
+    {
+      read |= FLAGS_READ_C;
+    } else if (is_name(name, "sub") || is_name(name, "and") || is_name(name, "or") || is_name(name, "xor") ||
+      is_name(name, "cp") || is_name(name, "neg") || (is_name(name, "add") && (nargs == 1 || arg_is_reg(a0, "a"))))
+    {
+      return read;
+    }
+  }
+
+  return read | FLAGS_READ_ALL;
+}
+
+// renders instruction with the assembler's tables and drops it
+static lint_cost_t lint_measure(compile_ctx_t *ctx, char *name, dynarray *args)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t saved_pc = section->curr_pc;
+  int saved_len = section->content->len;
+  int saved_patches = dynarray_length(ctx->patches);
+  long saved_cycles = ctx->cycles;
+  bool saved_in_profile = ctx->in_profile;
+  profile_data_t saved_profile = ctx->current_profile;
+  analysis_t *saved_analysis = ctx->analysis;
+
+  ctx->analysis = NULL;
+  ctx->in_profile = true;
+  memset(&ctx->current_profile, 0, sizeof(ctx->current_profile));
+
+  compile_instruction_impl(ctx, name, args);
+
+  lint_cost_t cost = {ctx->current_profile.bytes, ctx->current_profile.cycles};
+
+  while (dynarray_length(ctx->patches) > saved_patches) {
+    patch_t *patch = (patch_t *)dfirst(dynarray_remove_last_cell(ctx->patches));
+
+    xfree(patch->rept_suffix);
+    xfree(patch);
+  }
+
+  section->curr_pc = saved_pc;
+  section->content->len = saved_len;
+  ctx->cycles = saved_cycles;
+  ctx->in_profile = saved_in_profile;
+  ctx->current_profile = saved_profile;
+  ctx->analysis = saved_analysis;
+
+  return cost;
+}
+
+static lint_cost_t lint_measure_args(compile_ctx_t *ctx, char *name, parse_node *a0, parse_node *a1)
+{
+  dynarray *args = NULL;
+
+  if (a0)
+    args = dynarray_append_ptr(args, a0);
+  if (a1)
+    args = dynarray_append_ptr(args, a1);
+
+  lint_cost_t cost = lint_measure(ctx, name, args);
+  dynarray_free(args);
+
+  return cost;
+}
+
+static lint_finding_t *lint_new(compile_ctx_t *ctx, parse_node *node, char *text, char *note,
+                                lint_cost_t orig, lint_cost_t repl)
+{
+  lint_finding_t *finding = (lint_finding_t *)xmalloc(sizeof(lint_finding_t));
+
+  finding->fn = xstrdup(node->fn);
+  finding->line = node->line - 1;
+  finding->block = ctx->in_profile ? xstrdup(ctx->current_profile_name) : NULL;
+  finding->text = text;
+  finding->note = note;
+  finding->bytes = repl.bytes - orig.bytes;
+  finding->cycles = repl.cycles - orig.cycles;
+
+  return finding;
+}
+
+static void lint_add(compile_ctx_t *ctx, parse_node *node, char *text, char *note, lint_cost_t orig, lint_cost_t repl)
+{
+  lint_finding_t *finding = lint_new(ctx, node, text, note, orig, repl);
+  ctx->lint->findings = dynarray_append_ptr(ctx->lint->findings, finding);
+}
+
+static inline bool reljump_fits(uint32_t target, uint32_t pc)
+{
+  int offset = (int)target - (int)(pc + 2);
+  return offset >= -128 && offset <= 127;
+}
+
+static INSTR *prev_instr(dynarray *statements, int stmt_idx, const char *name)
+{
+  if (stmt_idx == 0)
+    return NULL;
+
+  parse_node *node = (parse_node *)dfirst(dynarray_nth_cell(statements, stmt_idx - 1));
+  if (node->type != NODE_INSTR || !is_name(((ID *)((INSTR *)node)->name)->name, name))
+    return NULL;
+
+  return (INSTR *)node;
+}
+
+static void lint_near_jump(compile_ctx_t *ctx, INSTR *instr, uint32_t pc, lint_cost_t orig,
+                           parse_node *cond, parse_node *target)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  int value;
+
+  if (target->is_ref || arg_is_reg(target, "hl"))
+    return;
+
+  if (cond && !(arg_is_reg(cond, "nz") || arg_is_reg(cond, "z") || arg_is_reg(cond, "nc") || arg_is_reg(cond, "c")))
+    return;
+
+  // measure relative jump to the current position, it always fits
+  lint_cost_t repl = lint_measure_args(ctx, "jr", cond, mk_int(section->curr_pc));
+  char *text = cond ? xstrdup("jp cc,nn -> jr cc,e") : xstrdup("jp nn -> jr e");
+
+  if (arg_is_int(target, &value)) {
+    if (reljump_fits(value, pc))
+      lint_add(ctx, (parse_node *)instr, text, NULL, orig, repl);
+    else
+      xfree(text);
+
+    return;
+  }
+
+  // forward target: check it when all labels are known
+  lint_near_jump_t *jump = (lint_near_jump_t *)xmalloc(sizeof(lint_near_jump_t));
+  jump->target = target;
+  jump->pc = pc;
+  jump->finding = lint_new(ctx, (parse_node *)instr, text, NULL, orig, repl);
+
+  ctx->lint->near_jumps = dynarray_append_ptr(ctx->lint->near_jumps, jump);
+}
+
+static void lint_indexed(compile_ctx_t *ctx, INSTR *instr, char *name, dynarray *args, lint_cost_t orig)
+{
+  dynarray_cell *dc = NULL;
+
+  // HL can't point to the data if instruction uses it itself
+  foreach (dc, args) {
+    parse_node *arg = (parse_node *)dfirst(dc);
+
+    if (arg_is_reg(arg, "h") || arg_is_reg(arg, "l") || arg_is_reg(arg, "hl"))
+      return;
+  }
+
+  foreach (dc, args) {
+    if (!arg_is_indexed((parse_node *)dfirst(dc)))
+      continue;
+
+    dynarray *repl_args = NULL;
+    dynarray_cell *rc = NULL;
+
+    foreach (rc, args) {
+      parse_node *arg = (parse_node *)dfirst(rc);
+      repl_args = dynarray_append_ptr(repl_args, rc == dc ? mk_reg("hl", true) : arg);
+    }
+
+    lint_cost_t repl = lint_measure(ctx, name, repl_args);
+    dynarray_free(repl_args);
+
+    lint_add(ctx, (parse_node *)instr, bsprintf("%s (%s+d) -> %s (hl)", name, index_reg((parse_node *)dfirst(dc)), name),
+      xstrdup("if HL can point to the data in this block"), orig, repl);
+    return;
+  }
+}
+
+void lint_instr(compile_ctx_t *ctx, dynarray *statements, int stmt_idx, uint32_t pc, int bytes, int cycles)
+{
+  dynarray_cell *dc = NULL;
+
+  if (ctx->lint == NULL)
+    return;
+
+  // every iteration of REPT block is the same source line
+  foreach (dc, ctx->repts) {
+    if (((rept_ctx_t *)dfirst(dc))->counter != 0)
+      return;
+  }
+
+  INSTR *instr = (INSTR *)ctx->node;
+  char *name = ((ID *)instr->name)->name;
+  dynarray *args = NULL;
+  lint_cost_t orig = {bytes, cycles};
+  int value;
+
+  if (instr->args) {
+    foreach (dc, instr->args->list)
+      args = dynarray_append_ptr(args, expr_eval(ctx, (parse_node *)dfirst(dc)));
+  }
+
+  int nargs = dynarray_length(args);
+  parse_node *a0 = nargs > 0 ? (parse_node *)dinitial(args) : NULL;
+  parse_node *a1 = nargs > 1 ? (parse_node *)dsecond(args) : NULL;
+
+  if (is_name(name, "ld") && nargs == 2 && arg_is_reg(a0, "a") && arg_is_int(a1, &value) && value == 0) {
+    if (flags_read_after(statements, stmt_idx) == 0)
+      lint_add(ctx, ctx->node, xstrdup("ld a,0 -> xor a"), NULL, orig, lint_measure_args(ctx, "xor", mk_reg("a", false), NULL));
+  } else if (is_name(name, "cp") && nargs == 1 && arg_is_int(a0, &value) && value == 0) {
+    // the same Z, S and C flags, only P/V differs
+    if ((flags_read_after(statements, stmt_idx) & FLAGS_READ_PV) == 0)
+      lint_add(ctx, ctx->node, xstrdup("cp 0 -> or a"), NULL, orig, lint_measure_args(ctx, "or", mk_reg("a", false), NULL));
+  } else if (is_name(name, "jp") && (nargs == 1 || nargs == 2)) {
+    lint_near_jump(ctx, instr, pc, orig, nargs == 2 ? a0 : NULL, nargs == 2 ? a1 : a0);
+  } else if ((is_name(name, "ldir") || is_name(name, "lddr")) && nargs == 0) {
+    INSTR *load = prev_instr(statements, stmt_idx, "ld");
+
+    if (load && load->args && dynarray_length(load->args->list) == 2 && arg_is_reg(dinitial(load->args->list), "bc") &&
+      arg_is_int(expr_eval(ctx, dsecond(load->args->list)), &value) && value >= 2 && value <= LINT_UNROLL_MAX)
+    {
+      char *single = is_name(name, "ldir") ? "ldi" : "ldd";
+      lint_cost_t step = lint_measure(ctx, single, NULL);
+      lint_cost_t repl = {step.bytes * value, step.cycles * value};
+
+      // the assembler's table has timing of repeated iteration
+      orig.cycles = cycles * value - BLOCK_LAST_ITER_SAVING;
+
+      lint_add(ctx, ctx->node, bsprintf("ld bc,%d / %s -> %d x %s", value, name, value, single),
+        xstrdup("or FASTCOPY"), orig, repl);
+    }
+  } else if (is_name(name, "pop") && nargs == 1 && arg_reg16(a0)) {
+    INSTR *push = prev_instr(statements, stmt_idx, "push");
+    const char *dst = arg_reg16(a0);
+    const char *src = (push && push->args && dynarray_length(push->args->list) == 1) ?
+      arg_reg16(dinitial(push->args->list)) : NULL;
+
+    if (src && strcmp(src, dst) != 0) {
+      lint_cost_t push_cost = lint_measure_args(ctx, "push", mk_reg(src, false), NULL);
+      char *text;
+      char *note = NULL;
+      lint_cost_t repl;
+
+      orig.bytes += push_cost.bytes;
+      orig.cycles += push_cost.cycles;
+
+      if (strcmp(src, "bc") != 0 && strcmp(dst, "bc") != 0) {
+        repl = lint_measure_args(ctx, "ex", mk_reg("de", false), mk_reg("hl", false));
+        text = bsprintf("push %s / pop %s -> ex de,hl", src, dst);
+        note = bsprintf("if %s isn't used afterwards, otherwise ld %c,%c / ld %c,%c", src, dst[0], src[0], dst[1], src[1]);
+      } else {
+        char dst_h[2] = {dst[0], 0}, dst_l[2] = {dst[1], 0};
+        char src_h[2] = {src[0], 0}, src_l[2] = {src[1], 0};
+        lint_cost_t ld_h = lint_measure_args(ctx, "ld", mk_reg(dst_h, false), mk_reg(src_h, false));
+        lint_cost_t ld_l = lint_measure_args(ctx, "ld", mk_reg(dst_l, false), mk_reg(src_l, false));
+
+        repl.bytes = ld_h.bytes + ld_l.bytes;
+        repl.cycles = ld_h.cycles + ld_l.cycles;
+        text = bsprintf("push %s / pop %s -> ld %s,%s / ld %s,%s", src, dst, dst_h, src_h, dst_l, src_l);
+      }
+
+      lint_add(ctx, (parse_node *)push, text, note, orig, repl);
+    }
+  } else if (ctx->in_profile && nargs > 0) {
+    lint_indexed(ctx, instr, name, args, orig);
+  }
+
+  dynarray_free(args);
+}
+
+void lint_finish(compile_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+
+  if (ctx->lint == NULL)
+    return;
+
+  foreach (dc, ctx->lint->near_jumps) {
+    lint_near_jump_t *jump = (lint_near_jump_t *)dfirst(dc);
+    int target;
+
+    if (arg_is_int(expr_eval(ctx, jump->target), &target) && reljump_fits(target, jump->pc)) {
+      ctx->lint->findings = dynarray_append_ptr(ctx->lint->findings, jump->finding);
+      jump->finding = NULL;
+    }
+  }
+}
+
+// hot findings first, then the largest savings
+static int finding_cmp(const void *a, const void *b)
+{
+  const lint_finding_t *f1 = *(const lint_finding_t **)a;
+  const lint_finding_t *f2 = *(const lint_finding_t **)b;
+
+  if ((f1->block != NULL) != (f2->block != NULL))
+    return (f2->block != NULL) - (f1->block != NULL);
+
+  if (f1->cycles != f2->cycles)
+    return f1->cycles - f2->cycles;
+
+  if (f1->bytes != f2->bytes)
+    return f1->bytes - f2->bytes;
+
+  int cmp = strcmp(f1->fn, f2->fn);
+  return cmp ? cmp : f1->line - f2->line;
+}
+
+void lint_report(compile_ctx_t *ctx)
+{
+  lint_t *lint = ctx->lint;
+  dynarray_cell *dc = NULL;
+  int nfindings = dynarray_length(lint->findings);
+  int nhot = 0;
+
+  lint_finding_t **sorted = (lint_finding_t **)xmalloc(sizeof(lint_finding_t *) * (nfindings + 1));
+  foreach (dc, lint->findings) {
+    sorted[foreach_current_index(dc)] = (lint_finding_t *)dfirst(dc);
+    nhot += (sorted[foreach_current_index(dc)]->block != NULL);
+  }
+
+  qsort(sorted, nfindings, sizeof(lint_finding_t *), finding_cmp);
+
+  report_info("\x1b[96mPerf lint\x1b[97m: %d findings, %d in PROFILE blocks", nfindings, nhot);
+
+  for (int i = 0; i < nfindings; i++) {
+    lint_finding_t *f = sorted[i];
+    char *block = f->block ? bsprintf(" [%s]", f->block) : xstrdup("");
+    char *note = f->note ? bsprintf(" (%s)", f->note) : xstrdup("");
+
+    report_info("%s:%d:%s %s: %+d bytes, %+d cycles%s", f->fn, f->line, block, f->text, f->bytes, f->cycles, note);
+
+    xfree(block);
+    xfree(note);
+  }
+
+  xfree(sorted);
+}
+
+static void finding_free(lint_finding_t *finding)
+{
+  if (finding == NULL)
+    return;
+
+  xfree(finding->fn);
+  xfree(finding->block);
+  xfree(finding->text);
+  xfree(finding->note);
+  xfree(finding);
+}
+
+void lint_free(lint_t *lint)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, lint->findings)
+    finding_free((lint_finding_t *)dfirst(dc));
+
+  foreach (dc, lint->near_jumps)
+    finding_free(((lint_near_jump_t *)dfirst(dc))->finding);
+
+  dynarray_free(lint->findings);
+  dynarray_free_deep(lint->near_jumps);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// the longest LDIR/LDDR worth unrolling into LDI/LDD sequence
+#define LINT_UNROLL_MAX 16
+
+// how many statements to look ahead for flags readers
+#define LINT_FLAGS_LOOKAHEAD 16
+
+typedef struct lint_t {
+  dynarray *findings;       // lint_finding_t
+  dynarray *near_jumps;     // JP with forward targets checked when all labels are known
+} lint_t;
+
+extern void lint_instr(compile_ctx_t *ctx, dynarray *statements, int stmt_idx, uint32_t pc, int bytes, int cycles);
+extern void lint_finish(compile_ctx_t *ctx);
+extern void lint_report(compile_ctx_t *ctx);
+extern void lint_free(lint_t *lint);
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+
+#include "asm/listing.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+
+// Listing of the final pass: every compiled statement with its address, size and timing. It's
+// collected for tools inspecting results of compilation (see compile_opts.inspect), bytes of
+// statement are read from section content there because forward references are patched after
+// the statement is compiled.
+
+void listing_track(compile_ctx_t *ctx, parse_node *node, int section_id, uint32_t addr,
+                   uint32_t pos, int cycles)
+{
+  listing_t *listing = ctx->listing;
+
+  if (listing == NULL)
+    return;
+
+  listing_line_t *line = (listing_line_t *)xmalloc(sizeof(listing_line_t));
+  line->node = node;
+  line->section_id = section_id;
+  line->addr = addr;
+  line->pos = pos;
+  line->cycles = cycles;
+
+  // SECTION statement switches to another one without rendering anything
+  line->size = (ctx->curr_section_id == section_id) ? get_current_section(ctx)->content->len - pos : 0;
+
+  listing->lines = dynarray_append_ptr(listing->lines, line);
+}
+
+void listing_free(listing_t *listing)
+{
+  dynarray_free_deep(listing->lines);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// statement compiled by the final pass with bytes and T-states it rendered
+typedef struct {
+  parse_node *node;
+  int section_id;
+  uint32_t addr;
+  uint32_t pos;                 // offset of the first byte in section content
+  int size;
+  int cycles;
+} listing_line_t;
+
+typedef struct listing_t {
+  dynarray *lines;              // listing_line_t in order of compilation (REPT bodies are repeated)
+} listing_t;
+
+extern void listing_track(compile_ctx_t *ctx, parse_node *node, int section_id, uint32_t addr,
+                          uint32_t pos, int cycles);
+extern void listing_free(listing_t *listing);
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/lz.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+
+// LZ compression for INCBIN_LZ and DB_LZ: byte aligned stream of literal runs and matches
+// which lib/lzdec.asm unpacks with one LDIR per token, so the routine stays at 21 T-states
+// per byte plus a fixed cost per token.
+//
+// Parsing is optimal for the format: the shortest stream is chosen by dynamic programming
+// from the end of data, and when lengths are equal the one with fewer decompression cycles
+// wins. Matches are found through hash chains of 4-byte prefixes.
+
+#define LZ_HASH_BITS    16
+#define LZ_CHAIN_LIMIT  1024
+
+typedef struct {
+  uint32_t bytes;     // packed size of data from this position to the end
+  long cycles;        // decompression cycles of the same
+  int len;            // literal run or match length taken at this position
+  bool match;
+} lz_step_t;
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// the longest match for every position and its distance
+static void find_matches(const uint8_t *data, uint32_t len, int *match_len, uint32_t *match_dist)
+{
+  int *head = (int *)xmalloc(sizeof(int) * (1 << LZ_HASH_BITS));
+  int *prev = (int *)xmalloc(sizeof(int) * (len + 1));
+
+  memset(head, 0xff, sizeof(int) * (1 << LZ_HASH_BITS));
+
+  for (uint32_t i = 0; i < len; i++) {
+    match_len[i] = 0;
+    match_dist[i] = 0;
+
+    if (i + LZ_MATCH_MIN > len)
+      continue;
+
+    uint32_t h = lz_hash(data + i);
+    int max = (len - i < LZ_MATCH_MAX) ? len - i : LZ_MATCH_MAX;
+    int chain = 0;
+
+    for (int j = head[h]; j >= 0 && i - j <= LZ_WINDOW && chain < LZ_CHAIN_LIMIT; j = prev[j], chain++) {
+      int l = 0;
+
+      // overlapped matches are fine: LDIR copies byte by byte
+      while (l < max && data[j + l] == data[i + l])
+        l++;
+
+      if (l > match_len[i]) {
+        match_len[i] = l;
+        match_dist[i] = i - j;
+
+        if (l == max)
+          break;
+      }
+    }
+
+    if (match_len[i] < LZ_MATCH_MIN)
+      match_len[i] = 0;
+
+    prev[i] = head[h];
+    head[h] = i;
+  }
+
+  xfree(head);
+  xfree(prev);
+}
+
+static inline bool lz_better(uint32_t bytes, long cycles, lz_step_t *step)
+{
+  return (bytes < step->bytes) || (bytes == step->bytes && cycles < step->cycles);
+}
+
+char *lz_compress(const uint8_t *data, uint32_t len, uint32_t *packed_len, long *cycles)
+{
+  int *match_len = (int *)xmalloc(sizeof(int) * (len + 1));
+  uint32_t *match_dist = (uint32_t *)xmalloc(sizeof(uint32_t) * (len + 1));
+  lz_step_t *steps = (lz_step_t *)xmalloc(sizeof(lz_step_t) * (len + 1));
+
+  find_matches(data, len, match_len, match_dist);
+
+  steps[len].bytes = 1;
+  steps[len].cycles = LZ_END_CYCLES;
+
+  for (int i = (int)len - 1; i >= 0; i--) {
+    lz_step_t *step = &steps[i];
+
+    step->bytes = UINT32_MAX;
+
+    for (int l = 1; l <= LZ_LITERAL_MAX && i + l <= (int)len; l++) {
+      uint32_t bytes = 1 + l + steps[i + l].bytes;
+      long c = LZ_LITERAL_CYCLES + LZ_BYTE_CYCLES * l + steps[i + l].cycles;
+
+      if (lz_better(bytes, c, step)) {
+        step->bytes = bytes;
+        step->cycles = c;
+        step->len = l;
+        step->match = false;
+      }
+    }
+
+    for (int l = LZ_MATCH_MIN; l <= match_len[i]; l++) {
+      uint32_t bytes = 3 + steps[i + l].bytes;
+      long c = LZ_MATCH_CYCLES + LZ_BYTE_CYCLES * l + steps[i + l].cycles;
+
+      if (lz_better(bytes, c, step)) {
+        step->bytes = bytes;
+        step->cycles = c;
+        step->len = l;
+        step->match = true;
+      }
+    }
+  }
+
+  char *packed = (char *)xmalloc(steps[0].bytes);
+  uint32_t pos = 0;
+
+  for (uint32_t i = 0; i < len; i += steps[i].len) {
+    lz_step_t *step = &steps[i];
+
+    if (step->match) {
+      // negative distance: decompressor adds it to destination pointer
+      uint16_t offset = (uint16_t)(0x10000 - match_dist[i]);
+
+      packed[pos++] = LZ_MATCH + step->len - LZ_MATCH_MIN;
+      packed[pos++] = offset & 0xff;
+      packed[pos++] = offset >> 8;
+    } else {
+      packed[pos++] = step->len;
+      memcpy(packed + pos, data + i, step->len);
+      pos += step->len;
+    }
+  }
+
+  packed[pos++] = LZ_END;
+
+  *packed_len = pos;
+  *cycles = LZ_ENTRY_CYCLES + steps[0].cycles;
+
+  xfree(match_len);
+  xfree(match_dist);
+  xfree(steps);
+
+  return packed;
+}
+
+void render_lz(compile_ctx_t *ctx, const char *what, char *data, uint32_t len)
+{
+  uint32_t packed_len;
+  long cycles;
+
+  char *packed = lz_compress((uint8_t *)data, len, &packed_len, &cycles);
+  render_bytes(ctx, packed, packed_len);
+  xfree(packed);
+
+  report_info("\x1b[96mLZ\x1b[97m at %s:%d: %s: %u -> %u bytes (%.1f%%), lz_decompress: %ld cycles (%.1f per byte)",
+    ctx->node->fn, ctx->node->line - 1, what, len, packed_len,
+    len ? 100.0 * packed_len / len : 100.0, cycles, len ? (double)cycles / len : 0.0);
+}
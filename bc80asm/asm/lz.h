@@ -0,0 +1,21 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// stream tokens, see lib/lzdec.asm
+#define LZ_END          0x00
+#define LZ_LITERAL_MAX  0x7f      // tokens 0x01..0x7f: literal run of that many bytes
+#define LZ_MATCH        0x80      // tokens 0x80..0xff: match of (token - 0x80 + LZ_MATCH_MIN) bytes
+#define LZ_MATCH_MIN    4
+#define LZ_MATCH_MAX    (0xff - LZ_MATCH + LZ_MATCH_MIN)
+#define LZ_WINDOW       0xffff
+
+// lz_decompress timings: per token and per copied byte (LDIR)
+#define LZ_ENTRY_CYCLES     7
+#define LZ_END_CYCLES       28
+#define LZ_LITERAL_CYCLES   41
+#define LZ_MATCH_CYCLES     110
+#define LZ_BYTE_CYCLES      21
+
+extern char *lz_compress(const uint8_t *data, uint32_t len, uint32_t *packed_len, long *cycles);
+extern void render_lz(compile_ctx_t *ctx, const char *what, char *data, uint32_t len);
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/map.h"
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/filesystem.h"
+
+// Memory map (--map): sections, global labels with sizes of their blocks, gaps and overlaps
+// between sections and free regions of 64K address space.
+//
+// Block of a label spans up to the next label of the section. Like profile blocks, it is code
+// if any instruction is rendered there and data otherwise.
+
+#define ADDRESS_SPACE 0x10000
+
+typedef struct {
+  uint32_t start;
+  uint32_t size;
+} map_region_t;
+
+void map_label(compile_ctx_t *ctx, const char *name, uint32_t addr, bool alias)
+{
+  map_t *map = ctx->map;
+
+  if (map == NULL)
+    return;
+
+  map_label_t *label = (map_label_t *)xmalloc(sizeof(map_label_t));
+  label->name = xstrdup(name);
+  label->section_id = ctx->curr_section_id;
+  label->addr = addr;
+  label->order = dynarray_length(map->labels);
+  label->alias = alias;
+
+  map->labels = dynarray_append_ptr(map->labels, label);
+}
+
+void map_code(compile_ctx_t *ctx, int size, int cycles)
+{
+  map_t *map = ctx->map;
+
+  if (map == NULL)
+    return;
+
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t offset = section->content->len - size;
+
+  if (dynarray_length(map->code) > 0) {
+    map_range_t *last = (map_range_t *)dlast(map->code);
+
+    if (last->section_id == ctx->curr_section_id && last->offset + last->size == offset) {
+      last->size += size;
+      return;
+    }
+  }
+
+  map_range_t *range = (map_range_t *)xmalloc(sizeof(map_range_t));
+  range->section_id = ctx->curr_section_id;
+  range->offset = offset;
+  range->size = size;
+
+  map->code = dynarray_append_ptr(map->code, range);
+}
+
+// bytes rendered by instructions in [start, end) of section
+static uint32_t code_bytes(map_t *map, int section_id, uint32_t start, uint32_t end)
+{
+  dynarray_cell *dc = NULL;
+  uint32_t bytes = 0;
+
+  foreach (dc, map->code) {
+    map_range_t *range = (map_range_t *)dfirst(dc);
+
+    if (range->section_id != section_id)
+      continue;
+
+    uint32_t from = (range->offset > start) ? range->offset : start;
+    uint32_t to = (range->offset + range->size < end) ? range->offset + range->size : end;
+
+    if (to > from)
+      bytes += to - from;
+  }
+
+  return bytes;
+}
+
+static int compare_label_addr(const void *a, const void *b)
+{
+  const map_label_t *l1 = *(const map_label_t **)a;
+  const map_label_t *l2 = *(const map_label_t **)b;
+
+  if (l1->section_id != l2->section_id)
+    return l1->section_id - l2->section_id;
+
+  if (l1->addr != l2->addr)
+    return (l1->addr > l2->addr) - (l1->addr < l2->addr);
+
+  return l1->order - l2->order;
+}
+
+static int compare_section_start(const void *a, const void *b)
+{
+  const section_ctx_t *s1 = *(const section_ctx_t **)a;
+  const section_ctx_t *s2 = *(const section_ctx_t **)b;
+
+  return (s1->start > s2->start) - (s1->start < s2->start);
+}
+
+static int compare_region_size(const void *a, const void *b)
+{
+  const map_region_t *r1 = (const map_region_t *)a;
+  const map_region_t *r2 = (const map_region_t *)b;
+
+  if (r1->size != r2->size)
+    return (r1->size < r2->size) - (r1->size > r2->size);
+
+  return (r1->start > r2->start) - (r1->start < r2->start);
+}
+
+static void write_block(buffer *buf, map_t *map, int section_id, section_ctx_t *section,
+                        const char *name, uint32_t addr, uint32_t size, uint32_t *code_total, uint32_t *data_total)
+{
+  uint32_t offset = addr - section->start;
+  uint32_t code = code_bytes(map, section_id, offset, offset + size);
+  const char *kind = (code > 0) ? "code" : (size > 0) ? "data" : "";
+
+  if (code > 0)
+    *code_total += size;
+  else
+    *data_total += size;
+
+  buffer_append(buf, "  %04xh  %6u  %-4s  %-12s  %s\n", addr, size, kind, section->name, name);
+}
+
+void map_write(compile_ctx_t *ctx, const char *filename)
+{
+  map_t *map = ctx->map;
+  dynarray_cell *dc = NULL;
+  buffer *buf = buffer_init();
+  int nsections = dynarray_length(ctx->sections);
+  uint32_t code_total = 0;
+  uint32_t data_total = 0;
+  uint32_t used_total = 0;
+
+  // sections
+
+  buffer_append(buf, "Sections:\n");
+  buffer_append(buf, "  %-12s  %-5s  %-5s  %6s  %s\n", "name", "start", "end", "size", "fill");
+
+  for (int s = 0; s < nsections; s++) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, s));
+    uint32_t size = section->content->len;
+
+    if (size > 0)
+      buffer_append(buf, "  %-12s  %04xh  %04xh  %6u  %02xh\n",
+        section->name, section->start, section->start + size - 1, size, section->filler);
+    else
+      buffer_append(buf, "  %-12s  %04xh  %-5s  %6u  %02xh\n", section->name, section->start, "-", 0, section->filler);
+  }
+
+  // gaps and overlaps between non-empty sections in address order
+
+  section_ctx_t **sorted = (section_ctx_t **)xmalloc(sizeof(section_ctx_t *) * nsections);
+  int nsorted = 0;
+
+  for (int s = 0; s < nsections; s++) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, s));
+
+    if (section->content->len > 0)
+      sorted[nsorted++] = section;
+  }
+
+  qsort(sorted, nsorted, sizeof(section_ctx_t *), compare_section_start);
+
+  map_region_t *free_regions = (map_region_t *)xmalloc(sizeof(map_region_t) * (nsorted + 1));
+  int nfree = 0;
+  uint32_t covered = 0;           // end of address space covered by sections so far
+  section_ctx_t *covering = NULL; // section which ends at covered
+  bool reported = false;
+
+  buffer_append(buf, "\nGaps and overlaps:\n");
+
+  for (int i = 0; i < nsorted; i++) {
+    section_ctx_t *section = sorted[i];
+    uint32_t end = section->start + section->content->len;
+
+    if (section->start > covered) {
+      if (i > 0) {
+        buffer_append(buf, "  gap      %04xh-%04xh  %6u bytes between '%s' and '%s'\n",
+          covered, section->start - 1, section->start - covered, covering->name, section->name);
+        reported = true;
+      }
+
+      free_regions[nfree].start = covered;
+      free_regions[nfree].size = section->start - covered;
+      nfree++;
+    } else if (i > 0 && section->start < covered) {
+      uint32_t overlap_end = (end < covered) ? end : covered;
+
+      buffer_append(buf, "  overlap  %04xh-%04xh  %6u bytes of '%s' and '%s'\n",
+        section->start, overlap_end - 1, overlap_end - section->start, covering->name, section->name);
+      reported = true;
+    }
+
+    used_total += (end > covered) ? end - ((section->start > covered) ? section->start : covered) : 0;
+
+    if (end > covered) {
+      covered = end;
+      covering = section;
+    }
+  }
+
+  if (!reported)
+    buffer_append(buf, "  none\n");
+
+  if (covered < ADDRESS_SPACE) {
+    free_regions[nfree].start = covered;
+    free_regions[nfree].size = ADDRESS_SPACE - covered;
+    nfree++;
+  }
+
+  // free regions by size
+
+  qsort(free_regions, nfree, sizeof(map_region_t), compare_region_size);
+
+  buffer_append(buf, "\nLargest free regions:\n");
+
+  for (int i = 0; i < nfree && i < MAP_FREE_REGIONS; i++)
+    buffer_append(buf, "  %04xh-%04xh  %6u bytes\n",
+      free_regions[i].start, free_regions[i].start + free_regions[i].size - 1, free_regions[i].size);
+
+  // global labels and their blocks
+
+  int nlabels = dynarray_length(map->labels);
+  map_label_t **labels = (map_label_t **)xmalloc(sizeof(map_label_t *) * (nlabels + 1));
+  int nblocks = 0;
+
+  foreach (dc, map->labels) {
+    map_label_t *label = (map_label_t *)dfirst(dc);
+
+    if (!label->alias)
+      labels[nblocks++] = label;
+  }
+
+  qsort(labels, nblocks, sizeof(map_label_t *), compare_label_addr);
+
+  buffer_append(buf, "\nLabels:\n");
+  buffer_append(buf, "  %-5s  %6s  %-4s  %-12s  %s\n", "addr", "size", "kind", "section", "name");
+
+  for (int s = 0; s < nsections; s++) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, s));
+    uint32_t end = section->start + section->content->len;
+    bool labeled = false;
+
+    for (int i = 0; i < nblocks; i++) {
+      if (labels[i]->section_id != s)
+        continue;
+
+      // bytes in front of the first label
+      if (!labeled && labels[i]->addr > section->start)
+        write_block(buf, map, s, section, "(no label)", section->start, labels[i]->addr - section->start,
+          &code_total, &data_total);
+
+      labeled = true;
+
+      uint32_t next = end;
+      for (int j = i + 1; j < nblocks && labels[j]->section_id == s; j++) {
+        if (labels[j]->addr > labels[i]->addr) {
+          next = labels[j]->addr;
+          break;
+        }
+      }
+
+      // labels at the same address: the last one takes the block
+      if (i + 1 < nblocks && labels[i + 1]->section_id == s && labels[i + 1]->addr == labels[i]->addr)
+        next = labels[i]->addr;
+
+      uint32_t size = (next > labels[i]->addr && labels[i]->addr < end) ? next - labels[i]->addr : 0;
+
+      write_block(buf, map, s, section, labels[i]->name, labels[i]->addr, size, &code_total, &data_total);
+    }
+
+    if (!labeled && end > section->start)
+      write_block(buf, map, s, section, "(no label)", section->start, end - section->start, &code_total, &data_total);
+  }
+
+  foreach (dc, map->labels) {
+    map_label_t *label = (map_label_t *)dfirst(dc);
+
+    if (label->alias)
+      buffer_append(buf, "  %04xh  %6s  %-4s  %-12s  %s (alias)\n", label->addr, "-", "data",
+        ((section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, label->section_id)))->name, label->name);
+  }
+
+  // totals
+
+  uint32_t instr_total = 0;
+
+  foreach (dc, map->code)
+    instr_total += ((map_range_t *)dfirst(dc))->size;
+
+  buffer_append(buf, "\nTotals:\n");
+  buffer_append(buf, "  code blocks:  %6u bytes (instructions: %u bytes)\n", code_total, instr_total);
+  buffer_append(buf, "  data blocks:  %6u bytes\n", data_total);
+  buffer_append(buf, "  used:         %6u bytes of %u\n", used_total, ADDRESS_SPACE);
+  buffer_append(buf, "  free:         %6u bytes\n", ADDRESS_SPACE - used_total);
+
+  write_file(buf->data, buf->len, (char *)filename);
+
+  xfree(labels);
+  xfree(free_regions);
+  xfree(sorted);
+  buffer_free(buf);
+}
+
+void map_free(map_t *map)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, map->labels) {
+    map_label_t *label = (map_label_t *)dfirst(dc);
+
+    xfree(label->name);
+    xfree(label);
+  }
+
+  dynarray_free(map->labels);
+  dynarray_free_deep(map->code);
+}
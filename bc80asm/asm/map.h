@@ -0,0 +1,30 @@
+#pragma once
+
+#include "asm/compile.h"
+
+// the most free regions listed in map
+#define MAP_FREE_REGIONS  8
+
+typedef struct {
+  char *name;
+  int section_id;
+  uint32_t addr;
+  int order;                    // labels at the same address are kept in source order
+  bool alias;                   // label points into another label's block (--merge-strings)
+} map_label_t;
+
+typedef struct {
+  int section_id;
+  uint32_t offset;              // from section start
+  uint32_t size;
+} map_range_t;
+
+typedef struct map_t {
+  dynarray *labels;             // map_label_t: global labels of the final pass
+  dynarray *code;               // map_range_t: bytes rendered by instructions
+} map_t;
+
+extern void map_label(compile_ctx_t *ctx, const char *name, uint32_t addr, bool alias);
+extern void map_code(compile_ctx_t *ctx, int size, int cycles);
+extern void map_write(compile_ctx_t *ctx, const char *filename);
+extern void map_free(map_t *map);
@@ -1,8 +1,13 @@
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "asm/bc80asm.h"
+#include "asm/deps.h"
 #include "asm/parse.h"
+#include "asm/watch.h"
 #include "bits/buffer.h"
 #include "bits/error.h"
 #include "bits/dynarray.h"
@@ -12,9 +17,7 @@
 #include "parser.tab.h"
 #include "lexer.yy.h"
 
-parse_node *new_node_macro_holder;
-
-int parse_source(char *filename, char *source, dynarray **statements)
+int parse_source(char *filename, char *source, compile_opts *opts, dynarray **statements)
 {
   struct yy_buffer_state *buffer;
   yyscan_t scanner;
@@ -32,6 +35,7 @@ int parse_source(char *filename, char *source, dynarray **statements)
 
   sstate.line_num = 1;
   sstate.pos_num = 1;
+  sstate.opts = opts;
 
   yylex_init(&scanner);
   yyset_extra(&sstate, scanner);
@@ -106,42 +110,72 @@ int parse_binnum(char *text, int len)
   return result;
 }
 
-int parse_include(char *filename, dynarray **statements)
+// contents of INCLUDE or INCBIN file followed by zero byte which isn't counted by size,
+// NULL if file isn't found
+char *read_include(compile_opts *opts, char *filename, uint32_t *size)
 {
-  int ret = 0;
-  size_t file_size, sret;
-  FILE *fp = NULL;
-  char *path;
-  char *source = NULL;
-
-  path = fs_abs_path(filename, g_includeopts);
-  if (path == NULL) {
-    report_error_noloc("file not found: %s", filename);
-    goto out;
-  }
+  if (opts->include_reader)
+    return opts->include_reader(opts->include_reader_data, filename, size);
+
+  char *path = fs_abs_path(filename, opts->includeopts);
+  if (path == NULL)
+    return NULL;
+
+  if (opts->watch != NULL)
+    watch_binary(opts->watch, path);
+
+  *size = fs_file_size(path);
+  FILE *fp = fopen(path, "r");
 
-  file_size = fs_file_size(path);
-  fp = fopen(path, "r");
-  if (!fp) {
-    report_error_noloc("%s: %s", path, strerror(errno));
-    goto out;
+  if (fp == NULL) {
+    free(path);
+    report_error_noloc("%s: %s", filename, strerror(errno));
   }
 
-  source = (char *)xmalloc(file_size + 1);
-  sret = fread(source, file_size, 1, fp);
-  if (sret != 1) {
-    report_error_noloc("%s: %s", path, strerror(errno));
-    goto out;
+  char *data = (char *)xmalloc(*size + 1);
+  size_t ret = (*size > 0) ? fread(data, *size, 1, fp) : 1;
+  fclose(fp);
+
+  if (ret != 1) {
+    free(path);
+    xfree(data);
+    report_error_noloc("unable to read %u bytes from %s", *size, filename);
   }
 
-  source[file_size] = 0;
-  ret = parse_source(filename, source, statements);
+  data[*size] = '\0';
+
+  if (opts->deps != NULL)
+    deps_add(opts->deps, filename, path, data, *size);
+
+  free(path);
+
+  return data;
+}
+
+// missing file is reported at INCLUDE statement (from) which refers to it, NULL for the main source
+void report_not_found(parse_node *from, char *filename)
+{
+  if (from == NULL)
+    report_error_noloc("file not found: %s", filename);
+
+  generic_report_error(ERROR_OUT_LOC | ERROR_OUT_LINE | ERROR_OUT_POS, from->fn, from->line - 1, from->pos,
+                       "file not found: %s", filename);
+}
+
+int parse_include(char *filename, parse_node *from, compile_opts *opts, dynarray **statements)
+{
+  if (opts->watch != NULL)
+    return watch_parse(opts->watch, filename, from, opts, statements);
+
+  uint32_t size;
+  char *source = read_include(opts, filename, &size);
+
+  if (source == NULL)
+    report_not_found(from, filename);
+
+  int ret = parse_source(filename, source, opts, statements);
 
-out:
-  if (source)
-    xfree(source);
-  if (fp)
-    fclose(fp);
+  xfree(source);
 
   return ret;
 }
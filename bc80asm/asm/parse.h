@@ -3,7 +3,9 @@
 #include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "asm/bc80asm.h"
 #include "bits/mmgr.h"
 
 typedef struct dynarray dynarray;
@@ -29,6 +31,15 @@ typedef enum parse_type
   NODE_IF,
   NODE_ELSE,
   NODE_ENDIF,
+  NODE_DELAY,
+  NODE_FASTCOPY,
+  NODE_FASTFILL,
+  NODE_TABLE,
+  NODE_SWITCH,
+  NODE_FUNC,
+  NODE_ALIGN,
+  NODE_LOOPBOUND,
+  NODE_KEEP,
 } parse_type;
 
 typedef struct parse_node {
@@ -62,6 +73,7 @@ typedef struct {
   parse_node hdr;
   defkind kind;
   LIST *values;
+  bool compressed;  // DB_LZ: values are packed by LZ compressor
 } DEF;
 
 typedef struct {
@@ -80,6 +92,8 @@ typedef struct {
   litkind kind;
   char *strval;
   int ival;
+  int section;      // address of label: id of its section plus one, -1 if it's computed from
+                    // addresses otherwise (object output can't relocate it), 0 for number
 } LITERAL;
 
 typedef enum
@@ -121,6 +135,7 @@ typedef struct {
 typedef struct {
   parse_node hdr;
   LITERAL *filename;
+  bool compressed;  // INCBIN_LZ
 } INCBIN;
 
 typedef struct {
@@ -178,17 +193,77 @@ typedef struct {
   parse_node hdr;
 } ENDIF;
 
-extern parse_node *new_node_macro_holder;
+typedef struct {
+  parse_node hdr;
+  EXPR *cycles;
+  LIST *clobbers; // registers allowed to be changed by generated code (may be NULL)
+} DELAY;
+
+typedef struct {
+  parse_node hdr;
+  EXPR *src;
+  EXPR *dst;
+  EXPR *len;
+  EXPR *unroll;   // number of LDI instructions per loop iteration (may be NULL)
+  EQU *option;    // 'unroll = n' or 'budget = n' bytes of code (may be NULL)
+} FASTCOPY;
+
+typedef struct {
+  parse_node hdr;
+  EXPR *dst;
+  EXPR *len;
+  EXPR *value;
+  EQU *option;    // 'unroll = n' or 'budget = n' bytes of code (may be NULL)
+} FASTFILL;
+
+typedef struct {
+  parse_node hdr;
+  defkind kind;   // DEFKIND_DB or DEFKIND_DW
+  EXPR *count;
+  EXPR *value;    // evaluated for each element with I set to its index
+} TABLE;
+
+typedef struct {
+  parse_node hdr;
+  EXPR *reg;      // 8-bit register holding case index
+  LIST *cases;    // jump targets, one per index value
+} SWITCH;
+
+typedef struct {
+  parse_node hdr;
+  ID *name;
+  LIST *args;
+} FUNC;
+
+typedef struct {
+  parse_node hdr;
+  EXPR *value;
+} ALIGN;
+
+typedef struct {
+  parse_node hdr;
+  EXPR *count;    // the most times the next instruction jumps back to repeat its loop
+} LOOPBOUND;
+
+typedef struct {
+  parse_node hdr;
+  LIST *labels;   // labels kept by --gc-sections
+} KEEP;
+
+static inline parse_node *new_node_(size_t size, parse_type t, const char *tag, char *fn, int line, int pos)
+{
+  parse_node *node = (parse_node *)xmalloc2(size, tag);
+
+  memset(node, 0, size);
+  node->type = t;
+  node->line = line + 1;
+  node->pos = pos;
+  node->fn = fn;
+
+  return node;
+}
 
-#define new_node(size, t, fn_, line_, pos_) \
-( \
-  new_node_macro_holder = (parse_node *)xmalloc2(size, #t), \
-  new_node_macro_holder->type = (t),                        \
-  new_node_macro_holder->line = (line_)+1,                  \
-  new_node_macro_holder->pos = (pos_),                      \
-  new_node_macro_holder->fn = (fn_),                        \
-  new_node_macro_holder \
-)
+#define new_node(size, t, fn_, line_, pos_) new_node_((size), (t), #t, (fn_), (line_), (pos_))
 
 #define make_node(t, fn, line_, pos_)    ((t *) new_node(sizeof(t), NODE_##t, (fn), (line_), (pos_)))
 #define make_node_internal(t)    ((t *) new_node(sizeof(t), NODE_##t, NULL, 0, 0))
@@ -199,6 +274,7 @@ typedef struct hashmap hashmap;
 struct as_scanner_state {
   int line_num;
   int pos_num;
+  compile_opts *opts;     // for reading INCLUDE files
 };
 
 #define IS_INT_LITERAL(node) \
@@ -206,8 +282,10 @@ struct as_scanner_state {
 
 struct bc80asm_args;
 
-extern int parse_source(char *filename, char *source, dynarray **statements);
-extern int parse_include(char *filename, dynarray **statements);
+extern int parse_source(char *filename, char *source, compile_opts *opts, dynarray **statements);
+extern int parse_include(char *filename, parse_node *from, compile_opts *opts, dynarray **statements);
+extern void report_not_found(parse_node *from, char *filename);
+extern char *read_include(compile_opts *opts, char *filename, uint32_t *size);
 
 extern int parse_decnum(char *text, int len);
 extern int parse_hexnum(char *text, int len);
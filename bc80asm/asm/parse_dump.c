@@ -66,6 +66,42 @@ const char *get_parse_node_name(parse_node *node)
       return "endprofile";
       break;
     }
+    case NODE_DELAY: {
+      return "delay";
+      break;
+    }
+    case NODE_FASTCOPY: {
+      return "fastcopy";
+      break;
+    }
+    case NODE_FASTFILL: {
+      return "fastfill";
+      break;
+    }
+    case NODE_TABLE: {
+      return "table";
+      break;
+    }
+    case NODE_FUNC: {
+      return "function";
+      break;
+    }
+    case NODE_ALIGN: {
+      return "align";
+      break;
+    }
+    case NODE_LOOPBOUND: {
+      return "loopbound";
+      break;
+    }
+    case NODE_KEEP: {
+      return "keep";
+      break;
+    }
+    case NODE_SWITCH: {
+      return "switch";
+      break;
+    }
     default:
       break;
   }
@@ -99,7 +135,8 @@ void print_node(parse_node *node)
     case NODE_DEF: {
       DEF *l = (DEF *)node;
       printf("(%s ",
-        (l->kind == DEFKIND_DB ? "DB" :
+        (l->compressed ? "DB_LZ" :
+         l->kind == DEFKIND_DB ? "DB" :
          l->kind == DEFKIND_DM ? "DM" :
          l->kind == DEFKIND_DW ? "DW" :
          l->kind == DEFKIND_DS ? "DS" :
@@ -121,7 +158,7 @@ void print_node(parse_node *node)
     }
     case NODE_INCBIN: {
       INCBIN *l = (INCBIN *)node;
-      printf("(INCBIN ");
+      printf(l->compressed ? "(INCBIN_LZ " : "(INCBIN ");
       print_node((parse_node *)l->filename);
       printf(") ");
       break;
@@ -292,6 +329,102 @@ void print_node(parse_node *node)
     case NODE_ENDPROFILE:
       printf("(ENDPROFILE) ");
       break;
+    case NODE_DELAY: {
+      DELAY *d = (DELAY *)node;
+
+      printf("(DELAY ");
+      print_node((parse_node *)d->cycles);
+      if (d->clobbers)
+        print_node((parse_node *)d->clobbers);
+      printf(") ");
+
+      break;
+    }
+    case NODE_FASTCOPY: {
+      FASTCOPY *c = (FASTCOPY *)node;
+
+      printf("(FASTCOPY ");
+      print_node((parse_node *)c->src);
+      print_node((parse_node *)c->dst);
+      print_node((parse_node *)c->len);
+      if (c->unroll)
+        print_node((parse_node *)c->unroll);
+      if (c->option)
+        print_node((parse_node *)c->option);
+      printf(") ");
+
+      break;
+    }
+    case NODE_FASTFILL: {
+      FASTFILL *f = (FASTFILL *)node;
+
+      printf("(FASTFILL ");
+      print_node((parse_node *)f->dst);
+      print_node((parse_node *)f->len);
+      print_node((parse_node *)f->value);
+      if (f->option)
+        print_node((parse_node *)f->option);
+      printf(") ");
+
+      break;
+    }
+    case NODE_TABLE: {
+      TABLE *t = (TABLE *)node;
+
+      printf("(TABLE %s ", (t->kind == DEFKIND_DW) ? "dw" : "db");
+      print_node((parse_node *)t->count);
+      print_node((parse_node *)t->value);
+      printf(") ");
+
+      break;
+    }
+    case NODE_FUNC: {
+      FUNC *f = (FUNC *)node;
+
+      printf("(FUNC ");
+      print_node((parse_node *)f->name);
+      print_node((parse_node *)f->args);
+      printf(") ");
+
+      break;
+    }
+    case NODE_ALIGN: {
+      ALIGN *a = (ALIGN *)node;
+
+      printf("(ALIGN ");
+      print_node((parse_node *)a->value);
+      printf(") ");
+
+      break;
+    }
+    case NODE_LOOPBOUND: {
+      LOOPBOUND *lb = (LOOPBOUND *)node;
+
+      printf("(LOOPBOUND ");
+      print_node((parse_node *)lb->count);
+      printf(") ");
+
+      break;
+    }
+    case NODE_KEEP: {
+      KEEP *k = (KEEP *)node;
+
+      printf("(KEEP ");
+      print_node((parse_node *)k->labels);
+      printf(") ");
+
+      break;
+    }
+    case NODE_SWITCH: {
+      SWITCH *sw = (SWITCH *)node;
+
+      printf("(SWITCH ");
+      print_node((parse_node *)sw->reg);
+      print_node((parse_node *)sw->cases);
+      printf(") ");
+
+      break;
+    }
     default:
       break;
   }
@@ -303,7 +436,8 @@ static void node_to_string_recurse(parse_node *node, buffer *buf)
     case NODE_DEF: {
       DEF *l = (DEF *)node;
       buffer_append(buf, "%s ",
-        (l->kind == DEFKIND_DB ? "DB" :
+        (l->compressed ? "DB_LZ" :
+         l->kind == DEFKIND_DB ? "DB" :
          l->kind == DEFKIND_DM ? "DM" :
          l->kind == DEFKIND_DW ? "DW" :
          l->kind == DEFKIND_DS ? "DS" :
@@ -319,7 +453,7 @@ static void node_to_string_recurse(parse_node *node, buffer *buf)
     }
     case NODE_INCBIN: {
       INCBIN *l = (INCBIN *)node;
-      buffer_append(buf, "INCBIN ");
+      buffer_append(buf, l->compressed ? "INCBIN_LZ " : "INCBIN ");
       node_to_string_recurse((parse_node *)l->filename, buf);
       break;
     }
@@ -530,6 +664,100 @@ static void node_to_string_recurse(parse_node *node, buffer *buf)
     case NODE_ENDPROFILE:
       buffer_append(buf, "ENDPROFILE ");
       break;
+    case NODE_DELAY: {
+      DELAY *d = (DELAY *)node;
+
+      buffer_append(buf, "DELAY ");
+      node_to_string_recurse((parse_node *)d->cycles, buf);
+      if (d->clobbers) {
+        buffer_append(buf, ", ");
+        node_to_string_recurse((parse_node *)d->clobbers, buf);
+      }
+
+      break;
+    }
+    case NODE_FASTCOPY: {
+      FASTCOPY *c = (FASTCOPY *)node;
+
+      buffer_append(buf, "FASTCOPY ");
+      node_to_string_recurse((parse_node *)c->src, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)c->dst, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)c->len, buf);
+      if (c->unroll) {
+        buffer_append(buf, ", ");
+        node_to_string_recurse((parse_node *)c->unroll, buf);
+      }
+
+      break;
+    }
+    case NODE_FASTFILL: {
+      FASTFILL *f = (FASTFILL *)node;
+
+      buffer_append(buf, "FASTFILL ");
+      node_to_string_recurse((parse_node *)f->dst, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)f->len, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)f->value, buf);
+
+      break;
+    }
+    case NODE_TABLE: {
+      TABLE *t = (TABLE *)node;
+
+      buffer_append(buf, (t->kind == DEFKIND_DW) ? "TABLE DW, " : "TABLE DB, ");
+      node_to_string_recurse((parse_node *)t->count, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)t->value, buf);
+
+      break;
+    }
+    case NODE_FUNC: {
+      FUNC *f = (FUNC *)node;
+
+      node_to_string_recurse((parse_node *)f->name, buf);
+      buffer_append(buf, "(");
+      node_to_string_recurse((parse_node *)f->args, buf);
+      buffer_append(buf, ")");
+
+      break;
+    }
+    case NODE_ALIGN: {
+      ALIGN *a = (ALIGN *)node;
+
+      buffer_append(buf, "ALIGN ");
+      node_to_string_recurse((parse_node *)a->value, buf);
+
+      break;
+    }
+    case NODE_LOOPBOUND: {
+      LOOPBOUND *lb = (LOOPBOUND *)node;
+
+      buffer_append(buf, "LOOPBOUND ");
+      node_to_string_recurse((parse_node *)lb->count, buf);
+
+      break;
+    }
+    case NODE_KEEP: {
+      KEEP *k = (KEEP *)node;
+
+      buffer_append(buf, "KEEP ");
+      node_to_string_recurse((parse_node *)k->labels, buf);
+
+      break;
+    }
+    case NODE_SWITCH: {
+      SWITCH *sw = (SWITCH *)node;
+
+      buffer_append(buf, "SWITCH ");
+      node_to_string_recurse((parse_node *)sw->reg, buf);
+      buffer_append(buf, ", ");
+      node_to_string_recurse((parse_node *)sw->cases, buf);
+
+      break;
+    }
     default:
       break;
   }
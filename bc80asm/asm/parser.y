@@ -7,18 +7,17 @@
     #include "bits/error.h"
     #include "bits/mmgr.h"
 
-    #define YY_DECL int yylex (yyscan_t yyscanner, char *filename, char *source)
     #include "parser.tab.h"
     #include "lexer.yy.h"
 
-    extern int yylex (yyscan_t yyscanner, char *filename, char *source);
+    extern int yylex (YYSTYPE *yylval_param, YYLTYPE *yylloc_param, yyscan_t yyscanner, char *filename, char *source);
 
-    void yyerror(yyscan_t scanner, dynarray **statements, char *filename, char *source, const char *msg)
+    void yyerror(YYLTYPE *llocp, yyscan_t scanner, dynarray **statements, char *filename, char *source, const char *msg)
     {
       (void)scanner;
       (void)statements;
       generic_report_error(ERROR_OUT_LOC | ERROR_OUT_LINE,
-        filename, yylloc.first_line + 1, 0,
+        filename, llocp->first_line + 1, 0,
         (char *) msg);
     }
 
@@ -44,13 +43,15 @@
 }
 
 %locations
+%define api.pure full
 %define parse.error custom
 
 %token <str> T_ID T_STR
 %token <ival> T_INT
 %token T_DOLLAR T_LPAR T_RPAR T_MINUS T_PLUS T_MUL T_DIV T_COMMA T_COLON T_ORG T_EQU T_END T_DB
 %token T_DM T_DW T_DS T_INCBIN T_INCLUDE T_NOT T_INV T_AND T_OR T_NL T_SECTION T_PERCENT T_SHL T_SHR
-%token T_REPT T_ENDR T_PROFILE T_ENDPROFILE T_IF T_ELSE T_ENDIF
+%token T_REPT T_ENDR T_PROFILE T_ENDPROFILE T_IF T_ELSE T_ENDIF T_DELAY
+%token T_FASTCOPY T_FASTFILL T_TABLE T_ALIGN T_SWITCH T_LOOPBOUND T_INCBIN_LZ T_DB_LZ T_KEEP
 %token T_EQ T_NE T_LT T_LE T_GT T_GE
 
 %type <node> id str integer dollar simple_expr unary_expr expr exprlist keyvalue kvlist
@@ -110,6 +111,12 @@ simple_expr
         $$ = $2;
         ((EXPR *)$$)->hdr.is_ref = true;
       }
+      | id T_LPAR exprlist T_RPAR {
+        FUNC *l = make_node(FUNC, filename, @1.first_line, @1.first_column);
+        l->name = (ID *)$1;
+        l->args = (LIST *)$3;
+        $$ = (parse_node *)l;
+      }
       ;
 
 unary_expr
@@ -269,6 +276,96 @@ stmt
         ENDIF *l = make_node(ENDIF, filename, @1.first_line, @1.first_column);
         *statements = dynarray_append_ptr(*statements, l);
       }
+      | T_DELAY expr {
+        DELAY *l = make_node(DELAY, filename, @1.first_line, @1.first_column);
+        l->cycles = (EXPR *)$2;
+        l->clobbers = NULL;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_DELAY expr T_COMMA exprlist {
+        DELAY *l = make_node(DELAY, filename, @1.first_line, @1.first_column);
+        l->cycles = (EXPR *)$2;
+        l->clobbers = (LIST *)$4;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_FASTCOPY expr T_COMMA expr T_COMMA expr {
+        FASTCOPY *l = make_node(FASTCOPY, filename, @1.first_line, @1.first_column);
+        l->src = (EXPR *)$2;
+        l->dst = (EXPR *)$4;
+        l->len = (EXPR *)$6;
+        l->unroll = NULL;
+        l->option = NULL;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_FASTCOPY expr T_COMMA expr T_COMMA expr T_COMMA expr {
+        FASTCOPY *l = make_node(FASTCOPY, filename, @1.first_line, @1.first_column);
+        l->src = (EXPR *)$2;
+        l->dst = (EXPR *)$4;
+        l->len = (EXPR *)$6;
+        l->unroll = (EXPR *)$8;
+        l->option = NULL;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_FASTCOPY expr T_COMMA expr T_COMMA expr T_COMMA keyvalue {
+        FASTCOPY *l = make_node(FASTCOPY, filename, @1.first_line, @1.first_column);
+        l->src = (EXPR *)$2;
+        l->dst = (EXPR *)$4;
+        l->len = (EXPR *)$6;
+        l->unroll = NULL;
+        l->option = (EQU *)$8;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_ALIGN expr {
+        ALIGN *l = make_node(ALIGN, filename, @1.first_line, @1.first_column);
+        l->value = (EXPR *)$2;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_LOOPBOUND expr {
+        LOOPBOUND *l = make_node(LOOPBOUND, filename, @1.first_line, @1.first_column);
+        l->count = (EXPR *)$2;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_KEEP exprlist {
+        KEEP *l = make_node(KEEP, filename, @1.first_line, @1.first_column);
+        l->labels = (LIST *)$2;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_TABLE T_DB T_COMMA expr T_COMMA expr {
+        TABLE *l = make_node(TABLE, filename, @1.first_line, @1.first_column);
+        l->kind = DEFKIND_DB;
+        l->count = (EXPR *)$4;
+        l->value = (EXPR *)$6;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_TABLE T_DW T_COMMA expr T_COMMA expr {
+        TABLE *l = make_node(TABLE, filename, @1.first_line, @1.first_column);
+        l->kind = DEFKIND_DW;
+        l->count = (EXPR *)$4;
+        l->value = (EXPR *)$6;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_SWITCH expr T_COMMA exprlist {
+        SWITCH *l = make_node(SWITCH, filename, @1.first_line, @1.first_column);
+        l->reg = (EXPR *)$2;
+        l->cases = (LIST *)$4;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_FASTFILL expr T_COMMA expr T_COMMA expr {
+        FASTFILL *l = make_node(FASTFILL, filename, @1.first_line, @1.first_column);
+        l->dst = (EXPR *)$2;
+        l->len = (EXPR *)$4;
+        l->value = (EXPR *)$6;
+        l->option = NULL;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
+      | T_FASTFILL expr T_COMMA expr T_COMMA expr T_COMMA keyvalue {
+        FASTFILL *l = make_node(FASTFILL, filename, @1.first_line, @1.first_column);
+        l->dst = (EXPR *)$2;
+        l->len = (EXPR *)$4;
+        l->value = (EXPR *)$6;
+        l->option = (EQU *)$8;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
       | id T_COLON T_EQU expr {
         EQU *l = make_node(EQU, filename, @1.first_line, @1.first_column);
         l->name = (ID *)$1;
@@ -286,9 +383,16 @@ stmt
         l->filename = (LITERAL *)$2;
         *statements = dynarray_append_ptr(*statements, l);
       }
+      | T_INCBIN_LZ str {
+        INCBIN *l = make_node(INCBIN, filename, @1.first_line, @1.first_column);
+        l->filename = (LITERAL *)$2;
+        l->compressed = true;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
       | T_INCLUDE str {
         LITERAL *lfilename = (LITERAL *)$2;
-        parse_include(lfilename->strval, statements);
+        struct as_scanner_state *sstate = (struct as_scanner_state *)yyget_extra(scanner);
+        parse_include(lfilename->strval, $2, sstate->opts, statements);
       }
       | T_DB exprlist {
         DEF *l = make_node(DEF, filename, @1.first_line, @1.first_column);
@@ -296,6 +400,13 @@ stmt
         l->values = (LIST *)$2;
         *statements = dynarray_append_ptr(*statements, l);
       }
+      | T_DB_LZ exprlist {
+        DEF *l = make_node(DEF, filename, @1.first_line, @1.first_column);
+        l->kind = DEFKIND_DB;
+        l->values = (LIST *)$2;
+        l->compressed = true;
+        *statements = dynarray_append_ptr(*statements, l);
+      }
       | T_DM exprlist {
         DEF *l = make_node(DEF, filename, @1.first_line, @1.first_column);
         l->kind = DEFKIND_DM;
@@ -384,11 +495,14 @@ static int yyreport_syntax_error(const yypcontext_t *yyctx, void* scanner, dynar
     }
   }
 
-  char *errstr = buffer_dup(errmsg);
+  // buffer_dup() doesn't terminate the string
+  char *errstr = bsprintf("%s", errmsg->data);
   buffer_free(errmsg);
 
+  YYLTYPE *errloc = yypcontext_location(yyctx);
+
   generic_report_error(ERROR_OUT_LOC | ERROR_OUT_LINE | ERROR_OUT_POS,
-    filename, yylloc.first_line, yylloc.first_column,
-    errstr);
+    filename, errloc->first_line, errloc->first_column,
+    "%s", errstr);
   return res;
 }
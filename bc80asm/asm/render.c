@@ -1,6 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "asm/analysis.h"
+#include "asm/gc.h"
+#include "asm/map.h"
 #include "asm/render.h"
 #include "bits/buffer.h"
 #include "bits/filesystem.h"
@@ -16,6 +20,11 @@ void render_start(compile_ctx_t *ctx)
   defsect->content = buffer_init();
   defsect->name = xstrdup(DEFAULT_SECTION_NAME);
   defsect->filler = 0;
+  defsect->align = 1;
+  defsect->padding = 0;
+  defsect->pack = false;
+  defsect->falls_through = false;
+  defsect->gaps = NULL;
 
   ctx->sections = dynarray_append_ptr(ctx->sections, defsect);
   ctx->curr_section_id = 0;
@@ -28,11 +37,21 @@ static uint32_t render_raw(compile_ctx_t *ctx, char **dest_buf)
   return output->len;
 }
 
-uint32_t render_finish(compile_ctx_t *ctx, char **dest_buf)
+uint32_t render_finish(compile_ctx_t *ctx, int target, char **dest_buf)
 {
   assert(dest_buf);
 
-  int target = ctx->opts.target;
+  // sources compiled for object output too have relocations instead of undefined symbols
+  if (target != ASM_TARGET_ELF) {
+    dynarray_cell *dc;
+
+    foreach (dc, ctx->relocs) {
+      reloc_t *reloc = (reloc_t *)dfirst(dc);
+
+      if (reloc->name != NULL)
+        report_error_noloc("unresolved symbol %s: only object output can refer to other objects", reloc->name);
+    }
+  }
 
   if (target == ASM_TARGET_RAW) {
     if (dynarray_length(ctx->sections) > 1)
@@ -43,6 +62,10 @@ uint32_t render_finish(compile_ctx_t *ctx, char **dest_buf)
     return render_elf(ctx, dest_buf);
   } else if (target == ASM_TARGET_SNA) {
     return render_sna(ctx, dest_buf);
+  } else if (target == ASM_TARGET_HEX) {
+    return render_hex(ctx, dest_buf);
+  } else if (target == ASM_TARGET_RANGES) {
+    return render_ranges(ctx, dest_buf);
   } else {
     report_error(ctx, "unsupported target %d", target);
   }
@@ -50,16 +73,55 @@ uint32_t render_finish(compile_ctx_t *ctx, char **dest_buf)
   return 0;
 }
 
-void render_byte(compile_ctx_t *ctx, char b, int cycles)
+// jumps, returns and HALT don't continue into the following code
+static void track_flow(section_ctx_t *section, int size)
+{
+  uint8_t *op = (uint8_t *)&section->content->data[section->content->len - size];
+
+  // jp nn, jr e, ret, halt, jp (hl)
+  bool ends = (op[0] == 0xC3 || op[0] == 0x18 || op[0] == 0xC9 || op[0] == 0x76 || op[0] == 0xE9);
+
+  // jp (ix), jp (iy), retn, reti
+  if (size == 2) {
+    ends |= ((op[0] == 0xDD || op[0] == 0xFD) && op[1] == 0xE9);
+    ends |= (op[0] == 0xED && (op[1] == 0x45 || op[1] == 0x4D));
+  }
+
+  section->falls_through = !ends;
+}
+
+// Rendered bytes are told code or data here once, the same way as PROFILE tells code blocks
+// from data ones: instructions are rendered with their timing, data and padding without it.
+// Code is passed further to code analysis, memory map and garbage collection.
+static void render_track(compile_ctx_t *ctx, int size, int cycles)
 {
   section_ctx_t *section = get_current_section(ctx);
-  buffer_append_char(section->content, b);
-  section->curr_pc += 1;
+
+  ctx->cycles += cycles;
 
   if (ctx->in_profile) {
     ctx->current_profile.cycles += cycles;
-    ctx->current_profile.bytes += 1;
+    ctx->current_profile.bytes += size;
   }
+
+  if (cycles == 0) {
+    section->falls_through = false;
+    return;
+  }
+
+  track_flow(section, size);
+  analysis_code(ctx, size, cycles);
+  map_code(ctx, size, cycles);
+  gc_code(ctx, size, cycles);
+}
+
+void render_byte(compile_ctx_t *ctx, char b, int cycles)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  buffer_append_char(section->content, b);
+  section->curr_pc += 1;
+
+  render_track(ctx, 1, cycles);
 }
 
 void render_2bytes(compile_ctx_t *ctx, char b1, char b2, int cycles)
@@ -69,10 +131,7 @@ void render_2bytes(compile_ctx_t *ctx, char b1, char b2, int cycles)
   buffer_append_char(section->content, b2);
   section->curr_pc += 2;
 
-  if (ctx->in_profile) {
-    ctx->current_profile.cycles += cycles;
-    ctx->current_profile.bytes += 2;
-  }
+  render_track(ctx, 2, cycles);
 }
 
 void render_3bytes(compile_ctx_t *ctx, char b1, char b2, char b3, int cycles)
@@ -83,10 +142,7 @@ void render_3bytes(compile_ctx_t *ctx, char b1, char b2, char b3, int cycles)
   buffer_append_char(section->content, b3);
   section->curr_pc += 3;
 
-  if (ctx->in_profile) {
-    ctx->current_profile.cycles += cycles;
-    ctx->current_profile.bytes += 3;
-  }
+  render_track(ctx, 3, cycles);
 }
 
 void render_4bytes(compile_ctx_t *ctx, char b1, char b2, char b3, char b4, int cycles)
@@ -98,10 +154,7 @@ void render_4bytes(compile_ctx_t *ctx, char b1, char b2, char b3, char b4, int c
   buffer_append_char(section->content, b4);
   section->curr_pc += 4;
 
-  if (ctx->in_profile) {
-    ctx->current_profile.cycles += cycles;
-    ctx->current_profile.bytes += 4;
-  }
+  render_track(ctx, 4, cycles);
 }
 
 void render_word(compile_ctx_t *ctx, int ival)
@@ -111,6 +164,7 @@ void render_word(compile_ctx_t *ctx, int ival)
   buffer_append_char(section->content, ival & 0xff);
   buffer_append_char(section->content, (ival >> 8) & 0xff);
   section->curr_pc += 2;
+  section->falls_through = false;
 
   if (ctx->in_profile) {
     ctx->current_profile.bytes += 2;
@@ -122,6 +176,7 @@ void render_bytes(compile_ctx_t *ctx, char *buf, uint32_t len)
   section_ctx_t *section = get_current_section(ctx);
   buffer_append_binary(section->content, buf, len);
   section->curr_pc += len;
+  section->falls_through = false;
 
   if (ctx->in_profile) {
     ctx->current_profile.bytes += len;
@@ -144,28 +199,83 @@ void render_block(compile_ctx_t *ctx, char filler, uint32_t len)
   }
 }
 
-void render_from_file(compile_ctx_t *ctx, char *filename, dynarray *includeopts)
+// adjacent gaps are merged into one
+static void add_gap(section_ctx_t *section, uint32_t pos, uint32_t len)
 {
-  section_ctx_t *section = get_current_section(ctx);
+  int ngaps = dynarray_length(section->gaps) / 2;
 
-  char *path = fs_abs_path(filename, includeopts);
-  if (path == NULL) {
-    report_error(ctx, "file not found: %s", filename);
+  if (len == 0)
     return;
+
+  if (ngaps > 0) {
+    dynarray_cell *last_pos = dynarray_nth_cell(section->gaps, 2 * ngaps - 2);
+    dynarray_cell *last_len = dynarray_nth_cell(section->gaps, 2 * ngaps - 1);
+
+    if ((uint32_t)(last_pos->int_value + last_len->int_value) == pos) {
+      last_len->int_value += len;
+      return;
+    }
+  }
+
+  section->gaps = dynarray_append_int(section->gaps, pos);
+  section->gaps = dynarray_append_int(section->gaps, len);
+}
+
+// filler of ALIGN and similar directives which only moves PC forward
+void render_padding(compile_ctx_t *ctx, uint32_t len)
+{
+  section_ctx_t *section = get_current_section(ctx);
+
+  add_gap(section, section->content->len, len);
+  render_block(ctx, section->filler, len);
+  section->padding += len;
+}
+
+// bytes written over filler after it's rendered (e.g. RST trampolines) aren't gap anymore
+void render_ungap(section_ctx_t *section, uint32_t pos, uint32_t len)
+{
+  dynarray *gaps = section->gaps;
+  uint32_t end = pos + len;
+
+  section->gaps = NULL;
+
+  for (int i = 0; i + 1 < dynarray_length(gaps); i += 2) {
+    uint32_t gap_pos = dfirst_int(dynarray_nth_cell(gaps, i));
+    uint32_t gap_end = gap_pos + dfirst_int(dynarray_nth_cell(gaps, i + 1));
+
+    // parts of gap before and after written bytes are kept
+    if (gap_pos < pos)
+      add_gap(section, gap_pos, ((gap_end < pos) ? gap_end : pos) - gap_pos);
+
+    if (gap_end > end) {
+      uint32_t tail = (gap_pos > end) ? gap_pos : end;
+      add_gap(section, tail, gap_end - tail);
+    }
   }
 
-  size_t size = fs_file_size(path);
-  char *buf = xmalloc(size);
+  dynarray_free(gaps);
+}
+
+char *load_from_file(compile_ctx_t *ctx, char *filename, uint32_t *size)
+{
+  char *buf = read_include(&ctx->opts, filename, size);
+  if (buf == NULL)
+    report_error(ctx, "file not found: %s", filename);
+
+  return buf;
+}
 
-  FILE *fp = fopen(path, "r");
-  size_t ret = fread(buf, size, 1, fp);
-  if (ret != 1)
-    report_error(ctx, "unable to read %ld bytes from %s", size, filename);
-  fclose(fp);
+void render_from_file(compile_ctx_t *ctx, char *filename)
+{
+  section_ctx_t *section = get_current_section(ctx);
+  uint32_t size;
+
+  char *buf = load_from_file(ctx, filename, &size);
 
   buffer_append_binary(section->content, buf, size);
   xfree(buf);
   section->curr_pc += size;
+  section->falls_through = false;
 
   if (ctx->in_profile) {
     ctx->current_profile.bytes += size;
@@ -182,6 +292,8 @@ void render_reorg(compile_ctx_t *ctx)
   } else {
     // enlarge buffer and fill up to new org
     size_t fill_size = section->curr_pc - section->start - section->content->len;
+    add_gap(section, section->content->len, fill_size);
+
     char *tmp = xmalloc(fill_size);
     memset(tmp, section->filler, fill_size);
     buffer_append_binary(section->content, tmp, fill_size);
@@ -14,11 +14,20 @@ extern void render_4bytes(compile_ctx_t *ctx, char b1, char b2, char b3, char b4
 extern void render_word(compile_ctx_t *ctx, int ival);
 extern void render_bytes(compile_ctx_t *ctx, char *buf, uint32_t len);
 extern void render_block(compile_ctx_t *ctx, char filler, uint32_t len);
-extern void render_from_file(compile_ctx_t *ctx, char *filename, dynarray *includeopts);
+extern void render_padding(compile_ctx_t *ctx, uint32_t len);
+extern void render_ungap(section_ctx_t *section, uint32_t pos, uint32_t len);
+extern char *load_from_file(compile_ctx_t *ctx, char *filename, uint32_t *size);
+extern void render_from_file(compile_ctx_t *ctx, char *filename);
 extern void render_reorg(compile_ctx_t *ctx);
 extern void render_patch(compile_ctx_t *ctx, patch_t *patch, int value);
 
 extern void render_start(compile_ctx_t *ctx);
-extern uint32_t render_finish(compile_ctx_t *ctx, char **dest_buf);
+extern uint32_t render_finish(compile_ctx_t *ctx, int target, char **dest_buf);
 extern uint32_t render_sna(compile_ctx_t *ctx, char **dest_buf);
-extern uint32_t render_elf(compile_ctx_t *ctx, char **dest_buf);
\ No newline at end of file
+extern uint32_t render_hex(compile_ctx_t *ctx, char **dest_buf);
+extern uint32_t render_ranges(compile_ctx_t *ctx, char **dest_buf);
+extern uint32_t render_elf(compile_ctx_t *ctx, char **dest_buf);
+extern void render_elf_symbol(compile_ctx_t *ctx, const char *name, uint32_t addr, bool local);
+extern void render_elf_reloc(compile_ctx_t *ctx, patch_t *patch, parse_node *unresolved);
+extern void render_elf_address(compile_ctx_t *ctx, patch_t *patch, LITERAL *value);
+extern void render_elf_free(compile_ctx_t *ctx);
\ No newline at end of file
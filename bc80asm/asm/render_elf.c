@@ -1,104 +1,440 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "asm/elf.h"
 #include "asm/render.h"
 #include "bits/buffer.h"
+#include "bits/hashmap.h"
 
 #define SHSTRTAB_NAME ".shstrtab"
+#define SYMTAB_NAME ".symtab"
+#define STRTAB_NAME ".strtab"
+#define RELA_PREFIX ".rela"
+
+// Object file layout: null section, sections of the source, .rela<name> for every section
+// with relocations, .symtab, .strtab and .shstrtab.
+//
+// Sections have addresses given by ORG (filler in front of the first one isn't written),
+// but linker could move them: every address of label written to output is relocated against
+// symbol of its section, references to symbols defined elsewhere against these symbols.
+// Symbol values and relocation offsets are relative to section start as usual for
+// relocatable files.
+
+void render_elf_symbol(compile_ctx_t *ctx, const char *name, uint32_t addr, bool local)
+{
+  if (ctx->opts.target != ASM_TARGET_ELF)
+    return;
+
+  symbol_t *sym = (symbol_t *)xmalloc(sizeof(symbol_t));
+  sym->name = xstrdup(name);
+  sym->section_id = ctx->curr_section_id;
+  sym->addr = addr;
+  sym->local = local;
+
+  ctx->symbols = dynarray_append_ptr(ctx->symbols, sym);
+}
+
+// symbol plus or minus constant
+static bool reloc_target(parse_node *node, ID **id, int *addend)
+{
+  EXPR *expr = (EXPR *)node;
+
+  if (node->type == NODE_ID) {
+    *id = (ID *)node;
+    return true;
+  }
+
+  if (node->type != NODE_EXPR)
+    return false;
+
+  if (expr->kind == SIMPLE || expr->kind == UNARY_PLUS)
+    return reloc_target(expr->left, id, addend);
+
+  if (expr->kind != BINARY_PLUS && expr->kind != BINARY_MINUS)
+    return false;
+
+  LITERAL *l = (LITERAL *)expr->right;
+
+  if (expr->left->type == NODE_ID && IS_INT_LITERAL(l)) {
+    *id = (ID *)expr->left;
+    *addend = (expr->kind == BINARY_PLUS) ? l->ival : -l->ival;
+    return true;
+  }
+
+  l = (LITERAL *)expr->left;
+
+  if (expr->kind == BINARY_PLUS && IS_INT_LITERAL(l) && expr->right->type == NODE_ID) {
+    *id = (ID *)expr->right;
+    *addend = l->ival;
+    return true;
+  }
+
+  return false;
+}
+
+void render_elf_reloc(compile_ctx_t *ctx, patch_t *patch, parse_node *unresolved)
+{
+  section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, patch->section_id));
+  ID *id = NULL;
+  int addend = 0;
+
+  ctx->node = unresolved;
+
+  // DS filler is repeated for every byte of the block
+  if (patch->nbytes > 2)
+    report_error(ctx, "can't relocate %s: DS filler must be defined in this source", node_to_string(patch->node));
+
+  if (!reloc_target(unresolved, &id, &addend))
+    report_error(ctx, "can't relocate %s: undefined symbol is allowed only with constant added or subtracted",
+      node_to_string(patch->node));
+
+  reloc_t *reloc = (reloc_t *)xmalloc(sizeof(reloc_t));
+  reloc->section_id = patch->section_id;
+  reloc->pos = patch->pos;
+  reloc->nbytes = patch->nbytes;
+  reloc->relative = patch->relative;
+  reloc->name = xstrdup(id->name);
+  reloc->target_section = -1;
+  reloc->addend = addend;
+
+  // displacement is counted from the end of instruction rather than from the patched byte
+  if (patch->relative)
+    reloc->addend += section->start + patch->pos - patch->instr_pc;
+
+  ctx->relocs = dynarray_append_ptr(ctx->relocs, reloc);
+}
+
+void render_elf_address(compile_ctx_t *ctx, patch_t *patch, LITERAL *value)
+{
+  section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, patch->section_id));
+  int target = value->section - 1;
+
+  // relative jump within section doesn't change wherever section is placed
+  if (patch->relative && target == patch->section_id)
+    return;
+
+  // forward references only, others are checked as they're written (see register_addr_lookup())
+  ctx->node = patch->node;
+
+  if (value->section == -1)
+    report_error(ctx, "can't relocate %s: only label address plus or minus constant is allowed in object file",
+      node_to_string(patch->node));
+
+  if (patch->nbytes > 2)
+    report_error(ctx, "can't relocate %s: DS filler can't be address", node_to_string(patch->node));
+
+  reloc_t *reloc = (reloc_t *)xmalloc(sizeof(reloc_t));
+  reloc->section_id = patch->section_id;
+  reloc->pos = patch->pos;
+  reloc->nbytes = patch->nbytes;
+  reloc->relative = patch->relative;
+  reloc->name = NULL;
+  reloc->target_section = target;
+  reloc->addend = value->ival;
+
+  if (target != -1)
+    reloc->addend -= ((section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, target)))->start;
+
+  if (patch->relative)
+    reloc->addend += section->start + patch->pos - patch->instr_pc;
+
+  ctx->relocs = dynarray_append_ptr(ctx->relocs, reloc);
+}
+
+void render_elf_free(compile_ctx_t *ctx)
+{
+  dynarray_cell *dc;
+
+  foreach (dc, ctx->symbols) {
+    symbol_t *sym = (symbol_t *)dfirst(dc);
+
+    xfree(sym->name);
+    xfree(sym);
+  }
+
+  foreach (dc, ctx->relocs) {
+    reloc_t *reloc = (reloc_t *)dfirst(dc);
+
+    xfree(reloc->name);
+    xfree(reloc);
+  }
+
+  dynarray_free(ctx->symbols);
+  dynarray_free(ctx->relocs);
+  ctx->symbols = NULL;
+  ctx->relocs = NULL;
+}
+
+static void append_symbol(buffer *symtab, buffer *strtab, const char *name, uint32_t value, int bind, int type,
+  int shndx)
+{
+  elf_symbol sym = {0};
+
+  // nameless symbols share the empty string at the start of table
+  if (name[0] != '\0') {
+    sym.st_name = buffer_append(strtab, "%s", name);
+    buffer_append_char(strtab, '\0');
+  }
+
+  sym.st_value = value;
+  sym.st_info = ELF32_ST_INFO(bind, type);
+  sym.st_shndx = shndx;
+
+  buffer_append_binary(symtab, (char *)&sym, sizeof(sym));
+}
+
+static void append_defined_symbols(compile_ctx_t *ctx, buffer *symtab, buffer *strtab, uint32_t *origins, bool local)
+{
+  dynarray_cell *dc;
+
+  foreach (dc, ctx->symbols) {
+    symbol_t *sym = (symbol_t *)dfirst(dc);
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, sym->section_id));
+    uint32_t value = sym->addr - section->start - origins[sym->section_id];
+
+    if (sym->local == local)
+      append_symbol(symtab, strtab, sym->name, value, local ? STB_LOCAL : STB_GLOBAL, STT_NOTYPE, sym->section_id + 1);
+  }
+}
+
+// ORG filler in front of the first byte of section isn't written, unless labels are there
+static uint32_t section_origin(compile_ctx_t *ctx, int section_id)
+{
+  section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, section_id));
+  dynarray_cell *dc;
+
+  if (dynarray_length(section->gaps) == 0 || dfirst_int(dynarray_nth_cell(section->gaps, 0)) != 0)
+    return 0;
+
+  uint32_t origin = dfirst_int(dynarray_nth_cell(section->gaps, 1));
+
+  foreach (dc, ctx->symbols) {
+    symbol_t *sym = (symbol_t *)dfirst(dc);
+
+    if (sym->section_id == section_id && sym->addr - section->start < origin)
+      origin = sym->addr - section->start;
+  }
+
+  return origin;
+}
 
 uint32_t render_elf(compile_ctx_t *ctx, char **dest_buf)
 {
   dynarray_cell *dc;
-  uint32_t elfsize = 0;
+  int nsections = dynarray_length(ctx->sections);
 
-  // add section to store section names (now it's empty, will populate it on the fly)
-  section_ctx_t *shstrtab = (section_ctx_t *)xmalloc(sizeof(section_ctx_t));
-  shstrtab->content = buffer_init();
-  shstrtab->name = xstrdup(SHSTRTAB_NAME);
-  buffer_append_char(shstrtab->content, '\0');  // first byte in strtab is always zero
-  ctx->sections = dynarray_append_ptr(ctx->sections, shstrtab);
+  // symbol table: locals go first as required, undefined symbols are added once for all
+  // their references
 
-  // start building elf file
-  buffer *elf = buffer_init();
-  int elf_fh_offset = buffer_reserve(elf, sizeof(elf_file_header));
-  elf_file_header *elf_fh = (elf_file_header *)&elf->data[elf_fh_offset];
-
-  elf_fh->ei_magic[0] = 0x7f;
-  elf_fh->ei_magic[1] = 0x45;
-  elf_fh->ei_magic[2] = 0x4c;
-  elf_fh->ei_magic[3] = 0x46;
-
-  elf_fh->ei_class = ELFCLASS32;
-  elf_fh->ei_data = ELFDATA2LSB;
-  elf_fh->ei_version = EIV_CURRENT;
-  elf_fh->ei_osabi = ELFOSABI_NONE;
-  elf_fh->ei_abiversion = 0;
-
-  elf_fh->e_type = ET_REL;
-  elf_fh->e_machine = EM_NONE;
-  elf_fh->e_version = EV_CURRENT;
-
-  elf_fh->e_entry = 0;
-  elf_fh->e_phoff = 0;
-  elf_fh->e_shoff = elf->len; // section headers follow right after elf_file_header
-  elf_fh->e_flags = 0;
-  elf_fh->e_ehsize = sizeof(elf_file_header);
-  elf_fh->e_phentsize = 32;
-  elf_fh->e_phnum = 0;
-  elf_fh->e_shentsize = sizeof(elf_section_header);
-  elf_fh->e_shnum = dynarray_length(ctx->sections);
-  elf_fh->e_shstrndx = dynarray_length(ctx->sections) - 1; // .shstrtab is always last section
-
-  elf_section_header **sech_ptrs = (elf_section_header **)xmalloc(sizeof(elf_section_header *) * dynarray_length(ctx->sections));
-
-  int i = 0;
-  foreach (dc, ctx->sections) {
-    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+  buffer *symtab = buffer_init();
+  buffer *strtab = buffer_init();
+  hashmap *undefined = hashmap_create(256, "elf_undefined");
+  uint32_t *origins = (uint32_t *)xmalloc(sizeof(uint32_t) * (nsections + 1));
 
-    int sech_offset = buffer_reserve(elf, sizeof(elf_section_header));
-    elf_section_header *sech = (elf_section_header *)&elf->data[sech_offset];
+  for (int s = 0; s < nsections; s++)
+    origins[s] = section_origin(ctx, s);
 
-    // add section name to .shstrtab
-    int str_offset = buffer_append(shstrtab->content, section->name);
-    buffer_append_char(shstrtab->content, '\0');
-    sech->sh_name = str_offset;
+  // symbol of section s has index s + 1
+  buffer_append_char(strtab, '\0');
+  append_symbol(symtab, strtab, "", 0, STB_LOCAL, STT_NOTYPE, SHN_UNDEF);
+  for (int s = 0; s < nsections; s++)
+    append_symbol(symtab, strtab, "", 0, STB_LOCAL, STT_SECTION, s + 1);
+  append_defined_symbols(ctx, symtab, strtab, origins, true);
 
-    if (strcmp(section->name, SHSTRTAB_NAME) == 0) {
-      sech->sh_type = SHT_STRTAB;
-      sech->sh_flags = 0;
-      sech->sh_addr = 0;
-    } else {
-      sech->sh_type = SHT_PROGBITS;
-      sech->sh_flags = SHF_ALLOC | SHF_EXECINSTR | SHF_WRITE;
+  int first_global = symtab->len / sizeof(elf_symbol);
+  append_defined_symbols(ctx, symtab, strtab, origins, false);
 
-      if (section->start == -1)
-        report_error(ctx, "section start address for %s isn't defined (no ORG directive)", section->name);
+  // relocations per section
 
-      sech->sh_addr = section->start;
-    }
+  buffer **relas = (buffer **)xmalloc(sizeof(buffer *) * (nsections + 1));
+  int nrelas = 0;
+
+  for (int s = 0; s < nsections; s++) {
+    relas[s] = NULL;
+
+    foreach (dc, ctx->relocs) {
+      reloc_t *reloc = (reloc_t *)dfirst(dc);
 
-    sech->sh_link = 0;
-    sech->sh_info = 0;
-    sech->sh_addralign = 0;
-    sech->sh_entsize = 0;
-    sech->sh_size = section->content->len;
+      if (reloc->section_id != s)
+        continue;
 
-    // remember pointer to section header to fill offset of section data later
-    sech_ptrs[i++] = sech;
+      // number (absolute target of relative jump) is relocated against null symbol
+      int symidx = 0;
+      int addend = reloc->addend;
+
+      if (reloc->name != NULL) {
+        symidx = (int)(intptr_t)hashmap_get(undefined, reloc->name);
+
+        if (symidx == 0) {
+          symidx = symtab->len / sizeof(elf_symbol);
+          append_symbol(symtab, strtab, reloc->name, 0, STB_GLOBAL, STT_NOTYPE, SHN_UNDEF);
+          hashmap_set(undefined, reloc->name, (void *)(intptr_t)symidx);
+        }
+      } else if (reloc->target_section != -1) {
+        symidx = reloc->target_section + 1;
+        addend -= origins[reloc->target_section];
+      }
+
+      int type = reloc->relative ? R_Z80_8_PCREL : (reloc->nbytes == 2) ? R_Z80_16 : R_Z80_8;
+      elf_rela rela = {0};
+
+      rela.r_offset = reloc->pos - origins[s];
+      rela.r_info = ELF32_R_INFO(symidx, type);
+      rela.r_addend = addend;
+
+      if (relas[s] == NULL) {
+        relas[s] = buffer_init();
+        nrelas++;
+      }
+
+      buffer_append_binary(relas[s], (char *)&rela, sizeof(rela));
+    }
   }
 
-  // add sections data
-  i = 0;
+  // section headers: null, source sections, relocations, .symtab, .strtab, .shstrtab
+
+  int nheaders = 1 + nsections + nrelas + 3;
+  int symtab_idx = 1 + nsections + nrelas;
+  elf_section_header *headers = (elf_section_header *)xmalloc(sizeof(elf_section_header) * nheaders);
+  buffer **contents = (buffer **)xmalloc(sizeof(buffer *) * nheaders);
+  uint32_t *skips = (uint32_t *)xmalloc(sizeof(uint32_t) * nheaders);
+  buffer *shstrtab = buffer_init();
+
+  memset(headers, 0, sizeof(elf_section_header) * nheaders);
+  memset(skips, 0, sizeof(uint32_t) * nheaders);
+  buffer_append_char(shstrtab, '\0');  // first byte in strtab is always zero
+  contents[0] = NULL;
+
+  int h = 1;
   foreach (dc, ctx->sections) {
     section_ctx_t *section = (section_ctx_t *)dfirst(dc);
-    sech_ptrs[i++]->sh_offset = buffer_append_binary(elf, section->content->data, section->content->len);
+    elf_section_header *sech = &headers[h];
+
+    if (section->start == -1)
+      report_error(ctx, "section start address for %s isn't defined (no ORG directive)", section->name);
+
+    sech->sh_name = buffer_append(shstrtab, "%s", section->name);
+    buffer_append_char(shstrtab, '\0');
+    sech->sh_type = SHT_PROGBITS;
+    sech->sh_flags = SHF_ALLOC | SHF_EXECINSTR | SHF_WRITE;
+    sech->sh_addr = section->start + origins[h - 1];
+    sech->sh_addralign = section->align;
+    sech->sh_size = section->content->len - origins[h - 1];
+    skips[h] = origins[h - 1];
+    contents[h++] = section->content;
   }
 
-  xfree(sech_ptrs);
+  for (int s = 0; s < nsections; s++) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, s));
+    elf_section_header *sech = &headers[h];
+
+    if (relas[s] == NULL)
+      continue;
+
+    sech->sh_name = buffer_append(shstrtab, "%s%s", RELA_PREFIX, section->name);
+    buffer_append_char(shstrtab, '\0');
+    sech->sh_type = SHT_RELA;
+    sech->sh_flags = SHF_INFO_LINK;
+    sech->sh_link = symtab_idx;
+    sech->sh_info = s + 1;
+    sech->sh_addralign = 4;
+    sech->sh_entsize = sizeof(elf_rela);
+    sech->sh_size = relas[s]->len;
+    contents[h++] = relas[s];
+  }
+
+  headers[h].sh_name = buffer_append(shstrtab, "%s", SYMTAB_NAME);
+  buffer_append_char(shstrtab, '\0');
+  headers[h].sh_type = SHT_SYMTAB;
+  headers[h].sh_link = h + 1;
+  headers[h].sh_info = first_global;
+  headers[h].sh_addralign = 4;
+  headers[h].sh_entsize = sizeof(elf_symbol);
+  headers[h].sh_size = symtab->len;
+  contents[h++] = symtab;
+
+  headers[h].sh_name = buffer_append(shstrtab, "%s", STRTAB_NAME);
+  buffer_append_char(shstrtab, '\0');
+  headers[h].sh_type = SHT_STRTAB;
+  headers[h].sh_size = strtab->len;
+  contents[h++] = strtab;
+
+  headers[h].sh_name = buffer_append(shstrtab, "%s", SHSTRTAB_NAME);
+  buffer_append_char(shstrtab, '\0');
+  headers[h].sh_type = SHT_STRTAB;
+  headers[h].sh_size = shstrtab->len;
+  contents[h++] = shstrtab;
+
+  // file header
+  elf_file_header elf_fh = {0};
+
+  elf_fh.ei_magic[0] = 0x7f;
+  elf_fh.ei_magic[1] = 0x45;
+  elf_fh.ei_magic[2] = 0x4c;
+  elf_fh.ei_magic[3] = 0x46;
+
+  elf_fh.ei_class = ELFCLASS32;
+  elf_fh.ei_data = ELFDATA2LSB;
+  elf_fh.ei_version = EIV_CURRENT;
+  elf_fh.ei_osabi = ELFOSABI_NONE;
+  elf_fh.ei_abiversion = 0;
+
+  elf_fh.e_type = ET_REL;
+  elf_fh.e_machine = EM_Z80;
+  elf_fh.e_version = EV_CURRENT;
+
+  elf_fh.e_entry = 0;
+  elf_fh.e_phoff = 0;
+  elf_fh.e_shoff = sizeof(elf_file_header); // section headers follow right after elf_file_header
+  elf_fh.e_flags = 0;
+  elf_fh.e_ehsize = sizeof(elf_file_header);
+  elf_fh.e_phentsize = 32;
+  elf_fh.e_phnum = 0;
+  elf_fh.e_shentsize = sizeof(elf_section_header);
+  elf_fh.e_shnum = nheaders;
+  elf_fh.e_shstrndx = nheaders - 1; // .shstrtab is always last section
+
+  // section data follows headers, tables are aligned for their entries
+  uint32_t offset = sizeof(elf_file_header) + sizeof(elf_section_header) * nheaders;
+
+  for (int i = 1; i < nheaders; i++) {
+    if (headers[i].sh_addralign == 4)
+      offset = (offset + 3) & ~3;
+
+    headers[i].sh_offset = offset;
+    offset += headers[i].sh_size;
+  }
+
+  buffer *elf = buffer_init();
+
+  buffer_append_binary(elf, (char *)&elf_fh, sizeof(elf_fh));
+  buffer_append_binary(elf, (char *)headers, sizeof(elf_section_header) * nheaders);
+
+  for (int i = 1; i < nheaders; i++) {
+    while (elf->len < headers[i].sh_offset)
+      buffer_append_char(elf, '\0');
+
+    buffer_append_binary(elf, contents[i]->data + skips[i], headers[i].sh_size);
+  }
 
   *dest_buf = buffer_dup(elf);
-  elfsize = elf->len;
+  uint32_t elfsize = elf->len;
+
+  for (int s = 0; s < nsections; s++) {
+    if (relas[s] != NULL)
+      buffer_free(relas[s]);
+  }
+
+  xfree(relas);
+  xfree(headers);
+  xfree(contents);
+  xfree(skips);
+  xfree(origins);
+  hashmap_free(undefined);
+  buffer_free(symtab);
+  buffer_free(strtab);
+  buffer_free(shstrtab);
   buffer_free(elf);
 
   return elfsize;
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/render.h"
+#include "bits/buffer.h"
+
+// gaps up to these sizes are written as filler: Intel HEX record costs 12 characters
+// against 2 per byte of data, header of range costs 4 bytes against 1 per byte
+#define HEX_GAP_THRESHOLD 6
+#define RANGES_GAP_THRESHOLD 4
+
+#define HEX_RECORD_SIZE 16
+#define RANGES_MAX_SIZE 0xffff
+
+// contiguous bytes of load image
+typedef struct {
+  uint32_t start;
+  buffer *data;
+} range_t;
+
+static int compare_section_start(const void *a, const void *b)
+{
+  const section_ctx_t *s1 = *(const section_ctx_t **)a;
+  const section_ctx_t *s2 = *(const section_ctx_t **)b;
+
+  return (s1->start > s2->start) - (s1->start < s2->start);
+}
+
+// append bytes between pos and end of section to the last range, or start a new range if
+// filler up to them is longer than threshold
+static dynarray *add_span(dynarray *ranges, section_ctx_t *prev, section_ctx_t *section,
+  uint32_t pos, uint32_t end, int threshold)
+{
+  range_t *last = (dynarray_length(ranges) > 0) ? (range_t *)dlast(ranges) : NULL;
+  uint32_t start = section->start + pos;
+
+  if (last != NULL && start - (last->start + last->data->len) <= (uint32_t)threshold) {
+    // gap inside of section is filled already, gap between sections gets filler of the preceding one
+    for (uint32_t addr = last->start + last->data->len; addr < start; addr++) {
+      buffer_append_char(last->data, (addr >= section->start) ?
+        section->content->data[addr - section->start] : prev->filler);
+    }
+  } else {
+    last = (range_t *)xmalloc(sizeof(range_t));
+    last->start = start;
+    last->data = buffer_init();
+    ranges = dynarray_append_ptr(ranges, last);
+  }
+
+  buffer_append_binary(last->data, section->content->data + pos, end - pos);
+
+  return ranges;
+}
+
+// bytes written by sections in address order, filler of ORG and ALIGN is skipped
+static dynarray *collect_ranges(compile_ctx_t *ctx, int threshold)
+{
+  section_ctx_t **sorted = (section_ctx_t **)xmalloc(sizeof(section_ctx_t *) * dynarray_length(ctx->sections));
+  int nsections = 0;
+  dynarray *ranges = NULL;
+  dynarray_cell *dc;
+
+  foreach (dc, ctx->sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+
+    // don't take into account empty sections
+    if (section->content->len > 0)
+      sorted[nsections++] = section;
+  }
+
+  qsort(sorted, nsections, sizeof(section_ctx_t *), compare_section_start);
+
+  for (int i = 0; i < nsections; i++) {
+    section_ctx_t *section = sorted[i];
+    section_ctx_t *prev = (i > 0) ? sorted[i - 1] : NULL;
+    int ngaps = dynarray_length(section->gaps) / 2;
+    uint32_t pos = 0;
+
+    if (prev != NULL && section->start < prev->start + prev->content->len) {
+      report_error_noloc("sections '%s' and '%s' overlap at address 0x%04x",
+        prev->name, section->name, section->start);
+    }
+
+    if (section->start + section->content->len > 0x10000)
+      report_error_noloc("section '%s' doesn't fit into 64K address space", section->name);
+
+    for (int g = 0; g <= ngaps; g++) {
+      uint32_t end = (g < ngaps) ? dfirst_int(dynarray_nth_cell(section->gaps, 2 * g)) : section->content->len;
+
+      if (end > pos)
+        ranges = add_span(ranges, prev, section, pos, end, threshold);
+
+      if (g < ngaps)
+        pos = end + dfirst_int(dynarray_nth_cell(section->gaps, 2 * g + 1));
+    }
+  }
+
+  xfree(sorted);
+
+  return ranges;
+}
+
+static void free_ranges(dynarray *ranges)
+{
+  dynarray_cell *dc;
+
+  foreach (dc, ranges) {
+    range_t *range = (range_t *)dfirst(dc);
+
+    buffer_free(range->data);
+    xfree(range);
+  }
+
+  dynarray_free(ranges);
+}
+
+static uint32_t finish_output(buffer *output, char **dest_buf)
+{
+  *dest_buf = buffer_dup(output);
+  uint32_t size = output->len;
+  buffer_free(output);
+
+  return size;
+}
+
+// Intel HEX: data records of written ranges followed by end of file record
+uint32_t render_hex(compile_ctx_t *ctx, char **dest_buf)
+{
+  int threshold = (ctx->opts.gap_threshold != -1) ? ctx->opts.gap_threshold : HEX_GAP_THRESHOLD;
+  dynarray *ranges = collect_ranges(ctx, threshold);
+  buffer *output = buffer_init();
+  dynarray_cell *dc;
+
+  foreach (dc, ranges) {
+    range_t *range = (range_t *)dfirst(dc);
+
+    for (int pos = 0; pos < range->data->len; pos += HEX_RECORD_SIZE) {
+      int size = (range->data->len - pos < HEX_RECORD_SIZE) ? range->data->len - pos : HEX_RECORD_SIZE;
+      uint32_t addr = range->start + pos;
+      uint8_t sum = size + (addr >> 8) + (addr & 0xff);
+
+      buffer_append(output, ":%02X%04X00", size, addr);
+
+      for (int i = 0; i < size; i++) {
+        uint8_t b = (uint8_t)range->data->data[pos + i];
+
+        buffer_append(output, "%02X", b);
+        sum += b;
+      }
+
+      buffer_append(output, "%02X\n", (uint8_t)-sum);
+    }
+  }
+
+  buffer_append(output, ":00000001FF\n");
+
+  free_ranges(ranges);
+
+  return finish_output(output, dest_buf);
+}
+
+// range list: 16-bit little endian address and size followed by data of every range,
+// list ends with zero size whose address is the lowest one of image
+uint32_t render_ranges(compile_ctx_t *ctx, char **dest_buf)
+{
+  int threshold = (ctx->opts.gap_threshold != -1) ? ctx->opts.gap_threshold : RANGES_GAP_THRESHOLD;
+  dynarray *ranges = collect_ranges(ctx, threshold);
+  buffer *output = buffer_init();
+  uint32_t lowest = 0;
+  dynarray_cell *dc;
+
+  if (dynarray_length(ranges) > 0)
+    lowest = ((range_t *)dinitial(ranges))->start;
+
+  foreach (dc, ranges) {
+    range_t *range = (range_t *)dfirst(dc);
+
+    for (int pos = 0; pos < range->data->len; pos += RANGES_MAX_SIZE) {
+      int size = (range->data->len - pos < RANGES_MAX_SIZE) ? range->data->len - pos : RANGES_MAX_SIZE;
+      uint32_t addr = range->start + pos;
+      char header[4] = {addr & 0xff, (addr >> 8) & 0xff, size & 0xff, (size >> 8) & 0xff};
+
+      buffer_append_binary(output, header, sizeof(header));
+      buffer_append_binary(output, range->data->data + pos, size);
+    }
+  }
+
+  char end[4] = {lowest & 0xff, (lowest >> 8) & 0xff, 0, 0};
+  buffer_append_binary(output, end, sizeof(end));
+
+  free_ranges(ranges);
+
+  return finish_output(output, dest_buf);
+}
@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/analysis.h"
+#include "asm/render.h"
+#include "asm/rst.h"
+#include "asm/symtab.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/hashmap.h"
+
+// RST substitution (--rst-opt): unconditional CALLs of the most called routines are
+// replaced with single byte RST instructions. Vector is free if program's section covers
+// it, but nothing except ORG padding is rendered there and source doesn't use it with RST
+// itself.
+//
+// Routine is compiled right at the vector if it fits ORG padding there: RST takes 11 cycles
+// instead of 17 of CALL and routine's bytes leave the image. It must be a block of plain
+// instructions from global label up to the next one which isn't fallen into (so routine ends
+// with RET or JP), which isn't fallen into itself, isn't placed by ORG or ALIGN and isn't left
+// or entered by relative jumps. Final pass compiles it in front of the ORG which pads over
+// the vector and skips it at its place.
+//
+// Other routines are called through JP trampoline at vector: it saves bytes only, since call
+// takes 21 cycles then. Call sites inside loops (code between backward jump and its target)
+// aren't rewritten and aren't counted for trampolines.
+//
+// Measuring pass counts call sites, routines and page zero usage of the source as is, the
+// final pass rewrites call sites and fills vectors when all labels are known.
+
+typedef struct {
+  char *name;
+  int sites;
+  int free_sites;     // sites out of loops
+} rst_candidate_t;
+
+typedef struct {
+  INSTR *instr;
+  char *target;
+  int section_id;
+  uint32_t pc;
+} rst_site_t;
+
+typedef struct {
+  int stmt_idx;
+  int section_id;
+  uint32_t from;
+  uint32_t to;
+} rst_org_t;
+
+void rst_start(compile_ctx_t *ctx)
+{
+  rst_plan_t *plan = ctx->rst;
+
+  if (plan == NULL)
+    return;
+
+  memset(plan->reserved, 0, sizeof(plan->reserved));
+  memset(plan->used, 0, sizeof(plan->used));
+  memset(plan->sites, 0, sizeof(plan->sites));
+  memset(plan->loop_sites, 0, sizeof(plan->loop_sites));
+
+  plan->open = NULL;
+  plan->fixed_pc = UINT32_MAX;
+  plan->detour = -1;
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    if (plan->placed[v])
+      plan->placed[v]->done = false;
+  }
+}
+
+static bool rst_kept(rst_plan_t *plan, INSTR *instr)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, plan->in_loop) {
+    if (dfirst(dc) == instr)
+      return true;
+  }
+
+  return false;
+}
+
+bool rst_substitute(compile_ctx_t *ctx, INSTR *instr)
+{
+  rst_plan_t *plan = ctx->rst;
+
+  if (plan == NULL || instr->args == NULL || dynarray_length(instr->args->list) != 1)
+    return false;
+
+  char *name = ((ID *)instr->name)->name;
+  parse_node *arg = (parse_node *)dinitial(instr->args->list);
+
+  if (strcasecmp(name, "rst") == 0) {
+    LITERAL *l = (LITERAL *)expr_eval(ctx, arg);
+
+    if (IS_INT_LITERAL(l) && (l->ival & ~0x38) == 0)
+      plan->reserved[l->ival >> 3] = true;
+
+    return false;
+  }
+
+  // label is wrapped into simple expression by parser
+  if (arg->type == NODE_EXPR && ((EXPR *)arg)->kind == SIMPLE && !arg->is_ref)
+    arg = ((EXPR *)arg)->left;
+
+  // only unconditional calls of global names: local labels are ambiguous out of scope
+  if (strcasecmp(name, "call") != 0 || arg->type != NODE_ID || ((ID *)arg)->name[0] == '.')
+    return false;
+
+  char *target = ((ID *)arg)->name;
+
+  if (plan->measure) {
+    rst_site_t *site = (rst_site_t *)xmalloc(sizeof(rst_site_t));
+
+    site->instr = instr;
+    site->target = target;
+    site->section_id = ctx->curr_section_id;
+    site->pc = get_current_section(ctx)->curr_pc;
+    plan->found = dynarray_append_ptr(plan->found, site);
+    return false;
+  }
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    if (plan->targets[v] && strcmp(plan->targets[v], target) == 0) {
+      if (plan->placed[v] == NULL && rst_kept(plan, instr)) {
+        plan->loop_sites[v]++;
+        return false;
+      }
+
+      render_byte(ctx, 0xC7 | (v << 3), RST_RST_CYCLES);  // rst v*8
+      plan->sites[v]++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Returns index of the statement to compile instead of the given one: routine placed at
+// vector is compiled in front of its ORG (the detour), then the ORG follows. Routine at its
+// place is skipped.
+int rst_route(compile_ctx_t *ctx, int stmt_idx)
+{
+  rst_plan_t *plan = ctx->rst;
+
+  if (plan == NULL || plan->measure)
+    return stmt_idx;
+
+  section_ctx_t *section = get_current_section(ctx);
+
+  if (plan->detour != -1) {
+    rst_routine_t *routine = plan->placed[plan->detour];
+
+    if (stmt_idx != routine->end)
+      return stmt_idx;
+
+    // rewritten call sites could shift code into vector which was free before
+    if (section->curr_pc > routine->limit)
+      report_error_noloc("%s doesn't fit at RST 0x%02x after call sites substitution", routine->name, plan->detour * 8);
+
+    routine->done = true;
+    plan->detour = -1;
+    ctx->curr_global_label = plan->detour_scope;
+
+    return routine->org;
+  }
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    rst_routine_t *routine = plan->placed[v];
+
+    if (routine == NULL || routine->done || routine->org != stmt_idx)
+      continue;
+
+    if (section->curr_pc > (uint32_t)v * 8)
+      report_error_noloc("RST vector 0x%02x is occupied after call sites substitution", v * 8);
+
+    section->curr_pc = v * 8;
+    render_reorg(ctx);
+
+    plan->detour = v;
+    plan->detour_scope = ctx->curr_global_label;
+
+    return routine->first;
+  }
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    if (plan->placed[v] && plan->placed[v]->first == stmt_idx)
+      return plan->placed[v]->end;
+  }
+
+  return stmt_idx;
+}
+
+// jr e, jr cc,e, djnz e, jp nn and jp cc,nn: relative ones can't leave or enter moved routine,
+// backward ones close loops
+static void rst_track_jump(rst_plan_t *plan, section_ctx_t *section, int section_id, uint32_t pc)
+{
+  uint32_t pos = pc - section->start;
+  uint32_t size = section->curr_pc - pc;
+
+  if (pos + size > section->content->len)
+    return;
+
+  uint8_t *op = (uint8_t *)&section->content->data[pos];
+  uint32_t target;
+
+  if (size == 2 && (op[0] == 0x18 || op[0] == 0x10 || (op[0] & 0xE7) == 0x20)) {
+    target = (pc + 2 + (int8_t)op[1]) & 0xffff;
+
+    // forward target is patched at 2nd pass, it's read back when planning
+    plan->rel_jumps = dynarray_append_int(plan->rel_jumps, section_id);
+    plan->rel_jumps = dynarray_append_int(plan->rel_jumps, pc);
+  } else if (size == 3 && (op[0] == 0xC3 || (op[0] & 0xC7) == 0xC2)) {
+    target = op[1] | (op[2] << 8);
+  } else {
+    return;
+  }
+
+  if (target > pc)
+    return;
+
+  plan->loops = dynarray_append_int(plan->loops, section_id);
+  plan->loops = dynarray_append_int(plan->loops, target);
+  plan->loops = dynarray_append_int(plan->loops, pc);
+}
+
+static void rst_close_routine(rst_plan_t *plan, section_ctx_t *section, int section_id, int stmt_idx, uint32_t pc)
+{
+  rst_routine_t *routine = plan->open;
+
+  routine->end = stmt_idx;
+  routine->size = pc - routine->start;
+  routine->movable &= (section_id == routine->section_id) && !section->falls_through;
+
+  plan->open = NULL;
+}
+
+static void rst_track_routine(compile_ctx_t *ctx, parse_node *node, int stmt_idx, int section_id, uint32_t pc)
+{
+  rst_plan_t *plan = ctx->rst;
+  section_ctx_t *section = get_current_section(ctx);
+  bool nested = dynarray_length(ctx->repts) > 0 || dynarray_length(ctx->conditions) > 0;
+
+  if (node->type == NODE_LABEL && ((LABEL *)node)->name->name[0] != '.') {
+    // routine takes in global labels it falls into
+    if (plan->open && section->falls_through && section_id == plan->open->section_id && !nested)
+      return;
+
+    if (plan->open)
+      rst_close_routine(plan, section, section_id, stmt_idx, pc);
+
+    rst_routine_t *routine = (rst_routine_t *)xmalloc(sizeof(rst_routine_t));
+    memset(routine, 0, sizeof(rst_routine_t));
+
+    routine->name = ((LABEL *)node)->name->name;
+    routine->first = stmt_idx;
+    routine->end = -1;
+    routine->section_id = section_id;
+    routine->start = pc;
+    routine->movable = !nested && !section->falls_through && !section->pack &&
+      pc != section->start && pc != plan->fixed_pc;
+
+    plan->routines = dynarray_append_ptr(plan->routines, routine);
+    plan->open = routine;
+    return;
+  }
+
+  if (node->type == NODE_ORG || node->type == NODE_ALIGN)
+    plan->fixed_pc = section->curr_pc;
+
+  if (node->type == NODE_ORG && !nested && ctx->curr_section_id == section_id &&
+    pc < section->curr_pc && pc < RST_PAGE_SIZE)
+  {
+    rst_org_t *org = (rst_org_t *)xmalloc(sizeof(rst_org_t));
+
+    org->stmt_idx = stmt_idx;
+    org->section_id = section_id;
+    org->from = pc;
+    org->to = section->curr_pc;
+    plan->orgs = dynarray_append_ptr(plan->orgs, org);
+  }
+
+  if (plan->open == NULL)
+    return;
+
+  bool plain = node->type == NODE_INSTR || node->type == NODE_LABEL || node->type == NODE_LOOPBOUND;
+
+  if (!plain || nested || ctx->curr_section_id != plan->open->section_id)
+    plan->open->movable = false;
+}
+
+void rst_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx, int section_id, uint32_t pc)
+{
+  rst_plan_t *plan = ctx->rst;
+
+  if (plan == NULL)
+    return;
+
+  if (plan->measure)
+    rst_track_routine(ctx, node, stmt_idx, section_id, pc);
+
+  if (node->type == NODE_ORG || node->type == NODE_SECTION || ctx->curr_section_id != section_id)
+    return;
+
+  section_ctx_t *section = get_current_section(ctx);
+
+  for (uint32_t addr = pc; addr < section->curr_pc && addr < sizeof(plan->used); addr++)
+    plan->used[addr] = 1;
+
+  if (plan->measure && node->type == NODE_INSTR)
+    rst_track_jump(plan, section, section_id, pc);
+}
+
+static bool rst_site_in_loop(rst_plan_t *plan, rst_site_t *site)
+{
+  for (int i = 0; i + 2 < dynarray_length(plan->loops); i += 3) {
+    int section_id = dfirst_int(dynarray_nth_cell(plan->loops, i));
+    uint32_t first = dfirst_int(dynarray_nth_cell(plan->loops, i + 1));
+    uint32_t last = dfirst_int(dynarray_nth_cell(plan->loops, i + 2));
+
+    if (section_id == site->section_id && first <= site->pc && site->pc <= last)
+      return true;
+  }
+
+  return false;
+}
+
+// relative jumps stay inside or outside of routine
+static bool rst_movable(rst_plan_t *plan, dynarray *sections, rst_routine_t *routine)
+{
+  if (!routine->movable || routine->end == -1 || routine->size == 0)
+    return false;
+
+  for (int i = 0; i + 1 < dynarray_length(plan->rel_jumps); i += 2) {
+    int section_id = dfirst_int(dynarray_nth_cell(plan->rel_jumps, i));
+    uint32_t pc = dfirst_int(dynarray_nth_cell(plan->rel_jumps, i + 1));
+
+    if (section_id != routine->section_id)
+      continue;
+
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(sections, section_id));
+    int8_t e = section->content->data[pc - section->start + 1];
+    uint32_t target = (pc + 2 + e) & 0xffff;
+    bool from = (pc >= routine->start && pc < routine->start + routine->size);
+    bool to = (target >= routine->start && target < routine->start + routine->size);
+
+    if (from != to)
+      return false;
+  }
+
+  return true;
+}
+
+static rst_routine_t *rst_find_routine(rst_plan_t *plan, char *name)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, plan->routines) {
+    rst_routine_t *routine = (rst_routine_t *)dfirst(dc);
+
+    if (strcmp(routine->name, name) == 0)
+      return routine;
+  }
+
+  return NULL;
+}
+
+// index of section which covers trampoline at vector address, -1 if there is no such section
+static int rst_vector_section(dynarray *sections, uint32_t addr)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, sections) {
+    section_ctx_t *section = (section_ctx_t *)dfirst(dc);
+
+    if (section->start <= addr && addr + 3 <= section->start + section->content->len)
+      return foreach_current_index(dc);
+  }
+
+  return -1;
+}
+
+static bool rst_range_free(rst_plan_t *plan, uint8_t *taken, uint32_t addr, uint32_t size)
+{
+  if (addr + size > RST_PAGE_SIZE)
+    return false;
+
+  for (uint32_t a = addr; a < addr + size; a++) {
+    if (taken[a] || ((a & 7) == 0 && plan->reserved[a >> 3]))
+      return false;
+  }
+
+  return true;
+}
+
+static bool rst_vector_free(rst_plan_t *plan, dynarray *sections, int v)
+{
+  uint32_t addr = v * 8;
+
+  return !plan->reserved[v] &&
+    !plan->used[addr] && !plan->used[addr + 1] && !plan->used[addr + 2] &&
+    rst_vector_section(sections, addr) != -1;
+}
+
+// the lowest vector where routine fits ORG padding, -1 if there is no such vector
+static int rst_place(rst_plan_t *plan, uint8_t *taken, rst_routine_t *routine)
+{
+  dynarray_cell *dc = NULL;
+
+  for (int v = 1; v < RST_NUM_VECTORS; v++) {
+    uint32_t addr = v * 8;
+
+    if (plan->targets[v] || !rst_range_free(plan, taken, addr, routine->size))
+      continue;
+
+    foreach (dc, plan->orgs) {
+      rst_org_t *org = (rst_org_t *)dfirst(dc);
+
+      if (org->from <= addr && addr + routine->size <= org->to) {
+        routine->org = org->stmt_idx;
+        routine->limit = org->to;
+        return v;
+      }
+    }
+  }
+
+  return -1;
+}
+
+static int rst_candidate_cmp(const void *a, const void *b)
+{
+  const rst_candidate_t *c1 = (const rst_candidate_t *)a;
+  const rst_candidate_t *c2 = (const rst_candidate_t *)b;
+
+  if (c1->sites != c2->sites)
+    return c2->sites - c1->sites;
+
+  return strcmp(c1->name, c2->name);
+}
+
+void rst_plan(rst_plan_t *plan, dynarray *sections)
+{
+  dynarray_cell *dc = NULL;
+  hashmap_scan *scan = NULL;
+  hashmap_entry *entry = NULL;
+  int ncandidates = 0;
+
+  // statement inside loop stays CALL everywhere it's rendered (e.g. REPT)
+  foreach (dc, plan->found) {
+    rst_site_t *site = (rst_site_t *)dfirst(dc);
+
+    if (rst_site_in_loop(plan, site) && !rst_kept(plan, site->instr))
+      plan->in_loop = dynarray_append_ptr(plan->in_loop, site->instr);
+  }
+
+  foreach (dc, plan->found) {
+    rst_site_t *site = (rst_site_t *)dfirst(dc);
+    rst_candidate_t *candidate = (rst_candidate_t *)hashmap_get(plan->calls, site->target);
+
+    if (candidate == NULL) {
+      candidate = (rst_candidate_t *)xmalloc(sizeof(rst_candidate_t));
+      candidate->name = site->target;
+      candidate->sites = 0;
+      candidate->free_sites = 0;
+      hashmap_set(plan->calls, site->target, candidate);
+      ncandidates++;
+    }
+
+    candidate->sites++;
+    candidate->free_sites += !rst_kept(plan, site->instr);
+  }
+
+  rst_candidate_t *candidates = (rst_candidate_t *)xmalloc(sizeof(rst_candidate_t) * (ncandidates + 1));
+  ncandidates = 0;
+
+  scan = hashmap_scan_init(plan->calls);
+  while ((entry = hashmap_scan_next(scan)) != NULL)
+    candidates[ncandidates++] = *(rst_candidate_t *)entry->value;
+
+  qsort(candidates, ncandidates, sizeof(rst_candidate_t), rst_candidate_cmp);
+
+  uint8_t taken[RST_PAGE_SIZE];
+  memcpy(taken, plan->used, sizeof(taken));
+
+  // RST 0 is reset entry point and never is free
+  for (int i = 0; i < ncandidates; i++) {
+    rst_routine_t *routine = rst_find_routine(plan, candidates[i].name);
+    int v = (routine && rst_movable(plan, sections, routine)) ? rst_place(plan, taken, routine) : -1;
+
+    if (v != -1) {
+      plan->targets[v] = xstrdup(candidates[i].name);
+      plan->placed[v] = routine;
+      memset(taken + v * 8, 1, routine->size);
+      continue;
+    }
+
+    // trampoline takes 3 bytes, every rewritten call site saves 2 ones
+    if (2 * candidates[i].free_sites <= 3)
+      continue;
+
+    for (v = 1; v < RST_NUM_VECTORS; v++) {
+      if (!plan->targets[v] && rst_vector_free(plan, sections, v) && rst_range_free(plan, taken, v * 8, 3)) {
+        plan->targets[v] = xstrdup(candidates[i].name);
+        memset(taken + v * 8, 1, 3);
+        break;
+      }
+    }
+  }
+
+  xfree(candidates);
+
+  plan->measure = false;
+}
+
+void rst_finish(compile_ctx_t *ctx)
+{
+  rst_plan_t *plan = ctx->rst;
+
+  if (plan == NULL || plan->measure)
+    return;
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    if (plan->targets[v] == NULL || plan->placed[v] != NULL)
+      continue;
+
+    uint32_t addr = v * 8;
+
+    // rewritten call sites could shift code into vector which was free before
+    if (!rst_vector_free(plan, ctx->sections, v))
+      report_error_noloc("RST vector 0x%02x is occupied after call sites substitution", addr);
+
+    LITERAL *l = (LITERAL *)get_sym_variable(ctx, plan->targets[v], true);
+    if (l == NULL || l->kind != INT)
+      report_error_noloc("can't resolve %s for RST 0x%02x trampoline", plan->targets[v], addr);
+
+    int section_id = rst_vector_section(ctx->sections, addr);
+    section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, section_id));
+    char *dest = &section->content->data[addr - section->start];
+
+    dest[0] = 0xC3;                       // jp target
+    dest[1] = l->ival & 0xff;
+    dest[2] = (l->ival >> 8) & 0xff;
+    render_ungap(section, addr - section->start, 3);
+
+    if (ctx->opts.target == ASM_TARGET_ELF) {
+      patch_t patch = {0};
+
+      patch.pos = addr - section->start + 1;
+      patch.nbytes = 2;
+      patch.section_id = section_id;
+      render_elf_address(ctx, &patch, l);
+    }
+
+    analysis_add(ctx->analysis, section, addr - section->start, 3, RST_JP_CYCLES);
+  }
+}
+
+void rst_report(compile_ctx_t *ctx)
+{
+  rst_plan_t *plan = ctx->rst;
+  int routines = 0;
+  int saved = 0;
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++) {
+    if (plan->targets[v] == NULL)
+      continue;
+
+    int bytes;
+
+    if (plan->placed[v] != NULL) {
+      bytes = 2 * plan->sites[v] + plan->placed[v]->size;
+
+      report_info("\x1b[96mRST 0x%02x\x1b[97m: %s (%u bytes) placed at vector, %d call sites: %d bytes saved, %d cycles per call (CALL: %d cycles)",
+        v * 8, plan->targets[v], plan->placed[v]->size, plan->sites[v], bytes, RST_RST_CYCLES, RST_CALL_CYCLES);
+    } else {
+      bytes = 2 * plan->sites[v] - 3;
+
+      report_info("\x1b[96mRST 0x%02x\x1b[97m: %s, %d call sites (%d inside loops kept): %d bytes saved, %d cycles per call through trampoline (CALL: %d cycles)",
+        v * 8, plan->targets[v], plan->sites[v], plan->loop_sites[v], bytes, RST_RST_CYCLES + RST_JP_CYCLES, RST_CALL_CYCLES);
+    }
+
+    routines++;
+    saved += bytes;
+  }
+
+  report_info("\x1b[96mRST substitution\x1b[97m: %d routines, %d bytes saved", routines, saved);
+}
+
+void rst_free(rst_plan_t *plan)
+{
+  hashmap_scan *scan = hashmap_scan_init(plan->calls);
+  hashmap_entry *entry = NULL;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL)
+    xfree(entry->value);
+
+  hashmap_free(plan->calls);
+  dynarray_free_deep(plan->found);
+  dynarray_free(plan->loops);
+  dynarray_free(plan->rel_jumps);
+  dynarray_free_deep(plan->routines);
+  dynarray_free_deep(plan->orgs);
+  dynarray_free(plan->in_loop);
+
+  for (int v = 0; v < RST_NUM_VECTORS; v++)
+    xfree(plan->targets[v]);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "asm/compile.h"
+
+#define RST_NUM_VECTORS 8
+
+// page zero bytes where routine placed at restart vector could extend to
+#define RST_PAGE_SIZE 0x100
+
+// CALL and RST opcodes' timings
+#define RST_CALL_CYCLES 17
+#define RST_RST_CYCLES  11
+#define RST_JP_CYCLES   10
+
+// block from global label up to the next one which isn't fallen into, measured for placement at
+// restart vector
+typedef struct {
+  char *name;
+  int first;                              // statement index of global label
+  int end;                                // statement index of global label after routine, -1 if none
+  int section_id;
+  uint32_t start;
+  uint32_t size;
+  bool movable;                           // plain instructions and labels, not fallen into and not
+                                          // placed by ORG or ALIGN
+
+  // final pass
+  int org;                                // ORG statement which routine is compiled in front of
+  uint32_t limit;                         // address ORG moves to, routine must end before it
+  bool done;                              // routine is compiled at vector already
+} rst_routine_t;
+
+typedef struct rst_plan_t {
+  // collected by measuring pass
+  dynarray *found;                        // rst_site_t of CALLs of global names
+  dynarray *loops;                        // section id, first and last address (int triples) of code
+                                          // closed by backward JR, DJNZ or JP
+  dynarray *rel_jumps;                    // section id and address (int pairs) of JR, DJNZ
+  dynarray *routines;                     // rst_routine_t in source order
+  rst_routine_t *open;                    // routine being measured
+  dynarray *orgs;                         // rst_org_t of ORG statements moving forward in page zero
+  uint32_t fixed_pc;                      // address set by the last ORG or ALIGN
+  bool reserved[RST_NUM_VECTORS];         // vectors referenced by RST instructions of source
+  uint8_t used[RST_PAGE_SIZE];            // page zero bytes occupied by code or data
+
+  // vectors assignment for the final pass
+  bool measure;
+  hashmap *calls;                         // CALL target name -> rst_candidate_t
+  dynarray *in_loop;                      // INSTR of call sites inside loops, trampolines skip them
+  char *targets[RST_NUM_VECTORS];         // routine called through vector or NULL
+  rst_routine_t *placed[RST_NUM_VECTORS]; // routine compiled at vector, NULL for JP trampoline
+  int detour;                             // vector whose routine is being compiled or -1
+  char *detour_scope;                     // global label in front of ORG the detour started at
+  int sites[RST_NUM_VECTORS];             // rewritten call sites
+  int loop_sites[RST_NUM_VECTORS];        // call sites kept because they are inside loops
+} rst_plan_t;
+
+extern void rst_start(compile_ctx_t *ctx);
+extern bool rst_substitute(compile_ctx_t *ctx, INSTR *instr);
+extern int rst_route(compile_ctx_t *ctx, int stmt_idx);
+extern void rst_track(compile_ctx_t *ctx, parse_node *node, int stmt_idx, int section_id, uint32_t pc);
+extern void rst_plan(rst_plan_t *plan, dynarray *sections);
+extern void rst_finish(compile_ctx_t *ctx);
+extern void rst_report(compile_ctx_t *ctx);
+extern void rst_free(rst_plan_t *plan);
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/analysis.h"
+#include "asm/map.h"
+#include "asm/render.h"
+#include "asm/strmerge.h"
+#include "asm/symtab.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+
+// String merging (--merge-strings): a labeled block of DB/DM statements which is identical to,
+// or a suffix of, another block of the same section isn't rendered, its label is aliased into
+// the bytes of that block instead. References to the label are resolved as usual, so the ones
+// preceding the block holding the bytes are patched with forward lookups.
+//
+// Blocks are assumed to be accessed only through their labels up to a terminator, so both an
+// aliased block and DB/DM data right in front of it must end with zero or a byte with bit 7 set
+// (DM style), and aliased block can't be followed by EQU which could measure it with '$'.
+// Any block could hold the bytes of aliased ones.
+//
+// Measuring pass collects blocks, the final pass renders kept blocks and defines aliases.
+
+static inline bool is_terminator(uint8_t b)
+{
+  return b == 0 || (b & 0x80);
+}
+
+static inline bool is_string_def(parse_node *node)
+{
+  DEF *def = (DEF *)node;
+
+  return node->type == NODE_DEF && !def->compressed &&
+    (def->kind == DEFKIND_DB || def->kind == DEFKIND_DM);
+}
+
+// bytes of DB/DM statement appended to 'data', false if some value isn't known yet
+static bool eval_def(compile_ctx_t *ctx, DEF *def, buffer *data)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, def->values->list) {
+    LITERAL *l = (LITERAL *)expr_eval(ctx, (parse_node *)dfirst(dc));
+
+    if (l->hdr.type != NODE_LITERAL)
+      return false;
+
+    if (l->kind == INT)
+      buffer_append_char(data, l->ival);
+    else if (l->kind == STR)
+      buffer_append_binary(data, l->strval, strlen(l->strval));
+    else
+      return false;
+  }
+
+  return true;
+}
+
+// labeled block of DB/DM statements starting at 'stmt_idx' with known values
+static bool find_block(compile_ctx_t *ctx, dynarray *statements, int stmt_idx, strmerge_block_t *block)
+{
+  LABEL *label = (LABEL *)dfirst(dynarray_nth_cell(statements, stmt_idx));
+  int nstatements = dynarray_length(statements);
+  bool movable = true;
+
+  // local labels and labels inside REPT have names depending on context
+  if (label->name->name[0] == '.' || dynarray_length(ctx->repts) > 0)
+    return false;
+
+  int end = stmt_idx + 1;
+  while (end < nstatements && is_string_def((parse_node *)dfirst(dynarray_nth_cell(statements, end))))
+    end++;
+
+  if (end == stmt_idx + 1)
+    return false;
+
+  buffer *data = buffer_init();
+  bool known = true;
+
+  for (int i = stmt_idx + 1; i < end && known; i++)
+    known = eval_def(ctx, (DEF *)dfirst(dynarray_nth_cell(statements, i)), data);
+
+  if (!known || data->len == 0) {
+    buffer_free(data);
+    return false;
+  }
+
+  if (!is_terminator(data->data[data->len - 1]))
+    movable = false;
+
+  if (end < nstatements && ((parse_node *)dfirst(dynarray_nth_cell(statements, end)))->type == NODE_EQU)
+    movable = false;
+
+  // another label of the same bytes or DB/DM data flowing into the block keep it in place
+  if (stmt_idx > 0 && movable) {
+    parse_node *prev = (parse_node *)dfirst(dynarray_nth_cell(statements, stmt_idx - 1));
+
+    if (prev->type == NODE_LABEL) {
+      movable = false;
+    } else if (is_string_def(prev)) {
+      buffer *prev_data = buffer_init();
+
+      if (!eval_def(ctx, (DEF *)prev, prev_data) || prev_data->len == 0 ||
+        !is_terminator(prev_data->data[prev_data->len - 1]))
+      {
+        movable = false;
+      }
+
+      buffer_free(prev_data);
+    }
+  }
+
+  memset(block, 0, sizeof(*block));
+  block->movable = movable;
+  block->stmt = stmt_idx;
+  block->end = end;
+  block->section_id = ctx->curr_section_id;
+  block->label = label->name->name;
+  block->len = data->len;
+  block->data = xmalloc(data->len);
+  memcpy(block->data, data->data, data->len);
+
+  buffer_free(data);
+  return true;
+}
+
+static void define_alias(compile_ctx_t *ctx, strmerge_block_t *block)
+{
+  uint32_t addr = block->target->addr + block->offset;
+
+  if (get_sym_variable(ctx, block->label, true) != NULL)
+    report_error(ctx, "duplicate label '%s'", block->label);
+
+  add_sym_variable_address(ctx, block->label, addr);
+  analysis_label(ctx, block->label, addr);
+  map_label(ctx, block->label, addr, true);
+  render_elf_symbol(ctx, block->label, addr, false);
+
+  block->defined = true;
+}
+
+void strmerge_start(compile_ctx_t *ctx)
+{
+  strmerge_t *sm = ctx->strmerge;
+  dynarray_cell *dc = NULL;
+
+  if (sm == NULL)
+    return;
+
+  sm->skip_until = -1;
+
+  foreach (dc, sm->blocks) {
+    strmerge_block_t *block = (strmerge_block_t *)dfirst(dc);
+
+    block->reached = false;
+    block->placed = false;
+    block->defined = false;
+  }
+}
+
+// returns true if label is aliased into another block and must not be compiled
+bool strmerge_label(compile_ctx_t *ctx, dynarray *statements, int stmt_idx)
+{
+  strmerge_t *sm = ctx->strmerge;
+  strmerge_block_t found;
+  dynarray_cell *dc = NULL;
+
+  if (sm == NULL)
+    return false;
+
+  bool is_block = find_block(ctx, statements, stmt_idx, &found);
+
+  if (sm->measure) {
+    if (is_block) {
+      strmerge_block_t *block = (strmerge_block_t *)xmalloc(sizeof(strmerge_block_t));
+      *block = found;
+      block->label = xstrdup(found.label);
+      sm->blocks = dynarray_append_ptr(sm->blocks, block);
+    }
+
+    return false;
+  }
+
+  strmerge_block_t *block = NULL;
+
+  foreach (dc, sm->blocks) {
+    strmerge_block_t *b = (strmerge_block_t *)dfirst(dc);
+
+    if (b->stmt == stmt_idx) {
+      block = b;
+      break;
+    }
+  }
+
+  if (block == NULL || (block->target == NULL && !block->container)) {
+    if (is_block)
+      xfree(found.data);
+    return false;
+  }
+
+  // values of the block could depend on addresses changed by merging
+  bool same = is_block && found.len == block->len && memcmp(found.data, block->data, block->len) == 0;
+
+  if (is_block)
+    xfree(found.data);
+
+  if (!same)
+    report_error(ctx, "data of '%s' changed after string merging, its values must not depend on addresses", block->label);
+
+  block->reached = true;
+
+  if (block->target == NULL) {
+    block->placed = true;
+    block->addr = get_current_section(ctx)->curr_pc;
+
+    // aliases preceding the block are waiting for its address
+    foreach (dc, sm->blocks) {
+      strmerge_block_t *alias = (strmerge_block_t *)dfirst(dc);
+
+      if (alias->target == block && alias->reached && !alias->defined)
+        define_alias(ctx, alias);
+    }
+
+    return false;
+  }
+
+  // alias is the scope for local labels as any global label
+  ctx->curr_global_label = xstrdup(block->label);
+  sm->skip_until = block->end;
+
+  if (block->target->placed)
+    define_alias(ctx, block);
+
+  return true;
+}
+
+bool strmerge_skip(compile_ctx_t *ctx, int stmt_idx)
+{
+  strmerge_t *sm = ctx->strmerge;
+
+  return sm != NULL && !sm->measure && stmt_idx < sm->skip_until;
+}
+
+// the longer blocks are kept, identical ones are merged into the first of them
+static int block_cmp(const void *b1, const void *b2)
+{
+  strmerge_block_t *block1 = *(strmerge_block_t **)b1;
+  strmerge_block_t *block2 = *(strmerge_block_t **)b2;
+
+  if (block1->len != block2->len)
+    return block2->len - block1->len;
+
+  return block1->stmt - block2->stmt;
+}
+
+void strmerge_plan(strmerge_t *sm)
+{
+  int nblocks = dynarray_length(sm->blocks);
+  strmerge_block_t **sorted = (strmerge_block_t **)xmalloc(sizeof(strmerge_block_t *) * (nblocks + 1));
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, sm->blocks)
+    sorted[foreach_current_index(dc)] = (strmerge_block_t *)dfirst(dc);
+
+  qsort(sorted, nblocks, sizeof(strmerge_block_t *), block_cmp);
+
+  for (int i = 0; i < nblocks; i++) {
+    strmerge_block_t *block = sorted[i];
+
+    block->target = NULL;
+    block->container = false;
+
+    for (int j = 0; j < i && block->movable; j++) {
+      strmerge_block_t *kept = sorted[j];
+
+      if (kept->target != NULL || kept->section_id != block->section_id)
+        continue;
+
+      if (memcmp(kept->data + kept->len - block->len, block->data, block->len) == 0) {
+        block->target = kept;
+        block->offset = kept->len - block->len;
+        kept->container = true;
+        break;
+      }
+    }
+  }
+
+  xfree(sorted);
+  sm->measure = false;
+}
+
+void strmerge_report(compile_ctx_t *ctx)
+{
+  strmerge_t *sm = ctx->strmerge;
+  dynarray_cell *dc = NULL;
+  int aliased = 0;
+  int saved = 0;
+
+  foreach (dc, sm->blocks) {
+    strmerge_block_t *block = (strmerge_block_t *)dfirst(dc);
+
+    if (block->target != NULL && block->defined) {
+      aliased++;
+      saved += block->len;
+    }
+  }
+
+  report_info("\x1b[96mString merging\x1b[97m: %d strings aliased, %d bytes saved", aliased, saved);
+
+  foreach (dc, sm->blocks) {
+    strmerge_block_t *block = (strmerge_block_t *)dfirst(dc);
+
+    if (block->target != NULL && block->defined) {
+      if (block->offset == 0)
+        report_info("  %s = %s (%d bytes)", block->label, block->target->label, block->len);
+      else
+        report_info("  %s = %s+%d (%d bytes)", block->label, block->target->label, block->offset, block->len);
+    }
+  }
+}
+
+void strmerge_free(strmerge_t *sm)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, sm->blocks) {
+    strmerge_block_t *block = (strmerge_block_t *)dfirst(dc);
+
+    xfree(block->label);
+    xfree(block->data);
+    xfree(block);
+  }
+
+  dynarray_free(sm->blocks);
+  sm->blocks = NULL;
+}
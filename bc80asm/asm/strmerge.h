@@ -0,0 +1,39 @@
+#pragma once
+
+#include "asm/compile.h"
+
+typedef struct strmerge_block_t strmerge_block_t;
+
+struct strmerge_block_t {
+  int stmt;                     // label statement
+  int end;                      // the first statement after DEFs of block
+  int section_id;
+  char *label;
+  char *data;
+  int len;
+  bool movable;                 // block could be aliased into another one
+
+  // plan: block holding the bytes of this one at given offset, NULL if block is kept
+  strmerge_block_t *target;
+  int offset;
+  bool container;               // some blocks are aliased into this one
+
+  // final pass
+  bool reached;                 // label statement is compiled
+  bool placed;                  // kept block is rendered at 'addr'
+  bool defined;                 // alias label is defined
+  uint32_t addr;
+};
+
+typedef struct strmerge_t {
+  bool measure;
+  dynarray *blocks;             // strmerge_block_t in source order
+  int skip_until;               // final pass: DEFs of aliased block are skipped up to this statement
+} strmerge_t;
+
+extern void strmerge_start(compile_ctx_t *ctx);
+extern bool strmerge_label(compile_ctx_t *ctx, dynarray *statements, int stmt_idx);
+extern bool strmerge_skip(compile_ctx_t *ctx, int stmt_idx);
+extern void strmerge_plan(strmerge_t *sm);
+extern void strmerge_report(compile_ctx_t *ctx);
+extern void strmerge_free(strmerge_t *sm);
@@ -20,7 +20,8 @@ static char *keywords[] = {
 
   "ORG", "REPT", "ENDR", "PROFILE", "ENDPROFILE", "EQU", "END", "DB", "DW", "DS",
   "DM", "DEFB", "DEFW", "DEFS", "DEFM", "INCBIN", "INCLUDE", "SECTION",
-  "IF", "ELSE", "ENDIF",
+  "IF", "ELSE", "ENDIF", "DELAY", "FASTCOPY", "FASTFILL", "TABLE", "ALIGN", "SWITCH",
+  "LOOPBOUND", "INCBIN_LZ", "DB_LZ", "KEEP",
   NULL};
 
 static bool is_keyword(const char *id)
@@ -81,6 +82,18 @@ parse_node *add_sym_variable_integer(compile_ctx_t *ctx, const char *name, int i
   return add_sym_variable_node(ctx, name, (parse_node *)l);
 }
 
+// label in the current section
+parse_node *add_sym_variable_address(compile_ctx_t *ctx, const char *name, uint32_t addr)
+{
+  LITERAL *l = make_node_internal(LITERAL);
+  l->kind = INT;
+  l->hdr.is_ref = false;
+  l->ival = addr;
+  l->section = ctx->curr_section_id + 1;
+
+  return add_sym_variable_node(ctx, name, (parse_node *)l);
+}
+
 parse_node *get_sym_variable(compile_ctx_t *ctx, const char *name, bool missing_ok)
 {
   parse_node *node = hashmap_get(ctx->symtab, (void *)name);
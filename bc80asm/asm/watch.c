@@ -0,0 +1,369 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "asm/parse.h"
+#include "asm/watch.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+
+// Files of --watch runs are cached between runs. Statements of every parsed file live in pool
+// of the file, so a changed file is parsed again and its old nodes are released without
+// touching other files. A file is reused while neither it nor any of its included files are
+// changed: parsing is repeated for changed files and files including them only.
+//
+// Changes are detected by polling stamps of files read by runs: it's portable and cheap for
+// the number of files of a program. Source files could be replaced by overlays (buffers of
+// editor served by bc80lsp), their stamps are versions of overlays.
+
+#define WATCH_POLL_INTERVAL_US 50000
+
+static void get_stamp(watch_t *watch, const char *path, watch_stamp_t *stamp)
+{
+  watch_overlay_t *overlay = (watch_overlay_t *)hashmap_get(watch->overlays, (void *)path);
+  struct stat st;
+
+  memset(stamp, 0, sizeof(watch_stamp_t));
+
+  if (overlay != NULL) {
+    stamp->exists = true;
+    stamp->size = strlen(overlay->text);
+    stamp->mtime_sec = -1;
+    stamp->mtime_nsec = overlay->seq;
+    return;
+  }
+
+  if (stat(path, &st) != 0)
+    return;
+
+  stamp->exists = true;
+  stamp->size = st.st_size;
+  stamp->mtime_sec = st.st_mtime;
+#ifdef __APPLE__
+  stamp->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  stamp->inode = st.st_ino;
+}
+
+static bool same_stamp(watch_stamp_t *a, watch_stamp_t *b)
+{
+  return a->exists == b->exists && a->size == b->size && a->mtime_sec == b->mtime_sec &&
+         a->mtime_nsec == b->mtime_nsec && a->inode == b->inode;
+}
+
+watch_t *watch_create()
+{
+  watch_t *watch = (watch_t *)xmalloc(sizeof(watch_t));
+
+  memset(watch, 0, sizeof(watch_t));
+  watch->pool = mmgr_switch(NULL);
+  mmgr_switch(watch->pool);
+  watch->files = hashmap_create(128, "watch_files");
+  watch->overlays = hashmap_create(64, "watch_overlays");
+
+  return watch;
+}
+
+// forget statements of file (must be called in watch pool)
+static void drop_file(watch_file_t *file)
+{
+  if (file->pool != NULL)
+    mmgr_pool_free(file->pool);
+
+  dynarray_free_deep(file->includes);
+
+  file->pool = NULL;
+  file->filename = NULL;
+  file->statements = NULL;
+  file->includes = NULL;
+}
+
+void watch_free(watch_t *watch)
+{
+  hashmap_scan *scan = hashmap_scan_init(watch->files);
+  hashmap_entry *entry = NULL;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    watch_file_t *file = (watch_file_t *)entry->value;
+
+    drop_file(file);
+    xfree(file->path);
+    xfree(file);
+  }
+
+  hashmap_free(watch->files);
+
+  scan = hashmap_scan_init(watch->overlays);
+
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    watch_overlay_t *overlay = (watch_overlay_t *)entry->value;
+
+    xfree(overlay->text);
+    xfree(overlay);
+  }
+
+  hashmap_free(watch->overlays);
+  xfree(watch);
+}
+
+// called before assembly of input file, allocations of assembly are tracked by run pool
+void watch_begin(watch_t *watch)
+{
+  watch->generation++;
+  watch->nparsed = 0;
+  watch->run_pool = mmgr_pool_create();
+  mmgr_switch(watch->run_pool);
+}
+
+// called after assembly even if it was interrupted by error
+void watch_end(watch_t *watch)
+{
+  mmgr_switch(watch->pool);
+
+  // files interrupted by error are parsed again by the next run
+  for (watch_file_t *file = watch->parsing; file != NULL; file = file->parent)
+    drop_file(file);
+
+  watch->parsing = NULL;
+
+  mmgr_pool_free(watch->run_pool);
+  watch->run_pool = NULL;
+}
+
+static watch_file_t *get_file(watch_t *watch, char *path)
+{
+  watch_file_t *file = (watch_file_t *)hashmap_get(watch->files, path);
+
+  if (file == NULL) {
+    file = (watch_file_t *)xmalloc(sizeof(watch_file_t));
+    memset(file, 0, sizeof(watch_file_t));
+    file->path = xstrdup(path);
+    hashmap_set(watch->files, path, file);
+  }
+
+  return file;
+}
+
+// "." and ".." components are resolved without touching file system: file of overlay may be
+// not saved yet. Result is allocated by malloc() like one of realpath()
+static char *normalize_path(const char *path)
+{
+  char *result = (char *)malloc(strlen(path) + 2);
+  const char *p = path;
+  int len = 0;
+
+  while (*p) {
+    const char *end = strchr(p, '/');
+    if (end == NULL)
+      end = p + strlen(p);
+
+    int n = end - p;
+
+    if (n == 2 && p[0] == '.' && p[1] == '.') {
+      while (len > 0 && result[--len] != '/')
+        ;
+    } else if (n > 0 && !(n == 1 && p[0] == '.')) {
+      result[len++] = '/';
+      memcpy(result + len, p, n);
+      len += n;
+    }
+
+    p = (*end != '\0') ? end + 1 : end;
+  }
+
+  if (len == 0)
+    result[len++] = '/';
+
+  result[len] = '\0';
+
+  return result;
+}
+
+// absolute path of file found in current directory or in include paths, like fs_abs_path(),
+// but overlays are taken before files on disk (NULL if file isn't found)
+char *watch_path(watch_t *watch, char *filename, dynarray *searchlist)
+{
+  char cwd[PATH_MAX];
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    cwd[0] = '\0';
+
+  // candidates are file name itself and file name in every directory of search list
+  for (int i = -1; i < dynarray_length(searchlist); i++) {
+    char *candidate = (i >= 0) ? bsprintf("%s/%s", (char *)dfirst(dynarray_nth_cell(searchlist, i)), filename) :
+                                 xstrdup(filename);
+
+    if (candidate[0] != '/') {
+      char *abs_candidate = bsprintf("%s/%s", cwd, candidate);
+
+      xfree(candidate);
+      candidate = abs_candidate;
+    }
+
+    char *path = normalize_path(candidate);
+
+    if (hashmap_get(watch->overlays, path) != NULL) {
+      xfree(candidate);
+      return path;
+    }
+
+    free(path);
+    path = fs_file_exists(candidate) ? realpath(candidate, NULL) : NULL;
+    xfree(candidate);
+
+    if (path != NULL)
+      return path;
+  }
+
+  return NULL;
+}
+
+// file can be reused if neither it nor its included files are changed since it was parsed
+static bool file_valid(watch_t *watch, watch_file_t *file)
+{
+  dynarray_cell *dc = NULL;
+  watch_stamp_t stamp;
+
+  if (file->checked == watch->generation)
+    return file->valid;
+
+  get_stamp(watch, file->path, &stamp);
+
+  file->checked = watch->generation;
+  file->valid = (file->pool != NULL) && same_stamp(&stamp, &file->stamp);
+
+  foreach (dc, file->includes) {
+    if (!file->valid)
+      break;
+
+    watch_file_t *included = (watch_file_t *)hashmap_get(watch->files, dfirst(dc));
+
+    // included file parsed after includer is already released from its statements
+    file->valid = (included != NULL) && file_valid(watch, included) &&
+                  (included->parse_seq < file->parse_seq);
+  }
+
+  return file->valid;
+}
+
+// append statements of file to the given ones, file is parsed only if it's changed since the
+// previous run, from is INCLUDE statement which refers to file (NULL for the main source)
+int watch_parse(watch_t *watch, char *filename, parse_node *from, compile_opts *opts, dynarray **statements)
+{
+  dynarray_cell *dc = NULL;
+  char *path = watch_path(watch, filename, opts->includeopts);
+
+  if (path == NULL)
+    report_not_found(from, filename);
+
+  mmgr_pool *prev = mmgr_switch(watch->pool);
+  watch_file_t *file = get_file(watch, path);
+
+  free(path);
+
+  if (watch->parsing != NULL)
+    watch->parsing->includes = dynarray_append_ptr(watch->parsing->includes, xstrdup(file->path));
+
+  if (!file_valid(watch, file)) {
+    drop_file(file);
+    get_stamp(watch, file->path, &file->stamp);
+    file->seen = file->stamp;
+
+    file->parent = watch->parsing;
+    watch->parsing = file;
+    file->pool = mmgr_pool_create();
+    mmgr_switch(file->pool);
+
+    watch_overlay_t *overlay = (watch_overlay_t *)hashmap_get(watch->overlays, file->path);
+
+    file->filename = xstrdup(filename);
+    char *source = (overlay != NULL) ? xstrdup(overlay->text) : read_file(file->path);
+
+    if (parse_source(file->filename, source, opts, &file->statements) != 0)
+      report_error_noloc("parse %s error", filename);
+
+    xfree(source);
+    mmgr_switch(watch->pool);
+
+    watch->parsing = file->parent;
+    file->parent = NULL;
+    file->parse_seq = ++watch->parse_seq;
+    file->valid = true;
+    watch->nparsed++;
+  }
+
+  mmgr_switch(prev);
+
+  foreach (dc, file->statements)
+    *statements = dynarray_append_ptr(*statements, dfirst(dc));
+
+  return 0;
+}
+
+// remember stamp of file read by INCBIN
+void watch_binary(watch_t *watch, char *path)
+{
+  mmgr_pool *prev = mmgr_switch(watch->pool);
+  watch_file_t *file = get_file(watch, path);
+
+  get_stamp(watch, file->path, &file->stamp);
+  file->seen = file->stamp;
+  mmgr_switch(prev);
+}
+
+// replace contents of source file by text, or use the file on disk again if text is NULL
+void watch_overlay(watch_t *watch, const char *path, const char *text)
+{
+  mmgr_pool *prev = mmgr_switch(watch->pool);
+  watch_overlay_t *overlay = (watch_overlay_t *)hashmap_remove(watch->overlays, (void *)path);
+
+  if (overlay != NULL) {
+    xfree(overlay->text);
+    xfree(overlay);
+  }
+
+  if (text != NULL) {
+    overlay = (watch_overlay_t *)xmalloc(sizeof(watch_overlay_t));
+    overlay->text = xstrdup(text);
+    overlay->seq = ++watch->overlay_seq;
+    hashmap_set(watch->overlays, (void *)path, overlay);
+  }
+
+  mmgr_switch(prev);
+}
+
+// wait until any of files read by runs is changed (files which aren't read anymore are still
+// watched, but they are reported once per change)
+void watch_wait(watch_t *watch)
+{
+  for (;;) {
+    hashmap_scan *scan = hashmap_scan_init(watch->files);
+    hashmap_entry *entry = NULL;
+    bool changed = false;
+
+    while ((entry = hashmap_scan_next(scan)) != NULL) {
+      watch_file_t *file = (watch_file_t *)entry->value;
+      watch_stamp_t stamp;
+
+      get_stamp(watch, file->path, &stamp);
+
+      if (!same_stamp(&stamp, &file->seen)) {
+        file->seen = stamp;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      return;
+
+    usleep(WATCH_POLL_INTERVAL_US);
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asm/bc80asm.h"
+#include "bits/mmgr.h"
+
+typedef struct dynarray dynarray;
+typedef struct hashmap hashmap;
+typedef struct parse_node parse_node;
+
+typedef struct {
+  bool exists;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;
+} watch_stamp_t;
+
+// contents of file which replace the one on disk (e.g. edited but not saved by editor)
+typedef struct {
+  char *text;
+  int seq;                      // order of setting, replaces modification time of file
+} watch_overlay_t;
+
+typedef struct watch_file_t {
+  char *path;                   // resolved path, key of watch_t.files
+  watch_stamp_t stamp;          // taken before file was read
+  watch_stamp_t seen;           // stamp seen by the last check for changes
+  mmgr_pool *pool;              // nodes of parsed statements (NULL if not parsed, e.g. INCBIN file)
+  char *filename;               // name of file as referenced by node locations (allocated in pool)
+  dynarray *statements;         // statements of file with ones of included files in place of INCLUDE
+  dynarray *includes;           // paths of files included directly
+  int parse_seq;                // order of parsing finish: included files are parsed before includer
+  int checked;                  // generation of the last validity check
+  bool valid;
+  struct watch_file_t *parent;  // includer while file is being parsed
+} watch_file_t;
+
+typedef struct watch_t {
+  mmgr_pool *pool;              // pool of watch_create() caller: bookkeeping of watch_t
+  mmgr_pool *run_pool;          // allocations of current run, released by watch_end()
+  hashmap *files;               // path -> watch_file_t of files read by runs
+  hashmap *overlays;            // path -> watch_overlay_t of source files
+  int overlay_seq;
+  watch_file_t *parsing;        // the innermost file being parsed
+  int generation;               // number of current run
+  int parse_seq;
+  int nparsed;                  // files parsed by current run
+} watch_t;
+
+extern watch_t *watch_create();
+extern void watch_free(watch_t *watch);
+extern void watch_begin(watch_t *watch);
+extern void watch_end(watch_t *watch);
+extern int watch_parse(watch_t *watch, char *filename, parse_node *from, compile_opts *opts, dynarray **statements);
+extern char *watch_path(watch_t *watch, char *filename, dynarray *searchlist);
+extern void watch_binary(watch_t *watch, char *path);
+extern void watch_overlay(watch_t *watch, const char *path, const char *text);
+extern void watch_wait(watch_t *watch);
@@ -1,14 +1,66 @@
 #include <setjmp.h>
 #include <stdarg.h>
-#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "bits/buffer.h"
 #include "bits/error.h"
 
-static jmp_buf *error_env;
+// error handling state is per thread, so that every thread could run its own job
+static _Thread_local jmp_buf *error_env;
+static _Thread_local bool quiet_mode = false;
+static _Thread_local FILE *error_output = NULL;
+static _Thread_local error_handler message_handler = NULL;
+static _Thread_local void *message_handler_data = NULL;
+
+jmp_buf *set_error_context(jmp_buf *error_env_) {
+  jmp_buf *prev = error_env;
 
-void set_error_context(jmp_buf *error_env_) {
   error_env = error_env_;
+  return prev;
+}
+
+void set_error_handler(error_handler handler, void *data) {
+  message_handler = handler;
+  message_handler_data = data;
+}
+
+void get_error_handler(error_handler *handler, void **data) {
+  *handler = message_handler;
+  *data = message_handler_data;
+}
+
+// pass message to handler if it's set, returns false if message should be printed
+static bool handle_message(int kind, int flags, const char *filename, int line, int pos, const char *msg) {
+  if (message_handler == NULL)
+    return false;
+
+  message_handler(message_handler_data, kind,
+    (flags & ERROR_OUT_LOC) ? filename : NULL,
+    (flags & ERROR_OUT_LINE) ? line : 0,
+    (flags & ERROR_OUT_POS) ? pos : 0,
+    msg);
+
+  return true;
+}
+
+void set_error_output(FILE *output) {
+  error_output = output;
+}
+
+static inline FILE *get_error_output() {
+  return error_output ? error_output : stderr;
+}
+
+void set_error_quiet(bool quiet) {
+  quiet_mode = quiet;
+}
+
+// file name of path, unlike basename() it's safe for concurrent jobs
+static const char *file_name(const char *path) {
+  const char *slash = strrchr(path, '/');
+
+  return slash ? slash + 1 : path;
 }
 
 void generic_report_error(int flags, const char *filename, int line, int pos, char *fmt, ...) {
@@ -19,16 +71,20 @@ void generic_report_error(int flags, const char *filename, int line, int pos, ch
   buffer_append_va(msgbuf, fmt, args);
   va_end(args);
 
+  if (handle_message(MESSAGE_ERROR, flags, filename, line, pos, msgbuf->data))
+    goto out;
+
   if (flags & ERROR_OUT_LOC) {
-    fprintf(stderr, "\x1b[97m%s", basename((char *)filename));
+    fprintf(get_error_output(), "\x1b[97m%s", file_name(filename));
     if (flags & ERROR_OUT_LINE)
-      fprintf(stderr, ":%d", line);
+      fprintf(get_error_output(), ":%d", line);
     if (flags & ERROR_OUT_POS)
-      fprintf(stderr, ":%d", pos);
-    fprintf(stderr, ":\x1b[0m ");
+      fprintf(get_error_output(), ":%d", pos);
+    fprintf(get_error_output(), ":\x1b[0m ");
   }
-  fprintf(stderr, "\x1b[91merror:\x1b[0m \x1b[97m%s\x1b[0m\n", msgbuf->data);
+  fprintf(get_error_output(), "\x1b[91merror:\x1b[0m \x1b[97m%s\x1b[0m\n", msgbuf->data);
 
+out:
   buffer_free(msgbuf);
 
   longjmp(*error_env, 1);
@@ -36,33 +92,45 @@ void generic_report_error(int flags, const char *filename, int line, int pos, ch
 
 void generic_report_warning(int flags, const char *filename, int line, int pos, char *fmt, ...) {
   va_list args;
+
+  if (quiet_mode)
+    return;
   buffer *msgbuf = buffer_init();
 
   va_start(args, fmt);
   buffer_append_va(msgbuf, fmt, args);
   va_end(args);
 
+  if (handle_message(MESSAGE_WARNING, flags, filename, line, pos, msgbuf->data)) {
+    buffer_free(msgbuf);
+    return;
+  }
+
   if (flags & ERROR_OUT_LOC) {
-    fprintf(stderr, "\x1b[97m%s", basename((char *)filename));
+    fprintf(get_error_output(), "\x1b[97m%s", file_name(filename));
     if (flags & ERROR_OUT_LINE)
-      fprintf(stderr, ":%d", line);
+      fprintf(get_error_output(), ":%d", line);
     if (flags & ERROR_OUT_POS)
-      fprintf(stderr, ":%d", pos);
-    fprintf(stderr, ":\x1b[0m");
+      fprintf(get_error_output(), ":%d", pos);
+    fprintf(get_error_output(), ":\x1b[0m");
   }
-  fprintf(stderr, " \x1b[95mwarning:\x1b[0m \x1b[97m%s\x1b[0m\n", msgbuf->data);
+  fprintf(get_error_output(), " \x1b[95mwarning:\x1b[0m \x1b[97m%s\x1b[0m\n", msgbuf->data);
 
   buffer_free(msgbuf);
 }
 
 void report_info(char *fmt, ...) {
   va_list args;
+
+  if (quiet_mode)
+    return;
   buffer *msgbuf = buffer_init();
 
   va_start(args, fmt);
   buffer_append_va(msgbuf, fmt, args);
   va_end(args);
 
-  fprintf(stderr, "\x1b[97m%s\x1b[0m\n", msgbuf->data);
+  if (!handle_message(MESSAGE_INFO, 0, NULL, 0, 0, msgbuf->data))
+    fprintf(get_error_output(), "\x1b[97m%s\x1b[0m\n", msgbuf->data);
   buffer_free(msgbuf);
 }
@@ -1,12 +1,36 @@
 #pragma once
 
 #include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 #define ERROR_OUT_LOC  (1 << 0)
 #define ERROR_OUT_LINE (1 << 1)
 #define ERROR_OUT_POS  (1 << 2)
 
-extern void set_error_context(jmp_buf *error_env);
+enum {
+  MESSAGE_ERROR = 0,
+  MESSAGE_WARNING,
+  MESSAGE_INFO,
+};
+
+// receives messages instead of error output, filename is NULL and line and pos are zero if not known
+typedef void (*error_handler)(void *data, int kind, const char *filename, int line, int pos, const char *msg);
+
+// set target of longjmp for errors of current thread, returns the previous one
+extern jmp_buf *set_error_context(jmp_buf *error_env);
+
+// pass messages of current thread to handler (NULL to print them)
+extern void set_error_handler(error_handler handler, void *data);
+
+// handler of current thread and its data, to restore them after set_error_handler()
+extern void get_error_handler(error_handler *handler, void **data);
+
+// redirect messages of current thread to another stream (NULL for stderr)
+extern void set_error_output(FILE *output);
+
+// suppress warnings and info messages (errors are reported anyway)
+extern void set_error_quiet(bool quiet);
 
 extern void generic_report_error(int flags, const char *filename, int line, int pos, char *fmt, ...);
 extern void generic_report_warning(int flags, const char *filename, int line, int pos, char *fmt, ...);
@@ -23,7 +47,7 @@ extern void report_info(char *fmt, ...);
 #define report_warning(ctx, fmt, ...) \
   do { \
     generic_report_warning(ERROR_OUT_LOC | ERROR_OUT_LINE, \
-      (ctx)->node->fn, (ctx)->node->line, 0, \
+      (ctx)->node->fn, (ctx)->node->line - 1, 0, \
       fmt, ## __VA_ARGS__); \
   } while (0)
 
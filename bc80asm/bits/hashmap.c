@@ -191,12 +191,16 @@ void hashmap_free(hashmap *hm) {
 
   for (int i = 0; i < hm->num_entries; i++) {
     hashmap_entry *entry = &hm->hashtab[i];
+    hashmap_entry *next = entry->next;
 
     free_fn(hm, entry->key);
 
-    while (entry->next != NULL) {
-      entry = entry->next;
+    // entries of collision lists are allocated one by one
+    while (next != NULL) {
+      entry = next;
+      next = entry->next;
       free_fn(hm, entry->key);
+      free_fn(hm, entry);
     }
   }
   free_fn(hm, hm->hashtab);
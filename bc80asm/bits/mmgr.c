@@ -7,13 +7,14 @@
 #include "bits/hashmap.h"
 #include "bits/mmgr.h"
 
-static hashmap *allocations = NULL;
-static size_t stat_alloc_bytes = 0;
-static size_t stat_dealloc_bytes = 0;
-static size_t stat_max_heap = 0;
-static size_t stat_num_allocs = 0;
-static size_t stat_num_reallocs = 0;
-static size_t stat_num_deallocs = 0;
+// allocations are tracked per thread: memory must be freed by the thread which allocated it
+static _Thread_local hashmap *allocations = NULL;
+static _Thread_local size_t stat_alloc_bytes = 0;
+static _Thread_local size_t stat_dealloc_bytes = 0;
+static _Thread_local size_t stat_max_heap = 0;
+static _Thread_local size_t stat_num_allocs = 0;
+static _Thread_local size_t stat_num_reallocs = 0;
+static _Thread_local size_t stat_num_deallocs = 0;
 
 struct alloc_entry {
   void *ptr;
@@ -64,6 +65,35 @@ void mmgr_init() {
                         internal_hash);
 }
 
+// true if allocations of current thread are tracked
+bool mmgr_active() {
+  return allocations != NULL;
+}
+
+// new pool which isn't current yet
+mmgr_pool *mmgr_pool_create() {
+  mmgr_pool *prev = mmgr_switch(NULL);
+
+  mmgr_init();
+
+  return mmgr_switch(prev);
+}
+
+// release all memory tracked by pool
+void mmgr_pool_free(mmgr_pool *pool) {
+  mmgr_pool *prev = mmgr_switch(pool);
+
+  mmgr_finish(false);
+  mmgr_switch((prev != pool) ? prev : NULL);
+}
+
+// make pool current (NULL for none), returns previous one
+mmgr_pool *mmgr_switch(mmgr_pool *pool) {
+  mmgr_pool *prev = allocations;
+  allocations = pool;
+  return prev;
+}
+
 void *xmalloc_(size_t size, const char *tag, const char *file, int line) {
   void *ptr = malloc(size);
 
@@ -124,6 +154,7 @@ void xfree_(void *ptr, const char *file, int line) {
   if ((stat_alloc_bytes - stat_dealloc_bytes) > stat_max_heap)
     stat_max_heap = stat_alloc_bytes - stat_dealloc_bytes;
 
+  internal_free(NULL, entry);
   free(ptr);
 }
 
@@ -162,6 +193,7 @@ void mmgr_finish(bool dump_stats) {
       printf("    post dealloc %lu bytes from %s:%d (%s)\n",
         ae->size, ae->file, ae->line, ae->tag);
     free(ae->ptr);
+    internal_free(NULL, ae);
   }
 
   if (dump_stats)
@@ -5,6 +5,15 @@
 
 extern void mmgr_init();
 extern void mmgr_finish(bool dump_stats);
+extern bool mmgr_active();
+
+// allocations are tracked by the current pool of thread: memory which outlives a piece of work
+// (e.g. cached between runs) is allocated in its own pool and released by finishing that pool
+typedef struct hashmap mmgr_pool;
+
+extern mmgr_pool *mmgr_pool_create();
+extern void mmgr_pool_free(mmgr_pool *pool);
+extern mmgr_pool *mmgr_switch(mmgr_pool *pool);
 
 // use it for 'set-like' hashmaps, when value doesn't make sense but presence makes
 #define XMMGR_DUMMY_PTR (void *)1
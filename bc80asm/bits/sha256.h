@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+// SHA-256 (FIPS 180-4) of data hashed so far
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;              // bytes hashed so far
+  uint8_t block[64];            // bytes of incomplete block
+} sha256_ctx;
+
+extern void sha256_init(sha256_ctx *ctx);
+extern void sha256_update(sha256_ctx *ctx, const void *data, size_t size);
+extern void sha256_final(sha256_ctx *ctx, uint8_t *hash);
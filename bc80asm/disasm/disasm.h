@@ -178,6 +178,11 @@ extern char *disassemble(char *data,
                   int opt_org);
 extern void disas_render_text(disas_context_t *ctx);
 
+// decodes single instruction (data must have 4 bytes available), returns false for invalid opcode
+extern bool disassemble_instr(uint8_t *data, disas_node_t *node);
+// mnemonic with arguments only, e.g. "ld a, 0ah"
+extern char *disas_instr_text(disas_node_t *node);
+
 extern char *MnemonicStrings[];
 
 // frequently used register shortcuts
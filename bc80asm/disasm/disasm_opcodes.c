@@ -44,6 +44,7 @@ static int add_instr1(disas_context_t *ctx, MnemonicEnum instr, int isize, disas
   node->cycles = cycles;
   node->num_args = 1;
   node->args[0] = *arg1;
+  xfree(arg1);
   ctx->curr_addr += node->isize;
   node->next = NULL;
 
@@ -62,6 +63,8 @@ static int add_instr2(disas_context_t *ctx, MnemonicEnum instr, int isize, disas
   node->num_args = 2;
   node->args[0] = *arg1;
   node->args[1] = *arg2;
+  xfree(arg1);
+  xfree(arg2);
   ctx->curr_addr += node->isize;
   node->next = NULL;
 
@@ -235,7 +238,7 @@ static int process_arithmetic(disas_context_t *ctx, uint8_t *data) {
   } else if (data[0] == 0xc6) {
     return add_instr2(ctx, ADD, 2, mk_arg_A, mk_arg(ARG_8IMM, data[1], 0, false), 7);
   } else if ((data[0] & 0xcf) == 0x09) {
-    return add_instr2(ctx, ADD, 1, mk_arg_HL, mk_arg(ARG_REGPAIR_Q, (data[0] >> 4) & 0x3, 0, false), 15);
+    return add_instr2(ctx, ADD, 1, mk_arg_HL, mk_arg(ARG_REGPAIR_Q, (data[0] >> 4) & 0x3, 0, false), 11);
   } else if (((data[0] == 0xdd) || (data[0] == 0xfd)) && ((data[1] & 0xcf) == 0x09)) {
     return add_instr2(ctx, ADD, 2, mk_arg(ARG_REGPAIR_I, (data[0] & 0x20) ? REG_IY : REG_IX, 0, false), mk_arg(ARG_REGPAIR_Q, (data[1] >> 4) & 0x3, 0, false), 15);
   } else if (data[0] == 0x8e) {
@@ -548,6 +551,31 @@ static int process_cpucontrol(disas_context_t *ctx, uint8_t *data) {
   return 0;
 }
 
+static int decode_instr(disas_context_t *ctx, uint8_t *p) {
+  int isize = process_ld(ctx, p);
+
+  if (isize == 0)
+    isize = process_pushpop(ctx, p);
+  if (isize == 0)
+    isize = process_ex_exx(ctx, p);
+  if (isize == 0)
+    isize = process_block_transfer_search(ctx, p);
+  if (isize == 0)
+    isize = process_arithmetic(ctx, p);
+  if (isize == 0)
+    isize = process_rotate_shift(ctx, p);
+  if (isize == 0)
+    isize = process_bit_manipulation(ctx, p);
+  if (isize == 0)
+    isize = process_jump_call_ret(ctx, p);
+  if (isize == 0)
+    isize = process_io(ctx, p);
+  if (isize == 0)
+    isize = process_cpucontrol(ctx, p);
+
+  return isize;
+}
+
 char *disassemble(char *data,
                   ssize_t size,
                   bool opt_addr,
@@ -572,28 +600,7 @@ char *disassemble(char *data,
   memset(&context.labels_bmp, 0, sizeof(context.labels_bmp));
 
   while (size > 0) {
-    int isize = 0;
-
-    if (isize == 0)
-      isize = process_ld(&context, p);
-    if (isize == 0)
-      isize = process_pushpop(&context, p);
-    if (isize == 0)
-      isize = process_ex_exx(&context, p);
-    if (isize == 0)
-      isize = process_block_transfer_search(&context, p);
-    if (isize == 0)
-      isize = process_arithmetic(&context, p);
-    if (isize == 0)
-      isize = process_rotate_shift(&context, p);
-    if (isize == 0)
-      isize = process_bit_manipulation(&context, p);
-    if (isize == 0)
-      isize = process_jump_call_ret(&context, p);
-    if (isize == 0)
-      isize = process_io(&context, p);
-    if (isize == 0)
-      isize = process_cpucontrol(&context, p);
+    int isize = decode_instr(&context, p);
 
     if (isize == 0) {
       int inv_isize = add_invalid_instr(&context, p[0]);
@@ -617,3 +624,18 @@ char *disassemble(char *data,
   return context.out_str;
 }
 
+bool disassemble_instr(uint8_t *data, disas_node_t *node) {
+  disas_context_t context;
+
+  memset(&context, 0, sizeof(context));
+  context.binary = data;
+
+  if (decode_instr(&context, data) == 0)
+    return false;
+
+  *node = *context.nodes;
+  node->next = NULL;
+  xfree(context.nodes);
+
+  return true;
+}
@@ -116,6 +116,163 @@ static int disas_printf(disas_context_t *ctx, char *fmt, ...) {
   return ctx->out_len - prev_len;
 }
 
+// renders mnemonic with arguments, returns number of printed characters
+static int render_instr(disas_context_t *ctx, disas_node_t *node) {
+  int column = 0;
+
+  char *mnemonic = str_tolower(MnemonicStrings[node->instr]);
+  column += disas_printf(ctx, "%s ", mnemonic);
+  xfree(mnemonic);
+
+  assert(node->num_args <= 2);
+
+  for (int i = 0; i < node->num_args; i++) {
+    switch (node->args[i].kind) {
+      case ARG_16IMM: {
+        uint16_t ival16 = ((uint16_t)node->args[i].extra << 8) | (uint16_t)node->args[i].value;
+        char *strval = NULL;
+        if (ctx->opt_labels && (node->instr == JP || node->instr == CALL))
+          strval = get_label_name(ctx, ival16);
+
+        if (strval == NULL)
+          strval = int_to_hex(ival16, true);
+
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          strval,
+          (node->args[i].is_ref ? ")" : ""));
+
+        xfree(strval);
+        break;
+      }
+
+      case ARG_INDEX: {
+        int8_t off8 = (int8_t)(node->args[i].extra & 0xff);
+        column += disas_printf(ctx, "(%s%s%d)",
+          (node->args[i].value == 0) ? "ix" : "iy",
+          (off8 >= 0) ? "+" : "-",
+          (off8 >= 0) ? off8 : -off8);
+        break;
+      }
+
+      case ARG_8IMM: {
+        char *strval = int_to_hex(node->args[i].value, false);
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          strval,
+          (node->args[i].is_ref ? ")" : ""));
+        xfree(strval);
+        break;
+      }
+
+      case ARG_BITNUM:
+        column += disas_printf(ctx, "%d", node->args[i].value);
+        break;
+
+      case ARG_8GPR: {
+        static char *regnames[] = {"b", "c", "d", "e", "h", "l", "<?>", "a"};
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          regnames[node->args[i].value % 8],
+          (node->args[i].is_ref ? ")" : ""));
+        break;
+      }
+
+      case ARG_INTERRUPT:
+        disas_printf(ctx, "i");
+        column += 1;
+        break;
+
+      case ARG_REFRESH:
+        disas_printf(ctx, "r");
+        column += 1;
+        break;
+
+      case ARG_REGPAIR_P: {
+        static char *regnames_16p[] = {"bc", "de", "hl", "af"};
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          regnames_16p[node->args[i].value % 4],
+          (node->args[i].is_ref ? ")" : ""));
+        break;
+      }
+
+      case ARG_REGPAIR_I: {
+        static char *regnames_16i[] = {"ix", "iy"};
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          regnames_16i[node->args[i].value % 2],
+          (node->args[i].is_ref ? ")" : ""));
+        break;
+      }
+
+      case ARG_REGPAIR_Q: {
+        static char *regnames_16q[] = {"bc", "de", "hl", "sp"};
+        column += disas_printf(ctx, "%s%s%s",
+          (node->args[i].is_ref ? "(" : ""),
+          regnames_16q[node->args[i].value % 4],
+          (node->args[i].is_ref ? ")" : ""));
+        break;
+      }
+
+      case ARG_AF_SHADOW:
+        disas_printf(ctx, "af'");
+        column += 3;
+        break;
+
+      case ARG_CONDITION: {
+        static char *condnames[] = {"nz", "z", "nc", "c", "po", "pe", "p", "m"};
+        column += disas_printf(ctx, "%s", condnames[node->args[i].value % 8]);
+        break;
+      }
+
+      case ARG_RELJUMP: {
+        int8_t next_instr_offset = (int8_t)(node->args[i].value & 0xff);
+
+        // add current JR instruction size
+        next_instr_offset += node->args[i].extra;
+
+        column += disas_printf(ctx, "$%s%d",
+          (next_instr_offset >= 0) ? "+" : "-",
+          (next_instr_offset >= 0) ? next_instr_offset : -next_instr_offset);
+
+        break;
+      }
+
+      case ARG_RST: {
+        uint8_t rstval[] = {0, 8, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38};
+        char *strval = int_to_hex(rstval[node->args[i].value % 8], false);
+        column += disas_printf(ctx, "%s", strval);
+        xfree(strval);
+        break;
+      }
+
+      case ARG_HALFINDEX: {
+        static char *regnames_ix[] = {"b", "c", "d", "e", "ixh", "ixl", "<?>", "a"};
+        static char *regnames_iy[] = {"b", "c", "d", "e", "iyh", "iyl", "<?>", "a"};
+
+        assert((node->args[i].extra == 0xdd) || (node->args[i].extra == 0xfd));
+
+        char **regnames = (node->args[i].extra == 0xdd) ? regnames_ix : regnames_iy;
+        column += disas_printf(ctx, "%s", regnames[node->args[i].value % 8]);
+        break;
+      }
+
+      default:
+        disas_printf(ctx, "<?>");
+        column += 3;
+        break;
+    }
+
+    if (i < node->num_args - 1) {
+      disas_printf(ctx, ", ");
+      column += 2;
+    }
+  } // for (args)
+
+  return column;
+}
+
 void disas_render_text(disas_context_t *ctx) {
   for (int i = 0; i < INSTR_COLUMN; i++) {
     disas_printf(ctx, " ");
@@ -154,155 +311,7 @@ void disas_render_text(disas_context_t *ctx) {
       continue;
     }
 
-    char *mnemonic = str_tolower(MnemonicStrings[node->instr]);
-    column += disas_printf(ctx, "%s ", mnemonic);
-    xfree(mnemonic);
-
-    assert(node->num_args <= 2);
-
-    for (int i = 0; i < node->num_args; i++) {
-      switch (node->args[i].kind) {
-        case ARG_16IMM: {
-          uint16_t ival16 = ((uint16_t)node->args[i].extra << 8) | (uint16_t)node->args[i].value;
-          char *strval = NULL;
-          if (ctx->opt_labels && (node->instr == JP || node->instr == CALL))
-            strval = get_label_name(ctx, ival16);
-
-          if (strval == NULL)
-            strval = int_to_hex(ival16, true);
-
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            strval,
-            (node->args[i].is_ref ? ")" : ""));
-
-          xfree(strval);
-          break;
-        }
-
-        case ARG_INDEX: {
-          int8_t off8 = (int8_t)(node->args[i].extra & 0xff);
-          column += disas_printf(ctx, "(%s%s%d)",
-            (node->args[i].value == 0) ? "ix" : "iy",
-            (off8 >= 0) ? "+" : "-",
-            (off8 >= 0) ? off8 : -off8);
-          break;
-        }
-
-        case ARG_8IMM: {
-          char *strval = int_to_hex(node->args[i].value, false);
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            strval,
-            (node->args[i].is_ref ? ")" : ""));
-          xfree(strval);
-          break;
-        }
-
-        case ARG_BITNUM:
-          column += disas_printf(ctx, "%d", node->args[i].value);
-          break;
-
-        case ARG_8GPR: {
-          static char *regnames[] = {"b", "c", "d", "e", "h", "l", "<?>", "a"};
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            regnames[node->args[i].value % 8],
-            (node->args[i].is_ref ? ")" : ""));
-          break;
-        }
-
-        case ARG_INTERRUPT:
-          disas_printf(ctx, "i");
-          column += 1;
-          break;
-
-        case ARG_REFRESH:
-          disas_printf(ctx, "r");
-          column += 1;
-          break;
-
-        case ARG_REGPAIR_P: {
-          static char *regnames_16p[] = {"bc", "de", "hl", "af"};
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            regnames_16p[node->args[i].value % 4],
-            (node->args[i].is_ref ? ")" : ""));
-          break;
-        }
-
-        case ARG_REGPAIR_I: {
-          static char *regnames_16i[] = {"ix", "iy"};
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            regnames_16i[node->args[i].value % 2],
-            (node->args[i].is_ref ? ")" : ""));
-          break;
-        }
-
-        case ARG_REGPAIR_Q: {
-          static char *regnames_16q[] = {"bc", "de", "hl", "sp"};
-          column += disas_printf(ctx, "%s%s%s",
-            (node->args[i].is_ref ? "(" : ""),
-            regnames_16q[node->args[i].value % 4],
-            (node->args[i].is_ref ? ")" : ""));
-          break;
-        }
-
-        case ARG_AF_SHADOW:
-          disas_printf(ctx, "af'");
-          column += 3;
-          break;
-
-        case ARG_CONDITION: {
-          static char *condnames[] = {"nz", "z", "nc", "c", "po", "pe", "p", "m"};
-          column += disas_printf(ctx, "%s", condnames[node->args[i].value % 8]);
-          break;
-        }
-
-        case ARG_RELJUMP: {
-          int8_t next_instr_offset = (int8_t)(node->args[i].value & 0xff);
-
-          // add current JR instruction size
-          next_instr_offset += node->args[i].extra;
-
-          column += disas_printf(ctx, "$%s%d",
-            (next_instr_offset >= 0) ? "+" : "-",
-            (next_instr_offset >= 0) ? next_instr_offset : -next_instr_offset);
-
-          break;
-        }
-
-        case ARG_RST: {
-          uint8_t rstval[] = {0, 8, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38};
-          char *strval = int_to_hex(rstval[node->args[i].value % 8], false);
-          column += disas_printf(ctx, "%s", strval);
-          xfree(strval);
-          break;
-        }
-
-        case ARG_HALFINDEX: {
-          static char *regnames_ix[] = {"b", "c", "d", "e", "ixh", "ixl", "<?>", "a"};
-          static char *regnames_iy[] = {"b", "c", "d", "e", "iyh", "iyl", "<?>", "a"};
-
-          assert((node->args[i].extra == 0xdd) || (node->args[i].extra == 0xfd));
-
-          char **regnames = (node->args[i].extra == 0xdd) ? regnames_ix : regnames_iy;
-          column += disas_printf(ctx, "%s", regnames[node->args[i].value % 8]);
-          break;
-        }
-
-        default:
-          disas_printf(ctx, "<?>");
-          column += 3;
-          break;
-      }
-
-      if (i < node->num_args - 1) {
-        disas_printf(ctx, ", ");
-        column += 2;
-      }
-    } // for (args)
+    column += render_instr(ctx, node);
 
     if (ctx->opt_addr || ctx->opt_source) {
       // add comment at the line end
@@ -347,3 +356,19 @@ void disas_render_text(disas_context_t *ctx) {
       disas_printf(ctx, "\n");
   } // for (nodes)
 }
+
+char *disas_instr_text(disas_node_t *node) {
+  disas_context_t ctx;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.out_capacity = 64;
+  ctx.out_str = xmalloc(ctx.out_capacity);
+
+  render_instr(&ctx, node);
+
+  // drop separator printed after mnemonic without arguments
+  while (ctx.out_len > 0 && ctx.out_str[ctx.out_len - 1] == ' ')
+    ctx.out_str[--ctx.out_len] = '\0';
+
+  return ctx.out_str;
+}
@@ -0,0 +1,165 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/snafmt.h"
+#include "bits/common.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/mmgr.h"
+#include "ld/bc80ld.h"
+
+static void print_usage(char *cmd)
+{
+  printf("Linker for bc80asm objects\n\n"
+         "usage: %s [options] <object file>...\n\n"
+         "options:\n"
+         "  -h              this help\n"
+         "  -o filename     name of target file (will use the first object file name if omitted)\n"
+         "  -T script       read section placements from linker script: one 'name base [filler]' per line,\n"
+         "                  text after ';' or '#' is a comment\n"
+         "  --section-start name=addr  place sections with given name from address\n"
+         "  --fill value    filler of gaps between sections (default: 0)\n"
+         "  -t target       set output file target type. Can be one of:\n"
+         "     raw (default)       raw binary from the lowest section address, gaps between sections\n"
+         "                         are filled with filler of preceding section.\n"
+         "     sna                 RAM snapshot file (SNA, 48k uncompressed)\n"
+         "\nPlacement moves sections to another address and relocates addresses in them. Sections with\n"
+         "the same name are placed one after another in command line order (aligned as ALIGN inside\n"
+         "of them requires), sections without placement stay at their ORG addresses.\n"
+         "\nFollowing options are valid only for sna target:\n"
+         "  --sna-generic      don't initialize RAM in the shapshot (default: initialize for ZX Spectrum device)\n"
+         "  --sna-pc value     initial value of PC (default: lowest section address)\n"
+         "  --sna-ramtop addr  address for RAM top (zxspectrum; default 5D5Bh) or initial stack (generic; default 4000h)\n",
+         cmd
+  );
+}
+
+static jmp_buf error_env;
+
+enum {
+  LONGOPT_SNA_GENERIC = 1,
+  LONGOPT_SNA_PC,
+  LONGOPT_SNA_RAMTOP,
+  LONGOPT_SECTION_START,
+  LONGOPT_FILL,
+};
+
+int main(int argc, char **argv)
+{
+  int optflag;
+  char *outfile = NULL;
+  char *dest_buf = NULL;
+  ld_ctx_t ctx = {0};
+  int fill;
+
+  int ret = setjmp(error_env);
+  if (ret != 0)
+    // returning from longjmp (error handler)
+    goto out;
+
+  set_error_context(&error_env);
+
+  mmgr_init();
+
+  ctx.opts.sna_pc_addr = -1;
+  ctx.opts.sna_ramtop = -1;
+
+  opterr = 0;
+
+  const struct option long_options[] = {
+    {"sna-generic",   no_argument,       0,            LONGOPT_SNA_GENERIC},
+    {"sna-pc",        required_argument, 0,            LONGOPT_SNA_PC},
+    {"sna-ramtop",    required_argument, 0,            LONGOPT_SNA_RAMTOP},
+    {"section-start", required_argument, 0,            LONGOPT_SECTION_START},
+    {"fill",          required_argument, 0,            LONGOPT_FILL},
+    {0, 0, 0, 0}
+  };
+
+  while ((optflag = getopt_long(argc, argv, "ho:t:T:", long_options, NULL)) != -1) {
+    switch (optflag) {
+      case LONGOPT_SNA_GENERIC:
+        ctx.opts.sna_generic = true;
+        break;
+
+      case LONGOPT_SNA_PC:
+        if (!parse_any_integer(optarg, &ctx.opts.sna_pc_addr))
+          report_error_noloc("can't parse value for PC address: %s", optarg);
+        break;
+
+      case LONGOPT_SNA_RAMTOP:
+        if (!parse_any_integer(optarg, &ctx.opts.sna_ramtop))
+          report_error_noloc("can't parse value for ramtop address: %s", optarg);
+        break;
+
+      case LONGOPT_SECTION_START:
+        ld_add_placement(&ctx.opts, optarg);
+        break;
+
+      case LONGOPT_FILL:
+        if (!parse_any_integer(optarg, &fill) || fill < 0 || fill > 0xff)
+          report_error_noloc("filler must be a byte: %s", optarg);
+        ctx.opts.fill = fill;
+        break;
+
+      case 'o':
+        xfree(outfile);
+        outfile = xstrdup(optarg);
+        break;
+
+      case 'T':
+        ld_script_read(&ctx.opts, optarg);
+        break;
+
+      case 't':
+        if (strcasecmp(optarg, "raw") == 0)
+          ctx.opts.target = LD_TARGET_RAW;
+        else if (strcasecmp(optarg, "sna") == 0)
+          ctx.opts.target = LD_TARGET_SNA;
+        else
+          report_error_noloc("target must be one of 'raw', 'sna'");
+        break;
+
+      case 'h':
+      case '?':
+      default:
+        print_usage(argv[0]);
+        goto out;
+    }
+  }
+
+  if (ctx.opts.sna_ramtop == -1)
+    ctx.opts.sna_ramtop = ctx.opts.sna_generic ? SNA_DEFAULT_RAMTOP : ZX_DEFAULT_RAMTOP;
+
+  if (optind >= argc)
+    report_error_noloc("no input files specified");
+
+  if (outfile == NULL)
+    outfile = fs_replace_suffix(argv[optind], (ctx.opts.target == LD_TARGET_SNA) ? "sna" : "bin");
+
+  // actual work below
+  for (int i = optind; i < argc; i++)
+    ld_add_object(&ctx, argv[i]);
+
+  ld_place(&ctx);
+  ld_resolve(&ctx);
+  ld_relocate(&ctx);
+
+  uint32_t dest_size = ld_render(&ctx, &dest_buf);
+
+  write_file(dest_buf, dest_size, outfile);
+  report_info("%u bytes written to %s", dest_size, outfile);
+
+out:
+  if (dest_buf)
+    xfree(dest_buf);
+
+  xfree(outfile);
+  ld_free(&ctx);
+
+  mmgr_finish(getenv("MEMSTAT") != NULL);
+
+  return ret;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asm/elf.h"
+
+typedef struct dynarray dynarray;
+typedef struct hashmap hashmap;
+
+enum {
+  LD_TARGET_RAW = 0,
+  LD_TARGET_SNA,
+};
+
+typedef struct {
+  char *filename;
+  char *data;                   // whole file mapped copy-on-write, relocations are applied in place
+  size_t size;
+  elf_file_header *header;
+  elf_section_header *sections;
+  int nsections;
+  elf_symbol *symbols;
+  int nsymbols;
+  int symtab_idx;               // index of .symtab section header, 0 if object has no symbols
+} ld_object_t;
+
+typedef struct {
+  ld_object_t *object;
+  int shndx;
+  const char *name;
+  uint32_t addr;                // ORG address or placement
+  uint32_t size;
+  uint8_t fill;                 // filler of gap following the section
+} ld_section_t;
+
+typedef struct {
+  char *name;
+  uint32_t base;
+  int fill;                     // -1 for default filler
+} ld_placement_t;
+
+typedef struct {
+  int target;                   // one of LD_TARGET_RAW, LD_TARGET_SNA
+  uint8_t fill;                 // default filler of gaps between sections
+  dynarray *placements;         // ld_placement_t from linker script and command line
+  bool sna_generic;
+  int sna_pc_addr;              // -1 if argument omitted
+  int sna_ramtop;
+} ld_opts_t;
+
+typedef struct {
+  ld_opts_t opts;
+  dynarray *objects;            // ld_object_t in command line order
+  dynarray *sections;           // ld_section_t of all objects in command line order
+  hashmap *symtab;              // global symbol name -> ld_symbol_t
+  dynarray *symbols;            // ld_symbol_t owned by symtab
+} ld_ctx_t;
+
+typedef struct {
+  const char *name;
+  ld_object_t *object;          // defining object
+  uint32_t value;
+} ld_symbol_t;
+
+// object.c
+extern ld_object_t *ld_object_open(char *filename);
+extern void ld_object_load(ld_object_t *object);
+extern void ld_object_close(ld_object_t *object);
+extern const char *ld_object_section_name(ld_object_t *object, int shndx);
+extern const char *ld_object_symbol_name(ld_object_t *object, elf_symbol *sym);
+
+// script.c
+extern void ld_script_read(ld_opts_t *opts, char *filename);
+extern void ld_add_placement(ld_opts_t *opts, char *spec);
+
+// link.c
+extern void ld_add_object(ld_ctx_t *ctx, char *filename);
+extern void ld_resolve(ld_ctx_t *ctx);
+extern void ld_relocate(ld_ctx_t *ctx);
+extern void ld_place(ld_ctx_t *ctx);
+extern uint32_t ld_render(ld_ctx_t *ctx, char **dest_buf);
+extern void ld_free(ld_ctx_t *ctx);
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "asm/render.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+#include "ld/bc80ld.h"
+
+// Objects of bc80asm are assembled for ORG addresses of their sections, but every address
+// written to section bytes has relocation: against symbol of its section or the undefined
+// symbol. So placement moves section to another address (both image and run one) before
+// symbols are resolved and relocations are applied.
+
+#define ADDRESS_SPACE 0x10000
+
+void ld_add_object(ld_ctx_t *ctx, char *filename)
+{
+  ld_object_t *object = ld_object_open(filename);
+
+  // object is owned by context before it's checked
+  ctx->objects = dynarray_append_ptr(ctx->objects, object);
+
+  ld_object_load(object);
+
+  for (int i = 1; i < object->nsections; i++) {
+    elf_section_header *sech = &object->sections[i];
+
+    if (sech->sh_type != SHT_PROGBITS || !(sech->sh_flags & SHF_ALLOC))
+      continue;
+
+    if (sech->sh_addr + sech->sh_size > ADDRESS_SPACE)
+      report_error_noloc("%s: section '%s' is out of 64K address space", filename, ld_object_section_name(object, i));
+
+    ld_section_t *section = (ld_section_t *)xmalloc(sizeof(ld_section_t));
+    section->object = object;
+    section->shndx = i;
+    section->name = ld_object_section_name(object, i);
+    section->addr = sech->sh_addr;
+    section->size = sech->sh_size;
+    section->fill = ctx->opts.fill;
+
+    ctx->sections = dynarray_append_ptr(ctx->sections, section);
+  }
+}
+
+static uint32_t symbol_value(ld_object_t *object, elf_symbol *sym)
+{
+  if (sym->st_shndx == SHN_ABS)
+    return sym->st_value;
+
+  return object->sections[sym->st_shndx].sh_addr + sym->st_value;
+}
+
+void ld_resolve(ld_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+  uint32_t nglobals = 0;
+
+  foreach (dc, ctx->objects) {
+    ld_object_t *object = (ld_object_t *)dfirst(dc);
+
+    for (int i = 1; i < object->nsymbols; i++) {
+      elf_symbol *sym = &object->symbols[i];
+
+      if (ELF32_ST_BIND(sym->st_info) == STB_GLOBAL && sym->st_shndx != SHN_UNDEF)
+        nglobals++;
+    }
+  }
+
+  // one bucket per symbol keeps chains short for any number of objects
+  ctx->symtab = hashmap_create(nglobals > 0 ? nglobals : 1, "ld_symtab");
+
+  foreach (dc, ctx->objects) {
+    ld_object_t *object = (ld_object_t *)dfirst(dc);
+
+    for (int i = 1; i < object->nsymbols; i++) {
+      elf_symbol *sym = &object->symbols[i];
+
+      if (ELF32_ST_BIND(sym->st_info) != STB_GLOBAL || sym->st_shndx == SHN_UNDEF)
+        continue;
+
+      const char *name = ld_object_symbol_name(object, sym);
+      ld_symbol_t *defined = (ld_symbol_t *)hashmap_get(ctx->symtab, (void *)name);
+
+      if (defined != NULL)
+        report_error_noloc("%s: duplicate symbol '%s', first defined in %s",
+          object->filename, name, defined->object->filename);
+
+      ld_symbol_t *symbol = (ld_symbol_t *)xmalloc(sizeof(ld_symbol_t));
+      symbol->name = name;
+      symbol->object = object;
+      symbol->value = symbol_value(object, sym);
+
+      ctx->symbols = dynarray_append_ptr(ctx->symbols, symbol);
+      hashmap_set(ctx->symtab, (void *)name, symbol);
+    }
+  }
+}
+
+static void apply_rela(ld_ctx_t *ctx, ld_object_t *object, elf_section_header *target, elf_rela *rela)
+{
+  int symidx = ELF32_R_SYM(rela->r_info);
+  int type = ELF32_R_TYPE(rela->r_info);
+
+  if (type == R_Z80_NONE)
+    return;
+
+  if (symidx >= object->nsymbols)
+    report_error_noloc("%s: relocation refers to missing symbol %d", object->filename, symidx);
+
+  elf_symbol *sym = &object->symbols[symidx];
+  const char *name = ld_object_symbol_name(object, sym);
+  int32_t value;
+
+  // null symbol is number 0, addend is absolute address (e.g. target of relative jump)
+  if (symidx == 0) {
+    value = 0;
+  } else if (sym->st_shndx == SHN_UNDEF) {
+    ld_symbol_t *defined = (ld_symbol_t *)hashmap_get(ctx->symtab, (void *)name);
+
+    if (defined == NULL)
+      report_error_noloc("%s: undefined symbol '%s'", object->filename, name);
+
+    value = defined->value;
+  } else {
+    value = symbol_value(object, sym);
+  }
+
+  value += rela->r_addend;
+
+  int nbytes = (type == R_Z80_16) ? 2 : 1;
+  int32_t min = -128, max = 255;
+
+  if (rela->r_offset > target->sh_size || nbytes > target->sh_size - rela->r_offset)
+    report_error_noloc("%s: relocation against '%s' is out of section bounds", object->filename, name);
+
+  switch (type) {
+    case R_Z80_8:
+      break;
+
+    case R_Z80_8_DIS:
+      max = 127;
+      break;
+
+    case R_Z80_8_PCREL:
+      value -= target->sh_addr + rela->r_offset;
+      max = 127;
+      break;
+
+    case R_Z80_16:
+      min = -32768;
+      max = 65535;
+      break;
+
+    default:
+      report_error_noloc("%s: unsupported relocation type %d", object->filename, type);
+  }
+
+  if (value < min || value > max)
+    report_error_noloc("%s: value %d of '%s' is out of range at address 0x%04x", object->filename,
+      value, name, target->sh_addr + rela->r_offset);
+
+  uint8_t *dest = (uint8_t *)object->data + target->sh_offset + rela->r_offset;
+
+  dest[0] = value & 0xff;
+  if (nbytes == 2)
+    dest[1] = (value >> 8) & 0xff;
+}
+
+void ld_relocate(ld_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, ctx->objects) {
+    ld_object_t *object = (ld_object_t *)dfirst(dc);
+
+    for (int i = 1; i < object->nsections; i++) {
+      elf_section_header *sech = &object->sections[i];
+
+      if (sech->sh_type != SHT_RELA)
+        continue;
+
+      elf_section_header *target = &object->sections[sech->sh_info];
+      elf_rela *relas = (elf_rela *)(object->data + sech->sh_offset);
+
+      if (target->sh_type != SHT_PROGBITS)
+        report_error_noloc("%s: relocations of section %d which has no data", object->filename, sech->sh_info);
+
+      for (uint32_t r = 0; r < sech->sh_size / sizeof(elf_rela); r++)
+        apply_rela(ctx, object, target, &relas[r]);
+    }
+  }
+}
+
+static int compare_section_addr(const void *a, const void *b)
+{
+  const ld_section_t *s1 = *(const ld_section_t **)a;
+  const ld_section_t *s2 = *(const ld_section_t **)b;
+
+  return (s1->addr > s2->addr) - (s1->addr < s2->addr);
+}
+
+// non-empty sections in address order, returns their number
+static int sorted_sections(ld_ctx_t *ctx, ld_section_t ***sorted)
+{
+  dynarray_cell *dc = NULL;
+  int nsections = 0;
+
+  *sorted = (ld_section_t **)xmalloc(sizeof(ld_section_t *) * (dynarray_length(ctx->sections) + 1));
+
+  foreach (dc, ctx->sections) {
+    ld_section_t *section = (ld_section_t *)dfirst(dc);
+
+    if (section->size > 0)
+      (*sorted)[nsections++] = section;
+  }
+
+  qsort(*sorted, nsections, sizeof(ld_section_t *), compare_section_addr);
+
+  return nsections;
+}
+
+// objects of older assembler relocate references to undefined symbols only
+static bool has_section_symbol(ld_object_t *object, int shndx)
+{
+  for (int i = 1; i < object->nsymbols; i++) {
+    elf_symbol *sym = &object->symbols[i];
+
+    if (ELF32_ST_TYPE(sym->st_info) == STT_SECTION && sym->st_shndx == shndx)
+      return true;
+  }
+
+  return false;
+}
+
+void ld_place(ld_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+  dynarray_cell *sc = NULL;
+
+  foreach (dc, ctx->opts.placements) {
+    ld_placement_t *placement = (ld_placement_t *)dfirst(dc);
+    uint32_t addr = placement->base;
+    bool found = false;
+
+    foreach (sc, ctx->sections) {
+      ld_section_t *section = (ld_section_t *)dfirst(sc);
+      elf_section_header *sech = &section->object->sections[section->shndx];
+
+      if (strcmp(section->name, placement->name) != 0)
+        continue;
+
+      // ALIGN inside of section holds for multiples of its alignment only
+      if (sech->sh_addralign > 1)
+        addr = (addr + sech->sh_addralign - 1) / sech->sh_addralign * sech->sh_addralign;
+
+      if (addr != section->addr && section->size > 0 && !has_section_symbol(section->object, section->shndx))
+        report_error_noloc("%s: section '%s' can't be moved from 0x%04x: object has no relocations of its "
+          "addresses (assemble it again)", section->object->filename, section->name, section->addr);
+
+      // symbols and relocations are computed from section header
+      section->addr = addr;
+      sech->sh_addr = addr;
+      if (placement->fill != -1)
+        section->fill = placement->fill;
+
+      addr += section->size;
+      found = true;
+    }
+
+    if (!found)
+      report_warning_noloc("section '%s' isn't defined by any object", placement->name);
+
+    if (addr > ADDRESS_SPACE)
+      report_error_noloc("sections '%s' placed from 0x%04x don't fit into 64K address space",
+        placement->name, placement->base);
+  }
+
+  ld_section_t **sorted;
+  int nsections = sorted_sections(ctx, &sorted);
+
+  for (int i = 1; i < nsections; i++) {
+    ld_section_t *prev = sorted[i - 1];
+
+    if (sorted[i]->addr < prev->addr + prev->size) {
+      report_error_noloc("section '%s' of %s and section '%s' of %s overlap at address 0x%04x",
+        prev->name, prev->object->filename, sorted[i]->name, sorted[i]->object->filename, sorted[i]->addr);
+    }
+  }
+
+  xfree(sorted);
+}
+
+static const char *section_data(ld_section_t *section)
+{
+  return section->object->data + section->object->sections[section->shndx].sh_offset;
+}
+
+static uint32_t render_raw(ld_ctx_t *ctx, char **dest_buf)
+{
+  ld_section_t **sorted;
+  int nsections = sorted_sections(ctx, &sorted);
+  buffer *output = buffer_init();
+
+  // single image from the lowest section address, gaps are filled with filler of the preceding section
+  for (int i = 0; i < nsections; i++) {
+    if (i > 0) {
+      ld_section_t *prev = sorted[i - 1];
+
+      for (uint32_t addr = prev->addr + prev->size; addr < sorted[i]->addr; addr++)
+        buffer_append_char(output, prev->fill);
+    }
+
+    buffer_append_binary(output, section_data(sorted[i]), sorted[i]->size);
+  }
+
+  xfree(sorted);
+
+  *dest_buf = buffer_dup(output);
+  uint32_t size = output->len;
+  buffer_free(output);
+
+  return size;
+}
+
+// snapshot is rendered by assembler's renderer from sections at their addresses
+static uint32_t render_sna_image(ld_ctx_t *ctx, char **dest_buf)
+{
+  compile_ctx_t cctx;
+  dynarray_cell *dc = NULL;
+
+  memset(&cctx, 0, sizeof(cctx));
+  cctx.opts.target = ASM_TARGET_SNA;
+  cctx.opts.sna_generic = ctx->opts.sna_generic;
+  cctx.opts.sna_pc_addr = ctx->opts.sna_pc_addr;
+  cctx.opts.sna_ramtop = ctx->opts.sna_ramtop;
+
+  foreach (dc, ctx->sections) {
+    ld_section_t *section = (ld_section_t *)dfirst(dc);
+    section_ctx_t *sctx = (section_ctx_t *)xmalloc(sizeof(section_ctx_t));
+
+    memset(sctx, 0, sizeof(section_ctx_t));
+    sctx->start = section->addr;
+    sctx->curr_pc = section->addr + section->size;
+    sctx->name = (char *)section->name;
+    sctx->filler = section->fill;
+    sctx->content = buffer_init();
+    buffer_append_binary(sctx->content, section_data(section), section->size);
+
+    cctx.sections = dynarray_append_ptr(cctx.sections, sctx);
+  }
+
+  uint32_t size = render_sna(&cctx, dest_buf);
+
+  foreach (dc, cctx.sections) {
+    section_ctx_t *sctx = (section_ctx_t *)dfirst(dc);
+
+    buffer_free(sctx->content);
+    xfree(sctx);
+  }
+
+  dynarray_free(cctx.sections);
+
+  return size;
+}
+
+uint32_t ld_render(ld_ctx_t *ctx, char **dest_buf)
+{
+  if (ctx->opts.target == LD_TARGET_SNA)
+    return render_sna_image(ctx, dest_buf);
+
+  return render_raw(ctx, dest_buf);
+}
+
+void ld_free(ld_ctx_t *ctx)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, ctx->opts.placements) {
+    ld_placement_t *placement = (ld_placement_t *)dfirst(dc);
+
+    xfree(placement->name);
+    xfree(placement);
+  }
+
+  foreach (dc, ctx->objects)
+    ld_object_close((ld_object_t *)dfirst(dc));
+
+  if (ctx->symtab)
+    hashmap_free(ctx->symtab);
+
+  dynarray_free(ctx->opts.placements);
+  dynarray_free_deep(ctx->symbols);
+  dynarray_free_deep(ctx->sections);
+  dynarray_free(ctx->objects);
+
+  memset(ctx, 0, sizeof(*ctx));
+}
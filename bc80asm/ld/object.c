@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bits/error.h"
+#include "bits/mmgr.h"
+#include "ld/bc80ld.h"
+
+// Objects are mapped copy-on-write: headers and tables are read in place and relocations
+// patch section bytes right in the mapping, nothing is copied until the image is rendered.
+
+static bool range_valid(ld_object_t *object, uint32_t offset, uint32_t size)
+{
+  return offset <= object->size && size <= object->size - offset;
+}
+
+static void validate_header(ld_object_t *object)
+{
+  elf_file_header *fh = object->header;
+
+  if (object->size < sizeof(elf_file_header) || memcmp(fh->ei_magic, "\x7f" "ELF", 4) != 0)
+    report_error_noloc("%s: not an ELF file", object->filename);
+
+  if (fh->ei_class != ELFCLASS32 || fh->ei_data != ELFDATA2LSB)
+    report_error_noloc("%s: not a 32-bit little-endian ELF file", object->filename);
+
+  if (fh->e_type != ET_REL || fh->e_machine != EM_Z80)
+    report_error_noloc("%s: not a Z80 relocatable object", object->filename);
+
+  if (fh->e_shentsize != sizeof(elf_section_header) ||
+    !range_valid(object, fh->e_shoff, fh->e_shnum * sizeof(elf_section_header)) ||
+    fh->e_shstrndx >= fh->e_shnum)
+  {
+    report_error_noloc("%s: malformed section headers", object->filename);
+  }
+}
+
+static const char *section_string(ld_object_t *object, int shndx, uint32_t offset)
+{
+  elf_section_header *sech = &object->sections[shndx];
+
+  if (sech->sh_type != SHT_STRTAB || offset >= sech->sh_size ||
+    memchr(object->data + sech->sh_offset + offset, '\0', sech->sh_size - offset) == NULL)
+  {
+    report_error_noloc("%s: malformed string table", object->filename);
+  }
+
+  return object->data + sech->sh_offset + offset;
+}
+
+const char *ld_object_section_name(ld_object_t *object, int shndx)
+{
+  return section_string(object, object->header->e_shstrndx, object->sections[shndx].sh_name);
+}
+
+const char *ld_object_symbol_name(ld_object_t *object, elf_symbol *sym)
+{
+  return section_string(object, object->sections[object->symtab_idx].sh_link, sym->st_name);
+}
+
+ld_object_t *ld_object_open(char *filename)
+{
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    report_error_noloc("%s: can't open for reading", filename);
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    report_error_noloc("%s: can't read", filename);
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    report_error_noloc("%s: can't map into memory", filename);
+
+  ld_object_t *object = (ld_object_t *)xmalloc(sizeof(ld_object_t));
+  memset(object, 0, sizeof(ld_object_t));
+
+  object->filename = xstrdup(filename);
+  object->data = (char *)data;
+  object->size = st.st_size;
+  object->header = (elf_file_header *)data;
+
+  return object;
+}
+
+// checks headers and locates the tables, object is closed by its owner on error
+void ld_object_load(ld_object_t *object)
+{
+  validate_header(object);
+
+  object->sections = (elf_section_header *)(object->data + object->header->e_shoff);
+  object->nsections = object->header->e_shnum;
+
+  for (int i = 1; i < object->nsections; i++) {
+    elf_section_header *sech = &object->sections[i];
+
+    if (sech->sh_type != SHT_NOBITS && !range_valid(object, sech->sh_offset, sech->sh_size))
+      report_error_noloc("%s: section %d is out of file bounds", object->filename, i);
+
+    if (sech->sh_type == SHT_SYMTAB) {
+      if (object->symtab_idx != 0)
+        report_error_noloc("%s: more than one symbol table", object->filename);
+
+      if (sech->sh_entsize != sizeof(elf_symbol) || sech->sh_link >= object->nsections)
+        report_error_noloc("%s: malformed symbol table", object->filename);
+
+      object->symtab_idx = i;
+      object->symbols = (elf_symbol *)(object->data + sech->sh_offset);
+      object->nsymbols = sech->sh_size / sizeof(elf_symbol);
+    }
+  }
+
+  // bc80asm writes the symbol table behind relocations, other tools could place it anywhere
+  for (int i = 1; i < object->nsections; i++) {
+    elf_section_header *sech = &object->sections[i];
+
+    if (sech->sh_type == SHT_RELA &&
+      (sech->sh_entsize != sizeof(elf_rela) || sech->sh_info == 0 || sech->sh_info >= object->nsections ||
+       sech->sh_link != object->symtab_idx || object->symtab_idx == 0))
+    {
+      report_error_noloc("%s: malformed relocation section %d", object->filename, i);
+    }
+  }
+
+  for (int i = 0; i < object->nsymbols; i++) {
+    elf_symbol *sym = &object->symbols[i];
+
+    if (sym->st_shndx != SHN_UNDEF && sym->st_shndx != SHN_ABS && sym->st_shndx >= object->nsections)
+      report_error_noloc("%s: symbol %d refers to missing section", object->filename, i);
+
+    ld_object_symbol_name(object, sym);
+  }
+}
+
+void ld_object_close(ld_object_t *object)
+{
+  munmap(object->data, object->size);
+  xfree(object->filename);
+  xfree(object);
+}
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bits/common.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/mmgr.h"
+#include "ld/bc80ld.h"
+
+// Linker script is a list of placements, one per line:
+//
+//   ; comment
+//   code   0c000h          ; sections named 'code' are placed from 0C000h
+//   data   0e000h  0ffh    ; gap following 'data' sections is filled with 0FFh
+//
+// Sections of the same name are placed one after another in command line order.
+
+static void add_placement(ld_opts_t *opts, char *name, int base, int fill)
+{
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, opts->placements) {
+    ld_placement_t *placement = (ld_placement_t *)dfirst(dc);
+
+    if (strcmp(placement->name, name) == 0)
+      report_error_noloc("section '%s' is placed twice", name);
+  }
+
+  if (base < 0 || base > 0xffff)
+    report_error_noloc("base address of section '%s' is out of 64K address space", name);
+
+  if (fill < -1 || fill > 0xff)
+    report_error_noloc("filler of section '%s' must be a byte", name);
+
+  ld_placement_t *placement = (ld_placement_t *)xmalloc(sizeof(ld_placement_t));
+  placement->name = xstrdup(name);
+  placement->base = base;
+  placement->fill = fill;
+
+  opts->placements = dynarray_append_ptr(opts->placements, placement);
+}
+
+void ld_script_read(ld_opts_t *opts, char *filename)
+{
+  char *script = read_file(filename);
+  char *line = script;
+  int lineno = 0;
+
+  while (line != NULL) {
+    char *next = strchr(line, '\n');
+    char *tokens[4];
+    int ntokens = 0;
+
+    if (next != NULL)
+      *next++ = '\0';
+
+    lineno++;
+    line[strcspn(line, ";#")] = '\0';
+
+    for (char *tok = strtok(line, " \t\r"); tok != NULL; tok = strtok(NULL, " \t\r")) {
+      if (ntokens == 3)
+        report_error_noloc("%s:%d: expected section name, base address and optional filler", filename, lineno);
+
+      tokens[ntokens++] = tok;
+    }
+
+    if (ntokens == 1)
+      report_error_noloc("%s:%d: missing base address of section '%s'", filename, lineno, tokens[0]);
+
+    if (ntokens > 1) {
+      int base, fill = -1;
+
+      if (!parse_any_integer(tokens[1], &base))
+        report_error_noloc("%s:%d: can't parse base address: %s", filename, lineno, tokens[1]);
+
+      if (ntokens == 3 && !parse_any_integer(tokens[2], &fill))
+        report_error_noloc("%s:%d: can't parse filler: %s", filename, lineno, tokens[2]);
+
+      add_placement(opts, tokens[0], base, fill);
+    }
+
+    line = next;
+  }
+
+  xfree(script);
+}
+
+// name=addr from command line
+void ld_add_placement(ld_opts_t *opts, char *spec)
+{
+  dynarray *kvparts = split_string_sep(spec, '=', true);
+  int base;
+
+  if (dynarray_length(kvparts) != 2 || !parse_any_integer(dsecond(kvparts), &base))
+    report_error_noloc("section placement must be name=address: %s", spec);
+
+  add_placement(opts, dinitial(kvparts), base, -1);
+
+  dynarray_free_deep(kvparts);
+}
@@ -0,0 +1,614 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asm/bc80asm.h"
+#include "asm/snafmt.h"
+#include "bits/buffer.h"
+#include "bits/common.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+#include "lsp/json.h"
+#include "lsp/project.h"
+
+// Language server for bc80asm sources: JSON-RPC messages of language server protocol are read
+// from stdin and written to stdout. Documents are synchronized as whole texts and analyzed when
+// there are no more messages waiting (or before answering request), so a burst of changes
+// costs a single analysis.
+
+static void print_usage(char *cmd)
+{
+  printf("Language server for bc80asm sources\n\n"
+         "usage: %s [options] [main file]...\n\n"
+         "options:\n"
+         "  -h              this help\n"
+         "  -Ipath          add directory to include path list\n"
+         "  -Dkey[=value]   define symbol for preprocessor\n"
+         "  -t target       target type as for bc80asm: raw (default), object or sna\n"
+         "  -v              log analysis times to stderr\n"
+         "\nMain files are assembled with files they include. If none are given, every open document\n"
+         "which isn't included by another open document is a main file. Include files are searched\n"
+         "from the root directory of workspace.\n"
+         "\nDiagnostics are messages of assembler. Go to definition works for labels and EQUs, hover\n"
+         "shows symbol values, address, bytes and T-states of source line and totals of block\n"
+         "between global labels.\n",
+         cmd
+  );
+}
+
+static char inbuf[65536];
+static size_t inbuf_start = 0;
+static size_t inbuf_end = 0;
+
+static int read_byte()
+{
+  if (inbuf_start == inbuf_end) {
+    ssize_t n = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+
+    if (n <= 0)
+      return -1;
+
+    inbuf_start = 0;
+    inbuf_end = n;
+  }
+
+  return (unsigned char)inbuf[inbuf_start++];
+}
+
+static bool input_pending()
+{
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+
+  return inbuf_start != inbuf_end || poll(&pfd, 1, 0) > 0;
+}
+
+// body of the next message (NULL at the end of input)
+static char *read_message()
+{
+  long length = -1;
+  char header[256];
+
+  for (;;) {
+    int len = 0;
+    int c;
+
+    while ((c = read_byte()) != -1 && c != '\n') {
+      if (len < (int)sizeof(header) - 1)
+        header[len++] = c;
+    }
+
+    if (c == -1)
+      return NULL;
+
+    if (len > 0 && header[len - 1] == '\r')
+      len--;
+
+    header[len] = '\0';
+
+    if (len == 0)
+      break;
+
+    if (strncasecmp(header, "Content-Length:", 15) == 0)
+      length = strtol(header + 15, NULL, 10);
+  }
+
+  if (length < 0)
+    return NULL;
+
+  char *body = (char *)xmalloc(length + 1);
+
+  for (long i = 0; i < length; i++) {
+    int c = read_byte();
+
+    if (c == -1) {
+      xfree(body);
+      return NULL;
+    }
+
+    body[i] = c;
+  }
+
+  body[length] = '\0';
+
+  return body;
+}
+
+static void write_message(buffer *msg)
+{
+  printf("Content-Length: %d\r\n\r\n", msg->len);
+  fwrite(msg->data, msg->len, 1, stdout);
+  fflush(stdout);
+}
+
+static void append_id(buffer *msg, json_value *id)
+{
+  if (id != NULL && id->type == JSON_STRING)
+    json_append_string(msg, id->string);
+  else if (id != NULL && id->type == JSON_NUMBER)
+    buffer_append(msg, "%ld", (long)id->number);
+  else
+    buffer_append(msg, "null");
+}
+
+static void reply(json_value *id, const char *result)
+{
+  buffer *msg = buffer_init();
+
+  buffer_append(msg, "{\"jsonrpc\":\"2.0\",\"id\":");
+  append_id(msg, id);
+  buffer_append(msg, ",\"result\":%s}", result);
+
+  write_message(msg);
+  buffer_free(msg);
+}
+
+static void reply_error(json_value *id, int code, const char *message)
+{
+  buffer *msg = buffer_init();
+
+  buffer_append(msg, "{\"jsonrpc\":\"2.0\",\"id\":");
+  append_id(msg, id);
+  buffer_append(msg, ",\"error\":{\"code\":%d,\"message\":", code);
+  json_append_string(msg, message);
+  buffer_append(msg, "}}");
+
+  write_message(msg);
+  buffer_free(msg);
+}
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+
+  return (c | 0x20) - 'a' + 10;
+}
+
+// path of file:// URI, real path if file exists
+static char *uri_to_path(const char *uri)
+{
+  if (uri == NULL || strncmp(uri, "file://", 7) != 0)
+    return NULL;
+
+  const char *p = uri + 7;
+  char *path = (char *)xmalloc(strlen(p) + 1);
+  int len = 0;
+
+  while (*p) {
+    if (p[0] == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+      path[len++] = hex_value(p[1]) * 16 + hex_value(p[2]);
+      p += 3;
+    } else {
+      path[len++] = *p++;
+    }
+  }
+
+  path[len] = '\0';
+
+  char *real = realpath(path, NULL);
+
+  if (real != NULL) {
+    xfree(path);
+    path = xstrdup(real);
+    free(real);
+  }
+
+  return path;
+}
+
+static void append_uri(buffer *msg, const char *path)
+{
+  buffer_append(msg, "\"file://");
+
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    if (isalnum(*p) || strchr("/._~-", *p))
+      buffer_append(msg, "%c", *p);
+    else
+      buffer_append(msg, "%%%02X", *p);
+  }
+
+  buffer_append(msg, "\"");
+}
+
+static void append_range(buffer *msg, int line, int start, int end)
+{
+  buffer_append(msg, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}",
+    line, start, line, end);
+}
+
+static void publish(const char *path, dynarray *diags, project_t *project)
+{
+  buffer *msg = buffer_init();
+  dynarray_cell *dc = NULL;
+  bool first = true;
+
+  buffer_append(msg, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+  append_uri(msg, path);
+  buffer_append(msg, ",\"diagnostics\":[");
+
+  foreach (dc, diags) {
+    lsp_diag_t *diag = (lsp_diag_t *)dfirst(dc);
+    int start = 0;
+    int end = INT_MAX / 2;
+
+    if (strcmp(diag->path, path) != 0)
+      continue;
+
+    // column points to token of error, otherwise the whole line is marked
+    if (diag->pos > 0) {
+      char *word = project_word_at(project, diag->path, diag->line, diag->pos - 1, &start);
+
+      start = diag->pos - 1;
+      end = start + (word ? (int)strlen(word) : 1);
+      xfree(word);
+    }
+
+    buffer_append(msg, "%s", first ? "{\"range\":" : ",{\"range\":");
+    append_range(msg, diag->line - 1, start, end);
+    buffer_append(msg, ",\"severity\":%d,\"source\":\"bc80asm\",\"message\":", diag->warning ? 2 : 1);
+    json_append_string(msg, diag->message);
+    buffer_append(msg, "}");
+    first = false;
+  }
+
+  buffer_append(msg, "]}}");
+
+  write_message(msg);
+  buffer_free(msg);
+}
+
+// diagnostics of files are replaced as a whole, so files which had them are cleared too
+static void publish_diagnostics(project_t *project)
+{
+  dynarray *paths = NULL;
+  hashmap *seen = hashmap_create(64, "lsp_published");
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, project->diags) {
+    lsp_diag_t *diag = (lsp_diag_t *)dfirst(dc);
+
+    if (hashmap_get(seen, diag->path) == NULL) {
+      hashmap_set(seen, diag->path, XMMGR_DUMMY_PTR);
+      paths = dynarray_append_ptr(paths, xstrdup(diag->path));
+    }
+  }
+
+  foreach (dc, project->diag_paths) {
+    if (hashmap_get(seen, dfirst(dc)) == NULL)
+      publish((char *)dfirst(dc), NULL, project);
+  }
+
+  foreach (dc, paths)
+    publish((char *)dfirst(dc), project->diags, project);
+
+  hashmap_free(seen);
+  dynarray_free_deep(project->diag_paths);
+  project->diag_paths = paths;
+}
+
+static void analyze(project_t *project, bool verbose)
+{
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  project_analyze(project);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  publish_diagnostics(project);
+
+  if (verbose)
+    report_info("\x1b[96mLSP\x1b[97m: analysis done in %.1f ms",
+      (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+static void append_bytes(buffer *md, lsp_line_t *line)
+{
+  int nbytes = (line->size < (int)sizeof(line->bytes)) ? line->size : (int)sizeof(line->bytes);
+
+  buffer_append(md, "`%04Xh`", line->addr);
+
+  if (nbytes > 0) {
+    buffer_append(md, ": `");
+    for (int i = 0; i < nbytes; i++)
+      buffer_append(md, (i > 0) ? " %02X" : "%02X", line->bytes[i]);
+    buffer_append(md, "%s", (line->size > nbytes) ? " ...`" : "`");
+  }
+
+  buffer_append(md, ", %d bytes", line->size);
+
+  if (line->cycles > 0)
+    buffer_append(md, ", %d T-states", line->cycles);
+
+  if (line->count > 1)
+    buffer_append(md, " (compiled %d times)", line->count);
+}
+
+static void append_block(buffer *md, const char *name, lsp_block_t *block)
+{
+  buffer_append(md, "block `%s` at `%04Xh`: %d bytes, %ld T-states", name, block->addr, block->size,
+    block->cycles);
+}
+
+static void handle_hover(project_t *project, json_value *id, json_value *params)
+{
+  char *path = uri_to_path(json_get_string(params, "textDocument.uri"));
+  int line = json_get_int(params, "position.line", 0) + 1;
+  int character = json_get_int(params, "position.character", 0);
+  int start = 0;
+  buffer *md = buffer_init();
+  lsp_def_t *def = NULL;
+
+  char *word = path ? project_word_at(project, path, line, character, &start) : NULL;
+
+  if (word != NULL)
+    def = project_find_def(project, path, line, word);
+
+  if (def != NULL) {
+    int value;
+    lsp_block_t *block = def->equ ? NULL : project_find_block(project, def->name);
+
+    if (project_find_symbol(project, def->name, &value))
+      buffer_append(md, "**%s** = `%04Xh` (%d)", def->name, value & 0xffff, value);
+    else
+      buffer_append(md, "**%s**", def->name);
+
+    const char *file = strrchr(def->path, '/');
+
+    buffer_append(md, ", %s at %s:%d", def->equ ? "EQU" : "label", file ? file + 1 : def->path, def->line);
+
+    if (block != NULL) {
+      buffer_append(md, "\n\n");
+      append_block(md, def->name, block);
+    }
+  }
+
+  lsp_line_t *ln = path ? project_find_line(project, path, line) : NULL;
+
+  if (ln != NULL && (ln->size > 0 || ln->cycles > 0)) {
+    if (md->len > 0)
+      buffer_append(md, "\n\n---\n\n");
+
+    append_bytes(md, ln);
+
+    lsp_block_t *block = ln->block ? project_find_block(project, ln->block) : NULL;
+
+    if (block != NULL && (def == NULL || strcmp(def->name, ln->block) != 0)) {
+      buffer_append(md, "\n\nin ");
+      append_block(md, ln->block, block);
+    }
+  }
+
+  if (md->len == 0) {
+    reply(id, "null");
+  } else {
+    buffer *result = buffer_init();
+
+    buffer_append(result, "{\"contents\":{\"kind\":\"markdown\",\"value\":");
+    json_append_string(result, md->data);
+    buffer_append(result, "}}");
+    reply(id, result->data);
+    buffer_free(result);
+  }
+
+  buffer_free(md);
+  xfree(word);
+  xfree(path);
+}
+
+static void handle_definition(project_t *project, json_value *id, json_value *params)
+{
+  char *path = uri_to_path(json_get_string(params, "textDocument.uri"));
+  int line = json_get_int(params, "position.line", 0) + 1;
+  int character = json_get_int(params, "position.character", 0);
+  int start = 0;
+  lsp_def_t *def = NULL;
+
+  char *word = path ? project_word_at(project, path, line, character, &start) : NULL;
+
+  if (word != NULL)
+    def = project_find_def(project, path, line, word);
+
+  if (def == NULL) {
+    reply(id, "null");
+  } else {
+    buffer *result = buffer_init();
+
+    // local label is written without its global label
+    const char *local = strchr(def->name + 1, '.');
+    int len = strlen((!def->equ && local != NULL) ? local : def->name);
+
+    buffer_append(result, "{\"uri\":");
+    append_uri(result, def->path);
+    buffer_append(result, ",\"range\":");
+    append_range(result, def->line - 1, def->pos - 1, def->pos - 1 + len);
+    buffer_append(result, "}");
+
+    reply(id, result->data);
+    buffer_free(result);
+  }
+
+  xfree(word);
+  xfree(path);
+}
+
+static void handle_initialize(project_t *project, json_value *id, json_value *params)
+{
+  char *root = uri_to_path(json_get_string(params, "rootUri"));
+
+  // include files are searched from the root of workspace like by bc80asm started there
+  if (root != NULL && chdir(root) != 0)
+    report_warning_noloc("can't change directory to %s", root);
+
+  xfree(root);
+
+  reply(id, "{\"capabilities\":{\"textDocumentSync\":1,\"hoverProvider\":true,\"definitionProvider\":true},"
+            "\"serverInfo\":{\"name\":\"bc80lsp\"}}");
+}
+
+static void handle_change(project_t *project, json_value *params)
+{
+  char *path = uri_to_path(json_get_string(params, "textDocument.uri"));
+  json_value *changes = json_get(params, "contentChanges");
+  const char *text = NULL;
+
+  // full synchronization: the last change is the whole text
+  if (changes != NULL && changes->type == JSON_ARRAY && dynarray_length(changes->items) > 0)
+    text = json_get_string((json_value *)dlast(changes->items), "text");
+
+  if (path != NULL && text != NULL)
+    project_open(project, path, text);
+
+  xfree(path);
+}
+
+int main(int argc, char **argv)
+{
+  int optflag;
+  bool verbose = false;
+  bool shutdown = false;
+  project_t project = {0};
+  jmp_buf error_env;
+
+  int ret = setjmp(error_env);
+  if (ret != 0)
+    // returning from longjmp (error handler)
+    return ret;
+
+  set_error_context(&error_env);
+
+  mmgr_init();
+
+  project.defineopts = hashmap_create(128, "defineopts");
+  project.opts.sna_pc_addr = -1;
+  project.opts.sna_ramtop = ZX_DEFAULT_RAMTOP;
+
+  while ((optflag = getopt(argc, argv, "hvD:I:t:")) != -1) {
+    switch (optflag) {
+      case 'D': {
+        dynarray *kvparts = split_string_sep(optarg, '=', true);
+        hashmap_set(project.defineopts, dinitial(kvparts),
+          (dynarray_length(kvparts) == 1) ? xstrdup("") : xstrdup(dsecond(kvparts)));
+        break;
+      }
+
+      case 'I': {
+        char *real = realpath(optarg, NULL);
+
+        // include paths stay valid when directory is changed to workspace root
+        project.opts.includeopts = dynarray_append_ptr(project.opts.includeopts, xstrdup(real ? real : optarg));
+        free(real);
+        break;
+      }
+
+      case 't':
+        if (strcasecmp(optarg, "raw") == 0)
+          project.opts.target = ASM_TARGET_RAW;
+        else if (strcasecmp(optarg, "object") == 0)
+          project.opts.target = ASM_TARGET_ELF;
+        else if (strcasecmp(optarg, "sna") == 0)
+          project.opts.target = ASM_TARGET_SNA;
+        else
+          report_error_noloc("target must be one of 'raw', 'object', 'sna'");
+        break;
+
+      case 'v':
+        verbose = true;
+        break;
+
+      case 'h':
+      case '?':
+      default:
+        print_usage(argv[0]);
+        return 0;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    char *real = realpath(argv[i], NULL);
+
+    if (real == NULL)
+      report_error_noloc("%s: file not found", argv[i]);
+
+    project.roots = dynarray_append_ptr(project.roots, xstrdup(real));
+    free(real);
+  }
+
+  project_init(&project);
+
+  for (;;) {
+    // changes are analyzed when editor stops sending them
+    if (project.dirty && !input_pending())
+      analyze(&project, verbose);
+
+    char *body = read_message();
+    if (body == NULL)
+      break;
+
+    json_value *msg = json_parse(body);
+    xfree(body);
+
+    if (msg == NULL) {
+      reply_error(NULL, -32700, "parse error");
+      continue;
+    }
+
+    const char *method = json_get_string(msg, "method");
+    json_value *id = json_get(msg, "id");
+    json_value *params = json_get(msg, "params");
+
+    if (method == NULL) {
+      // response to request of server (never sent)
+    } else if (strcmp(method, "initialize") == 0) {
+      handle_initialize(&project, id, params);
+    } else if (strcmp(method, "shutdown") == 0) {
+      shutdown = true;
+      reply(id, "null");
+    } else if (strcmp(method, "exit") == 0) {
+      json_free(msg);
+      break;
+    } else if (strcmp(method, "textDocument/didOpen") == 0) {
+      char *path = uri_to_path(json_get_string(params, "textDocument.uri"));
+      const char *text = json_get_string(params, "textDocument.text");
+
+      if (path != NULL && text != NULL)
+        project_open(&project, path, text);
+      xfree(path);
+    } else if (strcmp(method, "textDocument/didChange") == 0) {
+      handle_change(&project, params);
+    } else if (strcmp(method, "textDocument/didClose") == 0) {
+      char *path = uri_to_path(json_get_string(params, "textDocument.uri"));
+
+      if (path != NULL)
+        project_close(&project, path);
+      xfree(path);
+    } else if (strcmp(method, "textDocument/hover") == 0 ||
+               strcmp(method, "textDocument/definition") == 0) {
+      if (project.dirty)
+        analyze(&project, verbose);
+
+      if (strcmp(method, "textDocument/hover") == 0)
+        handle_hover(&project, id, params);
+      else
+        handle_definition(&project, id, params);
+    } else if (id != NULL) {
+      reply_error(id, -32601, "method not found");
+    }
+
+    json_free(msg);
+  }
+
+  project_free(&project);
+  mmgr_finish(getenv("MEMSTAT") != NULL);
+
+  return shutdown ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/mmgr.h"
+#include "lsp/json.h"
+
+// JSON reader for messages of language server protocol. Values are parsed into trees of
+// json_value, replies are written directly into buffers.
+
+typedef struct {
+  const char *p;
+  bool failed;
+} json_parser;
+
+static json_value *parse_value(json_parser *parser);
+
+static json_value *new_value(json_type type)
+{
+  json_value *value = (json_value *)xmalloc(sizeof(json_value));
+
+  memset(value, 0, sizeof(json_value));
+  value->type = type;
+
+  return value;
+}
+
+static void skip_ws(json_parser *parser)
+{
+  while (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r')
+    parser->p++;
+}
+
+static bool expect(json_parser *parser, char c)
+{
+  skip_ws(parser);
+
+  if (*parser->p != c) {
+    parser->failed = true;
+    return false;
+  }
+
+  parser->p++;
+  return true;
+}
+
+static void append_utf8(buffer *buf, unsigned int cp)
+{
+  if (cp < 0x80) {
+    buffer_append_char(buf, cp);
+  } else if (cp < 0x800) {
+    buffer_append_char(buf, 0xc0 | (cp >> 6));
+    buffer_append_char(buf, 0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    buffer_append_char(buf, 0xe0 | (cp >> 12));
+    buffer_append_char(buf, 0x80 | ((cp >> 6) & 0x3f));
+    buffer_append_char(buf, 0x80 | (cp & 0x3f));
+  } else {
+    buffer_append_char(buf, 0xf0 | (cp >> 18));
+    buffer_append_char(buf, 0x80 | ((cp >> 12) & 0x3f));
+    buffer_append_char(buf, 0x80 | ((cp >> 6) & 0x3f));
+    buffer_append_char(buf, 0x80 | (cp & 0x3f));
+  }
+}
+
+static bool parse_hex4(json_parser *parser, unsigned int *cp)
+{
+  *cp = 0;
+
+  for (int i = 0; i < 4; i++) {
+    char c = parser->p[i];
+
+    if (!isxdigit((unsigned char)c))
+      return false;
+
+    *cp = (*cp << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+  }
+
+  parser->p += 4;
+  return true;
+}
+
+static char *parse_string(json_parser *parser)
+{
+  if (!expect(parser, '"'))
+    return NULL;
+
+  buffer *buf = buffer_init();
+
+  // truncated input must leave parser at the terminating zero
+  while (*parser->p != '"') {
+    char c = *parser->p;
+
+    if (c == '\0') {
+      parser->failed = true;
+      break;
+    }
+
+    parser->p++;
+
+    if (c != '\\') {
+      buffer_append_char(buf, c);
+      continue;
+    }
+
+    unsigned int cp;
+
+    char esc = *parser->p;
+
+    if (esc != '\0')
+      parser->p++;
+
+    switch (esc) {
+      case '"':  buffer_append_char(buf, '"'); break;
+      case '\\': buffer_append_char(buf, '\\'); break;
+      case '/':  buffer_append_char(buf, '/'); break;
+      case 'b':  buffer_append_char(buf, '\b'); break;
+      case 'f':  buffer_append_char(buf, '\f'); break;
+      case 'n':  buffer_append_char(buf, '\n'); break;
+      case 'r':  buffer_append_char(buf, '\r'); break;
+      case 't':  buffer_append_char(buf, '\t'); break;
+      case 'u':
+        if (!parse_hex4(parser, &cp)) {
+          parser->failed = true;
+          break;
+        }
+
+        // surrogate pair
+        if (cp >= 0xd800 && cp < 0xdc00 && parser->p[0] == '\\' && parser->p[1] == 'u') {
+          unsigned int low;
+
+          parser->p += 2;
+          if (!parse_hex4(parser, &low)) {
+            parser->failed = true;
+            break;
+          }
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        append_utf8(buf, cp);
+        break;
+      default:
+        parser->failed = true;
+        break;
+    }
+
+    if (parser->failed)
+      break;
+  }
+
+  if (!parser->failed)
+    parser->p++;
+
+  buffer_append_char(buf, '\0');
+  char *str = xstrdup(buf->data);
+  buffer_free(buf);
+
+  return str;
+}
+
+static json_value *parse_array(json_parser *parser)
+{
+  json_value *value = new_value(JSON_ARRAY);
+
+  parser->p++;
+  skip_ws(parser);
+
+  if (*parser->p == ']') {
+    parser->p++;
+    return value;
+  }
+
+  while (!parser->failed) {
+    value->items = dynarray_append_ptr(value->items, parse_value(parser));
+
+    skip_ws(parser);
+    if (*parser->p == ',') {
+      parser->p++;
+      continue;
+    }
+
+    expect(parser, ']');
+    break;
+  }
+
+  return value;
+}
+
+static json_value *parse_object(json_parser *parser)
+{
+  json_value *value = new_value(JSON_OBJECT);
+
+  parser->p++;
+  skip_ws(parser);
+
+  if (*parser->p == '}') {
+    parser->p++;
+    return value;
+  }
+
+  while (!parser->failed) {
+    char *key = parse_string(parser);
+
+    if (key == NULL || !expect(parser, ':')) {
+      xfree(key);
+      break;
+    }
+
+    value->keys = dynarray_append_ptr(value->keys, key);
+    value->items = dynarray_append_ptr(value->items, parse_value(parser));
+
+    skip_ws(parser);
+    if (*parser->p == ',') {
+      parser->p++;
+      continue;
+    }
+
+    expect(parser, '}');
+    break;
+  }
+
+  return value;
+}
+
+static json_value *parse_value(json_parser *parser)
+{
+  json_value *value = NULL;
+  char *end = NULL;
+
+  skip_ws(parser);
+
+  switch (*parser->p) {
+    case '{':
+      return parse_object(parser);
+
+    case '[':
+      return parse_array(parser);
+
+    case '"':
+      value = new_value(JSON_STRING);
+      value->string = parse_string(parser);
+      return value;
+
+    case 't':
+    case 'f':
+    case 'n':
+      if (strncmp(parser->p, "true", 4) == 0) {
+        value = new_value(JSON_BOOL);
+        value->boolean = true;
+        parser->p += 4;
+      } else if (strncmp(parser->p, "false", 5) == 0) {
+        value = new_value(JSON_BOOL);
+        parser->p += 5;
+      } else if (strncmp(parser->p, "null", 4) == 0) {
+        value = new_value(JSON_NULL);
+        parser->p += 4;
+      }
+      break;
+
+    default:
+      value = new_value(JSON_NUMBER);
+      value->number = strtod(parser->p, &end);
+
+      if (end == parser->p)
+        parser->failed = true;
+
+      parser->p = end;
+      return value;
+  }
+
+  if (value == NULL) {
+    parser->failed = true;
+    value = new_value(JSON_NULL);
+  }
+
+  return value;
+}
+
+// returns NULL if text isn't valid JSON
+json_value *json_parse(const char *text)
+{
+  json_parser parser = {.p = text, .failed = false};
+  json_value *value = parse_value(&parser);
+
+  skip_ws(&parser);
+
+  if (parser.failed || *parser.p != '\0') {
+    json_free(value);
+    return NULL;
+  }
+
+  return value;
+}
+
+void json_free(json_value *value)
+{
+  dynarray_cell *dc = NULL;
+
+  if (value == NULL)
+    return;
+
+  foreach (dc, value->items)
+    json_free((json_value *)dfirst(dc));
+
+  dynarray_free(value->items);
+  dynarray_free_deep(value->keys);
+  xfree(value->string);
+  xfree(value);
+}
+
+json_value *json_get(json_value *value, const char *path)
+{
+  while (value != NULL && *path != '\0') {
+    const char *dot = strchr(path, '.');
+    size_t len = dot ? (size_t)(dot - path) : strlen(path);
+    json_value *member = NULL;
+    dynarray_cell *dc = NULL;
+
+    if (value->type != JSON_OBJECT)
+      return NULL;
+
+    foreach (dc, value->keys) {
+      const char *key = (const char *)dfirst(dc);
+
+      if (strlen(key) == len && strncmp(key, path, len) == 0) {
+        member = (json_value *)dfirst(dynarray_nth_cell(value->items, foreach_current_index(dc)));
+        break;
+      }
+    }
+
+    value = member;
+    path += dot ? len + 1 : len;
+  }
+
+  return value;
+}
+
+const char *json_get_string(json_value *value, const char *path)
+{
+  json_value *member = json_get(value, path);
+
+  return (member != NULL && member->type == JSON_STRING) ? member->string : NULL;
+}
+
+int json_get_int(json_value *value, const char *path, int defval)
+{
+  json_value *member = json_get(value, path);
+
+  return (member != NULL && member->type == JSON_NUMBER) ? (int)member->number : defval;
+}
+
+void json_append_string(buffer *buf, const char *str)
+{
+  const char *p = str;
+
+  buffer_append(buf, "\"");
+
+  while (*p) {
+    // characters which don't need escaping are copied in runs
+    size_t len = strcspn(p, "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\t\n\x0b\x0c\r\x0e\x0f"
+                            "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+
+    if (len > 0) {
+      buffer_append(buf, "%.*s", (int)len, p);
+      p += len;
+      continue;
+    }
+
+    switch (*p) {
+      case '"':  buffer_append(buf, "\\\""); break;
+      case '\\': buffer_append(buf, "\\\\"); break;
+      case '\n': buffer_append(buf, "\\n"); break;
+      case '\r': buffer_append(buf, "\\r"); break;
+      case '\t': buffer_append(buf, "\\t"); break;
+      default:   buffer_append(buf, "\\u%04x", (unsigned char)*p); break;
+    }
+
+    p++;
+  }
+
+  buffer_append(buf, "\"");
+}
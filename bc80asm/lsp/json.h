@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct buffer buffer;
+typedef struct dynarray dynarray;
+
+typedef enum {
+  JSON_NULL = 0,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT,
+} json_type;
+
+typedef struct json_value {
+  json_type type;
+  bool boolean;
+  double number;
+  char *string;
+  dynarray *items;              // json_value of array, values of object members
+  dynarray *keys;               // names of object members
+} json_value;
+
+extern json_value *json_parse(const char *text);
+extern void json_free(json_value *value);
+
+// member of object by path of names separated by dots (NULL if any of them is missing)
+extern json_value *json_get(json_value *value, const char *path);
+extern const char *json_get_string(json_value *value, const char *path);
+extern int json_get_int(json_value *value, const char *path, int defval);
+
+extern void json_append_string(buffer *buf, const char *str);
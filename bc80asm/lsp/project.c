@@ -0,0 +1,530 @@
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm/compile.h"
+#include "asm/listing.h"
+#include "asm/parse.h"
+#include "asm/watch.h"
+#include "bits/buffer.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/hashmap.h"
+#include "bits/mmgr.h"
+#include "lsp/project.h"
+
+// Analysis of project is assembly of its main files: every main file is parsed through watch
+// cache, so only files changed since the previous analysis are parsed again, and compiled with
+// listing of the final pass. Results are collected into the pool of analysis: messages of
+// assembler, definitions of labels and EQUs (even if compilation fails), symbol values,
+// addresses, bytes and T-states of source lines and totals of blocks between global labels.
+
+typedef struct {
+  project_t *project;
+  char *root;
+  hashmap *paths;               // filename of nodes -> resolved path
+  char *scope;                  // the last global label
+  char *block;                  // the last global label of listing
+} analysis_job_t;
+
+void project_init(project_t *project)
+{
+  project->watch = watch_create();
+  project->docs = hashmap_create(64, "lsp_docs");
+  project->opts.watch = project->watch;
+  project->opts.listing = true;
+}
+
+void project_open(project_t *project, const char *path, const char *text)
+{
+  lsp_doc_t *doc = (lsp_doc_t *)hashmap_get(project->docs, (void *)path);
+
+  if (doc == NULL) {
+    doc = (lsp_doc_t *)xmalloc(sizeof(lsp_doc_t));
+    doc->path = xstrdup(path);
+    doc->text = NULL;
+    hashmap_set(project->docs, (void *)path, doc);
+  }
+
+  xfree(doc->text);
+  doc->text = xstrdup(text);
+
+  watch_overlay(project->watch, path, text);
+  project->dirty = true;
+}
+
+void project_close(project_t *project, const char *path)
+{
+  lsp_doc_t *doc = (lsp_doc_t *)hashmap_remove(project->docs, (void *)path);
+
+  if (doc != NULL) {
+    xfree(doc->path);
+    xfree(doc->text);
+    xfree(doc);
+  }
+
+  watch_overlay(project->watch, path, NULL);
+  project->dirty = true;
+}
+
+void project_free(project_t *project)
+{
+  hashmap_scan *scan = hashmap_scan_init(project->docs);
+  hashmap_entry *entry = NULL;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    lsp_doc_t *doc = (lsp_doc_t *)entry->value;
+
+    xfree(doc->path);
+    xfree(doc->text);
+    xfree(doc);
+  }
+
+  hashmap_free(project->docs);
+
+  if (project->pool != NULL)
+    mmgr_pool_free(project->pool);
+
+  watch_free(project->watch);
+  hashmap_free(project->defineopts);
+  dynarray_free_deep(project->opts.includeopts);
+  dynarray_free_deep(project->roots);
+  dynarray_free_deep(project->diag_paths);
+}
+
+// path of file referenced by nodes (allocated in pool of analysis)
+static char *resolve_path(analysis_job_t *job, const char *filename)
+{
+  char *path = (char *)hashmap_get(job->paths, (void *)filename);
+
+  if (path == NULL) {
+    char *abs_path = watch_path(job->project->watch, (char *)filename, job->project->opts.includeopts);
+
+    path = xstrdup(abs_path ? abs_path : filename);
+    free(abs_path);
+    hashmap_set(job->paths, (void *)filename, path);
+  }
+
+  return path;
+}
+
+static void collect_message(void *data, int kind, const char *filename, int line, int pos, const char *msg)
+{
+  analysis_job_t *job = (analysis_job_t *)data;
+  project_t *project = job->project;
+
+  if (kind == MESSAGE_INFO)
+    return;
+
+  mmgr_pool *prev = mmgr_switch(project->pool);
+  lsp_diag_t *diag = (lsp_diag_t *)xmalloc(sizeof(lsp_diag_t));
+
+  // messages without location are shown at the beginning of main file
+  diag->path = resolve_path(job, filename ? filename : job->root);
+  diag->line = (filename && line > 0) ? line : 1;
+  diag->pos = filename ? pos : 0;
+  diag->warning = (kind == MESSAGE_WARNING);
+  diag->message = xstrdup(msg);
+
+  project->diags = dynarray_append_ptr(project->diags, diag);
+  mmgr_switch(prev);
+}
+
+static void add_def(analysis_job_t *job, const char *name, parse_node *node, bool equ)
+{
+  project_t *project = job->project;
+
+  if (node->fn == NULL || hashmap_get(project->defs, (void *)name) != NULL)
+    return;
+
+  lsp_def_t *def = (lsp_def_t *)xmalloc(sizeof(lsp_def_t));
+  def->name = xstrdup(name);
+  def->path = resolve_path(job, node->fn);
+  def->line = node->line - 1;
+  def->pos = node->pos;
+  def->equ = equ;
+
+  hashmap_set(project->defs, (void *)name, def);
+}
+
+// labels and EQUs are collected from parsed statements, so they are known even if compilation fails
+static void collect_defs(analysis_job_t *job, dynarray *statements)
+{
+  project_t *project = job->project;
+  dynarray_cell *dc = NULL;
+  mmgr_pool *prev = mmgr_switch(project->pool);
+
+  foreach (dc, statements) {
+    parse_node *node = (parse_node *)dfirst(dc);
+
+    if (node->type == NODE_EQU) {
+      EQU *equ = (EQU *)node;
+      add_def(job, equ->name->name, (parse_node *)equ->name, true);
+    } else if (node->type == NODE_LABEL && node->fn != NULL) {
+      LABEL *label = (LABEL *)node;
+      char *name = label->name->name;
+
+      if (name[0] == '.') {
+        if (job->scope != NULL) {
+          char *qualified = bsprintf("%s%s", job->scope, name);
+          add_def(job, qualified, (parse_node *)label->name, false);
+          xfree(qualified);
+        }
+        continue;
+      }
+
+      job->scope = name;
+      add_def(job, name, (parse_node *)label->name, false);
+
+      lsp_scope_t *scope = (lsp_scope_t *)xmalloc(sizeof(lsp_scope_t));
+      scope->name = xstrdup(name);
+      scope->path = resolve_path(job, node->fn);
+      scope->line = node->line - 1;
+
+      project->scopes = dynarray_append_ptr(project->scopes, scope);
+    }
+  }
+
+  mmgr_switch(prev);
+}
+
+static void collect_listing(analysis_job_t *job, compile_ctx_t *ctx)
+{
+  project_t *project = job->project;
+  dynarray_cell *dc = NULL;
+
+  foreach (dc, ctx->listing->lines) {
+    listing_line_t *ll = (listing_line_t *)dfirst(dc);
+    parse_node *node = ll->node;
+
+    if (node->type == NODE_LABEL && ((LABEL *)node)->name->name[0] != '.') {
+      char *name = ((LABEL *)node)->name->name;
+      lsp_block_t *block = (lsp_block_t *)hashmap_get(project->blocks, name);
+
+      // global labels of REPT iterations share the block
+      if (block == NULL) {
+        block = (lsp_block_t *)xmalloc(sizeof(lsp_block_t));
+        block->addr = ll->addr;
+        block->size = 0;
+        block->cycles = 0;
+        hashmap_set(project->blocks, name, block);
+      }
+
+      job->block = xstrdup(name);
+    }
+
+    if (job->block != NULL) {
+      lsp_block_t *block = (lsp_block_t *)hashmap_get(project->blocks, job->block);
+      block->size += ll->size;
+      block->cycles += ll->cycles;
+    }
+
+    if (node->fn == NULL)
+      continue;
+
+    char *key = bsprintf("%s:%d", resolve_path(job, node->fn), node->line - 1);
+    lsp_line_t *line = (lsp_line_t *)hashmap_get(project->lines, key);
+    bool describe = (line == NULL);
+
+    if (line == NULL) {
+      line = (lsp_line_t *)xmalloc(sizeof(lsp_line_t));
+      memset(line, 0, sizeof(lsp_line_t));
+      line->node = node;
+      line->count = 1;
+      line->block = job->block;
+      hashmap_set(project->lines, key, line);
+    } else if (line->node == node) {
+      line->count++;
+    } else {
+      // label in front of instruction is listed before it with nothing rendered, the line is
+      // described by instruction then
+      describe = (line->size == 0 && line->cycles == 0);
+    }
+
+    if (describe) {
+      section_ctx_t *section = (section_ctx_t *)dfirst(dynarray_nth_cell(ctx->sections, ll->section_id));
+
+      line->addr = ll->addr;
+      line->size = ll->size;
+      line->cycles = ll->cycles;
+      memcpy(line->bytes, section->content->data + ll->pos,
+        (ll->size < (int)sizeof(line->bytes)) ? ll->size : (int)sizeof(line->bytes));
+    }
+
+    xfree(key);
+  }
+}
+
+// inspect hook of the final pass
+static void collect_results(compile_ctx_t *ctx, void *data)
+{
+  analysis_job_t *job = (analysis_job_t *)data;
+  project_t *project = job->project;
+  mmgr_pool *prev = mmgr_switch(project->pool);
+  hashmap_scan *scan = hashmap_scan_init(ctx->symtab);
+  hashmap_entry *entry = NULL;
+
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    parse_node *value = (parse_node *)entry->value;
+
+    if (!IS_INT_LITERAL(value) || hashmap_get(project->symbols, entry->key) != NULL)
+      continue;
+
+    int *ival = (int *)xmalloc(sizeof(int));
+    *ival = ((LITERAL *)value)->ival;
+    hashmap_set(project->symbols, entry->key, ival);
+  }
+
+  collect_listing(job, ctx);
+  mmgr_switch(prev);
+}
+
+static void analyze_root(project_t *project, char *root)
+{
+  analysis_job_t job = {.project = project, .root = root};
+  compile_opts opts = project->opts;
+  dynarray *statements = NULL;
+  char *dest_buf = NULL;
+  jmp_buf error_env;
+
+  mmgr_pool *prev = mmgr_switch(project->pool);
+  job.paths = hashmap_create(64, "lsp_paths");
+  mmgr_switch(prev);
+
+  opts.inspect = collect_results;
+  opts.inspect_data = &job;
+
+  error_handler prev_handler;
+  void *prev_handler_data;
+
+  get_error_handler(&prev_handler, &prev_handler_data);
+
+  jmp_buf *prev_env = set_error_context(&error_env);
+  set_error_handler(collect_message, &job);
+  watch_begin(project->watch);
+
+  if (setjmp(error_env) == 0) {
+    watch_parse(project->watch, root, NULL, &opts, &statements);
+    collect_defs(&job, statements);
+    compile(opts, project->defineopts, statements, &dest_buf);
+  }
+
+  // error could interrupt quiet pass
+  set_error_quiet(false);
+  watch_end(project->watch);
+  set_error_handler(prev_handler, prev_handler_data);
+  set_error_context(prev_env);
+}
+
+// mark files included by file (as they were parsed last time)
+static void mark_included(project_t *project, hashmap *included, const char *path)
+{
+  watch_file_t *file = (watch_file_t *)hashmap_get(project->watch->files, (void *)path);
+  dynarray_cell *dc = NULL;
+
+  if (file == NULL)
+    return;
+
+  foreach (dc, file->includes) {
+    char *included_path = (char *)dfirst(dc);
+
+    if (hashmap_get(included, included_path) == NULL) {
+      hashmap_set(included, included_path, XMMGR_DUMMY_PTR);
+      mark_included(project, included, included_path);
+    }
+  }
+}
+
+// main files: given ones or open documents which aren't included by other open documents
+static dynarray *get_roots(project_t *project)
+{
+  dynarray *roots = NULL;
+  dynarray_cell *dc = NULL;
+  hashmap_scan *scan = NULL;
+  hashmap_entry *entry = NULL;
+
+  if (project->roots != NULL) {
+    foreach (dc, project->roots)
+      roots = dynarray_append_ptr(roots, xstrdup(dfirst(dc)));
+    return roots;
+  }
+
+  hashmap *included = hashmap_create(64, "lsp_included");
+
+  scan = hashmap_scan_init(project->docs);
+  while ((entry = hashmap_scan_next(scan)) != NULL)
+    mark_included(project, included, entry->key);
+
+  scan = hashmap_scan_init(project->docs);
+  while ((entry = hashmap_scan_next(scan)) != NULL) {
+    if (hashmap_get(included, entry->key) == NULL)
+      roots = dynarray_append_ptr(roots, xstrdup(entry->key));
+  }
+
+  hashmap_free(included);
+
+  return roots;
+}
+
+static bool same_roots(dynarray *roots1, dynarray *roots2)
+{
+  if (dynarray_length(roots1) != dynarray_length(roots2))
+    return false;
+
+  for (int i = 0; i < dynarray_length(roots1); i++) {
+    if (strcmp(dfirst(dynarray_nth_cell(roots1, i)), dfirst(dynarray_nth_cell(roots2, i))) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+static void analyze_roots(project_t *project, dynarray *roots)
+{
+  dynarray_cell *dc = NULL;
+
+  if (project->pool != NULL)
+    mmgr_pool_free(project->pool);
+
+  project->pool = mmgr_pool_create();
+
+  mmgr_pool *prev = mmgr_switch(project->pool);
+  project->diags = NULL;
+  project->defs = hashmap_create(1024, "lsp_defs");
+  project->scopes = NULL;
+  project->lines = hashmap_create(4096, "lsp_lines");
+  project->blocks = hashmap_create(256, "lsp_blocks");
+  project->symbols = hashmap_create(1024, "lsp_symbols");
+  mmgr_switch(prev);
+
+  foreach (dc, roots)
+    analyze_root(project, (char *)dfirst(dc));
+}
+
+void project_analyze(project_t *project)
+{
+  dynarray *roots = get_roots(project);
+
+  analyze_roots(project, roots);
+
+  // newly parsed file could include another open document, it isn't main file then
+  dynarray *parsed_roots = get_roots(project);
+
+  if (!same_roots(roots, parsed_roots))
+    analyze_roots(project, parsed_roots);
+
+  dynarray_free_deep(roots);
+  dynarray_free_deep(parsed_roots);
+
+  project->dirty = false;
+}
+
+static bool is_word_char(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+// identifier at position of open document (NULL if there is none), start is set to its column
+char *project_word_at(project_t *project, const char *path, int line, int character, int *start)
+{
+  lsp_doc_t *doc = (lsp_doc_t *)hashmap_get(project->docs, (void *)path);
+
+  if (doc == NULL)
+    return NULL;
+
+  const char *p = doc->text;
+
+  for (int i = 1; i < line && p != NULL; i++) {
+    p = strchr(p, '\n');
+    if (p != NULL)
+      p++;
+  }
+
+  if (p == NULL)
+    return NULL;
+
+  int len = strcspn(p, "\r\n");
+  int begin = (character < len) ? character : len;
+  int end = begin;
+
+  while (begin > 0 && is_word_char(p[begin - 1]))
+    begin--;
+
+  while (end < len && is_word_char(p[end]))
+    end++;
+
+  if (begin == end || isdigit((unsigned char)p[begin]))
+    return NULL;
+
+  char *word = (char *)xmalloc(end - begin + 1);
+  memcpy(word, p + begin, end - begin);
+  word[end - begin] = '\0';
+  *start = begin;
+
+  return word;
+}
+
+// global label which is the scope of line
+static const char *scope_at(project_t *project, const char *path, int line)
+{
+  dynarray_cell *dc = NULL;
+  const char *name = NULL;
+
+  foreach (dc, project->scopes) {
+    lsp_scope_t *scope = (lsp_scope_t *)dfirst(dc);
+
+    if (scope->line <= line && strcmp(scope->path, path) == 0)
+      name = scope->name;
+  }
+
+  return name;
+}
+
+lsp_def_t *project_find_def(project_t *project, const char *path, int line, const char *word)
+{
+  if (project->defs == NULL)
+    return NULL;
+
+  if (word[0] != '.')
+    return (lsp_def_t *)hashmap_get(project->defs, (void *)word);
+
+  const char *scope = scope_at(project, path, line);
+
+  if (scope == NULL)
+    return NULL;
+
+  char *qualified = bsprintf("%s%s", scope, word);
+  lsp_def_t *def = (lsp_def_t *)hashmap_get(project->defs, qualified);
+  xfree(qualified);
+
+  return def;
+}
+
+lsp_line_t *project_find_line(project_t *project, const char *path, int line)
+{
+  if (project->lines == NULL)
+    return NULL;
+
+  char *key = bsprintf("%s:%d", path, line);
+  lsp_line_t *result = (lsp_line_t *)hashmap_get(project->lines, key);
+  xfree(key);
+
+  return result;
+}
+
+lsp_block_t *project_find_block(project_t *project, const char *name)
+{
+  return project->blocks ? (lsp_block_t *)hashmap_get(project->blocks, (void *)name) : NULL;
+}
+
+bool project_find_symbol(project_t *project, const char *name, int *value)
+{
+  int *ival = project->symbols ? (int *)hashmap_get(project->symbols, (void *)name) : NULL;
+
+  if (ival != NULL)
+    *value = *ival;
+
+  return ival != NULL;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asm/bc80asm.h"
+#include "bits/mmgr.h"
+
+typedef struct dynarray dynarray;
+typedef struct hashmap hashmap;
+typedef struct parse_node parse_node;
+typedef struct watch_t watch_t;
+
+// lines are counted from 1 like in messages of assembler, columns too (0 if not known)
+typedef struct {
+  char *path;
+  int line;
+  int pos;
+  bool warning;
+  char *message;
+} lsp_diag_t;
+
+// label or EQU, names of local labels are prefixed by their global label
+typedef struct {
+  char *name;
+  char *path;
+  int line;
+  int pos;
+  bool equ;
+} lsp_def_t;
+
+// global label in source order, for scopes of local labels
+typedef struct {
+  char *name;
+  char *path;
+  int line;
+} lsp_scope_t;
+
+// what a source line rendered by the final pass
+typedef struct {
+  uint32_t addr;
+  int size;
+  int cycles;
+  int count;                    // statement is compiled more than once inside REPT block
+  parse_node *node;             // the first statement of line, counts compilations (analysis only)
+  uint8_t bytes[8];             // the first bytes of the first compilation
+  char *block;                  // global label of block which contains the line (NULL if none)
+} lsp_line_t;
+
+// totals of block between global labels
+typedef struct {
+  uint32_t addr;
+  int size;
+  long cycles;
+} lsp_block_t;
+
+typedef struct {
+  char *path;
+  char *text;
+} lsp_doc_t;
+
+typedef struct project_t {
+  compile_opts opts;
+  hashmap *defineopts;
+  dynarray *roots;              // absolute paths of main files (NULL: open documents which aren't included)
+  watch_t *watch;               // parsed files kept between analyses
+  hashmap *docs;                // path -> lsp_doc_t of documents open in editor
+  bool dirty;                   // documents are changed since the last analysis
+  dynarray *diag_paths;         // paths which diagnostics were published for
+
+  // results of the last analysis, allocated in their pool
+  mmgr_pool *pool;
+  dynarray *diags;              // lsp_diag_t
+  hashmap *defs;                // name -> lsp_def_t
+  dynarray *scopes;             // lsp_scope_t
+  hashmap *lines;               // "path:line" -> lsp_line_t
+  hashmap *blocks;              // global label -> lsp_block_t
+  hashmap *symbols;             // name -> int value of integer symbol
+} project_t;
+
+extern void project_init(project_t *project);
+extern void project_free(project_t *project);
+extern void project_open(project_t *project, const char *path, const char *text);
+extern void project_close(project_t *project, const char *path);
+extern void project_analyze(project_t *project);
+
+extern char *project_word_at(project_t *project, const char *path, int line, int character, int *start);
+extern lsp_def_t *project_find_def(project_t *project, const char *path, int line, const char *word);
+extern lsp_line_t *project_find_line(project_t *project, const char *path, int line);
+extern lsp_block_t *project_find_block(project_t *project, const char *name);
+extern bool project_find_symbol(project_t *project, const char *name, int *value);
@@ -0,0 +1,75 @@
+#!/bin/bash
+
+# usage test.sh /path/to/bc80lsp
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+NC='\033[0m'
+
+MY_LSP=$1
+TMPDIR=/tmp/lsptest
+
+rm -rf $TMPDIR
+mkdir -p $TMPDIR
+
+total=0
+failed=0
+
+# print message with Content-Length header (bodies are ASCII)
+message() {
+  printf 'Content-Length: %d\r\n\r\n%s' ${#1} "$1"
+}
+
+# open document, request hover to get it analyzed and finish the session, hover position is
+# the start of the first line unless given
+session() {
+  local uri=$1
+  local text=$2
+  local line=${3:-0}
+  local character=${4:-2}
+
+  message '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"rootUri":"file://'$TMPDIR'","capabilities":{}}}'
+  message '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"'"$uri"'","languageId":"asm","version":1,"text":"'"$text"'"}}}'
+  message '{"jsonrpc":"2.0","id":2,"method":"textDocument/hover","params":{"textDocument":{"uri":"'"$uri"'"},"position":{"line":'$line',"character":'$character'}}}'
+  message '{"jsonrpc":"2.0","id":3,"method":"shutdown"}'
+  message '{"jsonrpc":"2.0","method":"exit"}'
+}
+
+check() {
+  local name=$1
+  local output=$2
+  local expected=$3
+
+  echo -n "${name}... "
+  total=$((total+1))
+
+  if ! grep -qF -- "$expected" $output; then
+    echo -e "${RED}Failed${NC}"
+    failed=$((failed+1))
+    return
+  fi
+
+  echo -e "${GREEN}OK${NC}"
+}
+
+# 1. Message without location is published for main file
+printf '  nop\n' > $TMPDIR/noloc.asm
+session "file://$TMPDIR/noloc.asm" '  nop\n' | $MY_LSP -t sna > $TMPDIR/noloc.out 2>&1
+check "diagnostic without location" $TMPDIR/noloc.out \
+  '"uri":"file://'$TMPDIR'/noloc.asm","diagnostics":[{"range":{"start":{"line":0,"character":0}'
+
+# 2. Document which isn't saved yet is analyzed from its text
+session "file://$TMPDIR/unsaved.asm" '  jp missing\n' | $MY_LSP > $TMPDIR/unsaved.out 2>&1
+check "unsaved document" $TMPDIR/unsaved.out 'unresolved symbol ID missing'
+
+# 3. Instruction behind label describes the line
+printf '  org 8000h\nstart: ld b,3\n' > $TMPDIR/label.asm
+session "file://$TMPDIR/label.asm" '  org 8000h\nstart: ld b,3\n' 1 8 | $MY_LSP > $TMPDIR/label.out 2>&1
+check "instruction behind label" $TMPDIR/label.out '`8000h`: `06 03`, 2 bytes, 7 T-states'
+
+echo "--"
+echo "Total tests passed: ${total}"
+if [ "$failed" -ne "0" ]; then
+  echo -e "${RED}Failed: ${failed}${NC}"
+  exit 1
+fi
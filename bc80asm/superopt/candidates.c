@@ -0,0 +1,501 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bits/mmgr.h"
+#include "superopt/superopt.h"
+
+// Candidate instructions come from the disassembler's opcode tables: every encoding
+// (unprefixed, CB and ED ones) is decoded for its mnemonic, size and cycles, and kept
+// if the interpreter knows its semantics. Source instructions are parsed by matching
+// against texts of the same encodings.
+
+#define SKELETON_SIZE 64
+
+static inline bool is_gpr(disas_arg_t *arg)
+{
+  return arg->kind == ARG_8GPR && !arg->is_ref && arg->value != 6;
+}
+
+static inline bool is_hl_ref(disas_arg_t *arg)
+{
+  return arg->kind == ARG_REGPAIR_P && arg->is_ref && arg->value == REG_HL;
+}
+
+// BC, DE or HL
+static inline bool is_pair(disas_arg_t *arg)
+{
+  return (arg->kind == ARG_REGPAIR_P || arg->kind == ARG_REGPAIR_Q) && !arg->is_ref && arg->value < REG_SP;
+}
+
+static inline bool is_pair_ref(disas_arg_t *arg)
+{
+  return arg->kind == ARG_REGPAIR_P && arg->is_ref && arg->value < REG_SP;
+}
+
+static inline bool is_imm8(disas_arg_t *arg)
+{
+  return arg->kind == ARG_8IMM && !arg->is_ref;
+}
+
+static bool node_to_op(disas_node_t *node, z80_op_t *op)
+{
+  disas_arg_t *a0 = &node->args[0];
+  disas_arg_t *a1 = &node->args[1];
+  int alu = -1;
+  int rotation = -1;
+
+  memset(op, 0, sizeof(*op));
+
+  switch (node->instr) {
+    case ADD: alu = 0; break;
+    case ADC: alu = 1; break;
+    case SUB: alu = 2; break;
+    case SBC: alu = 3; break;
+    case AND: alu = 4; break;
+    case XOR: alu = 5; break;
+    case OR:  alu = 6; break;
+    case CP:  alu = 7; break;
+    case RLC: rotation = 0; break;
+    case RRC: rotation = 1; break;
+    case RL:  rotation = 2; break;
+    case RR:  rotation = 3; break;
+    case SLA: rotation = 4; break;
+    case SRA: rotation = 5; break;
+    case SRL: rotation = 7; break;
+    default: break;
+  }
+
+  if (alu >= 0) {
+    if (node->num_args == 2 && is_pair(a0) && a0->value == REG_HL) {
+      if (!is_pair(a1) || alu == 2)
+        return false;
+
+      op->kind = (alu == 0) ? OP_ADD16 : (alu == 1) ? OP_ADC16 : OP_SBC16;
+      op->src = a1->value;
+      return true;
+    }
+
+    // accumulator is explicit for ADD, ADC and SBC only
+    if (node->num_args == 2 && !(is_gpr(a0) && a0->value == REG_A))
+      return false;
+
+    disas_arg_t *src = (node->num_args == 2) ? a1 : a0;
+    op->sub = alu;
+
+    if (is_gpr(src)) {
+      op->kind = OP_ALU;
+      op->src = src->value;
+    } else if (is_imm8(src)) {
+      op->kind = OP_ALU_IMM;
+      op->imm = src->value;
+    } else if (is_hl_ref(src)) {
+      op->kind = OP_ALU_MEM;
+    } else {
+      return false;
+    }
+
+    return true;
+  }
+
+  if (rotation >= 0) {
+    op->sub = rotation;
+    op->dst = a0->value;
+    op->kind = is_gpr(a0) ? OP_ROT : OP_ROT_MEM;
+    return is_gpr(a0) || is_hl_ref(a0);
+  }
+
+  switch (node->instr) {
+    case LD:
+      if (is_gpr(a0) && is_gpr(a1)) {
+        op->kind = OP_LD;
+        op->dst = a0->value;
+        op->src = a1->value;
+      } else if (is_gpr(a0) && is_imm8(a1)) {
+        op->kind = OP_LD_IMM;
+        op->dst = a0->value;
+        op->imm = a1->value;
+      } else if (is_gpr(a0) && is_pair_ref(a1)) {
+        op->kind = OP_LD_LOAD;
+        op->dst = a0->value;
+        op->src = a1->value;
+      } else if (is_pair_ref(a0) && is_gpr(a1)) {
+        op->kind = OP_LD_STORE;
+        op->dst = a0->value;
+        op->src = a1->value;
+      } else if (is_hl_ref(a0) && is_imm8(a1)) {
+        op->kind = OP_LD_STORE_IMM;
+        op->imm = a1->value;
+      } else if (is_pair(a0) && a1->kind == ARG_16IMM && !a1->is_ref) {
+        op->kind = OP_LD16_IMM;
+        op->dst = a0->value;
+        op->imm = (a1->extra << 8) | a1->value;
+      } else {
+        return false;
+      }
+      return true;
+
+    case INC:
+    case DEC: {
+      bool inc = node->instr == INC;
+
+      if (is_gpr(a0))
+        op->kind = inc ? OP_INC : OP_DEC;
+      else if (is_hl_ref(a0))
+        op->kind = inc ? OP_INC_MEM : OP_DEC_MEM;
+      else if (is_pair(a0))
+        op->kind = inc ? OP_INC16 : OP_DEC16;
+      else
+        return false;
+
+      op->dst = a0->value;
+      return true;
+    }
+
+    case BIT:
+    case RES:
+    case SET: {
+      bool mem = is_hl_ref(a1);
+
+      if (!is_gpr(a1) && !mem)
+        return false;
+
+      if (node->instr == BIT)
+        op->kind = mem ? OP_BIT_MEM : OP_BIT;
+      else if (node->instr == RES)
+        op->kind = mem ? OP_RES_MEM : OP_RES;
+      else
+        op->kind = mem ? OP_SET_MEM : OP_SET;
+
+      op->sub = a0->value;
+      op->dst = a1->value;
+      return true;
+    }
+
+    case EX:
+      op->kind = OP_EX_DE_HL;
+      return is_pair(a0) && a0->value == REG_DE && is_pair(a1) && a1->value == REG_HL;
+
+    case RLCA: op->kind = OP_RLCA; return true;
+    case RRCA: op->kind = OP_RRCA; return true;
+    case RLA:  op->kind = OP_RLA; return true;
+    case RRA:  op->kind = OP_RRA; return true;
+    case CPL:  op->kind = OP_CPL; return true;
+    case NEG:  op->kind = OP_NEG; return true;
+    case SCF:  op->kind = OP_SCF; return true;
+    case CCF:  op->kind = OP_CCF; return true;
+    case DAA:  op->kind = OP_DAA; return true;
+
+    default:
+      return false;
+  }
+}
+
+template_t *build_templates(int *ntemplates)
+{
+  static const int prefixes[] = {-1, 0xcb, 0xed};
+  template_t *templates = (template_t *)xmalloc(sizeof(template_t) * 3 * 256);
+  int n = 0;
+
+  for (int i = 0; i < 3; i++) {
+    for (int opcode = 0; opcode < 256; opcode++) {
+      uint8_t data[8] = {0};
+      int len = 0;
+      disas_node_t node;
+      z80_op_t op;
+
+      // index registers aren't modelled
+      if (prefixes[i] < 0 && (opcode == 0xcb || opcode == 0xed || opcode == 0xdd || opcode == 0xfd))
+        continue;
+
+      if (prefixes[i] >= 0)
+        data[len++] = prefixes[i];
+      data[len++] = opcode;
+
+      if (!disassemble_instr(data, &node) || !node_to_op(&node, &op))
+        continue;
+
+      memcpy(templates[n].bytes, data, sizeof(templates[n].bytes));
+      templates[n].size = node.isize;
+      templates[n].imm_size = node.isize - len;
+      n++;
+    }
+  }
+
+  *ntemplates = n;
+  return templates;
+}
+
+bool instantiate(template_t *t, int value, candidate_t *candidate)
+{
+  uint8_t data[8] = {0};
+  disas_node_t node;
+
+  memcpy(data, t->bytes, sizeof(t->bytes));
+
+  if (t->imm_size == 1) {
+    data[t->size - 1] = value & 0xff;
+  } else if (t->imm_size == 2) {
+    data[t->size - 2] = value & 0xff;
+    data[t->size - 1] = (value >> 8) & 0xff;
+  }
+
+  if (!disassemble_instr(data, &node) || !node_to_op(&node, &candidate->op))
+    return false;
+
+  memcpy(candidate->bytes, data, sizeof(candidate->bytes));
+  candidate->size = node.isize;
+  candidate->cycles = node.cycles;
+  candidate->text = disas_instr_text(&node);
+
+  return true;
+}
+
+static bool parse_number(char prefix, const char *token, int *value)
+{
+  char buf[32];
+  int len = strlen(token);
+  int base = 10;
+  char *digits = buf;
+  char *endptr;
+
+  if (len == 0 || len >= (int)sizeof(buf))
+    return false;
+
+  strcpy(buf, token);
+
+  if (prefix == '$') {
+    base = 16;
+  } else if (prefix == '%') {
+    base = 2;
+  } else if (buf[len - 1] == 'h') {
+    base = 16;
+    buf[len - 1] = '\0';
+  } else if (buf[0] == '0' && buf[1] == 'x') {
+    base = 16;
+    digits += 2;
+  } else if (buf[0] == '0' && buf[1] == 'b') {
+    base = 2;
+    digits += 2;
+  }
+
+  if (*digits == '\0')
+    return false;
+
+  *value = strtol(digits, &endptr, base);
+  return *endptr == '\0';
+}
+
+// lowercases instruction and drops spaces except one after mnemonic, numbers are
+// replaced with '#' and their values are returned separately
+static bool canonicalize(const char *text, char *skeleton, int *values, int *nvalues)
+{
+  const char *p = text;
+  int len = 0;
+  char prev = ' ';
+
+  *nvalues = 0;
+
+  while (isspace((unsigned char)*p))
+    p++;
+
+  while (isalpha((unsigned char)*p) && len < SKELETON_SIZE - 2)
+    skeleton[len++] = tolower((unsigned char)*p++);
+
+  if (len == 0)
+    return false;
+
+  skeleton[len++] = ' ';
+
+  while (*p) {
+    if (isspace((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+
+    if (len >= SKELETON_SIZE - 2)
+      return false;
+
+    bool negative = false;
+    if (*p == '-' && (prev == ' ' || prev == ',' || prev == '(') && isdigit((unsigned char)p[1])) {
+      negative = true;
+      p++;
+    }
+
+    if (isdigit((unsigned char)*p) || ((*p == '$' || *p == '%') && isxdigit((unsigned char)p[1]))) {
+      char token[32];
+      int token_len = 0;
+      char prefix = 0;
+      int value;
+
+      if (*p == '$' || *p == '%')
+        prefix = *p++;
+
+      while (isalnum((unsigned char)*p) && token_len < (int)sizeof(token) - 1)
+        token[token_len++] = tolower((unsigned char)*p++);
+      token[token_len] = '\0';
+
+      if (!parse_number(prefix, token, &value) || *nvalues == 2)
+        return false;
+
+      values[(*nvalues)++] = negative ? -value : value;
+      prev = skeleton[len++] = '#';
+      continue;
+    }
+
+    prev = skeleton[len++] = tolower((unsigned char)*p++);
+  }
+
+  while (len > 0 && skeleton[len - 1] == ' ')
+    len--;
+
+  skeleton[len] = '\0';
+  return true;
+}
+
+// negative source values match their 8 or 16 bit encodings
+static inline bool value_matches(int source, int value)
+{
+  return source == value ||
+    (source < 0 && source >= -128 && (source & 0xff) == value) ||
+    (source < 0 && source >= -32768 && (source & 0xffff) == value);
+}
+
+bool parse_instr(template_t *templates, int ntemplates, const char *text, candidate_t *candidate)
+{
+  char skeleton[SKELETON_SIZE];
+  int values[2];
+  int nvalues;
+
+  if (!canonicalize(text, skeleton, values, &nvalues))
+    return false;
+
+  for (int i = 0; i < ntemplates; i++) {
+    template_t *t = &templates[i];
+    int ntries = (t->imm_size == 0) ? 1 : nvalues;
+
+    for (int k = 0; k < ntries; k++) {
+      char cand_skeleton[SKELETON_SIZE];
+      int cand_values[2];
+      int cand_nvalues;
+      bool matched = true;
+
+      if (!instantiate(t, (t->imm_size == 0) ? 0 : values[k], candidate))
+        continue;
+
+      if (!canonicalize(candidate->text, cand_skeleton, cand_values, &cand_nvalues) ||
+        strcmp(skeleton, cand_skeleton) != 0 || nvalues != cand_nvalues)
+      {
+        matched = false;
+      }
+
+      for (int v = 0; matched && v < nvalues; v++)
+        matched = value_matches(values[v], cand_values[v]);
+
+      if (matched)
+        return true;
+
+      xfree(candidate->text);
+    }
+  }
+
+  return false;
+}
+
+static int add_value(int *values, int nvalues, int value)
+{
+  for (int i = 0; i < nvalues; i++) {
+    if (values[i] == value)
+      return nvalues;
+  }
+
+  if (nvalues < SOPT_MAX_IMM)
+    values[nvalues++] = value;
+
+  return nvalues;
+}
+
+// cost order of candidates for qsort()
+static bool sort_by_size;
+
+static int candidate_cmp(const void *a, const void *b)
+{
+  const candidate_t *c1 = (const candidate_t *)a;
+  const candidate_t *c2 = (const candidate_t *)b;
+  bool optimize_size = sort_by_size;
+  int p1 = optimize_size ? c1->size : c1->cycles;
+  int p2 = optimize_size ? c2->size : c2->cycles;
+
+  if (p1 != p2)
+    return p1 - p2;
+
+  return optimize_size ? c1->cycles - c2->cycles : c1->size - c2->size;
+}
+
+candidate_t *build_candidates(sopt_ctx_t *ctx, template_t *templates, int ntemplates, int *ncandidates)
+{
+  int imm8[SOPT_MAX_IMM] = {0, 1, 0x80, 0xff};
+  int imm16[SOPT_MAX_IMM] = {0};
+  int nimm8 = 4;
+  int nimm16 = 1;
+
+  // constants of source are the likely ones
+  for (int i = 0; i < ctx->source_len; i++) {
+    z80_op_t *op = &ctx->source[i].op;
+
+    if (op->kind == OP_LD_IMM || op->kind == OP_ALU_IMM || op->kind == OP_LD_STORE_IMM) {
+      nimm8 = add_value(imm8, nimm8, op->imm);
+    } else if (op->kind == OP_LD16_IMM) {
+      nimm16 = add_value(imm16, nimm16, op->imm);
+      nimm8 = add_value(imm8, nimm8, op->imm >> 8);
+      nimm8 = add_value(imm8, nimm8, op->imm & 0xff);
+    }
+  }
+
+  int capacity = 0;
+  for (int i = 0; i < ntemplates; i++)
+    capacity += (templates[i].imm_size == 0) ? 1 : (templates[i].imm_size == 1) ? nimm8 : nimm16;
+
+  candidate_t *candidates = (candidate_t *)xmalloc(sizeof(candidate_t) * capacity);
+  int n = 0;
+  uint32_t rng = 0x1234567;
+
+  for (int i = 0; i < ntemplates; i++) {
+    template_t *t = &templates[i];
+    int *values = (t->imm_size == 2) ? imm16 : imm8;
+    int nvalues = (t->imm_size == 0) ? 1 : (t->imm_size == 1) ? nimm8 : nimm16;
+
+    for (int k = 0; k < nvalues; k++) {
+      candidate_t *c = &candidates[n];
+      z80_state_t probe;
+
+      if (!instantiate(t, values[k], c))
+        continue;
+
+      // SLL is undocumented and unknown to the assembler, LD r,r does nothing
+      bool skip = ((c->op.kind == OP_ROT || c->op.kind == OP_ROT_MEM) && c->op.sub == 6) ||
+        (c->op.kind == OP_LD && c->op.dst == c->op.src);
+
+      // memory is accessed only if source does the same
+      z80_random_state(&probe, &rng);
+      z80_exec(&probe, &c->op);
+
+      if ((probe.mem_read && !ctx->source_mem_read) || (probe.nwrites > 0 && !ctx->source_mem_write))
+        skip = true;
+
+      if (skip) {
+        xfree(c->text);
+        continue;
+      }
+
+      n++;
+    }
+  }
+
+  sort_by_size = ctx->optimize_size;
+  qsort(candidates, n, sizeof(candidate_t), candidate_cmp);
+
+  *ncandidates = n;
+  return candidates;
+}
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bits/mmgr.h"
+#include "superopt/superopt.h"
+
+// Search enumerates candidate sequences by iterative deepening. Every depth is split
+// into tasks (one or two leading instructions) dealt to per-worker deques; a worker
+// takes tasks from the tail of its own deque and steals from the head of others when
+// it runs dry. Sequences are pruned by cost (candidates are sorted by it), run on the
+// test states and the ones matching the source everywhere are verified exhaustively
+// over their inputs or with random states.
+//
+// Workers don't allocate: memory manager isn't thread-safe.
+
+#define TASK_PREFIX_MAX       2
+#define DEADLINE_CHECK_MASK   0xfff
+
+double sopt_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool stopped(sopt_ctx_t *ctx)
+{
+  if (atomic_load(&ctx->stop))
+    return true;
+
+  if (sopt_now() > ctx->deadline) {
+    atomic_store(&ctx->stop, true);
+    return true;
+  }
+
+  return false;
+}
+
+static inline int primary_cost(sopt_ctx_t *ctx, int cycles, int bytes)
+{
+  return ctx->optimize_size ? bytes : cycles;
+}
+
+// cheaper by primary cost, or by secondary one at the same primary cost
+static bool is_better(sopt_ctx_t *ctx, int cycles1, int bytes1, int cycles2, int bytes2)
+{
+  int p1 = primary_cost(ctx, cycles1, bytes1);
+  int p2 = primary_cost(ctx, cycles2, bytes2);
+
+  if (p1 != p2)
+    return p1 < p2;
+
+  return ctx->optimize_size ? cycles1 < cycles2 : bytes1 < bytes2;
+}
+
+static void run_source(sopt_ctx_t *ctx, z80_state_t *s)
+{
+  for (int i = 0; i < ctx->source_len; i++)
+    z80_exec(s, &ctx->source[i].op);
+}
+
+static void run_seq(sopt_ctx_t *ctx, const int *seq, int len, z80_state_t *s)
+{
+  for (int i = 0; i < len; i++)
+    z80_exec(s, &ctx->candidates[seq[i]].op);
+}
+
+// places bits of n into input registers and flags of state
+static void scatter_inputs(z80_state_t *s, uint16_t inputs, uint64_t n)
+{
+  for (int r = 0; r < 8; r++) {
+    if (r != R_F && (inputs & LIVE_REG(r))) {
+      s->r[r] = n & 0xff;
+      n >>= 8;
+    }
+  }
+
+  for (int b = 0; b < 8; b++) {
+    if (inputs & LIVE_FLAGS(1 << b)) {
+      s->r[R_F] = (s->r[R_F] & ~(1 << b)) | ((n & 1) << b);
+      n >>= 1;
+    }
+  }
+}
+
+static bool verify(sopt_worker_t *w, int len, sopt_result_t *result)
+{
+  sopt_ctx_t *ctx = w->ctx;
+  z80_state_t probe = ctx->tests[0];
+  uint32_t rng = 0x2545f491;
+  int bits = 0;
+
+  run_seq(ctx, w->seq, len, &probe);
+
+  // straight-line code reads the same registers on every input
+  uint16_t inputs = ctx->source_read | probe.read;
+
+  for (int r = 0; r < 8; r++)
+    bits += (r != R_F && (inputs & LIVE_REG(r))) ? 8 : 0;
+
+  bits += __builtin_popcount(inputs >> 8);
+
+  result->exhaustive = !ctx->source_mem_read && !probe.mem_read && bits <= SOPT_EXHAUSTIVE_BITS;
+  result->input_bits = bits;
+
+  uint64_t nstates = result->exhaustive ? (1ull << bits) : SOPT_RANDOM_TESTS;
+
+  for (uint64_t n = 0; n < nstates; n++) {
+    z80_state_t in;
+
+    if (result->exhaustive) {
+      in = ctx->tests[0];
+      scatter_inputs(&in, inputs, n);
+    } else {
+      z80_random_state(&in, &rng);
+    }
+
+    z80_state_t s1 = in;
+    z80_state_t s2 = in;
+
+    run_source(ctx, &s1);
+    run_seq(ctx, w->seq, len, &s2);
+
+    if (!z80_equal(&s1, &s2, ctx->live))
+      return false;
+
+    // unfinished verification doesn't count
+    if ((n & 0xffff) == 0xffff && stopped(ctx))
+      return false;
+  }
+
+  return true;
+}
+
+static int result_cmp(sopt_ctx_t *ctx, const sopt_result_t *r1, const sopt_result_t *r2)
+{
+  if (is_better(ctx, r1->cycles, r1->bytes, r2->cycles, r2->bytes))
+    return -1;
+
+  if (is_better(ctx, r2->cycles, r2->bytes, r1->cycles, r1->bytes))
+    return 1;
+
+  return r1->len - r2->len;
+}
+
+static void sort_results(sopt_ctx_t *ctx)
+{
+  for (int i = 1; i < ctx->nresults; i++) {
+    for (int k = i; k > 0 && result_cmp(ctx, &ctx->results[k], &ctx->results[k - 1]) < 0; k--) {
+      sopt_result_t tmp = ctx->results[k];
+      ctx->results[k] = ctx->results[k - 1];
+      ctx->results[k - 1] = tmp;
+    }
+  }
+}
+
+// instructions of shorter sequence appear in longer one in the same order
+static bool contains(const sopt_result_t *longer, const sopt_result_t *shorter)
+{
+  int k = 0;
+
+  for (int i = 0; i < longer->len && k < shorter->len; i++) {
+    if (longer->seq[i] == shorter->seq[k])
+      k++;
+  }
+
+  return shorter->len < longer->len && k == shorter->len;
+}
+
+static void add_result(sopt_ctx_t *ctx, sopt_result_t *result)
+{
+  pthread_mutex_lock(&ctx->results_lock);
+
+  // found sequence padded with extra instructions isn't worth listing
+  for (int i = 0; i < ctx->nresults; i++) {
+    if (contains(result, &ctx->results[i]) && result_cmp(ctx, &ctx->results[i], result) <= 0) {
+      pthread_mutex_unlock(&ctx->results_lock);
+      return;
+    }
+  }
+
+  if (ctx->nresults < SOPT_MAX_RESULTS) {
+    ctx->results[ctx->nresults++] = *result;
+  } else {
+    int worst = 0;
+
+    for (int i = 1; i < ctx->nresults; i++) {
+      if (result_cmp(ctx, &ctx->results[i], &ctx->results[worst]) > 0)
+        worst = i;
+    }
+
+    if (result_cmp(ctx, result, &ctx->results[worst]) < 0)
+      ctx->results[worst] = *result;
+  }
+
+  pthread_mutex_unlock(&ctx->results_lock);
+}
+
+static void found(sopt_worker_t *w, int len, int cycles, int bytes)
+{
+  sopt_result_t result = {0};
+
+  if (!verify(w, len, &result))
+    return;
+
+  memcpy(result.seq, w->seq, sizeof(result.seq));
+  result.len = len;
+  result.cycles = cycles;
+  result.bytes = bytes;
+
+  add_result(w->ctx, &result);
+}
+
+// states[level] hold test states after the first level instructions of sequence
+static void search_from(sopt_worker_t *w, int level, int cycles, int bytes)
+{
+  sopt_ctx_t *ctx = w->ctx;
+  int remaining = ctx->depth - level - 1;
+  int limit = ctx->bound - remaining * ctx->min_cost;
+
+  for (int i = 0; i < ctx->ncandidates; i++) {
+    candidate_t *c = &ctx->candidates[i];
+    int seq_cycles = cycles + c->cycles;
+    int seq_bytes = bytes + c->size;
+
+    // candidates are sorted by cost, the rest are more expensive
+    if (primary_cost(ctx, seq_cycles, seq_bytes) > limit)
+      break;
+
+    w->seq[level] = i;
+
+    if (remaining > 0) {
+      for (int t = 0; t < SOPT_NUM_TESTS; t++) {
+        w->states[level + 1][t] = w->states[level][t];
+        z80_exec(&w->states[level + 1][t], &c->op);
+      }
+
+      search_from(w, level + 1, seq_cycles, seq_bytes);
+
+      if (atomic_load(&ctx->stop))
+        return;
+
+      continue;
+    }
+
+    if (!is_better(ctx, seq_cycles, seq_bytes, ctx->source_cycles, ctx->source_bytes))
+      continue;
+
+    if ((++w->sequences & DEADLINE_CHECK_MASK) == 0 && stopped(ctx))
+      return;
+
+    bool matched = true;
+
+    for (int t = 0; matched && t < SOPT_NUM_TESTS; t++) {
+      z80_state_t s = w->states[level][t];
+
+      z80_exec(&s, &c->op);
+      matched = z80_equal(&s, &ctx->expected[t], ctx->live);
+    }
+
+    if (matched)
+      found(w, level + 1, seq_cycles, seq_bytes);
+  }
+}
+
+static void run_task(sopt_worker_t *w, sopt_task_t *task)
+{
+  sopt_ctx_t *ctx = w->ctx;
+  int cycles = 0;
+  int bytes = 0;
+
+  memcpy(w->states[0], ctx->tests, sizeof(ctx->tests));
+
+  for (int level = 0; level < task->len; level++) {
+    candidate_t *c = &ctx->candidates[task->prefix[level]];
+
+    w->seq[level] = task->prefix[level];
+    cycles += c->cycles;
+    bytes += c->size;
+
+    for (int t = 0; t < SOPT_NUM_TESTS; t++) {
+      w->states[level + 1][t] = w->states[level][t];
+      z80_exec(&w->states[level + 1][t], &c->op);
+    }
+  }
+
+  if (task->len < ctx->depth) {
+    search_from(w, task->len, cycles, bytes);
+    return;
+  }
+
+  // task is a complete sequence
+  if (!is_better(ctx, cycles, bytes, ctx->source_cycles, ctx->source_bytes))
+    return;
+
+  w->sequences++;
+
+  for (int t = 0; t < SOPT_NUM_TESTS; t++) {
+    if (!z80_equal(&w->states[task->len][t], &ctx->expected[t], ctx->live))
+      return;
+  }
+
+  found(w, task->len, cycles, bytes);
+}
+
+static bool take_task(sopt_worker_t *w, sopt_task_t *task)
+{
+  sopt_ctx_t *ctx = w->ctx;
+  sopt_deque_t *own = &w->deque;
+  bool taken = false;
+
+  pthread_mutex_lock(&own->lock);
+  if (own->tail > own->head) {
+    *task = own->tasks[--own->tail];
+    taken = true;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  for (int k = 1; !taken && k < ctx->nworkers; k++) {
+    sopt_deque_t *victim = &ctx->workers[(w->id + k) % ctx->nworkers].deque;
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->tail > victim->head) {
+      *task = victim->tasks[victim->head++];
+      taken = true;
+      w->stolen++;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+
+  return taken;
+}
+
+static void *worker_main(void *arg)
+{
+  sopt_worker_t *w = (sopt_worker_t *)arg;
+  sopt_task_t task;
+
+  while (!stopped(w->ctx) && take_task(w, &task))
+    run_task(w, &task);
+
+  return NULL;
+}
+
+// deals tasks of current depth round-robin, returns their number
+static int deal_tasks(sopt_ctx_t *ctx, bool count_only)
+{
+  int prefix_len = (ctx->depth < TASK_PREFIX_MAX) ? ctx->depth : TASK_PREFIX_MAX;
+  int limit = ctx->bound - (ctx->depth - prefix_len) * ctx->min_cost;
+  int ntasks = 0;
+
+  for (int i = 0; i < ctx->ncandidates; i++) {
+    candidate_t *c1 = &ctx->candidates[i];
+    int cost1 = primary_cost(ctx, c1->cycles, c1->size);
+    int nsecond = (prefix_len == 1) ? 1 : ctx->ncandidates;
+
+    if (cost1 + (prefix_len - 1) * ctx->min_cost > limit)
+      break;
+
+    for (int j = 0; j < nsecond; j++) {
+      sopt_task_t task = {{i, j}, prefix_len};
+
+      if (prefix_len == 2) {
+        candidate_t *c2 = &ctx->candidates[j];
+
+        if (cost1 + primary_cost(ctx, c2->cycles, c2->size) > limit)
+          break;
+      }
+
+      if (!count_only) {
+        sopt_deque_t *deque = &ctx->workers[ntasks % ctx->nworkers].deque;
+        deque->tasks[deque->tail++] = task;
+      }
+
+      ntasks++;
+    }
+  }
+
+  return ntasks;
+}
+
+void sopt_search(sopt_ctx_t *ctx, int max_depth, double budget)
+{
+  double started = sopt_now();
+  int source_cost = primary_cost(ctx, ctx->source_cycles, ctx->source_bytes);
+
+  ctx->deadline = started + budget;
+  atomic_store(&ctx->stop, false);
+  pthread_mutex_init(&ctx->results_lock, NULL);
+
+  for (int i = 0; i < ctx->nworkers; i++) {
+    ctx->workers[i].ctx = ctx;
+    ctx->workers[i].id = i;
+    pthread_mutex_init(&ctx->workers[i].deque.lock, NULL);
+  }
+
+  for (int depth = 1; depth <= max_depth && ctx->ncandidates > 0; depth++) {
+    // even the cheapest sequence of this length doesn't beat the source or found ones
+    if (depth * ctx->min_cost > source_cost)
+      break;
+
+    if (ctx->nresults > 0 &&
+      depth * ctx->min_cost > primary_cost(ctx, ctx->results[0].cycles, ctx->results[0].bytes))
+    {
+      break;
+    }
+
+    ctx->depth = depth;
+    ctx->bound = (ctx->nresults > 0) ?
+      primary_cost(ctx, ctx->results[0].cycles, ctx->results[0].bytes) : source_cost;
+
+    int ntasks = deal_tasks(ctx, true);
+    int per_worker = ntasks / ctx->nworkers + 1;
+
+    for (int i = 0; i < ctx->nworkers; i++) {
+      sopt_deque_t *deque = &ctx->workers[i].deque;
+
+      deque->tasks = (sopt_task_t *)xmalloc(sizeof(sopt_task_t) * per_worker);
+      deque->head = deque->tail = 0;
+    }
+
+    deal_tasks(ctx, false);
+
+    for (int i = 0; i < ctx->nworkers; i++)
+      pthread_create(&ctx->workers[i].thread, NULL, worker_main, &ctx->workers[i]);
+
+    uint64_t sequences = 0;
+    uint64_t stolen = 0;
+    int left = 0;
+
+    for (int i = 0; i < ctx->nworkers; i++) {
+      sopt_worker_t *w = &ctx->workers[i];
+
+      pthread_join(w->thread, NULL);
+
+      sequences += w->sequences;
+      stolen += w->stolen;
+      left += w->deque.tail - w->deque.head;
+      w->sequences = w->stolen = 0;
+
+      xfree(w->deque.tasks);
+      w->deque.tasks = NULL;
+    }
+
+    printf("depth %d: %llu sequences, %d tasks (%llu stolen), %.2f s\n",
+      depth, (unsigned long long)sequences, ntasks, (unsigned long long)stolen, sopt_now() - started);
+
+    if (atomic_load(&ctx->stop)) {
+      printf("time budget exhausted at depth %d, %d of %d tasks left\n", depth, left, ntasks);
+      break;
+    }
+
+    // the best result first for the depth limit above
+    sort_results(ctx);
+  }
+
+  sort_results(ctx);
+
+  for (int i = 0; i < ctx->nworkers; i++)
+    pthread_mutex_destroy(&ctx->workers[i].deque.lock);
+
+  pthread_mutex_destroy(&ctx->results_lock);
+}
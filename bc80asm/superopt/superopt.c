@@ -0,0 +1,373 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bits/common.h"
+#include "bits/dynarray.h"
+#include "bits/error.h"
+#include "bits/filesystem.h"
+#include "bits/mmgr.h"
+#include "superopt/superopt.h"
+
+#define DEFAULT_BUDGET  10.0
+#define DEFAULT_DEPTH   4
+
+static jmp_buf error_env;
+
+static void print_usage(char *cmd)
+{
+  printf("Z80 superoptimizer\n"
+         "searches for the fastest sequence of instructions equivalent to the given one\n\n"
+         "usage: %s [options] <instruction>[:<instruction>...]\n\n"
+         "options:\n"
+         "  -h              this help\n"
+         "  -s file:line[-line]  take source sequence from lines of assembler source\n"
+         "  -l regs         registers live after sequence, comma separated: a, b, c, d, e, h, l, bc, de, hl,\n"
+         "                  'all' (default) or 'none'. Memory written by sequence is always live\n"
+         "  -f flags        flags live after sequence: any of s, z, h, p (P/V), n, c letters, 'all' (default)\n"
+         "                  or 'none'\n"
+         "  -b              optimize for size: fewer bytes first, then fewer cycles\n"
+         "  -d depth        the longest candidate sequence (default: %d, at most %d)\n"
+         "  -j threads      number of search threads (default: number of CPU cores)\n"
+         "  -t seconds      time budget of search (default: %g)\n"
+         "\nCandidates are 8-bit and 16-bit loads, arithmetics, rotations and bit instructions without\n"
+         "index registers; memory is accessed only through BC, DE or HL and only if source does it.\n"
+         "Equivalence is verified exhaustively when inputs take %d bits at most, otherwise with %d\n"
+         "random states.\n",
+         cmd, DEFAULT_DEPTH, SOPT_MAX_DEPTH, DEFAULT_BUDGET, SOPT_EXHAUSTIVE_BITS, SOPT_RANDOM_TESTS
+  );
+}
+
+static uint16_t parse_live_regs(char *spec)
+{
+  static const char *names[] = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+  dynarray *parts = split_string_sep(spec, ',', false);
+  dynarray_cell *dc = NULL;
+  uint16_t live = 0;
+
+  foreach (dc, parts) {
+    char *name = (char *)dfirst(dc);
+    bool known = false;
+
+    if (strcasecmp(name, "all") == 0) {
+      live |= LIVE_ALL & 0xff;
+      known = true;
+    } else if (strcasecmp(name, "none") == 0) {
+      known = true;
+    }
+
+    for (int r = 0; r < 8; r++) {
+      if (names[r] && strcasecmp(name, names[r]) == 0) {
+        live |= LIVE_REG(r);
+        known = true;
+      }
+    }
+
+    for (int p = 0; p < 3; p++) {
+      char pair[3] = {names[2 * p][0], names[2 * p + 1][0], '\0'};
+
+      if (strcasecmp(name, pair) == 0) {
+        live |= LIVE_REG(2 * p) | LIVE_REG(2 * p + 1);
+        known = true;
+      }
+    }
+
+    if (!known)
+      report_error_noloc("unknown register in live list: %s", name);
+  }
+
+  dynarray_free_deep(parts);
+  return live;
+}
+
+static uint16_t parse_live_flags(char *spec)
+{
+  uint8_t flags = 0;
+
+  if (strcasecmp(spec, "all") == 0)
+    return LIVE_FLAGS(FLAGS_DOCUMENTED);
+
+  if (strcasecmp(spec, "none") == 0)
+    return 0;
+
+  for (char *p = spec; *p; p++) {
+    switch (tolower(*p)) {
+      case 's': flags |= FLAG_S; break;
+      case 'z': flags |= FLAG_Z; break;
+      case 'h': flags |= FLAG_H; break;
+      case 'p':
+      case 'v': flags |= FLAG_PV; break;
+      case 'n': flags |= FLAG_N; break;
+      case 'c': flags |= FLAG_C; break;
+      case ',': break;
+      default:
+        report_error_noloc("unknown flag in live list: %c", *p);
+    }
+  }
+
+  return LIVE_FLAGS(flags);
+}
+
+// instructions of source lines without labels and comments
+static dynarray *read_source_lines(char *spec)
+{
+  dynarray *parts = split_string_sep(spec, ':', false);
+  int first, last;
+  char *filename = NULL;
+  char *range = NULL;
+  dynarray *result = NULL;
+
+  if (dynarray_length(parts) == 2) {
+    filename = (char *)dinitial(parts);
+    range = (char *)dsecond(parts);
+  }
+
+  if (range == NULL || sscanf(range, "%d-%d", &first, &last) < 1)
+    report_error_noloc("invalid source lines: %s", spec);
+
+  if (strchr(range, '-') == NULL)
+    last = first;
+
+  char *source = read_file(filename);
+  char *line = source;
+
+  for (int n = 1; line && n <= last; n++) {
+    char *next = strchr(line, '\n');
+
+    if (next)
+      *next++ = '\0';
+
+    if (n >= first) {
+      char *comment = strchr(line, ';');
+      if (comment)
+        *comment = '\0';
+
+      // label starts at the first column
+      if (*line && !isspace((unsigned char)*line)) {
+        char *colon = strchr(line, ':');
+        line = colon ? colon + 1 : line + strlen(line);
+      }
+
+      while (isspace((unsigned char)*line))
+        line++;
+
+      if (*line)
+        result = dynarray_append_ptr(result, xstrdup(line));
+    }
+
+    line = next;
+  }
+
+  xfree(source);
+  dynarray_free_deep(parts);
+
+  return result;
+}
+
+static void print_seq(candidate_t *instrs, int *seq, int len, int bytes, int cycles, char *comment)
+{
+  char text[256] = {0};
+
+  for (int i = 0; i < len; i++) {
+    candidate_t *c = seq ? &instrs[seq[i]] : &instrs[i];
+    size_t used = strlen(text);
+
+    snprintf(text + used, sizeof(text) - used, "%s%s", i ? " : " : "", c->text);
+  }
+
+  printf("  %-40s ; %d bytes, %d cycles%s\n", text, bytes, cycles, comment);
+}
+
+// options and search are kept out of main(), so that their locals aren't clobbered by longjmp
+// of error handler. Returns exit code
+static int superoptimize(sopt_ctx_t *ctx, int argc, char **argv)
+{
+  int optflag;
+  int max_depth = DEFAULT_DEPTH;
+  double budget = DEFAULT_BUDGET;
+  uint16_t live_regs = LIVE_ALL & 0xff;
+  uint16_t live_flags = LIVE_ALL & 0xff00;
+
+  opterr = 0;
+
+  while ((optflag = getopt(argc, argv, "hs:l:f:bd:j:t:")) != -1) {
+    switch (optflag) {
+      case 's': {
+        dynarray *lines = read_source_lines(optarg);
+        dynarray_cell *dc = NULL;
+
+        foreach (dc, lines)
+          ctx->texts = dynarray_append_ptr(ctx->texts, dfirst(dc));
+
+        dynarray_free(lines);
+        break;
+      }
+
+      case 'l':
+        live_regs = parse_live_regs(optarg);
+        break;
+
+      case 'f':
+        live_flags = parse_live_flags(optarg);
+        break;
+
+      case 'b':
+        ctx->optimize_size = true;
+        break;
+
+      case 'd':
+        max_depth = atoi(optarg);
+        if (max_depth < 1 || max_depth > SOPT_MAX_DEPTH)
+          report_error_noloc("depth must be 1..%d", SOPT_MAX_DEPTH);
+        break;
+
+      case 'j':
+        ctx->nworkers = atoi(optarg);
+        if (ctx->nworkers < 1)
+          report_error_noloc("invalid number of threads: %s", optarg);
+        break;
+
+      case 't':
+        budget = atof(optarg);
+        if (budget <= 0)
+          report_error_noloc("invalid time budget: %s", optarg);
+        break;
+
+      case 'h':
+      default:
+        print_usage(argv[0]);
+        return 0;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    dynarray *parts = split_string_sep(argv[i], ':', false);
+    dynarray_cell *dc = NULL;
+
+    foreach (dc, parts) {
+      char *text = (char *)dfirst(dc);
+
+      if (text[strspn(text, " \t")] != '\0')
+        ctx->texts = dynarray_append_ptr(ctx->texts, xstrdup(text));
+    }
+
+    dynarray_free_deep(parts);
+  }
+
+  if (dynarray_length(ctx->texts) == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (dynarray_length(ctx->texts) > SOPT_MAX_SEQ)
+    report_error_noloc("source sequence is longer than %d instructions", SOPT_MAX_SEQ);
+
+  ctx->templates = build_templates(&ctx->ntemplates);
+
+  dynarray_cell *dc = NULL;
+  foreach (dc, ctx->texts) {
+    candidate_t *c = &ctx->source[ctx->source_len];
+
+    if (!parse_instr(ctx->templates, ctx->ntemplates, (char *)dfirst(dc), c))
+      report_error_noloc("unknown or unsupported instruction: %s", (char *)dfirst(dc));
+
+    ctx->source_len++;
+    ctx->source_bytes += c->size;
+    ctx->source_cycles += c->cycles;
+  }
+
+  ctx->live = live_regs | live_flags;
+
+  // corner states first, random ones then
+  uint32_t rng = 0x9e3779b9;
+
+  for (int t = 0; t < SOPT_NUM_TESTS; t++) {
+    z80_state_t *s = &ctx->tests[t];
+
+    z80_random_state(s, &rng);
+
+    if (t < 2)
+      memset(s->r, t ? 0xff : 0, sizeof(s->r));
+
+    ctx->expected[t] = *s;
+
+    for (int i = 0; i < ctx->source_len; i++)
+      z80_exec(&ctx->expected[t], &ctx->source[i].op);
+
+    ctx->source_read |= ctx->expected[t].read;
+    ctx->source_mem_read |= ctx->expected[t].mem_read;
+    ctx->source_mem_write |= ctx->expected[t].nwrites > 0;
+  }
+
+  ctx->candidates = build_candidates(ctx, ctx->templates, ctx->ntemplates, &ctx->ncandidates);
+  ctx->min_cost = (ctx->ncandidates > 0) ?
+    (ctx->optimize_size ? ctx->candidates[0].size : ctx->candidates[0].cycles) : 0;
+
+  printf("source:\n");
+  print_seq(ctx->source, NULL, ctx->source_len, ctx->source_bytes, ctx->source_cycles, "");
+  printf("%d candidate instructions, %d threads, %g s budget\n", ctx->ncandidates, ctx->nworkers, budget);
+
+  ctx->workers = (sopt_worker_t *)xmalloc(sizeof(sopt_worker_t) * ctx->nworkers);
+  memset(ctx->workers, 0, sizeof(sopt_worker_t) * ctx->nworkers);
+
+  sopt_search(ctx, max_depth, budget);
+
+  if (ctx->nresults == 0)
+    printf("no %s equivalent found\n", ctx->optimize_size ? "shorter" : "faster");
+  else
+    printf("%s equivalents:\n", ctx->optimize_size ? "shorter" : "faster");
+
+  for (int i = 0; i < ctx->nresults; i++) {
+    sopt_result_t *r = &ctx->results[i];
+    char comment[128];
+
+    if (r->exhaustive)
+      snprintf(comment, sizeof(comment), " (%+d bytes, %+d cycles), verified exhaustively over %d input bits",
+        r->bytes - ctx->source_bytes, r->cycles - ctx->source_cycles, r->input_bits);
+    else
+      snprintf(comment, sizeof(comment), " (%+d bytes, %+d cycles), verified with %d random states",
+        r->bytes - ctx->source_bytes, r->cycles - ctx->source_cycles, SOPT_RANDOM_TESTS);
+
+    print_seq(ctx->candidates, r->seq, r->len, r->bytes, r->cycles, comment);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  sopt_ctx_t *ctx = (sopt_ctx_t *)calloc(1, sizeof(sopt_ctx_t));
+
+  ctx->nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int ret = setjmp(error_env);
+  if (ret != 0)
+    // returning from longjmp (error handler)
+    goto out;
+
+  set_error_context(&error_env);
+
+  mmgr_init();
+
+  ret = superoptimize(ctx, argc, argv);
+
+out:
+  for (int i = 0; i < ctx->source_len; i++)
+    xfree(ctx->source[i].text);
+
+  for (int i = 0; i < ctx->ncandidates; i++)
+    xfree(ctx->candidates[i].text);
+
+  xfree(ctx->candidates);
+  xfree(ctx->workers);
+  xfree(ctx->templates);
+  dynarray_free_deep(ctx->texts);
+  free(ctx);
+
+  mmgr_finish(getenv("MEMSTAT") != NULL);
+
+  return ret;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "disasm/disasm.h"
+
+typedef struct dynarray dynarray;
+
+#define SOPT_MAX_SEQ          5         // the longest source sequence
+#define SOPT_MAX_DEPTH        8         // the longest candidate sequence
+#define SOPT_MAX_WRITES       SOPT_MAX_DEPTH
+#define SOPT_NUM_TESTS        32        // states every candidate runs on before verification
+#define SOPT_RANDOM_TESTS     (1 << 16) // states of randomized verification
+#define SOPT_EXHAUSTIVE_BITS  24        // the widest input verified exhaustively
+#define SOPT_MAX_RESULTS      10
+#define SOPT_MAX_IMM          16        // immediate values tried for candidates
+
+// registers are indexed by their encoding, F takes place of (HL)
+#define R_B   0
+#define R_C   1
+#define R_D   2
+#define R_E   3
+#define R_H   4
+#define R_L   5
+#define R_F   6
+#define R_A   7
+
+#define FLAG_C  0x01
+#define FLAG_N  0x02
+#define FLAG_PV 0x04
+#define FLAG_X  0x08
+#define FLAG_H  0x10
+#define FLAG_Y  0x20
+#define FLAG_Z  0x40
+#define FLAG_S  0x80
+
+#define FLAGS_DOCUMENTED (FLAG_S | FLAG_Z | FLAG_H | FLAG_PV | FLAG_N | FLAG_C)
+
+// masks of registers and flags: register r is bit r, flags are bits 8..15
+#define LIVE_REG(r)     (1 << (r))
+#define LIVE_FLAGS(f)   ((f) << 8)
+#define LIVE_ALL        (0x00bf | LIVE_FLAGS(FLAGS_DOCUMENTED))
+
+typedef enum {
+  OP_LD,            // ld r,r'
+  OP_LD_IMM,        // ld r,n
+  OP_LD_LOAD,       // ld r,(rr)
+  OP_LD_STORE,      // ld (rr),r
+  OP_LD_STORE_IMM,  // ld (hl),n
+  OP_LD16_IMM,      // ld rr,nn
+  OP_ALU,           // add/adc/sub/sbc/and/xor/or/cp r
+  OP_ALU_IMM,
+  OP_ALU_MEM,
+  OP_INC,
+  OP_DEC,
+  OP_INC_MEM,
+  OP_DEC_MEM,
+  OP_INC16,
+  OP_DEC16,
+  OP_ADD16,
+  OP_ADC16,
+  OP_SBC16,
+  OP_ROT,           // rlc/rrc/rl/rr/sla/sra/srl r
+  OP_ROT_MEM,
+  OP_BIT,
+  OP_BIT_MEM,
+  OP_RES,
+  OP_RES_MEM,
+  OP_SET,
+  OP_SET_MEM,
+  OP_RLCA,
+  OP_RRCA,
+  OP_RLA,
+  OP_RRA,
+  OP_CPL,
+  OP_NEG,
+  OP_SCF,
+  OP_CCF,
+  OP_DAA,
+  OP_EX_DE_HL,
+} op_kind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t sub;      // ALU operation or rotation (encoding order), bit number
+  uint8_t dst;      // register R_* or register pair (0: BC, 1: DE, 2: HL)
+  uint8_t src;
+  uint16_t imm;
+} z80_op_t;
+
+typedef struct {
+  uint8_t r[8];
+  uint32_t mem_seed;        // initial memory contents is a hash of address
+  int nwrites;
+  uint16_t waddr[SOPT_MAX_WRITES];
+  uint8_t wvalue[SOPT_MAX_WRITES];
+
+  // tracking of inputs: registers and flags used before they are written
+  uint16_t read;
+  uint16_t written;
+  bool mem_read;
+} z80_state_t;
+
+typedef struct {
+  z80_op_t op;
+  uint8_t bytes[4];
+  int size;
+  int cycles;
+  char *text;
+} candidate_t;
+
+// encoding without immediate operand values
+typedef struct {
+  uint8_t bytes[4];
+  int size;
+  int imm_size;
+} template_t;
+
+typedef struct {
+  int seq[SOPT_MAX_DEPTH];
+  int len;
+  int bytes;
+  int cycles;
+  bool exhaustive;
+  int input_bits;
+} sopt_result_t;
+
+typedef struct {
+  int prefix[2];
+  int len;
+} sopt_task_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  sopt_task_t *tasks;
+  int head;                 // thieves take tasks from head
+  int tail;                 // owner takes tasks from tail
+} sopt_deque_t;
+
+struct sopt_ctx;
+
+typedef struct {
+  struct sopt_ctx *ctx;
+  int id;
+  pthread_t thread;
+  sopt_deque_t deque;
+  uint64_t sequences;
+  uint64_t stolen;
+  uint32_t rng;
+  int seq[SOPT_MAX_DEPTH];
+  z80_state_t states[SOPT_MAX_DEPTH + 1][SOPT_NUM_TESTS];
+} sopt_worker_t;
+
+typedef struct sopt_ctx {
+  dynarray *texts;          // source instructions given by options and arguments
+  template_t *templates;
+  int ntemplates;
+
+  candidate_t *candidates;
+  int ncandidates;
+  int min_cost;             // the cheapest candidate by primary cost
+
+  candidate_t source[SOPT_MAX_SEQ];
+  int source_len;
+  int source_bytes;
+  int source_cycles;
+  uint16_t source_read;
+  bool source_mem_read;
+  bool source_mem_write;
+
+  uint16_t live;
+  bool optimize_size;
+  int depth;                // the current search depth
+  int bound;                // primary cost of sequences of the current depth doesn't exceed it: the
+                            // source's cost, or the best result's one when some are found
+
+  z80_state_t tests[SOPT_NUM_TESTS];
+  z80_state_t expected[SOPT_NUM_TESTS];
+
+  sopt_worker_t *workers;
+  int nworkers;
+  double deadline;
+  atomic_bool stop;
+
+  pthread_mutex_t results_lock;
+  sopt_result_t results[SOPT_MAX_RESULTS];
+  int nresults;
+} sopt_ctx_t;
+
+// z80sim.c
+extern void z80_exec(z80_state_t *s, const z80_op_t *op);
+extern void z80_random_state(z80_state_t *s, uint32_t *rng);
+extern bool z80_equal(const z80_state_t *s1, const z80_state_t *s2, uint16_t live);
+extern uint32_t xorshift32(uint32_t *rng);
+
+// candidates.c
+extern template_t *build_templates(int *ntemplates);
+extern bool instantiate(template_t *t, int value, candidate_t *candidate);
+extern bool parse_instr(template_t *templates, int ntemplates, const char *text, candidate_t *candidate);
+extern candidate_t *build_candidates(sopt_ctx_t *ctx, template_t *templates, int ntemplates, int *ncandidates);
+
+// search.c
+extern void sopt_search(sopt_ctx_t *ctx, int max_depth, double budget);
+extern double sopt_now();
@@ -0,0 +1,468 @@
+#include <string.h>
+
+#include "superopt/superopt.h"
+
+// Z80 interpreter for straight-line code: registers, flags and memory addressed by
+// register pairs. Undocumented X/Y flags are computed from results, but never are
+// compared. Memory isn't stored: bytes never written are a hash of their address.
+
+static inline uint8_t reg_get(z80_state_t *s, int r)
+{
+  if (!(s->written & LIVE_REG(r)))
+    s->read |= LIVE_REG(r);
+
+  return s->r[r];
+}
+
+static inline void reg_set(z80_state_t *s, int r, uint8_t value)
+{
+  s->r[r] = value;
+  s->written |= LIVE_REG(r);
+}
+
+static inline uint16_t pair_get(z80_state_t *s, int p)
+{
+  return (reg_get(s, 2 * p) << 8) | reg_get(s, 2 * p + 1);
+}
+
+static inline void pair_set(z80_state_t *s, int p, uint16_t value)
+{
+  reg_set(s, 2 * p, value >> 8);
+  reg_set(s, 2 * p + 1, value & 0xff);
+}
+
+// flags kept by instruction are its inputs too
+static inline uint8_t flags_get(z80_state_t *s, uint8_t mask)
+{
+  s->read |= LIVE_FLAGS(mask) & ~s->written;
+  return s->r[R_F] & mask;
+}
+
+static inline void flags_set(z80_state_t *s, uint8_t value)
+{
+  s->r[R_F] = value;
+  s->written |= LIVE_FLAGS(0xff);
+}
+
+static inline uint8_t mem_initial(uint32_t seed, uint16_t addr)
+{
+  uint32_t x = (seed ^ addr) * 0x9e3779b1u;
+  x ^= x >> 15;
+  return x >> 24;
+}
+
+static inline uint8_t mem_get(z80_state_t *s, uint16_t addr)
+{
+  for (int i = s->nwrites - 1; i >= 0; i--) {
+    if (s->waddr[i] == addr)
+      return s->wvalue[i];
+  }
+
+  s->mem_read = true;
+  return mem_initial(s->mem_seed, addr);
+}
+
+static inline uint8_t mem_peek(const z80_state_t *s, uint16_t addr)
+{
+  for (int i = s->nwrites - 1; i >= 0; i--) {
+    if (s->waddr[i] == addr)
+      return s->wvalue[i];
+  }
+
+  return mem_initial(s->mem_seed, addr);
+}
+
+static inline void mem_set(z80_state_t *s, uint16_t addr, uint8_t value)
+{
+  for (int i = 0; i < s->nwrites; i++) {
+    if (s->waddr[i] == addr) {
+      s->wvalue[i] = value;
+      return;
+    }
+  }
+
+  // sequences are shorter than the log, every instruction writes one byte at most
+  s->waddr[s->nwrites] = addr;
+  s->wvalue[s->nwrites] = value;
+  s->nwrites++;
+}
+
+static inline uint8_t szxy(uint8_t value)
+{
+  return (value & (FLAG_S | FLAG_X | FLAG_Y)) | (value ? 0 : FLAG_Z);
+}
+
+static inline uint8_t parity(uint8_t value)
+{
+  value ^= value >> 4;
+  value ^= value >> 2;
+  value ^= value >> 1;
+
+  return (value & 1) ? 0 : FLAG_PV;
+}
+
+static void alu8(z80_state_t *s, int op, uint8_t v)
+{
+  uint8_t a = reg_get(s, R_A);
+  int carry = (op == 1 || op == 3) ? flags_get(s, FLAG_C) : 0;
+  int r;
+  uint8_t f;
+
+  switch (op) {
+    case 0:   // add
+    case 1:   // adc
+      r = a + v + carry;
+      f = szxy(r & 0xff) | ((a ^ v ^ r) & FLAG_H) | ((((a ^ ~v) & (a ^ r)) & 0x80) ? FLAG_PV : 0) |
+        ((r & 0x100) ? FLAG_C : 0);
+      break;
+
+    case 2:   // sub
+    case 3:   // sbc
+    case 7:   // cp
+      r = a - v - carry;
+      f = szxy(r & 0xff) | ((a ^ v ^ r) & FLAG_H) | ((((a ^ v) & (a ^ r)) & 0x80) ? FLAG_PV : 0) |
+        ((r & 0x100) ? FLAG_C : 0) | FLAG_N;
+      break;
+
+    case 4:   // and
+      r = a & v;
+      f = szxy(r) | parity(r) | FLAG_H;
+      break;
+
+    case 5:   // xor
+      r = a ^ v;
+      f = szxy(r) | parity(r);
+      break;
+
+    default:  // or
+      r = a | v;
+      f = szxy(r) | parity(r);
+      break;
+  }
+
+  flags_set(s, f);
+
+  if (op != 7)
+    reg_set(s, R_A, r & 0xff);
+}
+
+static uint8_t inc8(z80_state_t *s, uint8_t v)
+{
+  uint8_t r = v + 1;
+  flags_set(s, flags_get(s, FLAG_C) | szxy(r) | ((v & 0x0f) == 0x0f ? FLAG_H : 0) | (v == 0x7f ? FLAG_PV : 0));
+  return r;
+}
+
+static uint8_t dec8(z80_state_t *s, uint8_t v)
+{
+  uint8_t r = v - 1;
+  flags_set(s, flags_get(s, FLAG_C) | szxy(r) | ((v & 0x0f) == 0 ? FLAG_H : 0) | (v == 0x80 ? FLAG_PV : 0) | FLAG_N);
+  return r;
+}
+
+static uint8_t rot(z80_state_t *s, int op, uint8_t v)
+{
+  uint8_t r;
+  uint8_t carry;
+
+  switch (op) {
+    case 0:   // rlc
+      r = (v << 1) | (v >> 7);
+      carry = v >> 7;
+      break;
+    case 1:   // rrc
+      r = (v >> 1) | (v << 7);
+      carry = v & 1;
+      break;
+    case 2:   // rl
+      r = (v << 1) | flags_get(s, FLAG_C);
+      carry = v >> 7;
+      break;
+    case 3:   // rr
+      r = (v >> 1) | (flags_get(s, FLAG_C) << 7);
+      carry = v & 1;
+      break;
+    case 4:   // sla
+      r = v << 1;
+      carry = v >> 7;
+      break;
+    case 5:   // sra
+      r = (v >> 1) | (v & 0x80);
+      carry = v & 1;
+      break;
+    case 6:   // sll
+      r = (v << 1) | 1;
+      carry = v >> 7;
+      break;
+    default:  // srl
+      r = v >> 1;
+      carry = v & 1;
+      break;
+  }
+
+  flags_set(s, szxy(r) | parity(r) | (carry ? FLAG_C : 0));
+  return r;
+}
+
+static void rot_a(z80_state_t *s, int op)
+{
+  uint8_t a = reg_get(s, R_A);
+  uint8_t kept = flags_get(s, FLAG_S | FLAG_Z | FLAG_PV);
+  uint8_t r;
+  uint8_t carry;
+
+  switch (op) {
+    case OP_RLCA:
+      r = (a << 1) | (a >> 7);
+      carry = a >> 7;
+      break;
+    case OP_RRCA:
+      r = (a >> 1) | (a << 7);
+      carry = a & 1;
+      break;
+    case OP_RLA:
+      r = (a << 1) | flags_get(s, FLAG_C);
+      carry = a >> 7;
+      break;
+    default:  // rra
+      r = (a >> 1) | (flags_get(s, FLAG_C) << 7);
+      carry = a & 1;
+      break;
+  }
+
+  flags_set(s, kept | (r & (FLAG_X | FLAG_Y)) | (carry ? FLAG_C : 0));
+  reg_set(s, R_A, r);
+}
+
+static void bit(z80_state_t *s, int n, uint8_t v)
+{
+  uint8_t set = v & (1 << n);
+  flags_set(s, flags_get(s, FLAG_C) | FLAG_H | (set ? 0 : FLAG_Z | FLAG_PV) | (set & FLAG_S) | (v & (FLAG_X | FLAG_Y)));
+}
+
+static void add16(z80_state_t *s, int op, int p)
+{
+  uint16_t hl = pair_get(s, 2);
+  uint16_t v = pair_get(s, p);
+  int carry = (op == OP_ADD16) ? 0 : flags_get(s, FLAG_C);
+  int r;
+  uint8_t f;
+
+  if (op == OP_SBC16) {
+    r = hl - v - carry;
+    f = FLAG_N | ((((hl ^ v) & (hl ^ r)) & 0x8000) ? FLAG_PV : 0);
+  } else {
+    r = hl + v + carry;
+    f = (((hl ^ ~v) & (hl ^ r)) & 0x8000) ? FLAG_PV : 0;
+  }
+
+  f |= (((hl ^ v ^ r) >> 8) & FLAG_H) | ((r & 0x10000) ? FLAG_C : 0) | ((r >> 8) & (FLAG_X | FLAG_Y));
+
+  if (op == OP_ADD16)
+    f = (f & ~(FLAG_PV)) | flags_get(s, FLAG_S | FLAG_Z | FLAG_PV);
+  else
+    f |= ((r >> 8) & FLAG_S) | ((r & 0xffff) ? 0 : FLAG_Z);
+
+  flags_set(s, f);
+  pair_set(s, 2, r & 0xffff);
+}
+
+static void daa(z80_state_t *s)
+{
+  uint8_t a = reg_get(s, R_A);
+  uint8_t f = flags_get(s, FLAG_C | FLAG_H | FLAG_N);
+  uint8_t diff = 0;
+  uint8_t carry = 0;
+
+  if ((f & FLAG_H) || (a & 0x0f) > 9)
+    diff |= 0x06;
+
+  if ((f & FLAG_C) || a > 0x99) {
+    diff |= 0x60;
+    carry = FLAG_C;
+  }
+
+  uint8_t r = (f & FLAG_N) ? a - diff : a + diff;
+  uint8_t half = (f & FLAG_N) ? ((f & FLAG_H) && (a & 0x0f) < 6 ? FLAG_H : 0) : ((a & 0x0f) > 9 ? FLAG_H : 0);
+
+  flags_set(s, szxy(r) | parity(r) | half | carry | (f & FLAG_N));
+  reg_set(s, R_A, r);
+}
+
+void z80_exec(z80_state_t *s, const z80_op_t *op)
+{
+  switch (op->kind) {
+    case OP_LD:
+      reg_set(s, op->dst, reg_get(s, op->src));
+      break;
+    case OP_LD_IMM:
+      reg_set(s, op->dst, op->imm);
+      break;
+    case OP_LD_LOAD:
+      reg_set(s, op->dst, mem_get(s, pair_get(s, op->src)));
+      break;
+    case OP_LD_STORE:
+      mem_set(s, pair_get(s, op->dst), reg_get(s, op->src));
+      break;
+    case OP_LD_STORE_IMM:
+      mem_set(s, pair_get(s, 2), op->imm);
+      break;
+    case OP_LD16_IMM:
+      pair_set(s, op->dst, op->imm);
+      break;
+
+    case OP_ALU:
+      alu8(s, op->sub, reg_get(s, op->src));
+      break;
+    case OP_ALU_IMM:
+      alu8(s, op->sub, op->imm);
+      break;
+    case OP_ALU_MEM:
+      alu8(s, op->sub, mem_get(s, pair_get(s, 2)));
+      break;
+
+    case OP_INC:
+      reg_set(s, op->dst, inc8(s, reg_get(s, op->dst)));
+      break;
+    case OP_DEC:
+      reg_set(s, op->dst, dec8(s, reg_get(s, op->dst)));
+      break;
+    case OP_INC_MEM: {
+      uint16_t addr = pair_get(s, 2);
+      mem_set(s, addr, inc8(s, mem_get(s, addr)));
+      break;
+    }
+    case OP_DEC_MEM: {
+      uint16_t addr = pair_get(s, 2);
+      mem_set(s, addr, dec8(s, mem_get(s, addr)));
+      break;
+    }
+    case OP_INC16:
+      pair_set(s, op->dst, pair_get(s, op->dst) + 1);
+      break;
+    case OP_DEC16:
+      pair_set(s, op->dst, pair_get(s, op->dst) - 1);
+      break;
+    case OP_ADD16:
+    case OP_ADC16:
+    case OP_SBC16:
+      add16(s, op->kind, op->src);
+      break;
+
+    case OP_ROT:
+      reg_set(s, op->dst, rot(s, op->sub, reg_get(s, op->dst)));
+      break;
+    case OP_ROT_MEM: {
+      uint16_t addr = pair_get(s, 2);
+      mem_set(s, addr, rot(s, op->sub, mem_get(s, addr)));
+      break;
+    }
+
+    case OP_BIT:
+      bit(s, op->sub, reg_get(s, op->dst));
+      break;
+    case OP_BIT_MEM:
+      bit(s, op->sub, mem_get(s, pair_get(s, 2)));
+      break;
+    case OP_RES:
+      reg_set(s, op->dst, reg_get(s, op->dst) & ~(1 << op->sub));
+      break;
+    case OP_RES_MEM: {
+      uint16_t addr = pair_get(s, 2);
+      mem_set(s, addr, mem_get(s, addr) & ~(1 << op->sub));
+      break;
+    }
+    case OP_SET:
+      reg_set(s, op->dst, reg_get(s, op->dst) | (1 << op->sub));
+      break;
+    case OP_SET_MEM: {
+      uint16_t addr = pair_get(s, 2);
+      mem_set(s, addr, mem_get(s, addr) | (1 << op->sub));
+      break;
+    }
+
+    case OP_RLCA:
+    case OP_RRCA:
+    case OP_RLA:
+    case OP_RRA:
+      rot_a(s, op->kind);
+      break;
+
+    case OP_CPL: {
+      uint8_t r = ~reg_get(s, R_A);
+      flags_set(s, flags_get(s, FLAG_S | FLAG_Z | FLAG_PV | FLAG_C) | FLAG_H | FLAG_N | (r & (FLAG_X | FLAG_Y)));
+      reg_set(s, R_A, r);
+      break;
+    }
+    case OP_NEG: {
+      uint8_t a = reg_get(s, R_A);
+      uint8_t r = -a;
+      flags_set(s, szxy(r) | ((a ^ r) & FLAG_H) | (a == 0x80 ? FLAG_PV : 0) | FLAG_N | (a ? FLAG_C : 0));
+      reg_set(s, R_A, r);
+      break;
+    }
+    case OP_SCF:
+      flags_set(s, flags_get(s, FLAG_S | FLAG_Z | FLAG_PV) | FLAG_C | (reg_get(s, R_A) & (FLAG_X | FLAG_Y)));
+      break;
+    case OP_CCF: {
+      uint8_t f = flags_get(s, FLAG_S | FLAG_Z | FLAG_PV | FLAG_C);
+      flags_set(s, (f ^ FLAG_C) | ((f & FLAG_C) ? FLAG_H : 0) | (reg_get(s, R_A) & (FLAG_X | FLAG_Y)));
+      break;
+    }
+    case OP_DAA:
+      daa(s);
+      break;
+
+    case OP_EX_DE_HL: {
+      uint16_t de = pair_get(s, 1);
+      pair_set(s, 1, pair_get(s, 2));
+      pair_set(s, 2, de);
+      break;
+    }
+  }
+}
+
+uint32_t xorshift32(uint32_t *rng)
+{
+  uint32_t x = *rng;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return *rng = x;
+}
+
+void z80_random_state(z80_state_t *s, uint32_t *rng)
+{
+  memset(s, 0, sizeof(*s));
+
+  for (int r = 0; r < 8; r++)
+    s->r[r] = xorshift32(rng) & 0xff;
+
+  s->mem_seed = xorshift32(rng);
+}
+
+bool z80_equal(const z80_state_t *s1, const z80_state_t *s2, uint16_t live)
+{
+  for (int r = 0; r < 8; r++) {
+    if ((live & LIVE_REG(r)) && r != R_F && s1->r[r] != s2->r[r])
+      return false;
+  }
+
+  if ((s1->r[R_F] ^ s2->r[R_F]) & (live >> 8))
+    return false;
+
+  // memory is always live
+  for (int i = 0; i < s1->nwrites; i++) {
+    if (mem_peek(s2, s1->waddr[i]) != s1->wvalue[i])
+      return false;
+  }
+
+  for (int i = 0; i < s2->nwrites; i++) {
+    if (mem_peek(s1, s2->waddr[i]) != s2->wvalue[i])
+      return false;
+  }
+
+  return true;
+}
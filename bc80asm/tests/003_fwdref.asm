@@ -0,0 +1,25 @@
+; operands referring to constants defined later are patched in place
+  adc a,value
+  nop
+  add a,value
+  nop
+  and value
+  nop
+  cp value
+  nop
+  in a,(port)
+  nop
+  ld b,value
+  nop
+  ld a,value
+  nop
+  ld hl,value
+  nop
+  ld hl,(address)
+  nop
+  ld de,address
+  ret
+
+value: equ 0x12
+port: equ 0x34
+address: equ 0x5678